@@ -0,0 +1,40 @@
+# Compiles compute shaders with glslangValidator and embeds the resulting
+# spirv in generated headers, as constexpr uint32_t arrays.
+#
+# fea_vkc_embed_shaders(<target> <shader files>...)
+#
+# Include the generated headers with '#include <vkc_shaders/<filename>.hpp>'.
+# The arrays live in namespace vkc_shaders and are named after the shader
+# filename, made a valid C identifier (ex : 'my_shader.comp' -> my_shader_comp).
+
+set(FEA_VKC_GLSLANG_VALIDATOR ${CMAKE_BINARY_DIR}/tools/glslangValidator CACHE FILEPATH "glslangValidator used to compile embedded shaders.")
+set(FEA_VKC_SPIRV_TO_HEADER ${CMAKE_CURRENT_LIST_DIR}/fea_vkc_spirv_to_header.cmake)
+
+function(fea_vkc_embed_shaders TARGET)
+	set(OUT_DIR ${CMAKE_CURRENT_BINARY_DIR}/${TARGET}_shaders)
+	set(HEADERS "")
+
+	foreach(SHADER ${ARGN})
+		get_filename_component(SHADER_ABS ${SHADER} ABSOLUTE)
+		get_filename_component(SHADER_NAME ${SHADER} NAME)
+		string(MAKE_C_IDENTIFIER ${SHADER_NAME} VAR_NAME)
+
+		set(SPV_FILE ${OUT_DIR}/spv/${SHADER_NAME}.spv)
+		set(HEADER_FILE ${OUT_DIR}/vkc_shaders/${SHADER_NAME}.hpp)
+
+		add_custom_command(
+			OUTPUT ${HEADER_FILE}
+			COMMAND ${CMAKE_COMMAND} -E make_directory ${OUT_DIR}/spv
+			COMMAND ${CMAKE_COMMAND} -E make_directory ${OUT_DIR}/vkc_shaders
+			COMMAND ${FEA_VKC_GLSLANG_VALIDATOR} -V ${SHADER_ABS} -o ${SPV_FILE}
+			COMMAND ${CMAKE_COMMAND} -DSPV_FILE=${SPV_FILE} -DHEADER_FILE=${HEADER_FILE} -DVAR_NAME=${VAR_NAME} -P ${FEA_VKC_SPIRV_TO_HEADER}
+			DEPENDS ${SHADER_ABS} ${FEA_VKC_SPIRV_TO_HEADER}
+			COMMENT "Embedding shader ${SHADER_NAME}"
+			VERBATIM
+		)
+		list(APPEND HEADERS ${HEADER_FILE})
+	endforeach()
+
+	target_sources(${TARGET} PRIVATE ${HEADERS})
+	target_include_directories(${TARGET} PRIVATE ${OUT_DIR})
+endfunction()
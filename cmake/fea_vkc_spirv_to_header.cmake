@@ -0,0 +1,25 @@
+# Script mode, called by fea_vkc_embed_shaders.
+# Converts a spirv binary (SPV_FILE) to a header (HEADER_FILE) declaring
+# 'inline constexpr uint32_t VAR_NAME[]'.
+
+file(READ ${SPV_FILE} SPV_HEX HEX)
+
+# Spirv words are little endian, swap bytes of every 4 byte group.
+string(REGEX REPLACE "([0-9a-f][0-9a-f])([0-9a-f][0-9a-f])([0-9a-f][0-9a-f])([0-9a-f][0-9a-f])" "0x\\4\\3\\2\\1, " SPV_WORDS "${SPV_HEX}")
+
+# 8 words per line.
+# CMake regexes don't support {n} repetitions.
+set(WORD_RE "0x[0-9a-f]+, ")
+string(REGEX REPLACE "(${WORD_RE}${WORD_RE}${WORD_RE}${WORD_RE}${WORD_RE}${WORD_RE}${WORD_RE}${WORD_RE})" "\\1\n\t" SPV_WORDS "${SPV_WORDS}")
+
+file(WRITE ${HEADER_FILE}
+"// Generated by fea_vkc_embed_shaders, do not edit.
+#pragma once
+#include <cstdint>
+
+namespace vkc_shaders {
+inline constexpr uint32_t ${VAR_NAME}[] = {
+	${SPV_WORDS}
+};
+} // namespace vkc_shaders
+")
@@ -0,0 +1,131 @@
+﻿/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Philippe Groarke
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ **/
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+/*
+The task capture file format, see task::begin_capture.
+
+Every section is 64 byte aligned, so the file can be memory mapped and its
+blobs used in place. Little endian.
+
+	capture_header
+	blob data
+	capture_command[command_count]
+	capture_blob[blob_count]
+
+Blobs hold the shader, names, push_constants and buffer and image data.
+Identical blobs are stored once.
+*/
+
+namespace fea {
+namespace vkc {
+inline constexpr std::array<char, 8> capture_magic{ 'v', 'k', 'c', 'c', 'a',
+	'p', 't', 'r' };
+inline constexpr uint32_t capture_version = 1;
+inline constexpr size_t capture_alignment = 64;
+
+// No blob.
+inline constexpr uint32_t capture_no_blob = ~uint32_t(0);
+
+// The recorded task calls.
+enum class capture_op : uint32_t {
+	// data : constant bytes.
+	push_constant,
+	// args[0] : byte size.
+	reserve_buffer,
+	// data : buffer bytes.
+	push_buffer,
+	pull_buffer,
+	// args[0] : format.
+	set_format,
+	// args : width, height, depth.
+	reserve_image,
+	// data : image bytes. args : width, height, depth.
+	push_image,
+	pull_image,
+	// args : width, height, depth.
+	submit,
+	// data : the constants of each dispatch. extra : their width, height
+	// and depth, as uint64_t. args[0] : dispatch count, args[1] : barriers,
+	// args[2] : constant byte size, 0 in older captures.
+	submit_many,
+	// args[0] : byte capacity.
+	reserve_buffer_capacity,
+	count,
+};
+
+struct capture_header {
+	std::array<char, 8> magic = capture_magic;
+	uint32_t version = capture_version;
+
+	// task_options::optimize.
+	uint32_t optimize = 0;
+
+	// The original shader spirv.
+	uint32_t spirv = capture_no_blob;
+
+	// task_options::spec_constants, as id and value uint32_t pairs.
+	uint32_t spec_constants = capture_no_blob;
+
+	uint32_t command_count = 0;
+	uint32_t blob_count = 0;
+	uint64_t commands_offset = 0;
+	uint64_t blobs_offset = 0;
+};
+
+struct capture_command {
+	capture_op op = capture_op::count;
+
+	// Blob of the buffer, image or push_constant name, without terminator.
+	uint32_t name = capture_no_blob;
+
+	// See capture_op.
+	uint32_t data = capture_no_blob;
+	uint32_t extra = capture_no_blob;
+	std::array<uint64_t, 3> args{};
+};
+
+// Offset from the start of the file.
+struct capture_blob {
+	uint64_t offset = 0;
+	uint64_t byte_size = 0;
+};
+
+static_assert(sizeof(capture_header) == 48, "capture_header has padding");
+static_assert(sizeof(capture_command) == 40, "capture_command has padding");
+static_assert(sizeof(capture_blob) == 16, "capture_blob has padding");
+} // namespace vkc
+} // namespace fea
@@ -0,0 +1,148 @@
+﻿/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Philippe Groarke
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ **/
+#pragma once
+#include "vkc/task.hpp"
+
+#include <cstddef>
+#include <functional>
+#include <optional>
+#include <tbb/concurrent_queue.h>
+#include <tbb/flow_graph.h>
+#include <thread>
+#include <vector>
+
+/*
+A tbb::flow node adapter, so gpu work can be pipelined with cpu nodes.
+Not included in vulkan_compute.hpp, to keep tbb's flow graph opt-in.
+*/
+
+namespace fea {
+namespace vkc {
+// A tbb::flow node which executes a task on its inputs.
+// The body pushes data, submits and pulls results with the provided task :
+// Output body(task&, const Input&).
+//
+// Submissions run on dedicated threads, one per in-flight submission, each
+// with its own task instance (see task::instance). Tbb workers never wait on
+// the gpu, so the cpu nodes before and after run concurrently.
+//
+// Inputs are queued until a submission thread is free. Use a
+// tbb::flow::limiter_node in front to bound the queue.
+// The body must not throw.
+// Call wait_for_all on the flow graph before destroying the node.
+template <class Input, class Output>
+struct task_node {
+	using node_type = tbb::flow::async_node<Input, Output>;
+	using gateway_type = typename node_type::gateway_type;
+	using body_type = std::function<Output(task&, const Input&)>;
+
+	// max_in_flight is the number of concurrent submissions, at least 1.
+	task_node(tbb::flow::graph& g, const task& t, size_t max_in_flight,
+			body_type body)
+			: _body(std::move(body))
+			, _node(g, tbb::flow::unlimited,
+					  [this](const Input& in, gateway_type& gateway) {
+						  // Keeps wait_for_all waiting until the output is
+						  // put.
+						  gateway.reserve_wait();
+						  _queue.push(job{ in, &gateway });
+					  }) {
+		if (max_in_flight == 0) {
+			max_in_flight = 1;
+		}
+
+		_instances.reserve(max_in_flight);
+		for (size_t i = 0; i < max_in_flight; ++i) {
+			_instances.push_back(t.instance());
+		}
+
+		_threads.reserve(max_in_flight);
+		for (size_t i = 0; i < max_in_flight; ++i) {
+			_threads.emplace_back([this, i]() { run(_instances[i]); });
+		}
+	}
+
+	~task_node() {
+		// An empty job stops a thread.
+		for (size_t i = 0; i < _threads.size(); ++i) {
+			_queue.push(std::nullopt);
+		}
+		for (std::thread& th : _threads) {
+			th.join();
+		}
+	}
+
+	// Threads reference the node.
+	task_node(const task_node&) = delete;
+	task_node& operator=(const task_node&) = delete;
+	task_node(task_node&&) = delete;
+	task_node& operator=(task_node&&) = delete;
+
+	// Connect this with tbb::flow::make_edge.
+	node_type& node() {
+		return _node;
+	}
+
+	size_t max_in_flight() const {
+		return _threads.size();
+	}
+
+private:
+	struct job {
+		Input input;
+		gateway_type* gateway = nullptr;
+	};
+
+	void run(task& t) {
+		while (true) {
+			std::optional<job> j;
+			_queue.pop(j);
+			if (!j.has_value()) {
+				return;
+			}
+
+			j->gateway->try_put(_body(t, j->input));
+			j->gateway->release_wait();
+		}
+	}
+
+	body_type _body;
+	tbb::concurrent_bounded_queue<std::optional<job>> _queue;
+	node_type _node;
+
+	// One instance per thread.
+	std::vector<task> _instances;
+	std::vector<std::thread> _threads;
+};
+} // namespace vkc
+} // namespace fea
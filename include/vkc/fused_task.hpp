@@ -0,0 +1,88 @@
+﻿/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Philippe Groarke
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ **/
+#pragma once
+#include "vkc/task.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace fea {
+namespace vkc {
+struct vkc;
+
+// A chain of elementwise operations, fused into a single task.
+// Intermediate values stay in registers, only the chain input and output
+// go through memory.
+//
+// Each stage is a glsl expression computing the new value from the previous
+// value 'x' and the element index 'i'. The first stage reads buffer
+// 'in_buf', the result of the last stage is written to buffer 'out_buf'.
+//
+// Extra read-only buffers declared in 'inputs' are accessed in expressions
+// as '<name>_data[i]'. Float push constants declared in 'constants' are
+// accessed as 'p_constants.<name>', push them as a struct of floats
+// named "p_constants".
+//
+// Ex, multiply then add buffers :
+//	fused_elementwise chain;
+//	chain.inputs = { "buf2" };
+//	chain.constants = { "mul" };
+//	chain.stages = { "x * p_constants.mul", "x + buf2_data[i]" };
+struct fused_elementwise {
+	// Glsl type of the elements, in all buffers.
+	std::string value_type = "float";
+
+	// Extra read-only buffers.
+	std::vector<std::string> inputs;
+
+	// Float push constants.
+	std::vector<std::string> constants;
+
+	// The glsl expressions, applied in order.
+	std::vector<std::string> stages;
+
+	// Shader work group size.
+	uint32_t workgroup_size = 64;
+};
+
+// Generates the glsl of the fused chain.
+std::string make_fused_glsl(const fused_elementwise& chain);
+
+// Generates, compiles and creates the fused task.
+// Submit it with the number of elements as width.
+task make_fused_task(vkc& vkc_inst, const fused_elementwise& chain,
+		const task_options& opts = {});
+
+} // namespace vkc
+} // namespace fea
@@ -0,0 +1,160 @@
+﻿/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Philippe Groarke
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ **/
+#pragma once
+#include "vkc/task.hpp"
+
+#include <cstdint>
+#include <fea/memory/pimpl_ptr.hpp>
+#include <vector>
+
+namespace fea {
+namespace vkc {
+struct vkc;
+
+namespace detail {
+struct graph_impl;
+}
+
+// A recorded sequence of buffer pushes, dispatches and buffer pulls, across
+// one or more tasks. The commands are recorded once, on first submit, and
+// are replayed with a single queue submission.
+//
+// Between replays, you may only change the recorded dispatch push_constants
+// and the buffer contents, through the graph. Buffers must keep their size.
+// If a task buffer is reallocated or resized, the graph is re-recorded on
+// next submit.
+//
+// The tasks must outlive the graph. Only use them through the graph while
+// it is in use.
+//
+// Ex :
+//	t.push_buffer("buf1", data); // sizes and binds the buffer
+//	graph g{ gpu };
+//	g.push(t, "buf1");
+//	size_t d = g.dispatch(t, data.size());
+//	g.pull(t, "buf1");
+//	for (...) {
+//		g.write(t, "buf1", data);
+//		g.push_constant(d, "p_constants", constants);
+//		g.submit();
+//		g.read(t, "buf1", &data);
+//	}
+struct graph : fea::pimpl_ptr<detail::graph_impl> {
+	graph(vkc& vkc_inst);
+	~graph();
+
+	graph(graph&&) noexcept;
+	graph& operator=(graph&&) noexcept;
+
+	// Move-only.
+	graph(const graph&) = delete;
+	graph& operator=(const graph&) = delete;
+
+	// Recording.
+
+	// Records a copy of the task buffer, from its staging memory to the gpu.
+	// The buffer must have been pushed or reserved on the task first.
+	// Unlike task transfers, which share the vkc staging ring, graph
+	// buffers keep their own staging memory. It starts with the buffer
+	// contents, and task pushes also update it, so writing through the graph
+	// is optional.
+	void push(task& t, const char* buf_name);
+
+	// Records a dispatch of the task.
+	// The push_constants currently enqueued on the task are recorded with
+	// the dispatch, and are cleared from the task.
+	// Returns the dispatch index, used to patch its push_constants.
+	size_t dispatch(task& t, size_t width, size_t height = 1, size_t depth = 1);
+
+	// Records a copy of the task buffer, from the gpu to its staging memory.
+	void pull(task& t, const char* buf_name);
+
+	// Replaying.
+
+	// Changes a recorded dispatch push_constant block.
+	// Each dispatch has its own small command buffer, only the changed
+	// dispatches are recorded again on next submit.
+	template <class T>
+	void push_constant(
+			size_t dispatch_idx, const char* constant_name, const T& val);
+
+	// Copies your data into the buffer's staging memory.
+	// It is uploaded by the recorded push, on next submit.
+	// The data size must match the buffer size.
+	template <class T>
+	void write(task& t, const char* buf_name, const std::vector<T>& in_data);
+
+	// Executes the recorded commands.
+	// Blocking.
+	void submit();
+
+	// Copies the buffer's staging memory into data.
+	// It contains the result of the recorded pull, after submit.
+	template <class T>
+	void read(task& t, const char* buf_name, std::vector<T>* out_data);
+
+	// Drops all recorded commands.
+	void clear();
+
+private:
+	void push_constant(size_t dispatch_idx, const char* constant_name,
+			const void* val, size_t byte_size);
+	void write(task& t, const char* buf_name, const uint8_t* in_data,
+			size_t byte_size);
+	size_t get_buffer_byte_size(task& t, const char* buf_name) const;
+	void read(task& t, const char* buf_name, uint8_t* out_data);
+};
+
+
+// Template implementations.
+
+template <class T>
+void graph::push_constant(
+		size_t dispatch_idx, const char* constant_name, const T& val) {
+	push_constant(dispatch_idx, constant_name, &val, sizeof(T));
+}
+
+template <class T>
+void graph::write(
+		task& t, const char* buf_name, const std::vector<T>& in_data) {
+	write(t, buf_name, reinterpret_cast<const uint8_t*>(in_data.data()),
+			sizeof(T) * in_data.size());
+}
+
+template <class T>
+void graph::read(task& t, const char* buf_name, std::vector<T>* out_data) {
+	out_data->resize(get_buffer_byte_size(t, buf_name) / sizeof(T));
+	read(t, buf_name, reinterpret_cast<uint8_t*>(out_data->data()));
+}
+} // namespace vkc
+} // namespace fea
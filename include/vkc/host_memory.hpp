@@ -0,0 +1,95 @@
+﻿/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Philippe Groarke
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ **/
+#pragma once
+#include <cstddef>
+#include <limits>
+#include <new>
+#include <vector>
+
+namespace fea {
+namespace vkc {
+// Page alignment, which satisfies the import alignment of common drivers.
+// See vkc::external_host_memory_alignment.
+inline constexpr size_t host_memory_alignment = 4096;
+
+// An allocator which aligns allocations, so the gpu can copy straight from
+// and into them (see vkc::external_host_memory).
+template <class T, size_t Alignment = host_memory_alignment>
+struct aligned_allocator {
+	static_assert((Alignment & (Alignment - 1)) == 0,
+			"aligned_allocator : Alignment must be a power of 2.");
+	static_assert(Alignment >= alignof(T),
+			"aligned_allocator : Alignment must be at least alignof(T).");
+
+	using value_type = T;
+
+	template <class U>
+	struct rebind {
+		using other = aligned_allocator<U, Alignment>;
+	};
+
+	aligned_allocator() noexcept = default;
+	template <class U>
+	aligned_allocator(const aligned_allocator<U, Alignment>&) noexcept {
+	}
+
+	T* allocate(size_t n) {
+		if (n > (std::numeric_limits<size_t>::max)() / sizeof(T)) {
+			throw std::bad_array_new_length{};
+		}
+		return static_cast<T*>(::operator new(
+				n * sizeof(T), std::align_val_t{ Alignment }));
+	}
+
+	void deallocate(T* ptr, size_t) noexcept {
+		::operator delete(ptr, std::align_val_t{ Alignment });
+	}
+
+	template <class U>
+	friend bool operator==(const aligned_allocator&,
+			const aligned_allocator<U, Alignment>&) noexcept {
+		return true;
+	}
+	template <class U>
+	friend bool operator!=(const aligned_allocator&,
+			const aligned_allocator<U, Alignment>&) noexcept {
+		return false;
+	}
+};
+
+// A vector which the gpu can copy straight from and into.
+// Use it with push_buffer and pull_buffer to skip the staging copy.
+template <class T>
+using host_vector = std::vector<T, aligned_allocator<T>>;
+} // namespace vkc
+} // namespace fea
@@ -0,0 +1,125 @@
+﻿/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2022, Philippe Groarke
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ **/
+#pragma once
+#include "vkc/task.hpp"
+
+#include <cstdint>
+#include <fea/memory/pimpl_ptr.hpp>
+#include <functional>
+#include <vector>
+
+namespace fea {
+namespace vkc {
+namespace detail {
+struct stream_impl;
+}
+
+// Streaming settings, see stream_executor.
+struct stream_options {
+	// Chunks in flight, each with its own task instance and buffers.
+	// With 3, the upload, compute and download of consecutive chunks overlap.
+	size_t in_flight = 3;
+
+	// Chunk sizes, in elements (NOT BYTES).
+	size_t initial_chunk_size = 64 * 1024;
+	size_t min_chunk_size = 1024;
+	size_t max_chunk_size = 16 * 1024 * 1024;
+
+	// Grows the chunk size while the measured throughput improves, and goes
+	// back to the best size when it degrades. It doesn't grow to a degraded
+	// size again. Stays within min_chunk_size and max_chunk_size.
+	bool adaptive = true;
+};
+
+// Called once per chunk, on the chunk's task instance.
+// Push your constants and submit.
+// first is the chunk's first element in the whole input and count its
+// number of elements.
+using stream_dispatch = std::function<void(task&, size_t first, size_t count)>;
+
+// Executes a task on inputs larger than device memory, chunk by chunk.
+// Chunks rotate through task instances (see task::instance), so the
+// transfers of a chunk overlap the compute of others.
+//
+// Ex :
+//	stream_executor s{ t };
+//	s.run("buf1", in, "buf1", &out, [&](task& inst, size_t, size_t count) {
+//		inst.push_constant("p_constants", constants);
+//		inst.submit(count, 1, 1);
+//	});
+struct stream_executor : fea::pimpl_ptr<detail::stream_impl> {
+	stream_executor(const task& t, const stream_options& opts = {});
+	~stream_executor();
+
+	stream_executor(stream_executor&&) noexcept;
+	stream_executor& operator=(stream_executor&&) noexcept;
+
+	// Move-only.
+	stream_executor(const stream_executor&) = delete;
+	stream_executor& operator=(const stream_executor&) = delete;
+
+	// Pushes each chunk of in to in_buf_name, dispatches and pulls
+	// out_buf_name into the matching chunk of out. out is resized to the
+	// input size. The buffers may be the same.
+	// Blocking.
+	template <class In, class Out>
+	void run(const char* in_buf_name, const std::vector<In>& in,
+			const char* out_buf_name, std::vector<Out>* out,
+			const stream_dispatch& dispatch);
+
+	// The current chunk size, in elements.
+	size_t chunk_size() const;
+
+	const stream_options& options() const;
+
+private:
+	void run(const char* in_buf_name, const uint8_t* in,
+			size_t in_elem_byte_size, const char* out_buf_name, uint8_t* out,
+			size_t out_elem_byte_size, size_t count,
+			const stream_dispatch& dispatch);
+};
+
+
+// Template implementations.
+
+template <class In, class Out>
+void stream_executor::run(const char* in_buf_name, const std::vector<In>& in,
+		const char* out_buf_name, std::vector<Out>* out,
+		const stream_dispatch& dispatch) {
+	out->resize(in.size());
+	run(in_buf_name, reinterpret_cast<const uint8_t*>(in.data()), sizeof(In),
+			out_buf_name, reinterpret_cast<uint8_t*>(out->data()), sizeof(Out),
+			in.size(), dispatch);
+}
+} // namespace vkc
+} // namespace fea
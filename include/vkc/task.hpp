@@ -32,24 +32,198 @@
  **/
 #pragma once
 
+#include <array>
 #include <cstdint>
+#include <cstring>
 #include <fea/containers/span.hpp>
 #include <fea/memory/pimpl_ptr.hpp>
+#include <filesystem>
+#include <future>
+#include <memory>
+#include <string>
+#include <string_view>
 #include <vector> // todo : span
 
 namespace fea {
 namespace vkc {
 struct vkc;
+struct graph;
+struct stream_executor;
 
 namespace detail {
 struct task_impl;
-}
+struct task_pipeline;
+} // namespace detail
+
+// Texel formats of images and texel buffers.
+enum class format : uint8_t {
+	undefined,
+	r8_unorm,
+	rg8_unorm,
+	rgba8_unorm,
+	rgba8_snorm,
+	rgba8_uint,
+	rgba8_sint,
+	r16_sfloat,
+	rg16_sfloat,
+	rgba16_sfloat,
+	r32_uint,
+	r32_sint,
+	r32_sfloat,
+	rg32_sfloat,
+	rgba32_uint,
+	rgba32_sint,
+	rgba32_sfloat,
+	count,
+};
+
+// A preprocessor macro, used when compiling glsl at runtime.
+// Equivalent to '#define name value'.
+struct shader_define {
+	std::string name;
+	std::string value;
+};
+
+// A specialization constant value.
+// id is the shader constant_id, value is the raw 32bit value.
+struct spec_constant {
+	spec_constant() = default;
+	spec_constant(uint32_t id_, uint32_t value_)
+			: id(id_)
+			, value(value_) {
+	}
+	spec_constant(uint32_t id_, int32_t value_)
+			: id(id_) {
+		std::memcpy(&value, &value_, sizeof(value));
+	}
+	spec_constant(uint32_t id_, float value_)
+			: id(id_) {
+		std::memcpy(&value, &value_, sizeof(value));
+	}
+	spec_constant(uint32_t id_, bool value_)
+			: id(id_)
+			, value(value_ ? 1u : 0u) {
+	}
+
+	uint32_t id = 0;
+	uint32_t value = 0;
+};
+
+// Optional task creation settings.
+struct task_options {
+	// Runs spirv-opt's performance passes (-O) on the shader before creating
+	// the pipeline. The optimized spirv is cached, see vkc::shader_cache_dir.
+	bool optimize = false;
+
+	// Specialization constant values, fixed at pipeline creation.
+	// When optimizing, they are frozen into the shader before optimization.
+	std::vector<spec_constant> spec_constants;
+};
+
+// A push_constant block and the sizes of its dispatch.
+// See task::submit_many.
+template <class T>
+struct dispatch_info {
+	T constants{};
+	size_t width = 1;
+	size_t height = 1;
+	size_t depth = 1;
+};
+
+// Memory owned by a task, for its buffers and images.
+// Includes gpu memory, and the staging memory of images, graph buffers and
+// spilled buffers. Buffer pushes and pulls use the vkc staging ring, see
+// vkc::memory_stats.
+struct task_memory_stats {
+	// Allocated memory.
+	size_t reserved_bytes = 0;
+
+	// Memory used by the current buffer and image sizes.
+	// The difference with reserved_bytes can be released with task::trim.
+	size_t used_bytes = 0;
+
+	// Buffer memory spilled to host memory, restored when the task is used.
+	// See vkc::residency_budget.
+	size_t spilled_bytes = 0;
+};
+
+// The time spent in a task phase. See task::last_timings.
+struct phase_timing {
+	// Host wall-clock of the whole call, including staging copies and waits.
+	double host_ms = 0.0;
+
+	// Gpu time of the call's transfers or dispatches, from timestamp queries.
+	// Stays 0 if the queue doesn't support timestamps.
+	double gpu_ms = 0.0;
+};
+
+// The timings of the last push, submit and pull of a task.
+// Only measured when profiling, see task::profiling.
+struct task_timings {
+	// The last push_buffer or push_image.
+	phase_timing push;
+
+	// The last submit or submit_many.
+	phase_timing submit;
+
+	// The last pull_buffer or pull_image.
+	phase_timing pull;
+};
+
+// A buffer or image declared in the shader. See task::reflection.
+struct resource_info {
+	std::string name;
+	uint32_t set = 0;
+	uint32_t binding = 0;
+
+	// The texel format declared in the shader, if any.
+	format fmt = format::undefined;
+
+	// Buffers : true for texel buffers, false for storage buffers.
+	bool texel = false;
+
+	// Images : 1, 2 or 3.
+	uint32_t dimensions = 0;
+};
+
+// A push_constant block declared in the shader. See task::reflection.
+struct push_constant_block {
+	std::string name;
+	size_t byte_size = 0;
+};
+
+// The resources a shader declares, as reflected when loading it.
+struct task_reflection {
+	std::vector<resource_info> buffers;
+	std::vector<resource_info> images;
+	std::vector<push_constant_block> push_constants;
+	std::array<uint32_t, 3> work_group_size = { 1u, 1u, 1u };
+};
 
 // A compute task.
 // Use this to loads shader, push data, execute shader and pull data.
 struct task : fea::pimpl_ptr<detail::task_impl> {
 	// Must be precompiled shader ending in .spv
-	task(vkc& vkc_inst, const wchar_t* shader_path);
+	task(vkc& vkc_inst, const wchar_t* shader_path,
+			const task_options& opts = {});
+
+	// Precompiled spirv in memory, for example an embedded shader.
+	// See cmake/fea_vkc_embed_shaders.cmake.
+	// The spirv isn't copied and only needs to outlive the constructor.
+	task(vkc& vkc_inst, fea::span<const uint32_t> spirv,
+			const task_options& opts = {});
+
+	// Precompiled spirv array, for example an embedded shader.
+	template <size_t N>
+	task(vkc& vkc_inst, const uint32_t (&spirv)[N],
+			const task_options& opts = {});
+
+	// Glsl compute shader source, compiled at runtime.
+	// The resulting spirv is cached on disk, keyed on the source, the defines
+	// and the compiler version. See vkc::shader_cache_dir.
+	task(vkc& vkc_inst, std::string_view glsl_source,
+			const std::vector<shader_define>& defines = {},
+			const task_options& opts = {});
 	~task();
 
 	task(task&&) noexcept;
@@ -59,23 +233,46 @@ struct task : fea::pimpl_ptr<detail::task_impl> {
 	task(const task&) = delete;
 	task& operator=(const task&) = delete;
 
+	// Creates a new task which shares this task's shader and pipeline.
+	// The instance owns its own descriptors, buffers, images and commands,
+	// and starts empty. No shader loading, reflection or pipeline creation
+	// happens, so it is cheap.
+	// Different instances may be used concurrently on different threads.
+	// A single task (or instance) isn't thread-safe.
+	task instance() const;
+
 	// Enqueue your push_constant block.
 	// constant_name is the name of the block in the shader.
 	// Copies and stores the constant until next submit.
 	template <class T>
 	void push_constant(const char* constant_name, const T& val);
 
+	// Untyped version, byte_size must match the block size in the shader.
+	// See task::reflection.
+	void push_constant(
+			const char* constant_name, const void* val, size_t byte_size);
+
 	// Size is the number of elements (NOT BYTES).
 	// Call this if you never have to push data to the shader.
 	// AKA, if your compute shader is purely a data generator.
 	template <class T>
 	void reserve_buffer(const char* buf_name, size_t size);
 
+	// Size is the number of elements (NOT BYTES).
+	// Allocates the buffer for sizes up to size, without changing its size.
+	// Later pushes and reserves which fit don't allocate. Without it,
+	// buffers grow geometrically. The contents aren't kept if it allocates.
+	template <class T>
+	void reserve_buffer_capacity(const char* buf_name, size_t size);
+
 	// Copies your data into gpu buffer.
 	// If you don't need to use this (you don't copy any data to the gpu), you
 	// must call reserve_buffer.
-	template <class T>
-	void push_buffer(const char* buf_name, const std::vector<T>& in_data);
+	// Large page-aligned data (see host_vector) is copied straight to the gpu
+	// when vkc::external_host_memory is supported.
+	template <class T, class Alloc>
+	void push_buffer(
+			const char* buf_name, const std::vector<T, Alloc>& in_data);
 
 	// Executes the compute shader.
 	// Blocking.
@@ -88,46 +285,212 @@ struct task : fea::pimpl_ptr<detail::task_impl> {
 	// Blocking.
 	// The provided width, height and depth will be divided by shader work group
 	// sizes, to compute the number of group counts.
+	// Group counts over the device limits are split in several dispatches.
+	// The shader must then declare a 'uvec3 vkc_group_base' member in its
+	// push_constant block, set to the first group of each dispatch, and add
+	// it to gl_WorkGroupID. Don't set it yourself. Throws if a dispatch must
+	// be split and the shader doesn't declare it.
 	void submit(size_t width, size_t height, size_t depth);
 
+	// Splits submit in tiles of at most max_groups work groups. Each tile is
+	// submitted and waited on separately, so other work on the queue can run
+	// in between. This bounds the latency of other tasks, at the cost of
+	// more submissions.
+	// Tiles are offset with vkc_group_base, see submit. Throws if the shader
+	// doesn't declare it.
+	// 0 disables tiling, the default.
+	void max_groups_per_submit(size_t max_groups);
+
+	// Executes the compute shader once per dispatch, in order, with a single
+	// submission.
+	// Blocking.
+	// constant_name is the push_constant block set by each dispatch.
+	// Other push_constants enqueued with push_constant are used by all
+	// dispatches.
+	// When barriers is true, each dispatch sees the previous dispatch's
+	// writes. Disable it if dispatches are independent.
+	template <class T>
+	void submit_many(const char* constant_name,
+			const std::vector<dispatch_info<T>>& dispatches,
+			bool barriers = true);
+
 	// Copies your gpu buffer into data.
+	// Large page-aligned data (see host_vector) is copied straight from the
+	// gpu when vkc::external_host_memory is supported.
+	template <class T, class Alloc>
+	void pull_buffer(const char* buf_name, std::vector<T, Alloc>* data);
+
+	// Sets the texel format of an image or texel buffer.
+	// Storage images and storage texel buffers default to the format declared
+	// in the shader. Sampled images and uniform texel buffers have no format
+	// in the shader, you must set one before pushing or reserving them.
+	void set_format(const char* name, format fmt);
+
+	// Size is in texels (NOT BYTES).
+	// Call this if you never have to push data to the image.
+	// AKA, if your compute shader only writes to it.
+	void reserve_image(const char* img_name, size_t width, size_t height = 1,
+			size_t depth = 1);
+
+	// Copies your texels into gpu image.
+	// Data must be tightly packed and match the image format.
+	// Sizes are in texels (NOT BYTES).
 	template <class T>
-	void pull_buffer(const char* buf_name, std::vector<T>* data);
+	void push_image(const char* img_name, const std::vector<T>& in_data,
+			size_t width, size_t height = 1, size_t depth = 1);
 
-private:
-	void push_constant(
-			const char* constant_name, const void* val, size_t byte_size);
+	// Copies your gpu image into data.
+	// Data is tightly packed in the image format.
+	template <class T>
+	void pull_image(const char* img_name, std::vector<T>* data);
+
+	// The memory owned by this task.
+	// See vkc::memory_stats for device-wide usage.
+	task_memory_stats memory_stats() const;
+
+	// Releases the memory reserved past the current buffer and image sizes.
+	// Buffers keep their contents.
+	// Blocking.
+	void trim();
+
+	// Measures the host and gpu time of pushes, submits and pulls.
+	// The gpu work is bracketed with timestamp queries, which adds a little
+	// overhead to every submit. Off by default.
+	void profiling(bool enable);
+	bool profiling() const;
+
+	// The timings of the last push, submit and pull, when profiling.
+	const task_timings& last_timings() const;
+
+	// The buffers, images and push_constants the shader declares.
+	// Useful to drive arbitrary shaders, for example in tools.
+	task_reflection reflection() const;
+
+	// Records the shader, push_constants, pushed buffers and images and
+	// dispatch sizes of this task to filepath, until end_capture.
+	// Identical data is stored once. See capture.hpp for the format, and
+	// tools/vkc_replay to replay and time it.
+	// Returns false if the file couldn't be created.
+	bool begin_capture(const std::filesystem::path& filepath);
+
+	// Finishes writing the capture. Returns false on write errors.
+	bool end_capture();
+	bool capturing() const;
+
+	// Untyped versions, sizes are in bytes.
+	// Useful to drive arbitrary shaders, for example in tools.
+
+	// sizes holds the width, height and depth of each dispatch.
+	void submit_many(const char* constant_name, const void* constants,
+			size_t constant_byte_size, const size_t* sizes, size_t count,
+			bool barriers);
 	void reserve_buffer(const char* buf_name, size_t byte_size);
+	void reserve_buffer_capacity(const char* buf_name, size_t byte_size);
 	void push_buffer(
 			const char* buf_name, const uint8_t* in_data, size_t byte_size);
 
 	size_t get_buffer_byte_size(const char* buf_name) const;
 	void pull_buffer(const char* buf_name, uint8_t* out_data);
+
+	// Width, height and depth are in texels.
+	void push_image(const char* img_name, const uint8_t* in_data,
+			size_t byte_size, size_t width, size_t height, size_t depth);
+	size_t get_image_byte_size(const char* img_name) const;
+	void pull_image(const char* img_name, uint8_t* out_data);
+
+private:
+	friend struct graph;
+	friend struct stream_executor;
+	friend std::vector<task> load_tasks(vkc&,
+			const std::vector<std::filesystem::path>&, const task_options&);
+
+	task(std::shared_ptr<const detail::task_pipeline> pipeline);
 };
 
+// Loads many precompiled shaders (.spv) at once, for example at startup.
+// Shaders are read, reflected and optimized in parallel, and all the
+// pipelines are created with a single batched call.
+// The tasks are returned in the same order as the paths.
+std::vector<task> load_tasks(vkc& vkc_inst,
+		const std::vector<std::filesystem::path>& shader_paths,
+		const task_options& opts = {});
+
+// Loads a precompiled shader (.spv) on a background thread.
+// The task is usable once the future is ready.
+std::future<task> load_task_async(vkc& vkc_inst,
+		std::filesystem::path shader_path, task_options opts = {});
+
+// Compiles a glsl compute shader on a background thread.
+// The task is usable once the future is ready.
+std::future<task> compile_task_async(vkc& vkc_inst, std::string glsl_source,
+		std::vector<shader_define> defines = {}, task_options opts = {});
+
 
 // Template implementations.
 
+template <size_t N>
+task::task(vkc& vkc_inst, const uint32_t (&spirv)[N], const task_options& opts)
+		: task(vkc_inst, fea::span<const uint32_t>{ spirv, N }, opts) {
+}
+
 template <class T>
 void task::push_constant(const char* constant_name, const T& val) {
 	push_constant(constant_name, &val, sizeof(T));
 }
 
+template <class T>
+void task::submit_many(const char* constant_name,
+		const std::vector<dispatch_info<T>>& dispatches, bool barriers) {
+	std::vector<T> constants;
+	std::vector<size_t> sizes;
+	constants.reserve(dispatches.size());
+	sizes.reserve(dispatches.size() * 3);
+
+	for (const dispatch_info<T>& d : dispatches) {
+		constants.push_back(d.constants);
+		sizes.push_back(d.width);
+		sizes.push_back(d.height);
+		sizes.push_back(d.depth);
+	}
+
+	submit_many(constant_name, constants.data(), sizeof(T), sizes.data(),
+			dispatches.size(), barriers);
+}
+
 template <class T>
 void task::reserve_buffer(const char* buf_name, size_t size) {
 	reserve_buffer(buf_name, sizeof(T) * size);
 }
 
 template <class T>
-void task::push_buffer(const char* buf_name, const std::vector<T>& in_data) {
+void task::reserve_buffer_capacity(const char* buf_name, size_t size) {
+	reserve_buffer_capacity(buf_name, sizeof(T) * size);
+}
+
+template <class T, class Alloc>
+void task::push_buffer(
+		const char* buf_name, const std::vector<T, Alloc>& in_data) {
 	push_buffer(buf_name, reinterpret_cast<const uint8_t*>(in_data.data()),
 			sizeof(T) * in_data.size());
 }
 
-template <class T>
-void task::pull_buffer(const char* buf_name, std::vector<T>* out_data) {
+template <class T, class Alloc>
+void task::pull_buffer(const char* buf_name, std::vector<T, Alloc>* out_data) {
 	out_data->resize(get_buffer_byte_size(buf_name) / sizeof(T));
 	pull_buffer(buf_name, reinterpret_cast<uint8_t*>(out_data->data()));
 }
+
+template <class T>
+void task::push_image(const char* img_name, const std::vector<T>& in_data,
+		size_t width, size_t height, size_t depth) {
+	push_image(img_name, reinterpret_cast<const uint8_t*>(in_data.data()),
+			sizeof(T) * in_data.size(), width, height, depth);
+}
+
+template <class T>
+void task::pull_image(const char* img_name, std::vector<T>* out_data) {
+	out_data->resize(get_image_byte_size(img_name) / sizeof(T));
+	pull_image(img_name, reinterpret_cast<uint8_t*>(out_data->data()));
+}
 } // namespace vkc
 } // namespace fea
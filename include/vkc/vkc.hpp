@@ -32,22 +32,119 @@
  **/
 #pragma once
 
+#include <array>
+#include <cstddef>
 #include <cstdint>
 #include <fea/memory/pimpl_ptr.hpp>
+#include <filesystem>
+#include <string>
+#include <vector>
 
 namespace vk {
 class Instance;
 class PhysicalDevice;
 class Device;
 class Queue;
+class Fence;
+struct SubmitInfo;
+enum class Result;
 } // namespace vk
 
 namespace fea {
 namespace vkc {
 namespace detail {
 struct vkc_impl;
+struct resident;
+struct staging_ring;
+struct stats_data;
+struct tracer;
 }
 
+// Usage of one memory heap.
+struct heap_stats {
+	// Total size of the heap.
+	size_t size = 0;
+
+	// How much memory this process can use before allocations may fail or
+	// degrade performance. Reported by the driver with VK_EXT_memory_budget,
+	// otherwise the heap size.
+	size_t budget = 0;
+
+	// How much memory this process uses. Reported by the driver with
+	// VK_EXT_memory_budget, otherwise allocated_bytes.
+	size_t usage = 0;
+
+	// Memory allocated through this vkc.
+	size_t allocated_bytes = 0;
+	size_t allocation_count = 0;
+
+	// Gpu memory, as opposed to host memory.
+	bool device_local = false;
+};
+
+struct device_memory_stats {
+	// Indexed with vulkan heap index.
+	std::vector<heap_stats> heaps;
+
+	// Live allocations made through this vkc, on all heaps.
+	size_t allocation_count = 0;
+
+	// The device allocation count limit (maxMemoryAllocationCount).
+	size_t max_allocation_count = 0;
+
+	// Whether budget and usage come from VK_EXT_memory_budget.
+	bool has_budget = false;
+
+	// Host visible memory of the staging ring, included in heaps.
+	// 0 until the first transfer. See vkc::staging_ring_byte_size.
+	size_t staging_ring_bytes = 0;
+};
+
+// Latency distribution, in power of 2 microsecond buckets.
+struct latency_histogram {
+	// Bucket i counts latencies under 2^i us, which didn't fit the previous
+	// buckets. The last bucket also counts everything longer.
+	std::array<uint64_t, 24> buckets{};
+
+	uint64_t count = 0;
+	uint64_t total_us = 0;
+	uint64_t max_us = 0;
+};
+
+// Counters of the work done through a vkc, see vkc::stats.
+struct vkc_stats {
+	// Whether stats are collected, see vkc::collect_stats.
+	bool enabled = false;
+
+	uint64_t queue_submits = 0;
+
+	// Blocking waits on submits. vkc never idles the whole queue or device.
+	uint64_t fence_waits = 0;
+
+	// Bytes transferred by task and graph pushes and pulls.
+	uint64_t bytes_pushed = 0;
+	uint64_t bytes_pulled = 0;
+
+	// Bytes of the pushes and pulls copied straight from or to imported user
+	// memory, see host_vector.
+	uint64_t bytes_imported = 0;
+
+	// Command buffers recorded, or re-recorded after a change.
+	uint64_t command_records = 0;
+
+	uint64_t descriptor_updates = 0;
+
+	// Device memory allocations, see memory_stats for live allocations.
+	uint64_t memory_allocations = 0;
+
+	uint64_t pipeline_creations = 0;
+
+	// Host latency of task and graph submits, and of task pushes and pulls.
+	latency_histogram submit_latency;
+	latency_histogram push_latency;
+	latency_histogram pull_latency;
+};
+
 // Initializes vulkan and stores the global state.
 // This is your GPU logical device.
 struct vkc : fea::pimpl_ptr<detail::vkc_impl> {
@@ -61,6 +158,64 @@ struct vkc : fea::pimpl_ptr<detail::vkc_impl> {
 	vkc(const vkc&) = delete;
 	vkc& operator=(const vkc&) = delete;
 
+	// The name of the selected device.
+	const std::string& device_name() const;
+
+	// Directory where runtime compiled spirv is cached.
+	// Defaults to '<temp directory>/fea_vkc_cache'.
+	// An empty path disables the disk cache.
+	// Not thread-safe, set it before creating tasks.
+	void shader_cache_dir(const std::filesystem::path& dir);
+	const std::filesystem::path& shader_cache_dir() const;
+
+	// Whether suitably aligned user memory is imported for transfers, instead
+	// of being copied to staging memory (VK_EXT_external_memory_host).
+	// See host_vector.
+	bool external_host_memory() const;
+
+	// The required address alignment of imported memory.
+	// 0 when external_host_memory isn't supported.
+	size_t external_host_memory_alignment() const;
+
+	// Per-heap memory usage and budget. Thread-safe.
+	// See task::memory_stats for per-task usage.
+	device_memory_stats memory_stats() const;
+
+	// Spills the device buffers of idle tasks to host memory, when new
+	// allocations would exceed budget_bytes of device memory. The least
+	// recently used tasks are spilled first, and restored when used again.
+	// Tasks in use on other threads aren't spilled.
+	// 0 disables it, the default. Thread-safe.
+	void residency_budget(size_t budget_bytes);
+	size_t residency_budget() const;
+
+	// Buffer pushes and pulls of all tasks go through a shared ring of host
+	// visible memory. Larger transfers are streamed through it in chunks.
+	// Defaults to 64MB. Not thread-safe, set it before transfers.
+	void staging_ring_byte_size(size_t byte_size);
+	size_t staging_ring_byte_size() const;
+
+	// Counters and latency histograms of everything done through this vkc.
+	// They stay 0 unless collecting, see collect_stats. Thread-safe.
+	vkc_stats stats() const;
+	void reset_stats();
+
+	// Collects stats. Off by default, on when built with FEA_VKC_STATS.
+	// Thread-safe.
+	void collect_stats(bool enable);
+	bool collect_stats() const;
+
+	// Records a timeline of task construction, pushes, submits, queue waits
+	// and pulls, on all threads. Gpu work is timestamped and shown on its
+	// own track. Off by default. Thread-safe.
+	void tracing(bool enable);
+	bool tracing() const;
+
+	// Writes the recorded timeline as Chrome trace-event json, which opens
+	// in Perfetto or chrome://tracing. The recorded events are cleared.
+	// Returns false if the file couldn't be written.
+	bool write_trace(const std::filesystem::path& filepath);
+
 	// These functions are used internally :
 
 	const vk::Instance& instance() const;
@@ -72,10 +227,42 @@ struct vkc : fea::pimpl_ptr<detail::vkc_impl> {
 	const vk::Device& device() const;
 	vk::Device& device();
 
+	// The queue isn't synchronized, prefer submit.
 	const vk::Queue& queue() const;
 	vk::Queue& queue();
 
+	// Submits to the queue. Thread-safe.
+	vk::Result submit(
+			const vk::SubmitInfo& submit_info, const vk::Fence& fence);
+
 	uint32_t queue_family() const;
+
+	// The memory types which can import the host pointer.
+	// 0 if it can't be imported.
+	uint32_t host_pointer_memory_type_bits(const void* ptr) const;
+
+	// Accounts device memory in memory_stats. Thread-safe.
+	void track_allocation(uint32_t memory_type_idx, size_t byte_size) const;
+	void track_free(uint32_t memory_type_idx, size_t byte_size) const;
+
+	// Residency, see residency_budget. Thread-safe.
+	void register_resident(detail::resident* r);
+	void unregister_resident(detail::resident* r);
+
+	// Marks r as used, and spills the least recently used residents until
+	// byte_size more device memory fits in the residency budget.
+	// The caller holds r, and the held residents, they are never spilled.
+	void make_room(detail::resident* r, size_t byte_size,
+			const std::vector<detail::resident*>& held = {});
+
+	// The collected stats, see stats. Thread-safe.
+	detail::stats_data& stats_data() const;
+
+	// The recorded timeline, see tracing. Thread-safe.
+	detail::tracer& tracer() const;
+
+	// Transfers staging memory, see staging_ring_byte_size. Thread-safe.
+	detail::staging_ring& staging_ring() const;
 };
 
 } // namespace vkc
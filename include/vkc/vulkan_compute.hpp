@@ -1,3 +1,8 @@
 ﻿#pragma once
+#include "vkc/capture.hpp"
+#include "vkc/fused_task.hpp"
+#include "vkc/graph.hpp"
+#include "vkc/host_memory.hpp"
+#include "vkc/stream.hpp"
 #include "vkc/task.hpp"
 #include "vkc/vkc.hpp"
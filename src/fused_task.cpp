@@ -0,0 +1,69 @@
+﻿#include "vkc/fused_task.hpp"
+#include "vkc/vkc.hpp"
+
+#include <fea/utils/throw.hpp>
+#include <string>
+
+namespace fea {
+namespace vkc {
+std::string make_fused_glsl(const fused_elementwise& chain) {
+	if (chain.stages.empty()) {
+		fea::maybe_throw<std::invalid_argument>(__FUNCTION__, __LINE__,
+				"Fused chain must have at least one stage.");
+	}
+
+	const std::string& t = chain.value_type;
+	std::string ret;
+	ret += "#version 450\n";
+	ret += "layout(local_size_x = " + std::to_string(chain.workgroup_size)
+			+ ", local_size_y = 1, local_size_z = 1) in;\n\n";
+
+	// Buffers.
+	ret += "layout(std430, binding = 0) readonly buffer in_buf {\n\t" + t
+			+ " in_buf_data[];\n};\n";
+	ret += "layout(std430, binding = 1) writeonly buffer out_buf {\n\t" + t
+			+ " out_buf_data[];\n};\n";
+
+	uint32_t binding = 2;
+	for (const std::string& name : chain.inputs) {
+		ret += "layout(std430, binding = " + std::to_string(binding++)
+				+ ") readonly buffer " + name + " {\n\t" + t + " " + name
+				+ "_data[];\n};\n";
+	}
+	ret += "\n";
+
+	// Push constants.
+	if (!chain.constants.empty()) {
+		ret += "layout(push_constant, std430) uniform fused_constants {\n";
+		for (const std::string& name : chain.constants) {
+			ret += "\tfloat " + name + ";\n";
+		}
+		ret += "} p_constants;\n\n";
+	}
+
+	// One function per stage, so expressions can't interfere.
+	for (size_t s = 0; s < chain.stages.size(); ++s) {
+		ret += t + " stage_" + std::to_string(s) + "(" + t
+				+ " x, uint i) {\n\treturn " + chain.stages[s] + ";\n}\n";
+	}
+	ret += "\n";
+
+	ret += "void main() {\n";
+	ret += "\tuint i = gl_GlobalInvocationID.x;\n";
+	ret += "\tif (i >= in_buf_data.length()) {\n\t\treturn;\n\t}\n\n";
+	ret += "\t" + t + " x = in_buf_data[i];\n";
+	for (size_t s = 0; s < chain.stages.size(); ++s) {
+		ret += "\tx = stage_" + std::to_string(s) + "(x, i);\n";
+	}
+	ret += "\tout_buf_data[i] = x;\n";
+	ret += "}\n";
+	return ret;
+}
+
+task make_fused_task(
+		vkc& vkc_inst, const fused_elementwise& chain, const task_options& opts) {
+	std::string glsl = make_fused_glsl(chain);
+	return task{ vkc_inst, glsl, {}, opts };
+}
+} // namespace vkc
+} // namespace fea
@@ -0,0 +1,224 @@
+﻿#include "private_include/glsl_compiler.hpp"
+#include "private_include/spirv_cache.hpp"
+
+#include <cstdio>
+#include <fea/utils/throw.hpp>
+#include <glslang/Public/ShaderLang.h>
+#include <glslang/SPIRV/GlslangToSpv.h>
+#include <glslang/build_info.h>
+#include <mutex>
+#include <string>
+#include <vulkan/vulkan.hpp>
+
+namespace fea {
+namespace vkc {
+namespace {
+// Bump when changing compile settings, invalidates cached shaders.
+constexpr uint32_t compile_settings_version = 1;
+
+/*
+glslang requires a process wide initialization before compiling anything.
+Compiling shaders is thread-safe afterwards.
+*/
+void init_glslang() {
+	static std::once_flag flag;
+	std::call_once(flag, []() { glslang::InitializeProcess(); });
+}
+
+/*
+glslang needs the limits of the target. These are glslang's defaults (see
+glslang/StandAlone/ResourceLimits.cpp), with compute limits taken from the
+device.
+*/
+TBuiltInResource make_resource_limits(const vkc& vkc_inst) {
+	vk::PhysicalDeviceLimits limits
+			= vkc_inst.physical_device().getProperties().limits;
+
+	TBuiltInResource ret{};
+	ret.maxLights = 32;
+	ret.maxClipPlanes = 6;
+	ret.maxTextureUnits = 32;
+	ret.maxTextureCoords = 32;
+	ret.maxVertexAttribs = 64;
+	ret.maxVertexUniformComponents = 4096;
+	ret.maxVaryingFloats = 64;
+	ret.maxVertexTextureImageUnits = 32;
+	ret.maxCombinedTextureImageUnits = 80;
+	ret.maxTextureImageUnits = 32;
+	ret.maxFragmentUniformComponents = 4096;
+	ret.maxDrawBuffers = 32;
+	ret.maxVertexUniformVectors = 128;
+	ret.maxVaryingVectors = 8;
+	ret.maxFragmentUniformVectors = 16;
+	ret.maxVertexOutputVectors = 16;
+	ret.maxFragmentInputVectors = 15;
+	ret.minProgramTexelOffset = -8;
+	ret.maxProgramTexelOffset = 7;
+	ret.maxClipDistances = 8;
+	ret.maxComputeWorkGroupCountX = int(limits.maxComputeWorkGroupCount[0]);
+	ret.maxComputeWorkGroupCountY = int(limits.maxComputeWorkGroupCount[1]);
+	ret.maxComputeWorkGroupCountZ = int(limits.maxComputeWorkGroupCount[2]);
+	ret.maxComputeWorkGroupSizeX = int(limits.maxComputeWorkGroupSize[0]);
+	ret.maxComputeWorkGroupSizeY = int(limits.maxComputeWorkGroupSize[1]);
+	ret.maxComputeWorkGroupSizeZ = int(limits.maxComputeWorkGroupSize[2]);
+	ret.maxComputeUniformComponents = 1024;
+	ret.maxComputeTextureImageUnits = 16;
+	ret.maxComputeImageUniforms = 8;
+	ret.maxComputeAtomicCounters = 8;
+	ret.maxComputeAtomicCounterBuffers = 1;
+	ret.maxVaryingComponents = 60;
+	ret.maxVertexOutputComponents = 64;
+	ret.maxGeometryInputComponents = 64;
+	ret.maxGeometryOutputComponents = 128;
+	ret.maxFragmentInputComponents = 128;
+	ret.maxImageUnits = 8;
+	ret.maxCombinedImageUnitsAndFragmentOutputs = 8;
+	ret.maxCombinedShaderOutputResources = 8;
+	ret.maxImageSamples = 0;
+	ret.maxVertexImageUniforms = 0;
+	ret.maxTessControlImageUniforms = 0;
+	ret.maxTessEvaluationImageUniforms = 0;
+	ret.maxGeometryImageUniforms = 0;
+	ret.maxFragmentImageUniforms = 8;
+	ret.maxCombinedImageUniforms = 8;
+	ret.maxGeometryTextureImageUnits = 16;
+	ret.maxGeometryOutputVertices = 256;
+	ret.maxGeometryTotalOutputComponents = 1024;
+	ret.maxGeometryUniformComponents = 1024;
+	ret.maxGeometryVaryingComponents = 64;
+	ret.maxTessControlInputComponents = 128;
+	ret.maxTessControlOutputComponents = 128;
+	ret.maxTessControlTextureImageUnits = 16;
+	ret.maxTessControlUniformComponents = 1024;
+	ret.maxTessControlTotalOutputComponents = 4096;
+	ret.maxTessEvaluationInputComponents = 128;
+	ret.maxTessEvaluationOutputComponents = 128;
+	ret.maxTessEvaluationTextureImageUnits = 16;
+	ret.maxTessEvaluationUniformComponents = 1024;
+	ret.maxTessPatchComponents = 120;
+	ret.maxPatchVertices = 32;
+	ret.maxTessGenLevel = 64;
+	ret.maxViewports = 16;
+	ret.maxVertexAtomicCounters = 0;
+	ret.maxTessControlAtomicCounters = 0;
+	ret.maxTessEvaluationAtomicCounters = 0;
+	ret.maxGeometryAtomicCounters = 0;
+	ret.maxFragmentAtomicCounters = 8;
+	ret.maxCombinedAtomicCounters = 8;
+	ret.maxAtomicCounterBindings = 1;
+	ret.maxVertexAtomicCounterBuffers = 0;
+	ret.maxTessControlAtomicCounterBuffers = 0;
+	ret.maxTessEvaluationAtomicCounterBuffers = 0;
+	ret.maxGeometryAtomicCounterBuffers = 0;
+	ret.maxFragmentAtomicCounterBuffers = 1;
+	ret.maxCombinedAtomicCounterBuffers = 1;
+	ret.maxAtomicCounterBufferSize = 16384;
+	ret.maxTransformFeedbackBuffers = 4;
+	ret.maxTransformFeedbackInterleavedComponents = 64;
+	ret.maxCullDistances = 8;
+	ret.maxCombinedClipAndCullDistances = 8;
+	ret.maxSamples = 4;
+	ret.maxMeshOutputVerticesNV = 256;
+	ret.maxMeshOutputPrimitivesNV = 512;
+	ret.maxMeshWorkGroupSizeX_NV = 32;
+	ret.maxMeshWorkGroupSizeY_NV = 1;
+	ret.maxMeshWorkGroupSizeZ_NV = 1;
+	ret.maxTaskWorkGroupSizeX_NV = 32;
+	ret.maxTaskWorkGroupSizeY_NV = 1;
+	ret.maxTaskWorkGroupSizeZ_NV = 1;
+	ret.maxMeshViewCountNV = 4;
+
+	ret.limits.nonInductiveForLoops = true;
+	ret.limits.whileLoops = true;
+	ret.limits.doWhileLoops = true;
+	ret.limits.generalUniformIndexing = true;
+	ret.limits.generalAttributeMatrixVectorIndexing = true;
+	ret.limits.generalVaryingIndexing = true;
+	ret.limits.generalSamplerIndexing = true;
+	ret.limits.generalVariableIndexing = true;
+	ret.limits.generalConstantMatrixVectorIndexing = true;
+	return ret;
+}
+
+uint64_t hash_glsl(
+		std::string_view glsl_source, const std::vector<shader_define>& defines) {
+	detail::spirv_hasher h;
+	h.add("glsl");
+	h.add(&compile_settings_version, sizeof(compile_settings_version));
+
+	// Compiler version.
+	int version[] = {
+		GLSLANG_VERSION_MAJOR,
+		GLSLANG_VERSION_MINOR,
+		GLSLANG_VERSION_PATCH,
+	};
+	h.add(version, sizeof(version));
+	h.add(GLSLANG_VERSION_FLAVOR);
+
+	h.add(glsl_source);
+	for (const shader_define& d : defines) {
+		h.add(d.name);
+		h.add(d.value);
+	}
+	return h.value();
+}
+} // namespace
+
+namespace detail {
+std::vector<uint32_t> compile_glsl(const vkc& vkc_inst,
+		std::string_view glsl_source, const std::vector<shader_define>& defines) {
+	uint64_t key = hash_glsl(glsl_source, defines);
+
+	std::vector<uint32_t> ret;
+	if (load_cached_spirv(vkc_inst.shader_cache_dir(), key, ret)) {
+		return ret;
+	}
+
+	init_glslang();
+
+	// Defines are injected after the #version directive.
+	std::string preamble;
+	for (const shader_define& d : defines) {
+		preamble += "#define " + d.name + " " + d.value + "\n";
+	}
+
+	const char* source_ptr = glsl_source.data();
+	int source_size = int(glsl_source.size());
+
+	glslang::TShader shader{ EShLangCompute };
+	shader.setStringsWithLengths(&source_ptr, &source_size, 1);
+	shader.setPreamble(preamble.c_str());
+	shader.setEnvInput(glslang::EShSourceGlsl, EShLangCompute,
+			glslang::EShClientVulkan, 100);
+	shader.setEnvClient(glslang::EShClientVulkan, glslang::EShTargetVulkan_1_2);
+	shader.setEnvTarget(glslang::EShTargetSpv, glslang::EShTargetSpv_1_5);
+
+	EShMessages messages = EShMessages(EShMsgSpvRules | EShMsgVulkanRules);
+	TBuiltInResource resources = make_resource_limits(vkc_inst);
+
+	if (!shader.parse(&resources, 450, false, messages)) {
+		fprintf(stderr, "Glsl compilation failed :\n%s\n%s\n",
+				shader.getInfoLog(), shader.getInfoDebugLog());
+		fea::maybe_throw<std::runtime_error>(
+				__FUNCTION__, __LINE__, "Couldn't compile glsl shader.");
+	}
+
+	glslang::TProgram program;
+	program.addShader(&shader);
+	if (!program.link(messages)) {
+		fprintf(stderr, "Glsl linking failed :\n%s\n%s\n",
+				program.getInfoLog(), program.getInfoDebugLog());
+		fea::maybe_throw<std::runtime_error>(
+				__FUNCTION__, __LINE__, "Couldn't link glsl shader.");
+	}
+
+	std::vector<unsigned int> spirv;
+	glslang::GlslangToSpv(*program.getIntermediate(EShLangCompute), spirv);
+	ret.assign(spirv.begin(), spirv.end());
+
+	store_cached_spirv(vkc_inst.shader_cache_dir(), key, ret);
+	return ret;
+}
+} // namespace detail
+} // namespace vkc
+} // namespace fea
@@ -0,0 +1,520 @@
+﻿#include "vkc/graph.hpp"
+#include "private_include/stats.hpp"
+#include "private_include/submit.hpp"
+#include "private_include/task_impl.hpp"
+#include "private_include/tracer.hpp"
+#include "vkc/vkc.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstdio>
+#include <fea/utils/throw.hpp>
+#include <mutex>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+namespace fea {
+namespace vkc {
+namespace {
+enum class step_type : uint8_t {
+	push,
+	dispatch,
+	pull,
+};
+
+// A recorded command.
+struct graph_step {
+	step_type type = step_type::push;
+	detail::task_impl* task = nullptr;
+
+	// Push and pull, the task buffer.
+	binding_id_t binding = 0;
+
+	// Dispatch, index in graph_impl::dispatches.
+	size_t dispatch_idx = 0;
+};
+
+// A recorded dispatch, with its own push_constants.
+struct graph_dispatch {
+	std::array<size_t, 3> group_counts = { 1u, 1u, 1u };
+
+	// Indexed with push_constant_info::idx.
+	std::vector<std::vector<uint8_t>> push_constants;
+
+	// Each dispatch is recorded in its own command buffer, so changing its
+	// push_constants only records it again.
+	vk::CommandBuffer cmd_buf;
+
+	// The push_constants changed since recorded.
+	bool dirty = true;
+};
+
+// A buffer referenced by recorded commands and descriptors.
+struct recorded_buffer {
+	vk::Buffer staging;
+	vk::Buffer gpu;
+
+	// Copies and descriptor ranges use it.
+	size_t byte_size = 0;
+
+	bool operator==(const recorded_buffer& other) const {
+		return staging == other.staging && gpu == other.gpu
+			&& byte_size == other.byte_size;
+	}
+};
+
+// If any buffer is reallocated or resized, the commands must be recorded
+// again.
+std::vector<recorded_buffer> recorded_buffers(
+		const std::vector<detail::task_impl*>& tasks) {
+	std::vector<recorded_buffer> ret;
+	for (const detail::task_impl* t : tasks) {
+		for (const auto& kv : t->transfer_buffers) {
+			ret.push_back(recorded_buffer{
+					kv.second.staging_buf().get(),
+					kv.second.gpu_buf().get(),
+					kv.second.byte_size(),
+			});
+		}
+	}
+	return ret;
+}
+
+transfer_buffer& get_buffer(detail::task_impl& t, const char* buf_name) {
+	buffer_ids ids = t.pipeline->buffer_name_to_id.at(buf_name);
+	transfer_buffer& buf = t.transfer_buffers.at(ids.binding_id.id);
+	assert(buf.gpu_buf().binding_id() == ids.binding_id);
+	return buf;
+}
+} // namespace
+
+namespace detail {
+struct graph_impl {
+	graph_impl(vkc* v)
+			: vkc_inst(v) {
+	}
+
+	vkc* vkc_inst = nullptr;
+
+	std::vector<graph_step> steps;
+	std::vector<graph_dispatch> dispatches;
+
+	// The recorded tasks, without duplicates.
+	std::vector<task_impl*> tasks;
+
+	// The buffers when last recorded.
+	std::vector<recorded_buffer> recorded_buffers;
+
+	// Record everything again on next submit.
+	bool dirty = true;
+
+	vk::UniqueCommandPool command_pool;
+
+	// The recorded command buffers, submitted in order with a single
+	// submission. Consecutive transfer steps share a command buffer, and
+	// each dispatch has its own.
+	std::vector<vk::CommandBuffer> cmd_bufs;
+	std::vector<vk::CommandBuffer> transfer_cmd_bufs;
+
+	// Unused command buffers, reused when recording.
+	std::vector<vk::CommandBuffer> free_cmd_bufs;
+
+	vk::UniqueFence fence;
+
+	// Timestamps the submit when tracing, see vkc::tracing.
+	gpu_timer timer;
+};
+} // namespace detail
+
+namespace {
+void add_task(detail::graph_impl& impl, detail::task_impl* t) {
+	if (std::find(impl.tasks.begin(), impl.tasks.end(), t)
+			== impl.tasks.end()) {
+		impl.tasks.push_back(t);
+	}
+	impl.dirty = true;
+}
+
+// Takes an unused command buffer, or allocates one.
+vk::CommandBuffer acquire_cmd_buf(detail::graph_impl& impl) {
+	if (!impl.free_cmd_bufs.empty()) {
+		vk::CommandBuffer ret = impl.free_cmd_bufs.back();
+		impl.free_cmd_bufs.pop_back();
+		return ret;
+	}
+
+	vk::CommandBufferAllocateInfo alloc_info{
+		impl.command_pool.get(),
+		vk::CommandBufferLevel::ePrimary,
+		1,
+	};
+	std::vector<vk::CommandBuffer> new_buf
+			= impl.vkc_inst->device().allocateCommandBuffers(alloc_info);
+	assert(new_buf.size() == 1);
+	return new_buf.back();
+}
+
+/*
+ Each step depends on the previous one, a global memory barrier makes
+ transfer and shader writes visible to following transfers and shaders.
+ Barriers apply to everything submitted before them, they work across the
+ graph command buffers.
+*/
+constexpr vk::PipelineStageFlags step_stages
+		= vk::PipelineStageFlagBits::eTransfer
+		| vk::PipelineStageFlagBits::eComputeShader;
+
+void record_step_barrier(vk::CommandBuffer cmd_buf) {
+	vk::MemoryBarrier barrier{
+		vk::AccessFlagBits::eTransferWrite | vk::AccessFlagBits::eShaderWrite,
+		vk::AccessFlagBits::eTransferRead | vk::AccessFlagBits::eTransferWrite
+				| vk::AccessFlagBits::eShaderRead
+				| vk::AccessFlagBits::eShaderWrite,
+	};
+	cmd_buf.pipelineBarrier(step_stages, step_stages, {}, 1, &barrier, 0,
+			nullptr, 0, nullptr);
+}
+
+// Records a dispatch step in its own command buffer.
+void record_dispatch_step(detail::graph_impl& impl, const graph_step& step) {
+	const detail::task_impl& t = *step.task;
+	const detail::task_pipeline& pipeline = *t.pipeline;
+	graph_dispatch& d = impl.dispatches[step.dispatch_idx];
+	if (!d.cmd_buf) {
+		d.cmd_buf = acquire_cmd_buf(impl);
+	}
+
+	vk::CommandBufferBeginInfo begin_info{};
+	d.cmd_buf.begin(begin_info);
+	detail::count_stat(*impl.vkc_inst, detail::stat::command_records);
+
+	if (&step != &impl.steps.front()) {
+		record_step_barrier(d.cmd_buf);
+	}
+
+	d.cmd_buf.bindPipeline(
+			vk::PipelineBindPoint::eCompute, pipeline.pipeline.get());
+	d.cmd_buf.bindDescriptorSets(vk::PipelineBindPoint::eCompute,
+			pipeline.pipeline_layout.get(), 0, 1, &t.descriptor_sets.back(), 0,
+			nullptr);
+
+	for (const auto& kv : pipeline.push_constants_name_to_info) {
+		const detail::push_constant_info& info = kv.second;
+		const std::vector<uint8_t>& constant = d.push_constants[info.idx];
+		if (constant.empty()) {
+			continue;
+		}
+
+		d.cmd_buf.pushConstants(pipeline.pipeline_layout.get(),
+				vk::ShaderStageFlagBits::eCompute, uint32_t(info.offset),
+				uint32_t(info.byte_size), constant.data());
+	}
+
+	detail::record_dispatch(pipeline, d.cmd_buf, d.group_counts);
+	d.cmd_buf.end();
+	d.dirty = false;
+}
+
+void record(detail::graph_impl& impl) {
+	impl.cmd_bufs.clear();
+	impl.free_cmd_bufs.insert(impl.free_cmd_bufs.end(),
+			impl.transfer_cmd_bufs.begin(), impl.transfer_cmd_bufs.end());
+	impl.transfer_cmd_bufs.clear();
+
+	// The command buffer of the current transfer steps, if any.
+	vk::CommandBuffer transfer_cmd;
+	auto begin_transfers = [&]() {
+		if (transfer_cmd) {
+			return;
+		}
+		transfer_cmd = acquire_cmd_buf(impl);
+		vk::CommandBufferBeginInfo begin_info{};
+		transfer_cmd.begin(begin_info);
+		detail::count_stat(*impl.vkc_inst, detail::stat::command_records);
+	};
+	auto end_transfers = [&]() {
+		if (!transfer_cmd) {
+			return;
+		}
+		transfer_cmd.end();
+		impl.transfer_cmd_bufs.push_back(transfer_cmd);
+		impl.cmd_bufs.push_back(transfer_cmd);
+		transfer_cmd = vk::CommandBuffer{};
+	};
+
+	for (size_t i = 0; i < impl.steps.size(); ++i) {
+		const graph_step& step = impl.steps[i];
+		detail::task_impl& t = *step.task;
+
+		if (step.type == step_type::dispatch) {
+			end_transfers();
+			record_dispatch_step(impl, step);
+			impl.cmd_bufs.push_back(
+					impl.dispatches[step.dispatch_idx].cmd_buf);
+			continue;
+		}
+
+		begin_transfers();
+		if (i != 0) {
+			record_step_barrier(transfer_cmd);
+		}
+
+		transfer_buffer& buf = t.transfer_buffers.at(step.binding);
+		vk::BufferCopy copy_region{ 0, 0, buf.byte_size() };
+		if (step.type == step_type::push) {
+			transfer_cmd.copyBuffer(buf.staging_buf().get(),
+					buf.gpu_buf().get(), 1, &copy_region);
+		} else {
+			transfer_cmd.copyBuffer(buf.gpu_buf().get(),
+					buf.staging_buf().get(), 1, &copy_region);
+		}
+	}
+
+	// Make the pulled data visible to the host.
+	begin_transfers();
+	vk::MemoryBarrier host_barrier{
+		vk::AccessFlagBits::eTransferWrite | vk::AccessFlagBits::eShaderWrite,
+		vk::AccessFlagBits::eHostRead,
+	};
+	transfer_cmd.pipelineBarrier(step_stages,
+			vk::PipelineStageFlagBits::eHost, {}, 1, &host_barrier, 0, nullptr,
+			0, nullptr);
+	end_transfers();
+
+	impl.recorded_buffers = recorded_buffers(impl.tasks);
+	impl.dirty = false;
+}
+} // namespace
+
+graph::~graph() = default;
+graph::graph(graph&&) noexcept = default;
+graph& graph::operator=(graph&&) noexcept = default;
+
+graph::graph(vkc& vkc_inst)
+		: pimpl_ptr(&vkc_inst) {
+	vk::CommandPoolCreateInfo command_pool_create_info{
+		vk::CommandPoolCreateFlagBits::eResetCommandBuffer,
+		vkc_inst.queue_family(),
+	};
+	_impl->command_pool = vkc_inst.device().createCommandPoolUnique(
+			command_pool_create_info);
+
+	_impl->fence = vkc_inst.device().createFenceUnique(vk::FenceCreateInfo{});
+}
+
+void graph::push(task& t, const char* buf_name) {
+	detail::task_impl& t_impl = *t._impl;
+	transfer_buffer& buf = get_buffer(t_impl, buf_name);
+	if (buf.byte_size() == 0) {
+		fea::maybe_throw<std::invalid_argument>(__FUNCTION__, __LINE__,
+				"Buffer has no size, push or reserve it on the task first.");
+	}
+
+	graph_step step;
+	step.type = step_type::push;
+	step.task = &t_impl;
+	step.binding = buf.gpu_buf().binding_id().id;
+	_impl->steps.push_back(step);
+	add_task(*_impl, &t_impl);
+}
+
+size_t graph::dispatch(task& t, size_t width, size_t height, size_t depth) {
+	detail::task_impl& t_impl = *t._impl;
+
+	// Take the enqueued push_constants, like task::submit.
+	graph_dispatch d;
+	d.group_counts
+			= detail::group_counts(*t_impl.pipeline, width, height, depth);
+	detail::check_dispatch(*t_impl.pipeline, d.group_counts);
+	d.push_constants.resize(t_impl.push_constants.size());
+	for (size_t i = 0; i < t_impl.push_constants.size(); ++i) {
+		d.push_constants[i] = std::move(t_impl.push_constants[i]);
+		t_impl.push_constants[i].clear();
+	}
+
+	graph_step step;
+	step.type = step_type::dispatch;
+	step.task = &t_impl;
+	step.dispatch_idx = _impl->dispatches.size();
+	_impl->steps.push_back(step);
+	_impl->dispatches.push_back(std::move(d));
+	add_task(*_impl, &t_impl);
+
+	return step.dispatch_idx;
+}
+
+void graph::pull(task& t, const char* buf_name) {
+	detail::task_impl& t_impl = *t._impl;
+	transfer_buffer& buf = get_buffer(t_impl, buf_name);
+	if (buf.byte_size() == 0) {
+		fea::maybe_throw<std::invalid_argument>(__FUNCTION__, __LINE__,
+				"Buffer has no size, push or reserve it on the task first.");
+	}
+
+	graph_step step;
+	step.type = step_type::pull;
+	step.task = &t_impl;
+	step.binding = buf.gpu_buf().binding_id().id;
+	_impl->steps.push_back(step);
+	add_task(*_impl, &t_impl);
+}
+
+void graph::push_constant(size_t dispatch_idx, const char* constant_name,
+		const void* val, size_t byte_size) {
+	graph_dispatch& d = _impl->dispatches.at(dispatch_idx);
+
+	// Find the dispatch task.
+	auto it = std::find_if(_impl->steps.begin(), _impl->steps.end(),
+			[&](const graph_step& s) {
+				return s.type == step_type::dispatch
+						&& s.dispatch_idx == dispatch_idx;
+			});
+	assert(it != _impl->steps.end());
+
+	const detail::push_constant_info& info
+			= it->task->pipeline->push_constants_name_to_info.at(
+					constant_name);
+
+	if (byte_size != info.byte_size) {
+		fea::maybe_throw<std::invalid_argument>(__FUNCTION__, __LINE__,
+				"Mismatch between passed in push_constant size and "
+				"shader size.");
+	}
+
+	std::vector<uint8_t>& constant = d.push_constants[info.idx];
+	const uint8_t* in_data = reinterpret_cast<const uint8_t*>(val);
+	if (constant.size() == byte_size
+			&& std::equal(in_data, in_data + byte_size, constant.begin())) {
+		// Unchanged, no need to record again.
+		return;
+	}
+
+	// Only this dispatch is recorded again.
+	constant.assign(in_data, in_data + byte_size);
+	d.dirty = true;
+}
+
+void graph::write(task& t, const char* buf_name, const uint8_t* in_data,
+		size_t byte_size) {
+	transfer_buffer& buf = get_buffer(*t._impl, buf_name);
+	if (byte_size != buf.byte_size()) {
+		fea::maybe_throw<std::invalid_argument>(__FUNCTION__, __LINE__,
+				"Mismatch between passed in data size and recorded buffer "
+				"size.");
+	}
+
+	// Don't race a spill.
+	std::lock_guard<std::mutex> resident_lock(t._impl->residency.in_use);
+	buf.reserve_staging(*_impl->vkc_inst, t._impl->command_pool.get(),
+			t._impl->fence.get());
+	buf.write_staging(*_impl->vkc_inst, in_data);
+	detail::count_stat(*_impl->vkc_inst, detail::stat::bytes_pushed, byte_size);
+}
+
+void graph::submit() {
+	if (_impl->steps.empty()) {
+		return;
+	}
+
+	detail::scoped_trace trace(*_impl->vkc_inst, "graph_submit");
+	detail::scoped_latency latency(*_impl->vkc_inst, detail::latency::submit);
+
+	// Restores spilled buffers and keeps them until done.
+	// See vkc::residency_budget.
+	std::vector<std::unique_lock<std::mutex>> resident_locks;
+	std::vector<detail::resident*> held;
+	resident_locks.reserve(_impl->tasks.size());
+	held.reserve(_impl->tasks.size());
+	for (detail::task_impl* t : _impl->tasks) {
+		resident_locks.push_back(detail::make_resident(*t, 0, held));
+		held.push_back(&t->residency);
+	}
+
+	// Graph transfers go through the buffers' staging mirrors.
+	for (const graph_step& step : _impl->steps) {
+		if (step.type != step_type::dispatch) {
+			detail::task_impl& t = *step.task;
+			transfer_buffer& buf = t.transfer_buffers.at(step.binding);
+			buf.reserve_staging(
+					*_impl->vkc_inst, t.command_pool.get(), t.fence.get());
+		}
+	}
+
+	if (!_impl->dirty
+			&& _impl->recorded_buffers != recorded_buffers(_impl->tasks)) {
+		// A buffer was reallocated or resized, the recorded commands are
+		// invalid.
+		_impl->dirty = true;
+	}
+
+	if (_impl->dirty) {
+		record(*_impl);
+	} else {
+		for (const graph_step& step : _impl->steps) {
+			if (step.type == step_type::dispatch
+					&& _impl->dispatches[step.dispatch_idx].dirty) {
+				record_dispatch_step(*_impl, step);
+			}
+		}
+	}
+
+	detail::gpu_timer* timer = nullptr;
+	if (detail::tracing(*_impl->vkc_inst)) {
+		if (!_impl->timer.supported()) {
+			_impl->timer = detail::gpu_timer{ *_impl->vkc_inst,
+				_impl->command_pool.get() };
+		}
+		timer = &_impl->timer;
+	}
+
+	vk::Result res = detail::submit_and_wait(*_impl->vkc_inst,
+			_impl->cmd_bufs.data(), uint32_t(_impl->cmd_bufs.size()),
+			_impl->fence.get(), timer);
+	if (res != vk::Result::eSuccess) {
+		fprintf(stderr, "Graph submit failed with result : '%d'\n", res);
+		return;
+	}
+
+	for (const graph_step& step : _impl->steps) {
+		if (step.type == step_type::push) {
+			step.task->transfer_buffers.at(step.binding).staging_pushed();
+		}
+	}
+}
+
+size_t graph::get_buffer_byte_size(task& t, const char* buf_name) const {
+	return get_buffer(*t._impl, buf_name).byte_size();
+}
+
+void graph::read(task& t, const char* buf_name, uint8_t* out_data) {
+	transfer_buffer& buf = get_buffer(*t._impl, buf_name);
+
+	// Don't race a spill.
+	std::lock_guard<std::mutex> resident_lock(t._impl->residency.in_use);
+	buf.reserve_staging(*_impl->vkc_inst, t._impl->command_pool.get(),
+			t._impl->fence.get());
+	buf.read_staging(*_impl->vkc_inst, out_data);
+	detail::count_stat(
+			*_impl->vkc_inst, detail::stat::bytes_pulled, buf.byte_size());
+}
+
+void graph::clear() {
+	for (const graph_dispatch& d : _impl->dispatches) {
+		if (d.cmd_buf) {
+			_impl->free_cmd_bufs.push_back(d.cmd_buf);
+		}
+	}
+	_impl->free_cmd_bufs.insert(_impl->free_cmd_bufs.end(),
+			_impl->transfer_cmd_bufs.begin(), _impl->transfer_cmd_bufs.end());
+	_impl->transfer_cmd_bufs.clear();
+	_impl->cmd_bufs.clear();
+
+	_impl->steps.clear();
+	_impl->dispatches.clear();
+	_impl->tasks.clear();
+	_impl->recorded_buffers.clear();
+	_impl->dirty = true;
+}
+} // namespace vkc
+} // namespace fea
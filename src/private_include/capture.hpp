@@ -0,0 +1,186 @@
+#pragma once
+#include "vkc/capture.hpp"
+#include "vkc/task.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace fea {
+namespace vkc {
+namespace detail {
+// 64bit hash of blob contents, 8 bytes at a time.
+// Only used to find duplicate candidates, which are then compared.
+inline uint64_t blob_hash(const void* data, size_t byte_size) {
+	const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+	uint64_t hash = 14695981039346656037ull ^ byte_size;
+
+	size_t i = 0;
+	for (; i + sizeof(uint64_t) <= byte_size; i += sizeof(uint64_t)) {
+		uint64_t word;
+		std::memcpy(&word, bytes + i, sizeof(word));
+		hash = (hash ^ word) * 1099511628211ull;
+		hash ^= hash >> 32;
+	}
+	for (; i < byte_size; ++i) {
+		hash = (hash ^ bytes[i]) * 1099511628211ull;
+	}
+	return hash;
+}
+
+// Streams a task capture to disk, see task::begin_capture.
+// Blob data is written as it comes, so large captures don't stay in memory.
+// The commands and blob table are written on close.
+struct capture_writer {
+	capture_writer() = default;
+	capture_writer(const capture_writer&) = delete;
+	capture_writer& operator=(const capture_writer&) = delete;
+
+	~capture_writer() {
+		close();
+	}
+
+	// Returns false if the file couldn't be created.
+	bool open(const std::filesystem::path& filepath,
+			const std::vector<uint32_t>& spirv, const task_options& opts) {
+		_file.open(filepath,
+				std::ios::binary | std::ios::in | std::ios::out
+						| std::ios::trunc);
+		if (!_file.is_open()) {
+			return false;
+		}
+
+		// Reserve the header, written on close.
+		static_assert(sizeof(capture_header) <= capture_alignment,
+				"capture_writer : header doesn't fit its section");
+		std::array<char, capture_alignment> header_space{};
+		_offset = 0;
+		write(header_space.data(), header_space.size());
+
+		_header.optimize = opts.optimize ? 1u : 0u;
+		_header.spirv = add_blob(spirv.data(), spirv.size() * sizeof(uint32_t));
+
+		if (!opts.spec_constants.empty()) {
+			std::vector<uint32_t> spec;
+			for (const spec_constant& c : opts.spec_constants) {
+				spec.push_back(c.id);
+				spec.push_back(c.value);
+			}
+			_header.spec_constants
+					= add_blob(spec.data(), spec.size() * sizeof(uint32_t));
+		}
+		return _file.good();
+	}
+
+	bool is_open() const {
+		return _file.is_open();
+	}
+
+	// Returns the blob index of data, which is stored once.
+	uint32_t add_blob(const void* data, size_t byte_size) {
+		uint64_t hash = blob_hash(data, byte_size);
+		auto range = _blob_lookup.equal_range(hash);
+		for (auto it = range.first; it != range.second; ++it) {
+			if (blob_equals(_blobs[it->second], data, byte_size)) {
+				return it->second;
+			}
+		}
+
+		uint32_t idx = uint32_t(_blobs.size());
+		_blobs.push_back(capture_blob{ _offset, uint64_t(byte_size) });
+		_blob_lookup.insert({ hash, idx });
+		write(data, byte_size);
+		pad_to(capture_alignment);
+		return idx;
+	}
+
+	uint32_t add_blob(std::string_view str) {
+		return add_blob(str.data(), str.size());
+	}
+
+	void add(const capture_command& cmd) {
+		_commands.push_back(cmd);
+	}
+
+	// Writes the commands, blob table and header.
+	// Returns false if anything failed to write.
+	bool close() {
+		if (!_file.is_open()) {
+			return false;
+		}
+
+		_header.command_count = uint32_t(_commands.size());
+		_header.commands_offset = _offset;
+		write(_commands.data(), _commands.size() * sizeof(capture_command));
+		pad_to(capture_alignment);
+
+		_header.blob_count = uint32_t(_blobs.size());
+		_header.blobs_offset = _offset;
+		write(_blobs.data(), _blobs.size() * sizeof(capture_blob));
+
+		_file.seekp(0);
+		_file.write(reinterpret_cast<const char*>(&_header), sizeof(_header));
+
+		bool ret = _file.good();
+		_file.close();
+		_commands.clear();
+		_blobs.clear();
+		_blob_lookup.clear();
+		return ret;
+	}
+
+private:
+	void write(const void* data, size_t byte_size) {
+		_file.write(reinterpret_cast<const char*>(data),
+				std::streamsize(byte_size));
+		_offset += byte_size;
+	}
+
+	void pad_to(size_t alignment) {
+		static constexpr std::array<char, capture_alignment> zeros{};
+		size_t pad = size_t((alignment - _offset % alignment) % alignment);
+		write(zeros.data(), pad);
+	}
+
+	// Reads back a stored blob and compares it.
+	bool blob_equals(const capture_blob& blob, const void* data,
+			size_t byte_size) {
+		if (blob.byte_size != byte_size) {
+			return false;
+		}
+
+		const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+		std::array<char, 64 * 1024> chunk;
+		_file.seekg(std::streamoff(blob.offset));
+
+		bool ret = true;
+		for (size_t i = 0; i < byte_size && ret; i += chunk.size()) {
+			size_t count = std::min(chunk.size(), byte_size - i);
+			_file.read(chunk.data(), std::streamsize(count));
+			ret = _file.good()
+					&& std::memcmp(chunk.data(), bytes + i, count) == 0;
+		}
+
+		_file.clear();
+		_file.seekp(std::streamoff(_offset));
+		return ret;
+	}
+
+	std::fstream _file;
+	uint64_t _offset = 0;
+	capture_header _header;
+	std::vector<capture_command> _commands;
+	std::vector<capture_blob> _blobs;
+
+	// hash -> blob index.
+	std::unordered_multimap<uint64_t, uint32_t> _blob_lookup;
+};
+} // namespace detail
+} // namespace vkc
+} // namespace fea
@@ -0,0 +1,76 @@
+#pragma once
+#include "vkc/task.hpp"
+
+#include <array>
+#include <cstdint>
+#include <spirv_cross.hpp>
+#include <vulkan/vulkan.hpp>
+
+namespace fea {
+namespace vkc {
+namespace detail {
+struct format_info {
+	format fmt;
+	vk::Format vk_format;
+	spv::ImageFormat spv_format;
+	size_t texel_byte_size;
+};
+
+// Indexed with format.
+constexpr std::array<format_info, size_t(format::count)> format_infos{ {
+		{ format::undefined, vk::Format::eUndefined,
+				spv::ImageFormatUnknown, 0 },
+		{ format::r8_unorm, vk::Format::eR8Unorm, spv::ImageFormatR8, 1 },
+		{ format::rg8_unorm, vk::Format::eR8G8Unorm, spv::ImageFormatRg8, 2 },
+		{ format::rgba8_unorm, vk::Format::eR8G8B8A8Unorm,
+				spv::ImageFormatRgba8, 4 },
+		{ format::rgba8_snorm, vk::Format::eR8G8B8A8Snorm,
+				spv::ImageFormatRgba8Snorm, 4 },
+		{ format::rgba8_uint, vk::Format::eR8G8B8A8Uint,
+				spv::ImageFormatRgba8ui, 4 },
+		{ format::rgba8_sint, vk::Format::eR8G8B8A8Sint,
+				spv::ImageFormatRgba8i, 4 },
+		{ format::r16_sfloat, vk::Format::eR16Sfloat, spv::ImageFormatR16f,
+				2 },
+		{ format::rg16_sfloat, vk::Format::eR16G16Sfloat,
+				spv::ImageFormatRg16f, 4 },
+		{ format::rgba16_sfloat, vk::Format::eR16G16B16A16Sfloat,
+				spv::ImageFormatRgba16f, 8 },
+		{ format::r32_uint, vk::Format::eR32Uint, spv::ImageFormatR32ui, 4 },
+		{ format::r32_sint, vk::Format::eR32Sint, spv::ImageFormatR32i, 4 },
+		{ format::r32_sfloat, vk::Format::eR32Sfloat, spv::ImageFormatR32f,
+				4 },
+		{ format::rg32_sfloat, vk::Format::eR32G32Sfloat,
+				spv::ImageFormatRg32f, 8 },
+		{ format::rgba32_uint, vk::Format::eR32G32B32A32Uint,
+				spv::ImageFormatRgba32ui, 16 },
+		{ format::rgba32_sint, vk::Format::eR32G32B32A32Sint,
+				spv::ImageFormatRgba32i, 16 },
+		{ format::rgba32_sfloat, vk::Format::eR32G32B32A32Sfloat,
+				spv::ImageFormatRgba32f, 16 },
+} };
+
+constexpr const format_info& get_format_info(format fmt) {
+	return format_infos[size_t(fmt)];
+}
+
+constexpr vk::Format to_vk_format(format fmt) {
+	return get_format_info(fmt).vk_format;
+}
+
+constexpr size_t texel_byte_size(format fmt) {
+	return get_format_info(fmt).texel_byte_size;
+}
+
+// Returns format::undefined if the shader format isn't supported.
+constexpr format to_format(spv::ImageFormat spv_fmt) {
+	for (const format_info& info : format_infos) {
+		if (info.spv_format == spv_fmt) {
+			return info.fmt;
+		}
+	}
+	return format::undefined;
+}
+} // namespace detail
+} // namespace vkc
+} // namespace fea
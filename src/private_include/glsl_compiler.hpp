@@ -0,0 +1,18 @@
+#pragma once
+#include "vkc/task.hpp"
+#include "vkc/vkc.hpp"
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace fea {
+namespace vkc {
+namespace detail {
+// Compiles a glsl compute shader to spirv using glslang.
+// Looks up and stores the result in vkc's shader cache directory.
+std::vector<uint32_t> compile_glsl(const vkc& vkc_inst,
+		std::string_view glsl_source, const std::vector<shader_define>& defines);
+} // namespace detail
+} // namespace vkc
+} // namespace fea
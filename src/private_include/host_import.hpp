@@ -0,0 +1,98 @@
+#pragma once
+#include "private_include/raw_buffer.hpp"
+#include "vkc/vkc.hpp"
+
+#include <cstdint>
+#include <vulkan/vulkan.hpp>
+
+namespace fea {
+namespace vkc {
+namespace detail {
+// Smaller transfers aren't worth creating and importing a buffer, a memcpy
+// to staging memory is faster.
+constexpr size_t min_import_byte_size = 1024 * 1024;
+
+// User memory imported as a transfer buffer (VK_EXT_external_memory_host).
+// The user memory must outlive it.
+struct imported_buffer {
+	explicit operator bool() const {
+		return bool(buf);
+	}
+
+	// Memory is declared first, so the buffer is destroyed before it.
+	tracked_memory mem;
+	vk::UniqueBuffer buf;
+};
+
+// How many bytes at the beginning of [ptr, ptr + byte_size) can be imported.
+// The address and size must be aligned, the remainder goes through staging
+// memory. Returns 0 if the memory shouldn't be imported.
+inline size_t importable_byte_size(
+		const vkc& vkc_inst, const void* ptr, size_t byte_size) {
+	if (!vkc_inst.external_host_memory()) {
+		return 0;
+	}
+
+	size_t alignment = vkc_inst.external_host_memory_alignment();
+	assert(alignment != 0);
+	if (reinterpret_cast<uintptr_t>(ptr) % alignment != 0) {
+		return 0;
+	}
+
+	size_t ret = byte_size - byte_size % alignment;
+	if (ret < min_import_byte_size) {
+		return 0;
+	}
+	return ret;
+}
+
+// Returns an empty imported_buffer on failure.
+// byte_size must come from importable_byte_size.
+inline imported_buffer import_host_memory(
+		const vkc& vkc_inst, void* ptr, size_t byte_size) {
+	imported_buffer ret;
+
+	uint32_t type_bits = vkc_inst.host_pointer_memory_type_bits(ptr);
+	if (type_bits == 0) {
+		return ret;
+	}
+
+	vk::ExternalMemoryBufferCreateInfo external_create_info{
+		vk::ExternalMemoryHandleTypeFlagBits::eHostAllocationEXT,
+	};
+	vk::BufferCreateInfo buffer_create_info{
+		{},
+		byte_size,
+		vk::BufferUsageFlagBits::eTransferSrc
+				| vk::BufferUsageFlagBits::eTransferDst,
+		vk::SharingMode::eExclusive,
+	};
+	buffer_create_info.pNext = &external_create_info;
+	vk::UniqueBuffer buf
+			= vkc_inst.device().createBufferUnique(buffer_create_info);
+
+	vk::MemoryRequirements requirements
+			= vkc_inst.device().getBufferMemoryRequirements(buf.get());
+	requirements.memoryTypeBits &= type_bits;
+	requirements.size = byte_size;
+	if (requirements.memoryTypeBits == 0) {
+		return ret;
+	}
+
+	vk::MemoryAllocateInfo allocate_info = find_memory_type(
+			vkc_inst, requirements, vk::MemoryPropertyFlagBits::eHostVisible);
+
+	vk::ImportMemoryHostPointerInfoEXT import_info{
+		vk::ExternalMemoryHandleTypeFlagBits::eHostAllocationEXT,
+		ptr,
+	};
+	allocate_info.pNext = &import_info;
+
+	ret.mem = tracked_memory{ vkc_inst, allocate_info };
+	vkc_inst.device().bindBufferMemory(buf.get(), ret.mem.get(), 0);
+	ret.buf = std::move(buf);
+	return ret;
+}
+} // namespace detail
+} // namespace vkc
+} // namespace fea
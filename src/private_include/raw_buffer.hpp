@@ -1,7 +1,11 @@
 #pragma once
+#include "private_include/format.hpp"
 #include "private_include/ids.hpp"
+#include "private_include/stats.hpp"
 #include "vkc/vkc.hpp"
 
+#include <algorithm>
+#include <cassert>
 #include <fea/utils/throw.hpp>
 #include <vulkan/vulkan.hpp>
 
@@ -10,16 +14,9 @@ namespace vkc {
 namespace detail {
 // Pass in the gpu instance, the buffer for which this memory will be
 // used and your desired memory types flag.
-vk::MemoryAllocateInfo find_memory_type(const vkc& vkc_inst,
-		const vk::Buffer& buffer, vk::MemoryPropertyFlags desired_mem_flags) {
-
-	/*
-	 First, we find the memory requirements for the buffer.
-	*/
-	vk::MemoryRequirements requirements
-			= vkc_inst.device().getBufferMemoryRequirements(buffer);
-
-
+inline vk::MemoryAllocateInfo find_memory_type(const vkc& vkc_inst,
+		const vk::MemoryRequirements& requirements,
+		vk::MemoryPropertyFlags desired_mem_flags) {
 	vk::PhysicalDeviceMemoryProperties memory_properties
 			= vkc_inst.physical_device().getMemoryProperties();
 
@@ -43,7 +40,26 @@ vk::MemoryAllocateInfo find_memory_type(const vkc& vkc_inst,
 	return {};
 }
 
-vk::UniqueBuffer make_unique_buffer(
+// The property flags of a memory type.
+inline vk::MemoryPropertyFlags memory_type_flags(
+		const vkc& vkc_inst, uint32_t memory_type_idx) {
+	vk::PhysicalDeviceMemoryProperties memory_properties
+			= vkc_inst.physical_device().getMemoryProperties();
+	assert(memory_type_idx < memory_properties.memoryTypeCount);
+	return memory_properties.memoryTypes[memory_type_idx].propertyFlags;
+}
+
+inline vk::MemoryAllocateInfo find_memory_type(const vkc& vkc_inst,
+		const vk::Buffer& buffer, vk::MemoryPropertyFlags desired_mem_flags) {
+	/*
+	 First, we find the memory requirements for the buffer.
+	*/
+	vk::MemoryRequirements requirements
+			= vkc_inst.device().getBufferMemoryRequirements(buffer);
+	return find_memory_type(vkc_inst, requirements, desired_mem_flags);
+}
+
+inline vk::UniqueBuffer make_unique_buffer(
 		const vkc& vkc_inst, size_t byte_size, vk::BufferUsageFlags usage) {
 	if (byte_size == 0) {
 		return {};
@@ -58,7 +74,91 @@ vk::UniqueBuffer make_unique_buffer(
 	return vkc_inst.device().createBufferUnique(buffer_create_info);
 }
 
-vk::UniqueDeviceMemory make_unique_memory(const vkc& vkc_inst,
+// Device memory, accounted in vkc::memory_stats.
+struct tracked_memory {
+	tracked_memory() = default;
+
+	tracked_memory(
+			const vkc& vkc_inst, const vk::MemoryAllocateInfo& allocate_info)
+			: _vkc_inst(&vkc_inst)
+			, _mem(vkc_inst.device().allocateMemoryUnique(allocate_info))
+			, _memory_type_idx(allocate_info.memoryTypeIndex)
+			, _byte_size(size_t(allocate_info.allocationSize))
+			, _flags(memory_type_flags(vkc_inst, _memory_type_idx)) {
+		_vkc_inst->track_allocation(_memory_type_idx, _byte_size);
+	}
+
+	~tracked_memory() {
+		reset();
+	}
+
+	// Move-only.
+	tracked_memory(tracked_memory&& other) noexcept
+			: _vkc_inst(other._vkc_inst)
+			, _mem(std::move(other._mem))
+			, _memory_type_idx(other._memory_type_idx)
+			, _byte_size(other._byte_size)
+			, _flags(other._flags) {
+		other._vkc_inst = nullptr;
+	}
+	tracked_memory& operator=(tracked_memory&& other) noexcept {
+		if (this == &other) {
+			return *this;
+		}
+
+		reset();
+		_vkc_inst = other._vkc_inst;
+		_mem = std::move(other._mem);
+		_memory_type_idx = other._memory_type_idx;
+		_byte_size = other._byte_size;
+		_flags = other._flags;
+		other._vkc_inst = nullptr;
+		return *this;
+	}
+	tracked_memory(const tracked_memory&) = delete;
+	tracked_memory& operator=(const tracked_memory&) = delete;
+
+	void reset() {
+		if (_vkc_inst == nullptr) {
+			return;
+		}
+
+		_mem.reset();
+		_vkc_inst->track_free(_memory_type_idx, _byte_size);
+		_vkc_inst = nullptr;
+		_byte_size = 0;
+	}
+
+	const vk::DeviceMemory& get() const {
+		return _mem.get();
+	}
+	vk::DeviceMemory& get() {
+		return _mem.get();
+	}
+
+	explicit operator bool() const {
+		return bool(_mem);
+	}
+
+	// The allocated size, may be bigger than requested.
+	size_t byte_size() const {
+		return _byte_size;
+	}
+
+	// The flags of the chosen memory type, may be more than requested.
+	vk::MemoryPropertyFlags flags() const {
+		return _flags;
+	}
+
+private:
+	const vkc* _vkc_inst = nullptr;
+	vk::UniqueDeviceMemory _mem;
+	uint32_t _memory_type_idx = 0;
+	size_t _byte_size = 0;
+	vk::MemoryPropertyFlags _flags;
+};
+
+inline tracked_memory make_unique_memory(const vkc& vkc_inst,
 		const vk::Buffer& buffer, vk::MemoryPropertyFlags mem_flags) {
 	if (!buffer) {
 		return {};
@@ -68,7 +168,7 @@ vk::UniqueDeviceMemory make_unique_memory(const vkc& vkc_inst,
 			= find_memory_type(vkc_inst, buffer, mem_flags);
 
 	// allocate memory on device.
-	return vkc_inst.device().allocateMemoryUnique(allocate_info);
+	return tracked_memory{ vkc_inst, allocate_info };
 }
 } // namespace detail
 
@@ -125,6 +225,14 @@ struct raw_buffer {
 			: raw_buffer({}, usage_flags, mem_flags) {
 	}
 
+	// Texel buffers need a format and a buffer view to be bound.
+	// Defaults to storage buffer.
+	void descriptor_type(vk::DescriptorType type, format fmt) {
+		_desc_type = type;
+		_format = fmt;
+		_bound_byte_size = 0;
+	}
+
 	// Move-only.
 	raw_buffer(raw_buffer&&) = default;
 	raw_buffer& operator=(raw_buffer&&) = default;
@@ -138,20 +246,50 @@ struct raw_buffer {
 		_byte_size = 0;
 	}
 
+	// Grows geometrically, so slowly growing sizes don't reallocate every
+	// time. The contents aren't kept when reallocating.
 	void resize(const vkc& vkc_inst, size_t new_byte_size) {
+		size_t new_capacity = grown_capacity(new_byte_size);
+		if (new_capacity != 0) {
+			reallocate(vkc_inst, new_capacity);
+		}
+		_byte_size = new_byte_size;
+	}
+
+	// Allocates for sizes up to new_capacity, byte_size doesn't change.
+	// The contents aren't kept when reallocating.
+	void reserve(const vkc& vkc_inst, size_t new_capacity) {
+		if (new_capacity > _reserved_size) {
+			reallocate(vkc_inst, new_capacity);
+		}
+	}
+
+	// The capacity a resize to new_byte_size allocates, 0 if it fits.
+	size_t grown_capacity(size_t new_byte_size) const {
 		if (new_byte_size <= _reserved_size) {
-			_byte_size = new_byte_size;
-			return;
+			return 0;
 		}
+		return std::max(new_byte_size, _reserved_size + _reserved_size / 2);
+	}
 
-		// Growing
-		_byte_size = new_byte_size;
-		_reserved_size = new_byte_size;
+	// Frees the buffer and its memory, but keeps byte_size.
+	// The next resize allocates again.
+	void release() {
+		_view.reset();
+		_buf.reset();
+		_mem.reset();
+		_reserved_size = 0;
+		_bound_byte_size = 0;
+	}
 
-		_buf = detail::make_unique_buffer(
-				vkc_inst, new_byte_size, _usage_flags);
-		_mem = detail::make_unique_memory(vkc_inst, _buf.get(), _mem_flags);
-		vkc_inst.device().bindBufferMemory(_buf.get(), _mem.get(), 0);
+	// Returns an empty buffer of byte_size, with the same ids and flags.
+	// Copy the contents and move it over this buffer to release the reserved
+	// memory.
+	raw_buffer fitted(const vkc& vkc_inst) const {
+		raw_buffer ret{ vkc_inst, _ids, _byte_size, _usage_flags, _mem_flags };
+		ret._desc_type = _desc_type;
+		ret._format = _format;
+		return ret;
 	}
 
 	void bind(const vkc& vkc_inst, vk::DescriptorSet target_desc_set) {
@@ -177,14 +315,35 @@ struct raw_buffer {
 			binding_id().id, // write to the binding.
 			0, // the array element we are writing to
 			1, // update a single descriptor.
-			vk::DescriptorType::eStorageBuffer,
+			_desc_type,
 			nullptr,
 			&descriptor_buffer_info,
 		};
 
+		if (is_texel_buffer()) {
+			if (_format == format::undefined) {
+				fea::maybe_throw<std::runtime_error>(__FUNCTION__, __LINE__,
+						"Texel buffer has no format, call set_format first.");
+			}
+
+			// Texel buffers are accessed through a typed view.
+			vk::BufferViewCreateInfo view_create_info{
+				{},
+				_buf.get(),
+				detail::to_vk_format(_format),
+				0,
+				_byte_size,
+			};
+			_view = vkc_inst.device().createBufferViewUnique(view_create_info);
+
+			write_descriptor_set.pBufferInfo = nullptr;
+			write_descriptor_set.pTexelBufferView = &_view.get();
+		}
+
 		// perform the update of the descriptor set.
 		vkc_inst.device().updateDescriptorSets(
 				1, &write_descriptor_set, 0, nullptr);
+		detail::count_stat(vkc_inst, detail::stat::descriptor_updates);
 
 		_bound_byte_size = _byte_size;
 	}
@@ -199,6 +358,11 @@ struct raw_buffer {
 		return _reserved_size;
 	}
 
+	// The allocated memory size, may be bigger than capacity.
+	size_t allocated_byte_size() const {
+		return _mem.byte_size();
+	}
+
 	const vk::Buffer& get() const {
 		return _buf.get();
 	}
@@ -213,6 +377,26 @@ struct raw_buffer {
 		return _mem.get();
 	}
 
+	// Host visible memory which isn't cached is usually write-combined.
+	// Writes to it should be sequential, and it is very slow to read.
+	bool write_combined() const {
+		return (_mem.flags() & vk::MemoryPropertyFlagBits::eHostVisible)
+				&& !(_mem.flags() & vk::MemoryPropertyFlagBits::eHostCached);
+	}
+
+	vk::DescriptorType descriptor_type() const {
+		return _desc_type;
+	}
+
+	bool is_texel_buffer() const {
+		return _desc_type == vk::DescriptorType::eUniformTexelBuffer
+			|| _desc_type == vk::DescriptorType::eStorageTexelBuffer;
+	}
+
+	format texel_format() const {
+		return _format;
+	}
+
 	bool has_set() const {
 		return _ids.set_id.valid();
 	}
@@ -228,6 +412,19 @@ struct raw_buffer {
 	}
 
 private:
+	// The new buffer is created before the old one is freed, so recorded
+	// commands can tell them apart.
+	void reallocate(const vkc& vkc_inst, size_t new_capacity) {
+		_reserved_size = new_capacity;
+		_buf = detail::make_unique_buffer(
+				vkc_inst, new_capacity, _usage_flags);
+		_mem = detail::make_unique_memory(vkc_inst, _buf.get(), _mem_flags);
+		vkc_inst.device().bindBufferMemory(_buf.get(), _mem.get(), 0);
+
+		// The descriptor references the old buffer.
+		_bound_byte_size = 0;
+	}
+
 	// Binding and descriptor set ids. Can be invalid.
 	buffer_ids _ids;
 
@@ -245,11 +442,21 @@ private:
 	// Used to skip binding if unnecessary.
 	size_t _bound_byte_size = 0;
 
+	// How the buffer is exposed to the shader.
+	vk::DescriptorType _desc_type = vk::DescriptorType::eStorageBuffer;
+
+	// Texel format, only used by texel buffers.
+	format _format = format::undefined;
+
 	// The buffer.
 	vk::UniqueBuffer _buf;
 
 	// The memory that backs the buffer.
-	vk::UniqueDeviceMemory _mem;
+	detail::tracked_memory _mem;
+
+	// Typed view, only used by texel buffers.
+	// Declared last, must be destroyed before the buffer.
+	vk::UniqueBufferView _view;
 };
 } // namespace vkc
 } // namespace fea
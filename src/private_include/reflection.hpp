@@ -1,10 +1,13 @@
 #pragma once
+#include "private_include/format.hpp"
 #include "private_include/ids.hpp"
+#include "vkc/task.hpp"
 
 #include <algorithm>
 #include <array>
 #include <cstdint>
 #include <limits>
+#include <string_view>
 #include <vector>
 
 #include <fea/utils/throw.hpp>
@@ -16,6 +19,32 @@ namespace vkc {
 struct buffer_binding_info {
 	buffer_ids ids;
 	std::string name;
+
+	// Storage buffer or texel buffer.
+	vk::DescriptorType type = vk::DescriptorType::eStorageBuffer;
+
+	// Texel format declared in shader, if any.
+	format fmt = format::undefined;
+};
+
+struct image_binding_info {
+	buffer_ids ids;
+	std::string name;
+
+	// Storage image, sampled image or combined image sampler.
+	vk::DescriptorType type = vk::DescriptorType::eStorageImage;
+
+	// Texel format declared in shader, if any.
+	format fmt = format::undefined;
+
+	// 1D, 2D or 3D.
+	vk::ImageType image_type = vk::ImageType::e2D;
+};
+
+// A separate sampler, `uniform sampler s;` in glsl.
+struct sampler_binding_info {
+	buffer_ids ids;
+	std::string name;
 };
 
 struct uniform_binding_info {
@@ -23,10 +52,18 @@ struct uniform_binding_info {
 	std::string name;
 	size_t offset = 0;
 	size_t size = 0;
+
+	// The offset of the vkc_group_base member, if the shader uses it.
+	bool has_group_base = false;
+	size_t group_base_offset = 0;
 };
 
+// The push_constant member split dispatches offset their group ids with.
+// See task::submit.
+constexpr std::string_view group_base_member_name = "vkc_group_base";
 
-std::vector<buffer_binding_info> reflect_buffer_bindings(
+
+inline std::vector<buffer_binding_info> reflect_buffer_bindings(
 		const spirv_cross::Compiler& comp) {
 	spirv_cross::ShaderResources resources = comp.get_shader_resources();
 	std::vector<buffer_binding_info> ret;
@@ -66,10 +103,123 @@ std::vector<buffer_binding_info> reflect_buffer_bindings(
 		// printf(type.array_size_literal[0]); // true
 	}
 
+	/*
+	 Texel buffers are images with a buffer dimension. Storage texel buffers
+	 are listed with storage images, uniform texel buffers with separate
+	 images.
+	*/
+	auto add_texel_buffers = [&](const spirv_cross::SmallVector<
+											 spirv_cross::Resource>& resources,
+									 vk::DescriptorType desc_type) {
+		for (const spirv_cross::Resource& res : resources) {
+			const spirv_cross::SPIRType& type = comp.get_type(res.type_id);
+			if (type.image.dim != spv::DimBuffer) {
+				continue;
+			}
+
+			buffer_binding_info b;
+			b.ids.set_id
+					= comp.get_decoration(res.id, spv::DecorationDescriptorSet);
+			b.ids.binding_id
+					= comp.get_decoration(res.id, spv::DecorationBinding);
+			b.name = res.name;
+			b.type = desc_type;
+			b.fmt = detail::to_format(type.image.format);
+			ret.push_back(std::move(b));
+		}
+	};
+	add_texel_buffers(resources.storage_images,
+			vk::DescriptorType::eStorageTexelBuffer);
+	add_texel_buffers(resources.separate_images,
+			vk::DescriptorType::eUniformTexelBuffer);
+
+	return ret;
+}
+
+inline std::vector<image_binding_info> reflect_image_bindings(
+		const spirv_cross::Compiler& comp) {
+	spirv_cross::ShaderResources resources = comp.get_shader_resources();
+	std::vector<image_binding_info> ret;
+	ret.reserve(resources.storage_images.size()
+			+ resources.sampled_images.size()
+			+ resources.separate_images.size());
+
+	auto add_images = [&](const spirv_cross::SmallVector<spirv_cross::Resource>&
+								  resources,
+							  vk::DescriptorType desc_type) {
+		for (const spirv_cross::Resource& res : resources) {
+			const spirv_cross::SPIRType& type = comp.get_type(res.type_id);
+
+			image_binding_info b;
+			switch (type.image.dim) {
+			case spv::Dim1D: {
+				b.image_type = vk::ImageType::e1D;
+			} break;
+			case spv::Dim2D: {
+				b.image_type = vk::ImageType::e2D;
+			} break;
+			case spv::Dim3D: {
+				b.image_type = vk::ImageType::e3D;
+			} break;
+			case spv::DimBuffer: {
+				// Texel buffer, reflected with buffers.
+				continue;
+			} break;
+			default: {
+				fea::maybe_throw<std::runtime_error>(__FUNCTION__, __LINE__,
+						"Unsupported image dimension. Only 1D, 2D and 3D "
+						"images are supported.");
+			} break;
+			}
+
+			if (type.image.arrayed) {
+				fea::maybe_throw<std::runtime_error>(__FUNCTION__, __LINE__,
+						"Image arrays aren't supported.");
+			}
+
+			b.ids.set_id
+					= comp.get_decoration(res.id, spv::DecorationDescriptorSet);
+			b.ids.binding_id
+					= comp.get_decoration(res.id, spv::DecorationBinding);
+			b.name = res.name;
+			b.type = desc_type;
+			b.fmt = detail::to_format(type.image.format);
+			ret.push_back(std::move(b));
+		}
+	};
+	add_images(resources.storage_images, vk::DescriptorType::eStorageImage);
+	add_images(resources.sampled_images,
+			vk::DescriptorType::eCombinedImageSampler);
+	add_images(resources.separate_images, vk::DescriptorType::eSampledImage);
+
+	return ret;
+}
+
+inline std::vector<sampler_binding_info> reflect_sampler_bindings(
+		const spirv_cross::Compiler& comp) {
+	spirv_cross::ShaderResources resources = comp.get_shader_resources();
+	std::vector<sampler_binding_info> ret;
+	ret.reserve(resources.separate_samplers.size());
+
+	for (const spirv_cross::Resource& res : resources.separate_samplers) {
+		const spirv_cross::SPIRType& type = comp.get_type(res.type_id);
+		if (!type.array.empty()) {
+			fea::maybe_throw<std::runtime_error>(__FUNCTION__, __LINE__,
+					"Sampler arrays aren't supported.");
+		}
+
+		sampler_binding_info b;
+		b.ids.set_id
+				= comp.get_decoration(res.id, spv::DecorationDescriptorSet);
+		b.ids.binding_id = comp.get_decoration(res.id, spv::DecorationBinding);
+		b.name = res.name;
+		ret.push_back(std::move(b));
+	}
+
 	return ret;
 }
 
-std::vector<uniform_binding_info> reflect_uniform_bindings(
+inline std::vector<uniform_binding_info> reflect_uniform_bindings(
 		const spirv_cross::Compiler& comp) {
 	spirv_cross::ShaderResources resources = comp.get_shader_resources();
 	std::vector<uniform_binding_info> ret;
@@ -92,12 +242,29 @@ std::vector<uniform_binding_info> reflect_uniform_bindings(
 		b.offset = ranges.front().offset;
 		b.size = 0;
 
+		const spirv_cross::SPIRType& block_type
+				= comp.get_type(res.base_type_id);
 		for (const spirv_cross::BufferRange& range : ranges) {
-			b.size += range.range;
-			// range.index; // Struct member index
-			// range.offset; // Offset into struct
-			// range.range; // Size of struct member
+			// Members may be padded, the range ends with the last one.
+			b.offset = std::min(b.offset, range.offset);
+			b.size = std::max(b.size, range.offset + range.range);
+
+			if (comp.get_member_name(res.base_type_id, range.index)
+					!= group_base_member_name) {
+				continue;
+			}
+
+			const spirv_cross::SPIRType& member_type
+					= comp.get_type(block_type.member_types[range.index]);
+			if (member_type.basetype != spirv_cross::SPIRType::UInt
+					|| member_type.vecsize != 3 || member_type.columns != 1) {
+				fea::maybe_throw<std::runtime_error>(__FUNCTION__, __LINE__,
+						"vkc_group_base push_constant must be a uvec3.");
+			}
+			b.has_group_base = true;
+			b.group_base_offset = range.offset;
 		}
+		b.size -= b.offset;
 
 		if (b.size > 128) {
 			fea::maybe_throw<std::runtime_error>(__FUNCTION__, __LINE__,
@@ -111,13 +278,16 @@ std::vector<uniform_binding_info> reflect_uniform_bindings(
 	return ret;
 }
 
-std::array<uint32_t, 3> reflect_workinggroup_sizes(
-		const spirv_cross::Compiler& comp) {
+// Specialized sizes (local_size_x_id, etc) use the provided spec_constants
+// values if present, or the shader default value.
+inline std::array<uint32_t, 3> reflect_workinggroup_sizes(
+		const spirv_cross::Compiler& comp,
+		const std::vector<spec_constant>& spec_constants) {
 	std::array<uint32_t, 3> ret{ 1u, 1u, 1u };
 
-	spirv_cross::SpecializationConstant x_unused, y_unused, z_unused;
+	std::array<spirv_cross::SpecializationConstant, 3> spec_sizes;
 	uint32_t id = comp.get_work_group_size_specialization_constants(
-			x_unused, y_unused, z_unused);
+			spec_sizes[0], spec_sizes[1], spec_sizes[2]);
 
 	if (id == 0) {
 		fea::maybe_throw<std::runtime_error>(__FUNCTION__, __LINE__,
@@ -130,6 +300,19 @@ std::array<uint32_t, 3> reflect_workinggroup_sizes(
 
 	for (size_t i = 0; i < count; ++i) {
 		ret[i] = workgroup_vals.vector().r[i].i32;
+
+		if (uint32_t(spec_sizes[i].id) == 0) {
+			// Not specialized.
+			continue;
+		}
+
+		auto it = std::find_if(spec_constants.begin(), spec_constants.end(),
+				[&](const spec_constant& c) {
+					return c.id == spec_sizes[i].constant_id;
+				});
+		if (it != spec_constants.end()) {
+			ret[i] = it->value;
+		}
 	}
 	return ret;
 }
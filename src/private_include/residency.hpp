@@ -0,0 +1,56 @@
+#pragma once
+#include "vkc/vkc.hpp"
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+
+namespace fea {
+namespace vkc {
+namespace detail {
+// Owner of spillable device memory, a task instance.
+// See vkc::residency_budget.
+struct resident {
+	resident() = default;
+	~resident() {
+		if (vkc_inst != nullptr) {
+			// Waits for a spill on another thread.
+			std::lock_guard<std::mutex> lock(in_use);
+			vkc_inst->unregister_resident(this);
+		}
+	}
+
+	// Non-copyable, non-moveable, vkc references it.
+	resident(const resident&) = delete;
+	resident& operator=(const resident&) = delete;
+
+	// Registers with vkc. spill_func copies the device buffers to host memory
+	// and frees them. byte_size_func returns the device memory spill_func
+	// would free.
+	void init(vkc& v, std::function<void()>&& spill_func,
+			std::function<size_t()>&& byte_size_func) {
+		assert(vkc_inst == nullptr);
+		vkc_inst = &v;
+		spill = std::move(spill_func);
+		spillable_byte_size = std::move(byte_size_func);
+		vkc_inst->register_resident(this);
+	}
+
+	// Locked while the owner uses its device memory.
+	// Residents are only spilled if it can be locked.
+	std::mutex in_use;
+
+	// Only called while in_use is locked.
+	std::function<void()> spill;
+	std::function<size_t()> spillable_byte_size;
+
+	// Compared with other residents to find the least recently used.
+	std::atomic<uint64_t> last_use{ 0 };
+
+	vkc* vkc_inst = nullptr;
+};
+} // namespace detail
+} // namespace vkc
+} // namespace fea
@@ -0,0 +1,131 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <fea/utils/file.hpp>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#if defined(_WIN32)
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace fea {
+namespace vkc {
+namespace detail {
+// 64bit FNV-1a.
+// Used to key cached spirv on its inputs (source, defines, tool versions).
+struct spirv_hasher {
+	void add(const void* data, size_t byte_size) {
+		const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+		for (size_t i = 0; i < byte_size; ++i) {
+			_hash ^= bytes[i];
+			_hash *= 1099511628211ull;
+		}
+	}
+
+	// Strings are terminated, so "ab" + "c" doesn't collide with "a" + "bc".
+	void add(std::string_view str) {
+		add(str.data(), str.size());
+		add("\0", 1);
+	}
+
+	uint64_t value() const {
+		return _hash;
+	}
+
+private:
+	uint64_t _hash = 14695981039346656037ull;
+};
+
+inline std::filesystem::path cached_spirv_path(
+		const std::filesystem::path& cache_dir, uint64_t key) {
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.spv", (unsigned long long)key);
+	return cache_dir / name;
+}
+
+// Returns false on cache miss.
+inline bool load_cached_spirv(const std::filesystem::path& cache_dir,
+		uint64_t key, std::vector<uint32_t>& out) {
+	if (cache_dir.empty()) {
+		return false;
+	}
+
+	std::filesystem::path filepath = cached_spirv_path(cache_dir, key);
+	std::error_code ec;
+	if (!std::filesystem::exists(filepath, ec)) {
+		return false;
+	}
+
+	std::vector<uint8_t> data;
+	if (!fea::open_binary_file(filepath, data) || data.empty()
+			|| data.size() % sizeof(uint32_t) != 0) {
+		return false;
+	}
+
+	out.resize(data.size() / sizeof(uint32_t));
+	std::copy(data.begin(), data.end(), reinterpret_cast<uint8_t*>(out.data()));
+	return true;
+}
+
+// Unique among the threads and processes sharing a cache directory.
+inline std::string temp_file_suffix() {
+	static std::atomic<uint64_t> counter{ 0 };
+#if defined(_WIN32)
+	uint64_t pid = uint64_t(_getpid());
+#else
+	uint64_t pid = uint64_t(getpid());
+#endif
+	return ".tmp" + std::to_string(pid) + "_"
+			+ std::to_string(counter.fetch_add(1, std::memory_order_relaxed));
+}
+
+// Failing to write the cache isn't an error, we'll just compile again.
+inline void store_cached_spirv(const std::filesystem::path& cache_dir,
+		uint64_t key, const std::vector<uint32_t>& spirv) {
+	if (cache_dir.empty()) {
+		return;
+	}
+
+	std::error_code ec;
+	std::filesystem::create_directories(cache_dir, ec);
+	if (ec) {
+		return;
+	}
+
+	// Write to a temporary file and rename, so concurrent processes never
+	// read a partially written shader.
+	std::filesystem::path filepath = cached_spirv_path(cache_dir, key);
+	std::filesystem::path temp_filepath = filepath;
+	temp_filepath += temp_file_suffix();
+
+	{
+		std::ofstream ofs{ temp_filepath, std::ios::binary };
+		if (!ofs.is_open()) {
+			return;
+		}
+		ofs.write(reinterpret_cast<const char*>(spirv.data()),
+				std::streamsize(spirv.size() * sizeof(uint32_t)));
+		if (!ofs.good()) {
+			ofs.close();
+			std::filesystem::remove(temp_filepath, ec);
+			return;
+		}
+	}
+
+	std::filesystem::rename(temp_filepath, filepath, ec);
+	if (ec) {
+		std::filesystem::remove(temp_filepath, ec);
+	}
+}
+} // namespace detail
+} // namespace vkc
+} // namespace fea
@@ -0,0 +1,21 @@
+#pragma once
+#include "vkc/task.hpp"
+#include "vkc/vkc.hpp"
+
+#include <cstdint>
+#include <fea/containers/span.hpp>
+#include <vector>
+
+namespace fea {
+namespace vkc {
+namespace detail {
+// Freezes the provided specialization constants and runs spirv-opt's
+// performance passes. Looks up and stores the result in vkc's shader cache
+// directory.
+// Returns an empty vector if optimization failed.
+std::vector<uint32_t> optimize_spirv(const vkc& vkc_inst,
+		fea::span<const uint32_t> spirv,
+		const std::vector<spec_constant>& spec_constants);
+} // namespace detail
+} // namespace vkc
+} // namespace fea
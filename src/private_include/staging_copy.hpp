@@ -0,0 +1,104 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
+#if defined(__SSE2__) || defined(_M_X64) \
+		|| (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FEA_VKC_STREAMING_STORES 1
+#endif
+
+namespace fea {
+namespace vkc {
+namespace detail {
+constexpr size_t cache_line_byte_size = 64;
+
+// Copies smaller than this run on the calling thread.
+// Below it, waking workers costs more than the copy.
+constexpr size_t parallel_copy_min_byte_size = 4 * 1024 * 1024;
+
+// The work unit of parallel copies, a multiple of the cache line.
+constexpr size_t copy_chunk_byte_size = 1024 * 1024;
+static_assert(copy_chunk_byte_size % cache_line_byte_size == 0,
+		"staging_copy : chunks must be cache line aligned");
+
+// Copies with non-temporal stores, which bypass the cache.
+// Avoids polluting the cache with data we won't read, and fills whole
+// write-combining buffers when writing to uncached memory.
+// Falls back to memcpy where streaming stores aren't available.
+inline void stream_copy(uint8_t* dst, const uint8_t* src, size_t byte_size) {
+#if defined(FEA_VKC_STREAMING_STORES)
+	constexpr size_t align = sizeof(__m128i);
+
+	// Unaligned head.
+	size_t head = size_t((align - reinterpret_cast<uintptr_t>(dst) % align)
+			% align);
+	head = std::min(head, byte_size);
+	std::memcpy(dst, src, head);
+	dst += head;
+	src += head;
+	byte_size -= head;
+
+	size_t body = byte_size - byte_size % align;
+	for (size_t i = 0; i < body; i += align) {
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+		_mm_stream_si128(reinterpret_cast<__m128i*>(dst + i), v);
+	}
+
+	// Unaligned tail.
+	std::memcpy(dst + body, src + body, byte_size - body);
+
+	// Streaming stores are weakly ordered, make them visible before the
+	// copy is submitted.
+	_mm_sfence();
+#else
+	std::memcpy(dst, src, byte_size);
+#endif
+}
+
+// Copies between user memory and mapped staging memory.
+// Large copies are split across tbb workers, in chunks which start on dst
+// cache lines, so no two workers write the same line.
+// Use non_temporal when dst is write-combined, see
+// raw_buffer::write_combined.
+inline void staging_copy(uint8_t* dst, const uint8_t* src, size_t byte_size,
+		bool non_temporal) {
+	auto copy = [&](uint8_t* d, const uint8_t* s, size_t count) {
+		if (non_temporal) {
+			stream_copy(d, s, count);
+		} else {
+			std::memcpy(d, s, count);
+		}
+	};
+
+	if (byte_size < parallel_copy_min_byte_size) {
+		copy(dst, src, byte_size);
+		return;
+	}
+
+	// Copy up to the first dst cache line, chunks start aligned after that.
+	size_t head = size_t((cache_line_byte_size
+								 - reinterpret_cast<uintptr_t>(dst)
+										 % cache_line_byte_size)
+			% cache_line_byte_size);
+	copy(dst, src, head);
+	dst += head;
+	src += head;
+	byte_size -= head;
+
+	size_t num_chunks
+			= (byte_size + copy_chunk_byte_size - 1) / copy_chunk_byte_size;
+	tbb::parallel_for(tbb::blocked_range<size_t>(0, num_chunks),
+			[&](const tbb::blocked_range<size_t>& range) {
+				size_t begin = range.begin() * copy_chunk_byte_size;
+				size_t end = std::min(
+						range.end() * copy_chunk_byte_size, byte_size);
+				copy(dst + begin, src + begin, end - begin);
+			});
+}
+} // namespace detail
+} // namespace vkc
+} // namespace fea
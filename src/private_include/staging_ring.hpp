@@ -0,0 +1,369 @@
+#pragma once
+#include "private_include/raw_buffer.hpp"
+#include "private_include/staging_copy.hpp"
+#include "private_include/stats.hpp"
+#include "private_include/submit.hpp"
+#include "private_include/tracer.hpp"
+#include "vkc/vkc.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <condition_variable>
+#include <cstdint>
+#include <fea/utils/throw.hpp>
+#include <limits>
+#include <mutex>
+#include <vulkan/vulkan.hpp>
+
+namespace fea {
+namespace vkc {
+namespace detail {
+constexpr vk::BufferUsageFlags staging_usage_flags
+		= vk::BufferUsageFlagBits::eTransferSrc
+		| vk::BufferUsageFlagBits::eTransferDst;
+
+constexpr vk::MemoryPropertyFlags staging_mem_flags
+		= vk::MemoryPropertyFlagBits::eHostVisible
+		| vk::MemoryPropertyFlagBits::eHostCoherent;
+
+// See vkc::staging_ring_byte_size.
+constexpr size_t default_staging_ring_byte_size = 64 * 1024 * 1024;
+
+/*
+Host visible memory shared by all task pushes and pulls, owned by vkc.
+
+The ring is split in slots. A transfer leases up to 2 slots and streams
+through them in chunks : while the gpu copies one chunk, the host fills or
+drains the other. Each slot has a fence, which gates its reuse. Slots are
+handed back once their copies are done, so transfers never wait on each
+other's fences, only for a free slot.
+
+The memory is allocated on first use, and stays mapped.
+*/
+struct staging_ring {
+	static constexpr size_t slot_count = 4;
+
+	staging_ring() = default;
+	staging_ring(const staging_ring&) = delete;
+	staging_ring& operator=(const staging_ring&) = delete;
+
+	// Frees the ring. Not thread-safe, no transfer may be running.
+	void reset(const vkc& vkc_inst) {
+		if (!_mem) {
+			return;
+		}
+
+		_slots = {};
+		_buf.reset();
+		_mem.reset();
+		_mapped = nullptr;
+		vkc_inst.track_free(_memory_type_idx, _allocated_byte_size);
+		_allocated_byte_size = 0;
+	}
+
+	// Not thread-safe, no transfer may be running.
+	void byte_size(const vkc& vkc_inst, size_t new_byte_size) {
+		if (new_byte_size < slot_count * cache_line_byte_size) {
+			fea::maybe_throw<std::invalid_argument>(__FUNCTION__, __LINE__,
+					"Staging ring is too small.");
+		}
+
+		reset(vkc_inst);
+		_byte_size = new_byte_size;
+	}
+
+	size_t byte_size() const {
+		return _byte_size;
+	}
+
+	// 0 until the first transfer.
+	size_t allocated_byte_size() const {
+		return _allocated_byte_size;
+	}
+
+	// The largest chunk of a transfer.
+	size_t slot_byte_size() const {
+		return (_byte_size / slot_count) & ~(cache_line_byte_size - 1);
+	}
+
+	// Copies in_mem to dst, at dst_offset. Blocks until the gpu is done.
+	vk::Result push(vkc& vkc_inst, const uint8_t* in_mem, vk::Buffer dst,
+			size_t dst_offset, size_t byte_size, gpu_timer* timer = nullptr) {
+		if (byte_size == 0) {
+			return vk::Result::eSuccess;
+		}
+
+		lease l = acquire(vkc_inst, byte_size, timer);
+		size_t chunk_byte_size = slot_byte_size();
+
+		vk::Result res = vk::Result::eSuccess;
+		for (size_t i = 0, offset = 0; offset < byte_size;
+				++i, offset += chunk_byte_size) {
+			slot& s = *l.slots[i % l.count];
+			res = wait(vkc_inst, s);
+			if (res != vk::Result::eSuccess) {
+				break;
+			}
+
+			size_t count = std::min(chunk_byte_size, byte_size - offset);
+			staging_copy(_mapped + s.offset, in_mem + offset, count,
+					_write_combined);
+
+			vk::BufferCopy region{ s.offset, dst_offset + offset, count };
+			record(vkc_inst, s, _buf.get(), dst, region);
+			res = submit(vkc_inst, s, timer);
+			if (res != vk::Result::eSuccess) {
+				break;
+			}
+		}
+
+		vk::Result wait_res = release(vkc_inst, l);
+		return res != vk::Result::eSuccess ? res : wait_res;
+	}
+
+	// Copies src, from src_offset, to out_mem. Blocks until done.
+	vk::Result pull(vkc& vkc_inst, vk::Buffer src, size_t src_offset,
+			uint8_t* out_mem, size_t byte_size, gpu_timer* timer = nullptr) {
+		if (byte_size == 0) {
+			return vk::Result::eSuccess;
+		}
+
+		lease l = acquire(vkc_inst, byte_size, timer);
+		size_t chunk_byte_size = slot_byte_size();
+		size_t num_chunks = (byte_size + chunk_byte_size - 1) / chunk_byte_size;
+
+		auto submit_chunk = [&](size_t i) {
+			slot& s = *l.slots[i % l.count];
+			size_t offset = i * chunk_byte_size;
+			size_t count = std::min(chunk_byte_size, byte_size - offset);
+
+			vk::BufferCopy region{ src_offset + offset, s.offset, count };
+			record(vkc_inst, s, src, _buf.get(), region);
+			return submit(vkc_inst, s, timer);
+		};
+
+		// The gpu copies the next chunk while we read this one.
+		vk::Result res = submit_chunk(0);
+		for (size_t i = 0; i < num_chunks && res == vk::Result::eSuccess;
+				++i) {
+			slot& s = *l.slots[i % l.count];
+			if (l.count > 1 && i + 1 < num_chunks) {
+				res = submit_chunk(i + 1);
+				if (res != vk::Result::eSuccess) {
+					break;
+				}
+			}
+
+			res = wait(vkc_inst, s);
+			if (res != vk::Result::eSuccess) {
+				break;
+			}
+
+			size_t offset = i * chunk_byte_size;
+			size_t count = std::min(chunk_byte_size, byte_size - offset);
+			staging_copy(out_mem + offset, _mapped + s.offset, count, false);
+
+			if (l.count == 1 && i + 1 < num_chunks) {
+				res = submit_chunk(i + 1);
+			}
+		}
+
+		vk::Result wait_res = release(vkc_inst, l);
+		return res != vk::Result::eSuccess ? res : wait_res;
+	}
+
+private:
+	struct slot {
+		// Offset in the ring memory.
+		size_t offset = 0;
+
+		// Each slot records on its own, pools aren't thread-safe.
+		vk::UniqueCommandPool command_pool;
+		vk::UniqueCommandBuffer cmd_buf;
+		vk::UniqueFence fence;
+
+		// Submitted and not waited yet. Only used by the lease owner.
+		bool in_flight = false;
+
+		// Guarded by the ring mutex.
+		bool leased = false;
+	};
+
+	// The slots a transfer streams through.
+	struct lease {
+		std::array<slot*, 2> slots{};
+		size_t count = 0;
+	};
+
+	// Blocks until a slot is free. Allocates the ring on first use.
+	// Timed transfers wait on every submit, so they only use 1 slot.
+	lease acquire(const vkc& vkc_inst, size_t byte_size, gpu_timer* timer) {
+		size_t wanted = 2;
+		if (byte_size <= slot_byte_size()
+				|| (timer != nullptr && timer->supported())) {
+			wanted = 1;
+		}
+
+		std::unique_lock<std::mutex> lock(_mutex);
+		if (!_mem) {
+			allocate(vkc_inst);
+		}
+
+		_slot_freed.wait(lock, [this]() {
+			return std::any_of(_slots.begin(), _slots.end(),
+					[](const slot& s) { return !s.leased; });
+		});
+
+		lease ret;
+		for (slot& s : _slots) {
+			if (ret.count == wanted) {
+				break;
+			}
+			if (!s.leased) {
+				s.leased = true;
+				ret.slots[ret.count++] = &s;
+			}
+		}
+		return ret;
+	}
+
+	// Waits on the lease copies and hands back its slots.
+	vk::Result release(const vkc& vkc_inst, lease& l) {
+		vk::Result ret = vk::Result::eSuccess;
+		for (size_t i = 0; i < l.count; ++i) {
+			vk::Result res = wait(vkc_inst, *l.slots[i]);
+			if (res != vk::Result::eSuccess) {
+				ret = res;
+			}
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			for (size_t i = 0; i < l.count; ++i) {
+				l.slots[i]->leased = false;
+			}
+		}
+		_slot_freed.notify_all();
+		return ret;
+	}
+
+	void allocate(const vkc& vkc_inst) {
+		const vk::Device& device = vkc_inst.device();
+		_buf = make_unique_buffer(vkc_inst, _byte_size, staging_usage_flags);
+
+		vk::MemoryAllocateInfo allocate_info
+				= find_memory_type(vkc_inst, _buf.get(), staging_mem_flags);
+		_mem = device.allocateMemoryUnique(allocate_info);
+		_memory_type_idx = allocate_info.memoryTypeIndex;
+		_allocated_byte_size = size_t(allocate_info.allocationSize);
+		vkc_inst.track_allocation(_memory_type_idx, _allocated_byte_size);
+		device.bindBufferMemory(_buf.get(), _mem.get(), 0);
+
+		// Host visible memory which isn't cached is usually write-combined.
+		_write_combined = !(memory_type_flags(vkc_inst, _memory_type_idx)
+				& vk::MemoryPropertyFlagBits::eHostCached);
+
+		// Stays mapped, mapping isn't thread-safe.
+		_mapped = reinterpret_cast<uint8_t*>(
+				device.mapMemory(_mem.get(), 0, VK_WHOLE_SIZE));
+
+		for (size_t i = 0; i < slot_count; ++i) {
+			slot& s = _slots[i];
+			s.offset = i * slot_byte_size();
+
+			vk::CommandPoolCreateInfo pool_info{
+				vk::CommandPoolCreateFlagBits::eTransient,
+				vkc_inst.queue_family(),
+			};
+			s.command_pool = device.createCommandPoolUnique(pool_info);
+
+			vk::CommandBufferAllocateInfo alloc_info{
+				s.command_pool.get(),
+				vk::CommandBufferLevel::ePrimary,
+				1,
+			};
+			s.cmd_buf = std::move(
+					device.allocateCommandBuffersUnique(alloc_info).back());
+			s.fence = device.createFenceUnique(vk::FenceCreateInfo{});
+		}
+	}
+
+	// Chunks change every transfer, they are recorded on the spot.
+	// Resetting the slot pool recycles the command buffer memory.
+	void record(const vkc& vkc_inst, slot& s, vk::Buffer src, vk::Buffer dst,
+			const vk::BufferCopy& region) {
+		assert(!s.in_flight);
+		vkc_inst.device().resetCommandPool(s.command_pool.get(), {});
+
+		vk::CommandBufferBeginInfo begin_info{
+			vk::CommandBufferUsageFlagBits::eOneTimeSubmit,
+		};
+		s.cmd_buf->begin(begin_info);
+		s.cmd_buf->copyBuffer(src, dst, 1, &region);
+		s.cmd_buf->end();
+		count_stat(vkc_inst, stat::command_records);
+	}
+
+	// Timed submits are waited right away, see gpu_timer.
+	vk::Result submit(vkc& vkc_inst, slot& s, gpu_timer* timer) {
+		if (timer != nullptr && timer->supported()) {
+			return submit_and_wait(
+					vkc_inst, &s.cmd_buf.get(), 1, s.fence.get(), timer);
+		}
+
+		vk::Result res = vkc_inst.device().resetFences(1, &s.fence.get());
+		if (res != vk::Result::eSuccess) {
+			return res;
+		}
+
+		vk::SubmitInfo submit_info{
+			{},
+			nullptr,
+			nullptr,
+			1,
+			&s.cmd_buf.get(),
+		};
+
+		{
+			scoped_trace trace(vkc_inst, "queue_submit");
+			res = vkc_inst.submit(submit_info, s.fence.get());
+		}
+		s.in_flight = res == vk::Result::eSuccess;
+		return res;
+	}
+
+	vk::Result wait(const vkc& vkc_inst, slot& s) {
+		if (!s.in_flight) {
+			return vk::Result::eSuccess;
+		}
+		s.in_flight = false;
+
+		vk::Result res;
+		{
+			scoped_trace trace(vkc_inst, "fence_wait");
+			res = vkc_inst.device().waitForFences(1, &s.fence.get(), VK_TRUE,
+					(std::numeric_limits<uint64_t>::max)());
+		}
+		count_stat(vkc_inst, stat::fence_waits);
+		return res;
+	}
+
+	size_t _byte_size = default_staging_ring_byte_size;
+
+	vk::UniqueBuffer _buf;
+	vk::UniqueDeviceMemory _mem;
+	uint32_t _memory_type_idx = 0;
+	size_t _allocated_byte_size = 0;
+	uint8_t* _mapped = nullptr;
+	bool _write_combined = false;
+
+	// Declared after the memory, slots are destroyed first.
+	std::array<slot, slot_count> _slots;
+
+	std::mutex _mutex;
+	std::condition_variable _slot_freed;
+};
+} // namespace detail
+} // namespace vkc
+} // namespace fea
@@ -0,0 +1,138 @@
+#pragma once
+#include "vkc/vkc.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <tuple>
+
+namespace fea {
+namespace vkc {
+namespace detail {
+// Whether stats are collected from vkc construction, see vkc::collect_stats.
+#if defined(FEA_VKC_STATS)
+constexpr bool stats_default = true;
+#else
+constexpr bool stats_default = false;
+#endif
+
+// The vkc_stats counters.
+enum class stat : unsigned {
+	queue_submits,
+	fence_waits,
+	bytes_pushed,
+	bytes_pulled,
+	bytes_imported,
+	command_records,
+	descriptor_updates,
+	memory_allocations,
+	pipeline_creations,
+	count,
+};
+
+// The vkc_stats histograms.
+enum class latency : unsigned {
+	submit,
+	push,
+	pull,
+	count,
+};
+
+// latency_histogram, updated concurrently.
+struct atomic_histogram {
+	static constexpr size_t bucket_count
+			= std::tuple_size<decltype(latency_histogram::buckets)>::value;
+
+	void add(uint64_t us) {
+		size_t idx = 0;
+		while (idx < bucket_count - 1 && (us >> idx) != 0) {
+			++idx;
+		}
+
+		buckets[idx].fetch_add(1, std::memory_order_relaxed);
+		count.fetch_add(1, std::memory_order_relaxed);
+		total_us.fetch_add(us, std::memory_order_relaxed);
+
+		uint64_t prev_max = max_us.load(std::memory_order_relaxed);
+		while (prev_max < us
+				&& !max_us.compare_exchange_weak(
+						prev_max, us, std::memory_order_relaxed)) {
+		}
+	}
+
+	latency_histogram load() const {
+		latency_histogram ret;
+		for (size_t i = 0; i < bucket_count; ++i) {
+			ret.buckets[i] = buckets[i].load(std::memory_order_relaxed);
+		}
+		ret.count = count.load(std::memory_order_relaxed);
+		ret.total_us = total_us.load(std::memory_order_relaxed);
+		ret.max_us = max_us.load(std::memory_order_relaxed);
+		return ret;
+	}
+
+	void reset() {
+		for (std::atomic<uint64_t>& b : buckets) {
+			b = 0;
+		}
+		count = 0;
+		total_us = 0;
+		max_us = 0;
+	}
+
+	std::array<std::atomic<uint64_t>, bucket_count> buckets{};
+	std::atomic<uint64_t> count{ 0 };
+	std::atomic<uint64_t> total_us{ 0 };
+	std::atomic<uint64_t> max_us{ 0 };
+};
+
+// Stored in vkc, see vkc::stats.
+struct stats_data {
+	std::atomic<bool> enabled{ stats_default };
+	std::array<std::atomic<uint64_t>, size_t(stat::count)> counters{};
+	std::array<atomic_histogram, size_t(latency::count)> latencies{};
+};
+
+inline bool collecting_stats(const vkc& vkc_inst) {
+	return vkc_inst.stats_data().enabled.load(std::memory_order_relaxed);
+}
+
+// Does nothing unless collecting stats.
+inline void count_stat(const vkc& vkc_inst, stat s, uint64_t n = 1) {
+	if (collecting_stats(vkc_inst)) {
+		vkc_inst.stats_data().counters[size_t(s)].fetch_add(
+				n, std::memory_order_relaxed);
+	}
+}
+
+// Records the latency of its scope, when collecting stats.
+struct scoped_latency {
+	scoped_latency(const vkc& vkc_inst, latency l)
+			: _vkc_inst(vkc_inst)
+			, _latency(l)
+			, _enabled(collecting_stats(vkc_inst)) {
+		if (_enabled) {
+			_start = std::chrono::steady_clock::now();
+		}
+	}
+
+	~scoped_latency() {
+		if (_enabled) {
+			auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+					std::chrono::steady_clock::now() - _start);
+			_vkc_inst.stats_data().latencies[size_t(_latency)].add(
+					uint64_t(us.count()));
+		}
+	}
+
+private:
+	const vkc& _vkc_inst;
+	latency _latency;
+	bool _enabled;
+	std::chrono::steady_clock::time_point _start;
+};
+} // namespace detail
+} // namespace vkc
+} // namespace fea
@@ -0,0 +1,188 @@
+#pragma once
+#include "private_include/stats.hpp"
+#include "private_include/tracer.hpp"
+#include "vkc/vkc.hpp"
+
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+namespace fea {
+namespace vkc {
+namespace detail {
+// Brackets submits with gpu timestamps and accumulates their gpu time.
+// See task::profiling.
+struct gpu_timer {
+	gpu_timer() = default;
+	gpu_timer(const vkc& vkc_inst, vk::CommandPool command_pool) {
+		const vk::PhysicalDevice& physical_device = vkc_inst.physical_device();
+		std::vector<vk::QueueFamilyProperties> families
+				= physical_device.getQueueFamilyProperties();
+		uint32_t valid_bits
+				= families[vkc_inst.queue_family()].timestampValidBits;
+		if (valid_bits == 0) {
+			// The queue doesn't support timestamps, only host time is
+			// measured.
+			return;
+		}
+
+		// The bits past timestampValidBits are undefined.
+		_valid_mask = valid_bits >= 64 ? ~uint64_t(0)
+									   : (uint64_t(1) << valid_bits) - 1;
+
+		// timestampPeriod is in nanoseconds per tick.
+		_period_ms = double(physical_device.getProperties()
+									.limits.timestampPeriod)
+				/ 1'000'000.0;
+
+		vk::QueryPoolCreateInfo pool_info{
+			{},
+			vk::QueryType::eTimestamp,
+			2,
+		};
+		_query_pool = vkc_inst.device().createQueryPoolUnique(pool_info);
+
+		vk::CommandBufferAllocateInfo alloc_info{
+			command_pool,
+			vk::CommandBufferLevel::ePrimary,
+			2,
+		};
+		std::vector<vk::UniqueCommandBuffer> cmd_bufs
+				= vkc_inst.device().allocateCommandBuffersUnique(alloc_info);
+		assert(cmd_bufs.size() == 2);
+
+		// Reused for every submit.
+		vk::CommandBufferBeginInfo begin_info{};
+		_begin_cmd = std::move(cmd_bufs[0]);
+		_begin_cmd->begin(begin_info);
+		_begin_cmd->resetQueryPool(_query_pool.get(), 0, 2);
+		_begin_cmd->writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe,
+				_query_pool.get(), 0);
+		_begin_cmd->end();
+
+		_end_cmd = std::move(cmd_bufs[1]);
+		_end_cmd->begin(begin_info);
+		_end_cmd->writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe,
+				_query_pool.get(), 1);
+		_end_cmd->end();
+	}
+
+	// False if the queue doesn't support timestamps.
+	bool supported() const {
+		return bool(_query_pool);
+	}
+
+	vk::CommandBuffer begin_cmd() const {
+		return _begin_cmd.get();
+	}
+	vk::CommandBuffer end_cmd() const {
+		return _end_cmd.get();
+	}
+
+	// Call once the bracketed submit is done.
+	// Returns false if the timestamps couldn't be read.
+	bool accumulate(const vkc& vkc_inst) {
+		std::array<uint64_t, 2> stamps{};
+		vk::Result res = vkc_inst.device().getQueryPoolResults(
+				_query_pool.get(), 0, 2, sizeof(stamps), stamps.data(),
+				sizeof(uint64_t),
+				vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWait);
+		if (res != vk::Result::eSuccess) {
+			return false;
+		}
+		stamps[0] &= _valid_mask;
+		stamps[1] &= _valid_mask;
+
+		// Masked, so the difference wraps like the counter.
+		uint64_t ticks = (stamps[1] - stamps[0]) & _valid_mask;
+		_elapsed_ms += double(ticks) * _period_ms;
+		_last_stamps = { stamps[0], stamps[0] + ticks };
+		return true;
+	}
+
+	// The begin and end ticks of the last bracketed submit.
+	// End is past begin, even if the counter wrapped.
+	const std::array<uint64_t, 2>& last_stamps() const {
+		return _last_stamps;
+	}
+
+	// The gpu time of bracketed submits since the last reset, in ms.
+	double elapsed_ms() const {
+		return _elapsed_ms;
+	}
+	void reset() {
+		_elapsed_ms = 0.0;
+	}
+
+private:
+	vk::UniqueQueryPool _query_pool;
+	vk::UniqueCommandBuffer _begin_cmd;
+	vk::UniqueCommandBuffer _end_cmd;
+	uint64_t _valid_mask = 0;
+	double _period_ms = 0.0;
+	double _elapsed_ms = 0.0;
+	std::array<uint64_t, 2> _last_stamps{};
+};
+
+// Submits the command buffers and blocks until the fence is signaled.
+// The fence is reset first, so it can be reused for every submit.
+// If provided, the timer brackets the command buffers with timestamps.
+inline vk::Result submit_and_wait(vkc& vkc_inst,
+		const vk::CommandBuffer* cmd_bufs, uint32_t cmd_count,
+		vk::Fence fence, gpu_timer* timer = nullptr) {
+	vk::Result res = vkc_inst.device().resetFences(1, &fence);
+	if (res != vk::Result::eSuccess) {
+		return res;
+	}
+
+	std::vector<vk::CommandBuffer> timed_cmd_bufs;
+	if (timer != nullptr && timer->supported()) {
+		timed_cmd_bufs.reserve(cmd_count + 2);
+		timed_cmd_bufs.push_back(timer->begin_cmd());
+		timed_cmd_bufs.insert(
+				timed_cmd_bufs.end(), cmd_bufs, cmd_bufs + cmd_count);
+		timed_cmd_bufs.push_back(timer->end_cmd());
+		cmd_bufs = timed_cmd_bufs.data();
+		cmd_count = uint32_t(timed_cmd_bufs.size());
+	}
+
+	vk::SubmitInfo submit_info{
+		{},
+		nullptr,
+		nullptr,
+		cmd_count,
+		cmd_bufs,
+	};
+
+	{
+		// Includes waiting on other threads for the queue.
+		scoped_trace trace(vkc_inst, "queue_submit");
+		res = vkc_inst.submit(submit_info, fence);
+	}
+	if (res != vk::Result::eSuccess) {
+		return res;
+	}
+
+	{
+		scoped_trace trace(vkc_inst, "fence_wait");
+		res = vkc_inst.device().waitForFences(
+				1, &fence, VK_TRUE, (std::numeric_limits<uint64_t>::max)());
+	}
+	count_stat(vkc_inst, stat::fence_waits);
+	if (res != vk::Result::eSuccess || timed_cmd_bufs.empty()) {
+		return res;
+	}
+
+	int64_t done_ns = vkc_inst.tracer().now_ns();
+	if (timer->accumulate(vkc_inst) && tracing(vkc_inst)) {
+		const std::array<uint64_t, 2>& stamps = timer->last_stamps();
+		trace_gpu(vkc_inst, stamps[0], stamps[1], done_ns);
+	}
+	return res;
+}
+} // namespace detail
+} // namespace vkc
+} // namespace fea
@@ -0,0 +1,325 @@
+#pragma once
+#include "private_include/capture.hpp"
+#include "private_include/ids.hpp"
+#include "private_include/reflection.hpp"
+#include "private_include/residency.hpp"
+#include "private_include/submit.hpp"
+#include "private_include/transfer_buffer.hpp"
+#include "private_include/transfer_image.hpp"
+#include "vkc/task.hpp"
+#include "vkc/vkc.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <fea/maps/unsigned_map.hpp>
+#include <fea/utils/throw.hpp>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+namespace fea {
+namespace vkc {
+namespace detail {
+// A push constant (aka uniform).
+struct push_constant_info {
+	set_id_v set;
+	binding_id_v binding;
+	size_t offset = 0;
+	size_t byte_size = 0;
+
+	// Index of the enqueued constant in task instances.
+	size_t idx = 0;
+};
+
+// The immutable part of a task : shader, layouts, pipeline and reflection.
+// It is shared by a task and all its instances.
+struct task_pipeline {
+	vkc* vkc_inst = nullptr;
+
+	/*
+	Descriptors represent resources in shaders. They allow us to use
+	things like uniform buffers, storage buffers and images in GLSL. A
+	single descriptor represents a single resource, and several
+	descriptors are organized into descriptor sets, which are basically
+	just collections of descriptors.
+	*/
+	// Separate samplers are immutable in the layout, they outlive it.
+	std::vector<vk::UniqueSampler> samplers;
+	std::vector<vk::UniqueDescriptorSetLayout> descriptor_set_layouts;
+
+	// Descriptor counts per type, used to create instance descriptor pools.
+	std::vector<vk::DescriptorPoolSize> pool_sizes;
+	uint32_t descriptor_count = 0;
+
+	/*
+	The pipeline specifies the pipeline that all graphics and compute commands
+	pass though in Vulkan. We will be creating a simple compute pipeline in this
+	application.
+	*/
+	vk::UniqueShaderModule compute_shader_module;
+	vk::UniquePipelineLayout pipeline_layout;
+	vk::UniquePipeline pipeline;
+
+	// The push_constants in the shader (aka uniforms).
+	std::vector<vk::PushConstantRange> push_constants_ranges;
+
+	// The reflected resources, instances create their buffers from these.
+	std::vector<buffer_binding_info> buffer_bindings;
+	std::vector<image_binding_info> image_bindings;
+
+	// string -> id
+	std::unordered_map<std::string, buffer_ids> buffer_name_to_id;
+	std::unordered_map<std::string, buffer_ids> image_name_to_id;
+	std::unordered_map<std::string, push_constant_info>
+			push_constants_name_to_info;
+
+	// The set working group sizes.
+	std::array<uint32_t, 3> workgroupsizes = { 1u, 1u, 1u };
+
+	// Device limits, larger dispatches are split.
+	std::array<uint32_t, 3> max_group_counts = { 65535u, 65535u, 65535u };
+
+	// Device limits, larger buffers can't be bound.
+	size_t max_storage_buffer_range = 0;
+
+	// The push_constant offset of vkc_group_base, if the shader declares it.
+	// See record_dispatch.
+	bool has_group_base = false;
+	size_t group_base_offset = 0;
+
+	// The original shader and options, recorded by captures.
+	std::vector<uint32_t> spirv;
+	task_options opts;
+};
+
+struct task_impl {
+	task_impl() = default;
+	task_impl(vkc* v)
+			: vkc_inst(v) {
+	}
+	task_impl(std::shared_ptr<const task_pipeline> p)
+			: vkc_inst(p->vkc_inst)
+			, pipeline(std::move(p)) {
+	}
+
+	const vkc& instance() const {
+		return *vkc_inst;
+	}
+	vkc& instance() {
+		return *vkc_inst;
+	}
+
+	// Pass to submits, nullptr when not profiling or tracing.
+	gpu_timer* timer_ptr() {
+		if (!profiling && !tracing(*vkc_inst)) {
+			return nullptr;
+		}
+
+		if (!timer.supported()) {
+			timer = gpu_timer{ *vkc_inst, command_pool.get() };
+		}
+		return &timer;
+	}
+
+	vkc* vkc_inst = nullptr;
+
+	// Shared with other instances of this task.
+	// Declared first, it must outlive the instance resources.
+	std::shared_ptr<const task_pipeline> pipeline;
+
+	// Each instance owns its descriptors, so it can bind its own buffers.
+	vk::UniqueDescriptorPool descriptor_pool;
+	std::vector<vk::DescriptorSet> descriptor_sets;
+
+	/*
+	The command buffer is used to record commands, that will be submitted to a
+	queue. To allocate such command buffers, we use a command pool.
+	*/
+	vk::UniqueCommandPool command_pool;
+
+	// Our buffers.
+	fea::unsigned_map<binding_id_t, transfer_buffer> transfer_buffers;
+
+	// Our images.
+	fea::unsigned_map<binding_id_t, transfer_image> transfer_images;
+
+	// The enqueued push constants, indexed with push_constant_info::idx.
+	// Cleared on submit.
+	std::vector<std::vector<uint8_t>> push_constants;
+
+	// The main submit command (aka, execute the shader cmd).
+	vk::CommandBuffer pipeline_submit_cmd;
+
+	// Times our submits when profiling or tracing, see task::profiling and
+	// vkc::tracing.
+	// Declared after the command pool, it owns command buffers.
+	bool profiling = false;
+	gpu_timer timer;
+	task_timings timings;
+
+	// Records calls while capturing, see task::begin_capture.
+	std::unique_ptr<capture_writer> capture;
+
+	// Splits submits in tiles of at most this many groups.
+	// 0 doesn't tile. See task::max_groups_per_submit.
+	size_t max_groups_per_submit = 0;
+
+	// Signaled when this instance's gpu work is done.
+	// We wait on it instead of idling the shared queue.
+	vk::UniqueFence fence;
+
+	// Spills our buffers when vkc needs room, see vkc::residency_budget.
+	// Declared last, it unregisters before the buffers are destroyed.
+	resident residency;
+};
+
+// Locks the instance's device memory for the returned lock's scope.
+// Restores spilled buffers and makes room for extra_byte_size of new device
+// memory. See vkc::residency_budget.
+// Pass the residents the caller already holds, they aren't spilled.
+inline std::unique_lock<std::mutex> make_resident(task_impl& impl,
+		size_t extra_byte_size = 0,
+		const std::vector<resident*>& held = {}) {
+	std::unique_lock<std::mutex> lock(impl.residency.in_use);
+
+	size_t spilled_byte_size = 0;
+	for (const auto& kv : impl.transfer_buffers) {
+		if (kv.second.spilled()) {
+			spilled_byte_size += kv.second.byte_size();
+		}
+	}
+
+	impl.instance().make_room(
+			&impl.residency, spilled_byte_size + extra_byte_size, held);
+	if (spilled_byte_size == 0) {
+		return lock;
+	}
+
+	for (auto& kv : impl.transfer_buffers) {
+		transfer_buffer& buf = kv.second;
+		if (!buf.spilled()) {
+			continue;
+		}
+
+		buf.restore(impl.instance(), impl.command_pool.get(), impl.fence.get());
+		buf.bind(impl.instance(),
+				impl.descriptor_sets[buf.gpu_buf().set_id().id]);
+	}
+	return lock;
+}
+
+// The width, height and depth are divided by the shader work group sizes,
+// rounded up.
+inline std::array<size_t, 3> group_counts(const task_pipeline& pipeline,
+		size_t width, size_t height, size_t depth) {
+	const std::array<uint32_t, 3>& wg = pipeline.workgroupsizes;
+	return {
+		(width + wg[0] - 1) / wg[0],
+		(height + wg[1] - 1) / wg[1],
+		(depth + wg[2] - 1) / wg[2],
+	};
+}
+
+// Dispatches that start past group 0, or that are split, need the shader to
+// offset its work group ids with the vkc_group_base push_constant member.
+// Throws if it doesn't declare it, or if the group ids don't fit uint32_t.
+inline void check_dispatch(const task_pipeline& pipeline,
+		const std::array<size_t, 3>& counts,
+		const std::array<size_t, 3>& base = {}) {
+	constexpr size_t max_group_id = std::numeric_limits<uint32_t>::max();
+	const std::array<uint32_t, 3>& max_counts = pipeline.max_group_counts;
+	for (size_t i = 0; i < 3; ++i) {
+		if (counts[i] != 0 && base[i] + counts[i] - 1 > max_group_id) {
+			fea::maybe_throw<std::invalid_argument>(__FUNCTION__, __LINE__,
+					"Dispatch group count doesn't fit 32 bits.");
+		}
+
+		if (pipeline.has_group_base) {
+			continue;
+		}
+
+		if (base[i] != 0 || counts[i] > max_counts[i]) {
+			fea::maybe_throw<std::invalid_argument>(__FUNCTION__, __LINE__,
+					"Dispatch is split, but the shader push_constant block "
+					"doesn't declare 'uvec3 vkc_group_base'.");
+		}
+	}
+}
+
+// Records the dispatch of counts groups, starting at group base.
+// Counts over the device maxComputeWorkGroupCount are split in several
+// dispatches. If the shader declares vkc_group_base, it is pushed before each
+// dispatch with the dispatch's first group. The shader adds it to
+// gl_WorkGroupID, so splitting is invisible to it.
+// Call check_dispatch first.
+inline void record_dispatch(const task_pipeline& pipeline,
+		vk::CommandBuffer cmd_buf, const std::array<size_t, 3>& counts,
+		const std::array<size_t, 3>& base = {}) {
+	const std::array<uint32_t, 3>& max_counts = pipeline.max_group_counts;
+
+	for (size_t z = 0; z < counts[2]; z += max_counts[2]) {
+		for (size_t y = 0; y < counts[1]; y += max_counts[1]) {
+			for (size_t x = 0; x < counts[0]; x += max_counts[0]) {
+				std::array<uint32_t, 3> b{
+					uint32_t(base[0] + x),
+					uint32_t(base[1] + y),
+					uint32_t(base[2] + z),
+				};
+				std::array<uint32_t, 3> c{
+					uint32_t(std::min<size_t>(max_counts[0], counts[0] - x)),
+					uint32_t(std::min<size_t>(max_counts[1], counts[1] - y)),
+					uint32_t(std::min<size_t>(max_counts[2], counts[2] - z)),
+				};
+
+				if (pipeline.has_group_base) {
+					cmd_buf.pushConstants(pipeline.pipeline_layout.get(),
+							vk::ShaderStageFlagBits::eCompute,
+							uint32_t(pipeline.group_base_offset),
+							uint32_t(sizeof(b)), b.data());
+				}
+				cmd_buf.dispatch(c[0], c[1], c[2]);
+			}
+		}
+	}
+}
+
+// Splits counts in tiles of at most max_groups groups, in x then y then z.
+// Calls func(tile_base, tile_counts) on each tile.
+// Empty dispatches have no tiles.
+template <class Func>
+void for_each_tile(const std::array<size_t, 3>& counts, size_t max_groups,
+		Func&& func) {
+	assert(max_groups != 0);
+	if (counts[0] == 0 || counts[1] == 0 || counts[2] == 0) {
+		return;
+	}
+
+	std::array<size_t, 3> tile;
+	tile[0] = std::min(counts[0], max_groups);
+	tile[1] = std::min(counts[1], std::max(size_t(1), max_groups / tile[0]));
+	tile[2] = std::min(counts[2],
+			std::max(size_t(1), max_groups / (tile[0] * tile[1])));
+
+	for (size_t z = 0; z < counts[2]; z += tile[2]) {
+		for (size_t y = 0; y < counts[1]; y += tile[1]) {
+			for (size_t x = 0; x < counts[0]; x += tile[0]) {
+				func(std::array<size_t, 3>{ x, y, z },
+						std::array<size_t, 3>{
+								std::min(tile[0], counts[0] - x),
+								std::min(tile[1], counts[1] - y),
+								std::min(tile[2], counts[2] - z),
+						});
+			}
+		}
+	}
+}
+} // namespace detail
+} // namespace vkc
+} // namespace fea
@@ -0,0 +1,186 @@
+#pragma once
+#include "vkc/vkc.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <mutex>
+#include <vector>
+
+namespace fea {
+namespace vkc {
+namespace detail {
+// A host span, on the thread which recorded it.
+struct host_trace_event {
+	const char* name = nullptr;
+	uint32_t thread_id = 0;
+	int64_t begin_ns = 0;
+	int64_t end_ns = 0;
+};
+
+// A timestamped gpu range, with the host time its fence wait returned.
+struct gpu_trace_event {
+	const char* name = nullptr;
+	uint64_t begin_ticks = 0;
+	uint64_t end_ticks = 0;
+	int64_t host_done_ns = 0;
+};
+
+// Small sequential ids, nicer than std::thread::id in the viewer.
+// 0 is the gpu track.
+inline uint32_t trace_thread_id() {
+	static std::atomic<uint32_t> next_id{ 1 };
+	thread_local uint32_t id = next_id++;
+	return id;
+}
+
+// The innermost span on this thread, names the gpu work it submits.
+inline const char*& current_trace_span() {
+	thread_local const char* name = nullptr;
+	return name;
+}
+
+// Stored in vkc, see vkc::tracing.
+struct tracer {
+	int64_t now_ns() const {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now() - start)
+				.count();
+	}
+
+	void add(const host_trace_event& e) {
+		std::lock_guard<std::mutex> lock(mutex);
+		host_events.push_back(e);
+	}
+
+	void add(const gpu_trace_event& e) {
+		std::lock_guard<std::mutex> lock(mutex);
+		gpu_events.push_back(e);
+	}
+
+	// Writes Chrome trace-event json and clears the events.
+	bool write(const std::filesystem::path& filepath) {
+		std::vector<host_trace_event> hosts;
+		std::vector<gpu_trace_event> gpus;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			hosts.swap(host_events);
+			gpus.swap(gpu_events);
+		}
+
+		std::ofstream ofs{ filepath };
+		if (!ofs.is_open()) {
+			return false;
+		}
+
+		/*
+		Gpu timestamps are in device ticks. A fence wait returns after the
+		gpu is done, so host_done - end is an upper bound of the clock offset.
+		The smallest one observed is the tightest mapping.
+		*/
+		double offset_ns = (std::numeric_limits<double>::max)();
+		for (const gpu_trace_event& e : gpus) {
+			offset_ns = (std::min)(offset_ns,
+					double(e.host_done_ns) - double(e.end_ticks) * period_ns);
+		}
+
+		ofs << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+		ofs << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,"
+			   "\"args\":{\"name\":\"gpu queue\"}}";
+
+		// Trace-event timestamps are in microseconds.
+		ofs.precision(3);
+		ofs << std::fixed;
+		for (const host_trace_event& e : hosts) {
+			ofs << ",\n{\"name\":\"" << e.name
+				<< "\",\"cat\":\"host\",\"ph\":\"X\",\"pid\":1,\"tid\":"
+				<< e.thread_id << ",\"ts\":" << double(e.begin_ns) / 1000.0
+				<< ",\"dur\":" << double(e.end_ns - e.begin_ns) / 1000.0
+				<< "}";
+		}
+		for (const gpu_trace_event& e : gpus) {
+			double begin_ns = double(e.begin_ticks) * period_ns + offset_ns;
+			double dur_ns = double(e.end_ticks - e.begin_ticks) * period_ns;
+			ofs << ",\n{\"name\":\"" << e.name
+				<< "\",\"cat\":\"gpu\",\"ph\":\"X\",\"pid\":1,\"tid\":0"
+				<< ",\"ts\":" << begin_ns / 1000.0
+				<< ",\"dur\":" << dur_ns / 1000.0 << "}";
+		}
+		ofs << "\n]}\n";
+		return ofs.good();
+	}
+
+	std::atomic<bool> enabled{ false };
+
+	// Nanoseconds per gpu timestamp tick.
+	double period_ns = 1.0;
+
+	std::chrono::steady_clock::time_point start
+			= std::chrono::steady_clock::now();
+
+	std::mutex mutex;
+	std::vector<host_trace_event> host_events;
+	std::vector<gpu_trace_event> gpu_events;
+};
+
+inline bool tracing(const vkc& vkc_inst) {
+	return vkc_inst.tracer().enabled.load(std::memory_order_relaxed);
+}
+
+// Records a host span while in scope, when tracing.
+// name must be a string literal.
+struct scoped_trace {
+	scoped_trace(const vkc& vkc_inst, const char* name)
+			: _tracer(vkc_inst.tracer()) {
+		if (!tracing(vkc_inst)) {
+			return;
+		}
+
+		_event.name = name;
+		_event.thread_id = trace_thread_id();
+		_event.begin_ns = _tracer.now_ns();
+		_parent = current_trace_span();
+		current_trace_span() = name;
+	}
+
+	~scoped_trace() {
+		if (_event.name == nullptr) {
+			return;
+		}
+
+		_event.end_ns = _tracer.now_ns();
+		current_trace_span() = _parent;
+		_tracer.add(_event);
+	}
+
+	// Non-copyable, non-moveable.
+	scoped_trace(const scoped_trace&) = delete;
+	scoped_trace& operator=(const scoped_trace&) = delete;
+
+private:
+	tracer& _tracer;
+	host_trace_event _event;
+	const char* _parent = nullptr;
+};
+
+// Records a timestamped gpu range, named after the current span.
+// host_done_ns is when its fence wait returned, see tracer::now_ns.
+inline void trace_gpu(const vkc& vkc_inst, uint64_t begin_ticks,
+		uint64_t end_ticks, int64_t host_done_ns) {
+	tracer& t = vkc_inst.tracer();
+	const char* name = current_trace_span();
+	t.add(gpu_trace_event{
+			name != nullptr ? name : "gpu",
+			begin_ticks,
+			end_ticks,
+			host_done_ns,
+	});
+}
+
+} // namespace detail
+} // namespace vkc
+} // namespace fea
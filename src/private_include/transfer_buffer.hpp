@@ -1,50 +1,73 @@
 #pragma once
 #include "private_include/ids.hpp"
 #include "private_include/raw_buffer.hpp"
+#include "private_include/staging_copy.hpp"
+#include "private_include/staging_ring.hpp"
+#include "private_include/submit.hpp"
 #include "vkc/vkc.hpp"
 
 #include <algorithm>
+#include <array>
 #include <limits>
 #include <vulkan/vulkan.hpp>
 
 namespace fea {
 namespace vkc {
 namespace detail {
-constexpr vk::BufferUsageFlags staging_usage_flags
-		= vk::BufferUsageFlagBits::eTransferSrc
-		| vk::BufferUsageFlagBits::eTransferDst;
-
-constexpr vk::MemoryPropertyFlags staging_mem_flags
-		= vk::MemoryPropertyFlagBits::eHostVisible
-		| vk::MemoryPropertyFlagBits::eHostCoherent;
-
 constexpr vk::BufferUsageFlags gpu_usage_flags
 		= vk::BufferUsageFlagBits::eTransferDst
 		| vk::BufferUsageFlagBits::eTransferSrc
-		| vk::BufferUsageFlagBits::eStorageBuffer;
+		| vk::BufferUsageFlagBits::eStorageBuffer
+		| vk::BufferUsageFlagBits::eUniformTexelBuffer
+		| vk::BufferUsageFlagBits::eStorageTexelBuffer;
 
 constexpr vk::MemoryPropertyFlags gpu_mem_flags
 		= vk::MemoryPropertyFlagBits::eDeviceLocal;
 
-void make_copy_cmd(const vk::Buffer& src, const vk::Buffer& dst,
-		size_t byte_size, vk::CommandBuffer& cmd_buf) {
-	vk::CommandBufferBeginInfo begin_info{};
-	cmd_buf.begin(begin_info);
+struct buffer_copy {
+	vk::Buffer src;
+	vk::Buffer dst;
+	vk::BufferCopy region;
+};
+
+// Records the copies in a temporary command buffer, submits and waits.
+inline vk::Result submit_copies(vkc& vkc_inst, vk::CommandPool command_pool,
+		vk::Fence fence, const buffer_copy* copies, size_t count,
+		gpu_timer* timer = nullptr) {
+	vk::CommandBufferAllocateInfo alloc_info{
+		command_pool,
+		vk::CommandBufferLevel::ePrimary,
+		1,
+	};
+
+	std::vector<vk::UniqueCommandBuffer> cmd_bufs
+			= vkc_inst.device().allocateCommandBuffersUnique(alloc_info);
+	assert(cmd_bufs.size() == 1);
+	vk::CommandBuffer& cmd_buf = cmd_bufs.back().get();
 
-	vk::BufferCopy copy_region{
-		0,
-		0,
-		byte_size,
+	vk::CommandBufferBeginInfo begin_info{
+		vk::CommandBufferUsageFlagBits::eOneTimeSubmit,
 	};
-	cmd_buf.copyBuffer(src, dst, 1, &copy_region);
+	cmd_buf.begin(begin_info);
+	count_stat(vkc_inst, stat::command_records);
+	for (size_t i = 0; i < count; ++i) {
+		if (copies[i].region.size == 0) {
+			continue;
+		}
+		cmd_buf.copyBuffer(copies[i].src, copies[i].dst, 1, &copies[i].region);
+	}
 	cmd_buf.end();
+
+	return submit_and_wait(vkc_inst, &cmd_buf, 1, fence, timer);
 }
 } // namespace detail
 
 
-// This buffer contains 2 raw_buffers.
-// One cpu-visible staging buffer, and one gpu-only data buffer.
-// Use this to transfer memory to/from the gpu.
+
+
+// A gpu-only data buffer, transferred through the vkc staging ring.
+// Graphs and spills need the buffer contents in host memory, which is
+// kept in an optional staging mirror of the same size.
 struct transfer_buffer {
 	transfer_buffer() = default;
 
@@ -53,16 +76,12 @@ struct transfer_buffer {
 			: _staging_buf(
 					detail::staging_usage_flags, detail::staging_mem_flags)
 			, _gpu_buf(ids, detail::gpu_usage_flags, detail::gpu_mem_flags) {
-		assert(_staging_buf.byte_size() == _gpu_buf.byte_size());
 	}
 
-	// Create a bound transfer_buffer and allocate memory.
-	transfer_buffer(const vkc& vkc_inst, buffer_ids gpu_ids, size_t byte_size)
-			: _staging_buf(vkc_inst, byte_size, detail::staging_usage_flags,
-					detail::staging_mem_flags)
-			, _gpu_buf(vkc_inst, gpu_ids, byte_size, detail::gpu_usage_flags,
-					  detail::gpu_mem_flags) {
-		assert(_staging_buf.byte_size() == _gpu_buf.byte_size());
+	// Create a bound texel transfer_buffer but doesn't allocate memory.
+	transfer_buffer(buffer_ids ids, vk::DescriptorType type, format fmt)
+			: transfer_buffer(ids) {
+		_gpu_buf.descriptor_type(type, fmt);
 	}
 
 	// Move-only
@@ -75,116 +94,294 @@ struct transfer_buffer {
 	void clear() {
 		_staging_buf.clear();
 		_gpu_buf.clear();
-		assert(_staging_buf.byte_size() == _gpu_buf.byte_size());
 	}
 
 	void resize(const vkc& vkc_inst, size_t byte_size) {
-		_staging_buf.resize(vkc_inst, byte_size);
 		_gpu_buf.resize(vkc_inst, byte_size);
-		assert(_staging_buf.byte_size() == _gpu_buf.byte_size());
+		if (has_staging()) {
+			_staging_buf.resize(vkc_inst, byte_size);
+		}
+		assert(!has_staging() || _staging_buf.byte_size() == byte_size);
+	}
+
+	// Allocates for sizes up to capacity, byte_size doesn't change.
+	void reserve(const vkc& vkc_inst, size_t capacity) {
+		_gpu_buf.reserve(vkc_inst, capacity);
+		if (has_staging()) {
+			_staging_buf.reserve(vkc_inst, capacity);
+		}
 	}
 
 	void bind(const vkc& vkc_inst, vk::DescriptorSet target_desc_set) {
-		assert(_staging_buf.byte_size() == _gpu_buf.byte_size());
 		_gpu_buf.bind(vkc_inst, target_desc_set);
 	}
 
-	void make_push_cmd(vk::CommandBuffer&& cmd_buf) {
-		if (has_push_cmd()) {
-			// Has already been created at correct size.
+	// Allocates the staging mirror, used by graphs. It is kept from then on,
+	// and task pushes also write it.
+	// A new mirror is seeded with the gpu buffer contents.
+	void reserve_staging(
+			vkc& vkc_inst, vk::CommandPool command_pool, vk::Fence fence) {
+		_keep_staging = true;
+		if (has_staging() || byte_size() == 0) {
 			return;
 		}
 
-		_push_cmd = std::move(cmd_buf);
-		detail::make_copy_cmd(
-				_staging_buf.get(), _gpu_buf.get(), byte_size(), _push_cmd);
-		_push_cmd_byte_size = byte_size();
-	}
-
-	void make_pull_cmd(vk::CommandBuffer&& cmd_buf) {
-		if (has_pull_cmd()) {
-			// Has already been created at correct size.
+		_staging_buf.resize(vkc_inst, byte_size());
+		detail::buffer_copy copy{
+			_gpu_buf.get(),
+			_staging_buf.get(),
+			{ 0, 0, byte_size() },
+		};
+		vk::Result res = detail::submit_copies(
+				vkc_inst, command_pool, fence, &copy, 1);
+		if (res != vk::Result::eSuccess) {
+			fprintf(stderr, "Staging mirror copy failed with result : '%d'\n",
+					res);
 			return;
 		}
-
-		_pull_cmd = std::move(cmd_buf);
-		detail::make_copy_cmd(
-				_gpu_buf.get(), _staging_buf.get(), byte_size(), _pull_cmd);
-		_pull_cmd_byte_size = byte_size();
+		_staging_is_newer = false;
 	}
 
-	void push(vkc& vkc_inst, const uint8_t* in_mem) {
+	// Copies into the staging mirror only.
+	void write_staging(const vkc& vkc_inst, const uint8_t* in_mem) {
+		assert(has_staging());
+
 		// Map the buffer memory, so that we can read from it on the CPU.
 		void* mapped_memory = vkc_inst.device().mapMemory(
 				_staging_buf.get_memory(), 0, byte_size());
 
 		uint8_t* out_mem = reinterpret_cast<uint8_t*>(mapped_memory);
-		std::copy(in_mem, in_mem + byte_size(), out_mem);
+		detail::staging_copy(out_mem, in_mem, byte_size(),
+				_staging_buf.write_combined());
 
 		// Done writing, so unmap.
 		vkc_inst.device().unmapMemory(_staging_buf.get_memory());
+		_staging_is_newer = true;
+	}
 
-		// Now, copy the staging buffer to gpu memory.
-		vk::SubmitInfo submit_info{
-			{},
-			nullptr,
-			nullptr,
-			1, // submit a single command buffer
-			// the command buffer to submit.
-			&_push_cmd,
-		};
+	// The staging contents were copied to the gpu buffer.
+	void staging_pushed() {
+		_staging_is_newer = false;
+	}
+
+	// Copies from the staging mirror only.
+	void read_staging(const vkc& vkc_inst, uint8_t* out_mem) const {
+		assert(has_staging());
+
+		// Map the buffer memory, so that we can read from it on the CPU.
+		const void* mapped_memory = vkc_inst.device().mapMemory(
+				_staging_buf.get_memory(), 0, byte_size());
 
-		vk::Result res = vkc_inst.queue().submit(1, &submit_info, {});
+		const uint8_t* in_mem = reinterpret_cast<const uint8_t*>(mapped_memory);
+		detail::staging_copy(out_mem, in_mem, byte_size(), false);
+
+		// Done reading, so unmap.
+		vkc_inst.device().unmapMemory(_staging_buf.get_memory());
+	}
+
+	// Streams in_mem to the gpu buffer, through the staging ring.
+	void push(vkc& vkc_inst, const uint8_t* in_mem,
+			detail::gpu_timer* timer = nullptr) {
+		vk::Result res = vkc_inst.staging_ring().push(
+				vkc_inst, in_mem, _gpu_buf.get(), 0, byte_size(), timer);
 		if (res != vk::Result::eSuccess) {
 			fprintf(stderr, "Buffer push submit failed with result : '%d'\n",
 					res);
 			return;
 		}
+		mirror_push(vkc_inst, in_mem);
+	}
 
-		vkc_inst.queue().waitIdle();
+	// Streams the gpu buffer to out_mem, through the staging ring.
+	void pull(vkc& vkc_inst, uint8_t* out_mem,
+			detail::gpu_timer* timer = nullptr) {
+		vk::Result res = vkc_inst.staging_ring().pull(
+				vkc_inst, _gpu_buf.get(), 0, out_mem, byte_size(), timer);
+		if (res != vk::Result::eSuccess) {
+			fprintf(stderr, "Buffer pull submit failed with result : '%d'\n",
+					res);
+			return;
+		}
 	}
 
-	void pull(vkc& vkc_inst, uint8_t* out_mem) {
-		// First, copy the gpu buffer to staging buffer.
-		vk::SubmitInfo submit_info{
-			{},
-			nullptr,
-			nullptr,
-			1,
-			&_pull_cmd,
-		};
+	// Copies imported user memory straight to the gpu buffer.
+	// The unaligned remainder, past imported_byte_size, goes through the
+	// staging ring.
+	void push_imported(vkc& vkc_inst, vk::CommandPool command_pool,
+			const uint8_t* in_mem, vk::Buffer imported,
+			size_t imported_byte_size, vk::Fence fence,
+			detail::gpu_timer* timer = nullptr) {
+		assert(imported_byte_size <= byte_size());
+		if (!copy_imported(vkc_inst, command_pool, imported,
+					imported_byte_size, true, fence, timer)) {
+			return;
+		}
 
-		vkc_inst.queue().waitIdle();
-		vk::Result res = vkc_inst.queue().submit(1, &submit_info, {});
+		vk::Result res = vkc_inst.staging_ring().push(vkc_inst,
+				in_mem + imported_byte_size, _gpu_buf.get(),
+				imported_byte_size, byte_size() - imported_byte_size, timer);
+		if (res != vk::Result::eSuccess) {
+			fprintf(stderr, "Buffer push submit failed with result : '%d'\n",
+					res);
+			return;
+		}
+		mirror_push(vkc_inst, in_mem);
+	}
+
+	// Copies the gpu buffer straight to imported user memory.
+	// The unaligned remainder, past imported_byte_size, goes through the
+	// staging ring.
+	void pull_imported(vkc& vkc_inst, vk::CommandPool command_pool,
+			uint8_t* out_mem, vk::Buffer imported, size_t imported_byte_size,
+			vk::Fence fence, detail::gpu_timer* timer = nullptr) {
+		assert(imported_byte_size <= byte_size());
+		if (!copy_imported(vkc_inst, command_pool, imported,
+					imported_byte_size, false, fence, timer)) {
+			return;
+		}
+
+		vk::Result res = vkc_inst.staging_ring().pull(vkc_inst,
+				_gpu_buf.get(), imported_byte_size,
+				out_mem + imported_byte_size,
+				byte_size() - imported_byte_size, timer);
 		if (res != vk::Result::eSuccess) {
 			fprintf(stderr, "Buffer pull submit failed with result : '%d'\n",
 					res);
 			return;
 		}
+	}
 
-		vkc_inst.queue().waitIdle();
+	// Releases the memory reserved past byte_size, keeping the contents.
+	// Returns true if the buffers were reallocated, they must be bound again.
+	// Empty buffers keep their memory, vulkan buffers can't be empty.
+	bool shrink_to_fit(
+			vkc& vkc_inst, vk::CommandPool command_pool, vk::Fence fence) {
+		if (byte_size() == 0 || capacity() == byte_size()) {
+			return false;
+		}
 
-		// Map the buffer memory, so that we can read from it on the CPU.
-		const void* mapped_memory = vkc_inst.device().mapMemory(
-				_staging_buf.get_memory(), 0, byte_size());
+		raw_buffer gpu_buf = _gpu_buf.fitted(vkc_inst);
+		raw_buffer staging_buf{ detail::staging_usage_flags,
+			detail::staging_mem_flags };
+		if (has_staging()) {
+			staging_buf = _staging_buf.fitted(vkc_inst);
+		}
 
-		const uint8_t* in_mem = reinterpret_cast<const uint8_t*>(mapped_memory);
-		std::copy(in_mem, in_mem + byte_size(), out_mem);
+		vk::BufferCopy region{
+			0,
+			0,
+			byte_size(),
+		};
+		std::array<detail::buffer_copy, 2> copies{ {
+				{ _gpu_buf.get(), gpu_buf.get(), region },
+				{ _staging_buf.get(), staging_buf.get(), region },
+		} };
 
-		// Done reading, so unmap.
-		vkc_inst.device().unmapMemory(_staging_buf.get_memory());
+		vk::Result res = detail::submit_copies(vkc_inst, command_pool, fence,
+				copies.data(), has_staging() ? 2 : 1);
+		if (res != vk::Result::eSuccess) {
+			fprintf(stderr, "Buffer shrink failed with result : '%d'\n", res);
+			return false;
+		}
+
+		_gpu_buf = std::move(gpu_buf);
+		_staging_buf = std::move(staging_buf);
+		return true;
+	}
+
+	// Copies the gpu buffer to staging memory and frees it.
+	// The staging mirror holds the contents until restore.
+	void spill(vkc& vkc_inst, vk::CommandPool command_pool, vk::Fence fence) {
+		if (_gpu_buf.allocated_byte_size() == 0) {
+			return;
+		}
+
+		_staging_buf.resize(vkc_inst, byte_size());
+
+		// Written staging memory waiting to be pushed is kept, the gpu
+		// contents would be overwritten anyways.
+		detail::buffer_copy copy{
+			_gpu_buf.get(),
+			_staging_buf.get(),
+			{ 0, 0, _staging_is_newer ? 0 : byte_size() },
+		};
+		vk::Result res = detail::submit_copies(
+				vkc_inst, command_pool, fence, &copy, 1);
+		if (res != vk::Result::eSuccess) {
+			fprintf(stderr, "Buffer spill failed with result : '%d'\n", res);
+			return;
+		}
+
+		_gpu_buf.release();
+	}
+
+	// Allocates the spilled gpu buffer and copies back its contents.
+	// The staging mirror is freed, unless a graph uses it.
+	// It must be bound again.
+	void restore(
+			vkc& vkc_inst, vk::CommandPool command_pool, vk::Fence fence) {
+		if (!spilled()) {
+			return;
+		}
+
+		_gpu_buf.resize(vkc_inst, byte_size());
+
+		detail::buffer_copy copy{
+			_staging_buf.get(),
+			_gpu_buf.get(),
+			{ 0, 0, byte_size() },
+		};
+		vk::Result res = detail::submit_copies(
+				vkc_inst, command_pool, fence, &copy, 1);
+		if (res != vk::Result::eSuccess) {
+			fprintf(stderr, "Buffer restore failed with result : '%d'\n",
+					res);
+			return;
+		}
+
+		if (!_keep_staging && !_staging_is_newer) {
+			_staging_buf.release();
+			_staging_buf.clear();
+		}
 	}
 
 	// Getters and setters
 
+	// Whether the gpu buffer contents live in staging memory.
+	bool spilled() const {
+		return byte_size() != 0 && _gpu_buf.allocated_byte_size() == 0;
+	}
+
+	// Whether the staging mirror is allocated.
+	bool has_staging() const {
+		return _staging_buf.allocated_byte_size() != 0;
+	}
+
 	size_t byte_size() const {
-		assert(_staging_buf.byte_size() == _gpu_buf.byte_size());
 		return _gpu_buf.byte_size();
 	}
 
+	// The buffers may differ after a spill.
 	size_t capacity() const {
-		assert(_staging_buf.capacity() == _gpu_buf.capacity());
-		return _gpu_buf.capacity();
+		return std::max(_staging_buf.capacity(), _gpu_buf.capacity());
+	}
+
+	// The memory allocated for both buffers.
+	size_t allocated_byte_size() const {
+		return _staging_buf.allocated_byte_size()
+			 + _gpu_buf.allocated_byte_size();
+	}
+
+	// The memory used by both buffers.
+	size_t used_byte_size() const {
+		size_t ret = 0;
+		if (_gpu_buf.allocated_byte_size() != 0) {
+			ret += byte_size();
+		}
+		if (has_staging()) {
+			ret += byte_size();
+		}
+		return ret;
 	}
 
 	const raw_buffer& staging_buf() const {
@@ -201,79 +398,55 @@ struct transfer_buffer {
 		return _gpu_buf;
 	}
 
-	bool has_push_cmd() const {
-		assert(_staging_buf.byte_size() == _gpu_buf.byte_size());
-		return _push_cmd != vk::CommandBuffer{}
-		&& _push_cmd_byte_size == _staging_buf.byte_size();
+private:
+	// Graphs replay the staging mirror, it must hold what the task pushed.
+	// Overwrites staged graph writes.
+	void mirror_push(const vkc& vkc_inst, const uint8_t* in_mem) {
+		if (_keep_staging && byte_size() != 0) {
+			_staging_buf.resize(vkc_inst, byte_size());
+			write_staging(vkc_inst, in_mem);
+		}
+		_staging_is_newer = false;
 	}
-	bool has_pull_cmd() const {
-		assert(_staging_buf.byte_size() == _gpu_buf.byte_size());
-		return _pull_cmd != vk::CommandBuffer{}
-		&& _pull_cmd_byte_size == _staging_buf.byte_size();
+
+	// One-shot copy between imported memory and the gpu buffer.
+	// Imported memory changes every transfer, so the command isn't kept.
+	// Returns false on failure.
+	bool copy_imported(vkc& vkc_inst, vk::CommandPool command_pool,
+			vk::Buffer imported, size_t imported_byte_size, bool to_gpu,
+			vk::Fence fence, detail::gpu_timer* timer) {
+		detail::buffer_copy copy{
+			imported,
+			_gpu_buf.get(),
+			{ 0, 0, imported_byte_size },
+		};
+		if (!to_gpu) {
+			std::swap(copy.src, copy.dst);
+		}
+
+		vk::Result res = detail::submit_copies(
+				vkc_inst, command_pool, fence, &copy, 1, timer);
+		if (res != vk::Result::eSuccess) {
+			fprintf(stderr,
+					"Imported buffer transfer failed with result : '%d'\n",
+					res);
+			return false;
+		}
+		return true;
 	}
 
-private:
-	// The staging buffer, accessible from cpu.
+	// The staging mirror, accessible from cpu. Only allocated for graphs
+	// and spills.
 	raw_buffer _staging_buf;
 
 	// The actual gpu buffer, not accessible from cpu.
 	raw_buffer _gpu_buf;
 
-	// The command to copy from staging to gpu.
-	vk::CommandBuffer _push_cmd;
-
-	// The push command byte_size.
-	// Used to trigger creation of new command when size has changed.
-	size_t _push_cmd_byte_size = 0;
+	// A graph uses the staging mirror, keep it.
+	bool _keep_staging = false;
 
-	// The command to copy from gpu to staging.
-	vk::CommandBuffer _pull_cmd;
-
-	// The pull command byte_size.
-	// Used to trigger creation of new command when size has changed.
-	size_t _pull_cmd_byte_size = 0;
+	// Staging memory was written and not yet copied to the gpu buffer.
+	bool _staging_is_newer = false;
 };
-
-// TODO : Allocate and create multiple commands at once, thread.
-void make_push_cmds(const vkc& vkc_inst, vk::CommandPool command_pool,
-		transfer_buffer& buf) {
-	if (buf.has_push_cmd()) {
-		return;
-	}
-
-	// We are only creating 1 new command buffer. For now.
-	vk::CommandBufferAllocateInfo alloc_info{
-		command_pool,
-		vk::CommandBufferLevel::ePrimary,
-		1,
-	};
-
-	std::vector<vk::CommandBuffer> new_buf
-			= vkc_inst.device().allocateCommandBuffers(alloc_info);
-	assert(new_buf.size() == 1);
-
-	buf.make_push_cmd(std::move(new_buf.back()));
-}
-
-// TODO : Allocate and create multiple commands at once, thread.
-void make_pull_cmds(const vkc& vkc_inst, vk::CommandPool command_pool,
-		transfer_buffer& buf) {
-	if (buf.has_pull_cmd()) {
-		return;
-	}
-
-	// We are only creating 1 new command buffer. For now.
-	vk::CommandBufferAllocateInfo alloc_info{
-		command_pool,
-		vk::CommandBufferLevel::ePrimary,
-		1,
-	};
-
-	std::vector<vk::CommandBuffer> new_buf
-			= vkc_inst.device().allocateCommandBuffers(alloc_info);
-	assert(new_buf.size() == 1);
-
-	buf.make_pull_cmd(std::move(new_buf.back()));
-}
 } // namespace vkc
 } // namespace fea
@@ -0,0 +1,506 @@
+#pragma once
+#include "private_include/format.hpp"
+#include "private_include/ids.hpp"
+#include "private_include/raw_buffer.hpp"
+#include "private_include/staging_copy.hpp"
+#include "private_include/submit.hpp"
+#include "private_include/transfer_buffer.hpp"
+#include "vkc/vkc.hpp"
+
+#include <algorithm>
+#include <vulkan/vulkan.hpp>
+
+namespace fea {
+namespace vkc {
+namespace detail {
+constexpr vk::ImageUsageFlags image_transfer_usage_flags
+		= vk::ImageUsageFlagBits::eTransferSrc
+		| vk::ImageUsageFlagBits::eTransferDst;
+
+// Images always live in the general layout.
+// It is valid for storage, sampling and transfers, which saves us from
+// tracking layouts between pushes, submits and pulls.
+constexpr vk::ImageLayout image_layout = vk::ImageLayout::eGeneral;
+
+inline vk::ImageUsageFlags image_usage_flags(vk::DescriptorType type) {
+	switch (type) {
+	case vk::DescriptorType::eStorageImage: {
+		return image_transfer_usage_flags | vk::ImageUsageFlagBits::eStorage;
+	} break;
+	case vk::DescriptorType::eSampledImage:
+	case vk::DescriptorType::eCombinedImageSampler: {
+		return image_transfer_usage_flags | vk::ImageUsageFlagBits::eSampled;
+	} break;
+	default: {
+		fea::maybe_throw<std::invalid_argument>(
+				__FUNCTION__, __LINE__, "Unsupported image descriptor type.");
+	} break;
+	}
+	return image_transfer_usage_flags;
+}
+
+inline vk::ImageViewType image_view_type(vk::ImageType type) {
+	switch (type) {
+	case vk::ImageType::e1D: {
+		return vk::ImageViewType::e1D;
+	} break;
+	case vk::ImageType::e3D: {
+		return vk::ImageViewType::e3D;
+	} break;
+	default: {
+		return vk::ImageViewType::e2D;
+	} break;
+	}
+}
+
+// The sampler of combined image samplers and separate samplers.
+// Linear filtering, clamped to the edges.
+inline vk::UniqueSampler make_sampler(const vkc& vkc_inst) {
+	vk::SamplerCreateInfo sampler_create_info{};
+	sampler_create_info.magFilter = vk::Filter::eLinear;
+	sampler_create_info.minFilter = vk::Filter::eLinear;
+	sampler_create_info.mipmapMode = vk::SamplerMipmapMode::eNearest;
+	sampler_create_info.addressModeU = vk::SamplerAddressMode::eClampToEdge;
+	sampler_create_info.addressModeV = vk::SamplerAddressMode::eClampToEdge;
+	sampler_create_info.addressModeW = vk::SamplerAddressMode::eClampToEdge;
+	return vkc_inst.device().createSamplerUnique(sampler_create_info);
+}
+
+constexpr vk::ImageSubresourceRange image_subresource_range{
+	vk::ImageAspectFlagBits::eColor,
+	0, // base mip
+	1, // mip count
+	0, // base layer
+	1, // layer count
+};
+
+inline void make_image_copy_cmd(const vk::Buffer& buf, const vk::Image& img,
+		vk::Extent3D extent, bool to_image, vk::CommandBuffer& cmd_buf) {
+	vk::CommandBufferBeginInfo begin_info{};
+	cmd_buf.begin(begin_info);
+
+	// Tightly packed, copy the whole image.
+	vk::BufferImageCopy copy_region{
+		0,
+		0,
+		0,
+		vk::ImageSubresourceLayers{
+				vk::ImageAspectFlagBits::eColor,
+				0,
+				0,
+				1,
+		},
+		vk::Offset3D{ 0, 0, 0 },
+		extent,
+	};
+
+	if (to_image) {
+		cmd_buf.copyBufferToImage(buf, img, image_layout, 1, &copy_region);
+	} else {
+		cmd_buf.copyImageToBuffer(img, image_layout, buf, 1, &copy_region);
+	}
+	cmd_buf.end();
+}
+} // namespace detail
+
+
+// This image contains a cpu-visible staging buffer and a gpu-only image.
+// Use this to transfer texels to/from the gpu.
+struct transfer_image {
+	transfer_image() = default;
+
+	// Create a bound transfer_image but doesn't allocate memory.
+	transfer_image(buffer_ids ids, vk::DescriptorType type,
+			vk::ImageType img_type, format fmt)
+			: _ids(ids)
+			, _desc_type(type)
+			, _img_type(img_type)
+			, _format(fmt)
+			, _staging_buf(
+					  detail::staging_usage_flags, detail::staging_mem_flags) {
+	}
+
+	// Move-only
+	transfer_image(transfer_image&&) = default;
+	transfer_image& operator=(transfer_image&&) = default;
+	transfer_image(const transfer_image&) = delete;
+	transfer_image& operator=(const transfer_image&) = delete;
+
+	// Operations
+
+	// Changing the format drops the image, it is recreated on next resize.
+	void set_format(format fmt) {
+		if (fmt == _format) {
+			return;
+		}
+
+		_format = fmt;
+		_extent = vk::Extent3D{ 0, 0, 0 };
+		invalidate_cmds();
+		_view.reset();
+		_img.reset();
+		_mem.reset();
+		_staging_buf.clear();
+		_bound = false;
+	}
+
+	void resize(vkc& vkc_inst, vk::CommandPool command_pool, vk::Fence fence,
+			vk::Extent3D ext) {
+		if (_format == format::undefined) {
+			fea::maybe_throw<std::runtime_error>(__FUNCTION__, __LINE__,
+					"Image has no format, call set_format first.");
+		}
+
+		if (ext == _extent) {
+			return;
+		}
+
+		// A new image is created, the cached commands reference the old one.
+		_extent = ext;
+		invalidate_cmds();
+		_staging_buf.resize(vkc_inst, byte_size());
+		_bound = false;
+
+		vk::ImageCreateInfo image_create_info{
+			{},
+			_img_type,
+			detail::to_vk_format(_format),
+			_extent,
+			1, // mip levels
+			1, // array layers
+			vk::SampleCountFlagBits::e1,
+			vk::ImageTiling::eOptimal,
+			detail::image_usage_flags(_desc_type),
+			vk::SharingMode::eExclusive,
+		};
+
+		_view.reset();
+		_img = vkc_inst.device().createImageUnique(image_create_info);
+
+		vk::MemoryRequirements requirements
+				= vkc_inst.device().getImageMemoryRequirements(_img.get());
+		vk::MemoryAllocateInfo allocate_info = detail::find_memory_type(
+				vkc_inst, requirements, detail::gpu_mem_flags);
+		_mem = detail::tracked_memory{ vkc_inst, allocate_info };
+		vkc_inst.device().bindImageMemory(_img.get(), _mem.get(), 0);
+
+		vk::ImageViewCreateInfo view_create_info{
+			{},
+			_img.get(),
+			detail::image_view_type(_img_type),
+			detail::to_vk_format(_format),
+			{},
+			detail::image_subresource_range,
+		};
+		_view = vkc_inst.device().createImageViewUnique(view_create_info);
+
+		if (_desc_type == vk::DescriptorType::eCombinedImageSampler
+				&& !_sampler) {
+			_sampler = detail::make_sampler(vkc_inst);
+		}
+
+		transition_layout(vkc_inst, command_pool, fence);
+	}
+
+	void bind(const vkc& vkc_inst, vk::DescriptorSet target_desc_set) {
+		if (!_ids.set_id.valid() || !_ids.binding_id.valid()) {
+			fea::maybe_throw<std::runtime_error>(__FUNCTION__, __LINE__,
+					"Trying to bind an image without set_id and binding_id.");
+		}
+
+		if (_bound) {
+			return;
+		}
+
+		vk::DescriptorImageInfo descriptor_image_info{
+			_sampler.get(),
+			_view.get(),
+			detail::image_layout,
+		};
+
+		vk::WriteDescriptorSet write_descriptor_set{
+			target_desc_set, // write to this descriptor set.
+			_ids.binding_id.id, // write to the binding.
+			0, // the array element we are writing to
+			1, // update a single descriptor.
+			_desc_type,
+			&descriptor_image_info,
+			nullptr,
+		};
+
+		vkc_inst.device().updateDescriptorSets(
+				1, &write_descriptor_set, 0, nullptr);
+		detail::count_stat(vkc_inst, detail::stat::descriptor_updates);
+		_bound = true;
+	}
+
+	// Records the copy in cmd_buf, which may be the previous push command.
+	void make_push_cmd(vk::CommandBuffer cmd_buf) {
+		if (has_push_cmd()) {
+			return;
+		}
+
+		_push_cmd = cmd_buf;
+		detail::make_image_copy_cmd(
+				_staging_buf.get(), _img.get(), _extent, true, _push_cmd);
+		_push_cmd_extent = _extent;
+	}
+
+	// Records the copy in cmd_buf, which may be the previous pull command.
+	void make_pull_cmd(vk::CommandBuffer cmd_buf) {
+		if (has_pull_cmd()) {
+			return;
+		}
+
+		_pull_cmd = cmd_buf;
+		detail::make_image_copy_cmd(
+				_staging_buf.get(), _img.get(), _extent, false, _pull_cmd);
+		_pull_cmd_extent = _extent;
+	}
+
+	void push(vkc& vkc_inst, const uint8_t* in_mem, vk::Fence fence,
+			detail::gpu_timer* timer = nullptr) {
+		void* mapped_memory = vkc_inst.device().mapMemory(
+				_staging_buf.get_memory(), 0, byte_size());
+
+		uint8_t* out_mem = reinterpret_cast<uint8_t*>(mapped_memory);
+		detail::staging_copy(out_mem, in_mem, byte_size(),
+				_staging_buf.write_combined());
+
+		vkc_inst.device().unmapMemory(_staging_buf.get_memory());
+
+		vk::Result res = detail::submit_and_wait(
+				vkc_inst, &_push_cmd, 1, fence, timer);
+		if (res != vk::Result::eSuccess) {
+			fprintf(stderr, "Image push submit failed with result : '%d'\n",
+					res);
+			return;
+		}
+	}
+
+	void pull(vkc& vkc_inst, uint8_t* out_mem, vk::Fence fence,
+			detail::gpu_timer* timer = nullptr) {
+		vk::Result res = detail::submit_and_wait(
+				vkc_inst, &_pull_cmd, 1, fence, timer);
+		if (res != vk::Result::eSuccess) {
+			fprintf(stderr, "Image pull submit failed with result : '%d'\n",
+					res);
+			return;
+		}
+
+		const void* mapped_memory = vkc_inst.device().mapMemory(
+				_staging_buf.get_memory(), 0, byte_size());
+
+		const uint8_t* in_mem = reinterpret_cast<const uint8_t*>(mapped_memory);
+		detail::staging_copy(out_mem, in_mem, byte_size(), false);
+
+		vkc_inst.device().unmapMemory(_staging_buf.get_memory());
+	}
+
+	// Releases the staging memory reserved past byte_size.
+	// Staging contents only live during a transfer, they aren't kept.
+	void shrink_to_fit(const vkc& vkc_inst) {
+		if (_staging_buf.capacity() == _staging_buf.byte_size()) {
+			return;
+		}
+
+		// The cached commands reference the old staging buffer.
+		invalidate_cmds();
+		_staging_buf = _staging_buf.fitted(vkc_inst);
+	}
+
+	// Getters and setters
+
+	size_t byte_size() const {
+		return size_t(_extent.width) * _extent.height * _extent.depth
+			 * detail::texel_byte_size(_format);
+	}
+
+	// The memory allocated for the staging buffer and image.
+	size_t allocated_byte_size() const {
+		return _staging_buf.allocated_byte_size() + _mem.byte_size();
+	}
+
+	vk::Extent3D extent() const {
+		return _extent;
+	}
+
+	format texel_format() const {
+		return _format;
+	}
+
+	vk::ImageType image_type() const {
+		return _img_type;
+	}
+
+	binding_id_v binding_id() const {
+		return _ids.binding_id;
+	}
+
+	bool has_push_cmd() const {
+		return _push_cmd != vk::CommandBuffer{} && _push_cmd_extent == _extent;
+	}
+	bool has_pull_cmd() const {
+		return _pull_cmd != vk::CommandBuffer{} && _pull_cmd_extent == _extent;
+	}
+
+	// The command buffers, kept when outdated so they can be recorded again.
+	vk::CommandBuffer push_cmd() const {
+		return _push_cmd;
+	}
+	vk::CommandBuffer pull_cmd() const {
+		return _pull_cmd;
+	}
+
+private:
+	// The cached commands are recorded again on next transfer.
+	// Call whenever the image or staging buffer is replaced.
+	void invalidate_cmds() {
+		_push_cmd_extent = vk::Extent3D{ 0, 0, 0 };
+		_pull_cmd_extent = vk::Extent3D{ 0, 0, 0 };
+	}
+
+	// New images are in undefined layout, move them to general once.
+	void transition_layout(
+			vkc& vkc_inst, vk::CommandPool command_pool, vk::Fence fence) {
+		vk::CommandBufferAllocateInfo alloc_info{
+			command_pool,
+			vk::CommandBufferLevel::ePrimary,
+			1,
+		};
+
+		std::vector<vk::UniqueCommandBuffer> cmd_bufs
+				= vkc_inst.device().allocateCommandBuffersUnique(alloc_info);
+		assert(cmd_bufs.size() == 1);
+		vk::CommandBuffer& cmd_buf = cmd_bufs.back().get();
+
+		vk::CommandBufferBeginInfo begin_info{
+			vk::CommandBufferUsageFlagBits::eOneTimeSubmit,
+		};
+		cmd_buf.begin(begin_info);
+		detail::count_stat(vkc_inst, detail::stat::command_records);
+
+		vk::ImageMemoryBarrier barrier{
+			{},
+			vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite
+					| vk::AccessFlagBits::eTransferRead
+					| vk::AccessFlagBits::eTransferWrite,
+			vk::ImageLayout::eUndefined,
+			detail::image_layout,
+			VK_QUEUE_FAMILY_IGNORED,
+			VK_QUEUE_FAMILY_IGNORED,
+			_img.get(),
+			detail::image_subresource_range,
+		};
+
+		cmd_buf.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe,
+				vk::PipelineStageFlagBits::eTransfer
+						| vk::PipelineStageFlagBits::eComputeShader,
+				{}, 0, nullptr, 0, nullptr, 1, &barrier);
+		cmd_buf.end();
+
+		vk::Result res = detail::submit_and_wait(vkc_inst, &cmd_buf, 1, fence);
+		if (res != vk::Result::eSuccess) {
+			fprintf(stderr,
+					"Image layout transition failed with result : '%d'\n", res);
+			return;
+		}
+	}
+
+	// Binding and descriptor set ids.
+	buffer_ids _ids;
+
+	// Storage image, sampled image or combined image sampler.
+	vk::DescriptorType _desc_type = vk::DescriptorType::eStorageImage;
+
+	// 1D, 2D or 3D.
+	vk::ImageType _img_type = vk::ImageType::e2D;
+
+	// Texel format.
+	format _format = format::undefined;
+
+	// Size in texels.
+	vk::Extent3D _extent{ 0, 0, 0 };
+
+	// Whether the current image view is bound to the descriptor.
+	bool _bound = false;
+
+	// The staging buffer, accessible from cpu.
+	raw_buffer _staging_buf;
+
+	// The actual gpu image, not accessible from cpu.
+	vk::UniqueImage _img;
+
+	// The memory that backs the image.
+	detail::tracked_memory _mem;
+
+	// The view used to bind the image.
+	vk::UniqueImageView _view;
+
+	// Only used by combined image samplers.
+	vk::UniqueSampler _sampler;
+
+	// The command to copy from staging to gpu.
+	vk::CommandBuffer _push_cmd;
+
+	// The push command extent.
+	// Used to trigger creation of new command when size has changed.
+	vk::Extent3D _push_cmd_extent{ 0, 0, 0 };
+
+	// The command to copy from gpu to staging.
+	vk::CommandBuffer _pull_cmd;
+
+	// The pull command extent.
+	// Used to trigger creation of new command when size has changed.
+	vk::Extent3D _pull_cmd_extent{ 0, 0, 0 };
+};
+
+namespace detail {
+// Allocates a command buffer from the task command pool.
+inline vk::CommandBuffer allocate_cmd(
+		const vkc& vkc_inst, vk::CommandPool command_pool) {
+	vk::CommandBufferAllocateInfo alloc_info{
+		command_pool,
+		vk::CommandBufferLevel::ePrimary,
+		1,
+	};
+
+	std::vector<vk::CommandBuffer> new_buf
+			= vkc_inst.device().allocateCommandBuffers(alloc_info);
+	assert(new_buf.size() == 1);
+	return new_buf.back();
+}
+} // namespace detail
+
+// Records the image copy commands when the extent changed.
+// The previous command buffers are recorded again, which the task command
+// pool allows (eResetCommandBuffer). They are freed with the pool.
+inline void make_push_cmds(const vkc& vkc_inst, vk::CommandPool command_pool,
+		transfer_image& img) {
+	if (img.has_push_cmd()) {
+		return;
+	}
+
+	vk::CommandBuffer cmd_buf = img.push_cmd();
+	if (!cmd_buf) {
+		cmd_buf = detail::allocate_cmd(vkc_inst, command_pool);
+	}
+	img.make_push_cmd(cmd_buf);
+	detail::count_stat(vkc_inst, detail::stat::command_records);
+}
+
+inline void make_pull_cmds(const vkc& vkc_inst, vk::CommandPool command_pool,
+		transfer_image& img) {
+	if (img.has_pull_cmd()) {
+		return;
+	}
+
+	vk::CommandBuffer cmd_buf = img.pull_cmd();
+	if (!cmd_buf) {
+		cmd_buf = detail::allocate_cmd(vkc_inst, command_pool);
+	}
+	img.make_pull_cmd(cmd_buf);
+	detail::count_stat(vkc_inst, detail::stat::command_records);
+}
+} // namespace vkc
+} // namespace fea
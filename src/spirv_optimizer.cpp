@@ -0,0 +1,81 @@
+﻿#include "private_include/spirv_optimizer.hpp"
+#include "private_include/spirv_cache.hpp"
+
+#include <cstdio>
+#include <spirv-tools/libspirv.h>
+#include <spirv-tools/optimizer.hpp>
+#include <unordered_map>
+
+namespace fea {
+namespace vkc {
+namespace {
+// Bump when changing optimizer passes, invalidates cached shaders.
+constexpr uint32_t optimize_settings_version = 1;
+
+uint64_t hash_optimized(fea::span<const uint32_t> spirv,
+		const std::vector<spec_constant>& spec_constants) {
+	detail::spirv_hasher h;
+	h.add("spirv-opt");
+	h.add(&optimize_settings_version, sizeof(optimize_settings_version));
+	h.add(spvSoftwareVersionString());
+
+	h.add(spirv.data(), spirv.size() * sizeof(uint32_t));
+	for (const spec_constant& c : spec_constants) {
+		h.add(&c.id, sizeof(c.id));
+		h.add(&c.value, sizeof(c.value));
+	}
+	return h.value();
+}
+} // namespace
+
+namespace detail {
+std::vector<uint32_t> optimize_spirv(const vkc& vkc_inst,
+		fea::span<const uint32_t> spirv,
+		const std::vector<spec_constant>& spec_constants) {
+	uint64_t key = hash_optimized(spirv, spec_constants);
+
+	std::vector<uint32_t> ret;
+	if (load_cached_spirv(vkc_inst.shader_cache_dir(), key, ret)) {
+		return ret;
+	}
+
+	spvtools::Optimizer optimizer{ SPV_ENV_VULKAN_1_2 };
+	optimizer.SetMessageConsumer([](spv_message_level_t level, const char*,
+										 const spv_position_t& position,
+										 const char* message) {
+		if (level > SPV_MSG_WARNING) {
+			return;
+		}
+		fprintf(stderr, "spirv-opt : %zu : %s\n", position.index, message);
+	});
+
+	/*
+	Fixed specialization constants become regular constants, so the
+	performance passes can fold them (loop bounds, branches, etc).
+	*/
+	if (!spec_constants.empty()) {
+		std::unordered_map<uint32_t, std::vector<uint32_t>> default_values;
+		for (const spec_constant& c : spec_constants) {
+			default_values[c.id] = { c.value };
+		}
+		optimizer.RegisterPass(
+				spvtools::CreateSetSpecConstantDefaultValuePass(
+						default_values));
+		optimizer.RegisterPass(spvtools::CreateFreezeSpecConstantValuePass());
+	}
+
+	// Same as 'spirv-opt -O'.
+	optimizer.RegisterPerformancePasses();
+
+	if (!optimizer.Run(spirv.data(), spirv.size(), &ret)) {
+		fprintf(stderr,
+				"spirv-opt failed, using unoptimized shader instead.\n");
+		return {};
+	}
+
+	store_cached_spirv(vkc_inst.shader_cache_dir(), key, ret);
+	return ret;
+}
+} // namespace detail
+} // namespace vkc
+} // namespace fea
@@ -0,0 +1,181 @@
+﻿#include "vkc/stream.hpp"
+#include "vkc/task.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fea/utils/scope.hpp>
+#include <fea/utils/throw.hpp>
+#include <mutex>
+#include <tbb/concurrent_queue.h>
+#include <tbb/parallel_pipeline.h>
+#include <vector>
+
+namespace fea {
+namespace vkc {
+namespace detail {
+struct stream_impl {
+	stream_impl(const stream_options& o)
+			: opts(o) {
+	}
+
+	stream_options opts;
+
+	// One instance per chunk in flight.
+	std::vector<task> instances;
+	tbb::concurrent_bounded_queue<size_t> free_instances;
+
+	// In elements.
+	std::atomic<size_t> chunk_size{ 0 };
+
+	// The best measured throughput, in elements per second.
+	std::mutex adapt_mutex;
+	double best_throughput = 0.0;
+	size_t best_chunk_size = 0;
+
+	// The smallest size that degraded throughput, 0 if none did.
+	// Growing stops below it.
+	size_t bad_chunk_size = 0;
+};
+} // namespace detail
+
+namespace {
+struct chunk_range {
+	size_t first = 0;
+	size_t count = 0;
+};
+
+// Doubles the chunk size while throughput improves. When it degrades, go back
+// to the best size and never grow to the degraded size again, or the size
+// would oscillate.
+void adapt_chunk_size(
+		detail::stream_impl& impl, size_t count, double seconds) {
+	if (!impl.opts.adaptive || seconds <= 0.0) {
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(impl.adapt_mutex);
+	size_t current = impl.chunk_size;
+	if (count != current) {
+		// A smaller last chunk, or the size has already changed.
+		return;
+	}
+
+	size_t next = current;
+	double throughput = double(count) / seconds;
+	if (throughput >= impl.best_throughput) {
+		impl.best_throughput = throughput;
+		impl.best_chunk_size = current;
+		if (impl.bad_chunk_size == 0 || current * 2 < impl.bad_chunk_size) {
+			next = current * 2;
+		}
+	} else if (throughput < impl.best_throughput * 0.9) {
+		if (current == impl.best_chunk_size) {
+			// Slower at the best size, conditions changed. Measure again.
+			impl.best_throughput = throughput;
+		} else {
+			impl.bad_chunk_size = impl.bad_chunk_size == 0
+					? current
+					: std::min(impl.bad_chunk_size, current);
+			next = impl.best_chunk_size;
+		}
+	}
+
+	impl.chunk_size = std::clamp(
+			next, impl.opts.min_chunk_size, impl.opts.max_chunk_size);
+}
+} // namespace
+
+stream_executor::stream_executor(const task& t, const stream_options& opts)
+		: pimpl_ptr(opts) {
+	if (opts.in_flight == 0 || opts.min_chunk_size == 0
+			|| opts.min_chunk_size > opts.max_chunk_size) {
+		fea::maybe_throw<std::invalid_argument>(__FUNCTION__, __LINE__,
+				"Invalid stream options, need at least 1 chunk in flight and "
+				"min_chunk_size <= max_chunk_size.");
+	}
+
+	_impl->chunk_size = std::clamp(
+			opts.initial_chunk_size, opts.min_chunk_size, opts.max_chunk_size);
+
+	_impl->instances.reserve(opts.in_flight);
+	for (size_t i = 0; i < opts.in_flight; ++i) {
+		_impl->instances.push_back(t.instance());
+		_impl->free_instances.push(i);
+	}
+}
+
+stream_executor::~stream_executor() = default;
+stream_executor::stream_executor(stream_executor&&) noexcept = default;
+stream_executor& stream_executor::operator=(
+		stream_executor&&) noexcept = default;
+
+size_t stream_executor::chunk_size() const {
+	return _impl->chunk_size;
+}
+
+const stream_options& stream_executor::options() const {
+	return _impl->opts;
+}
+
+void stream_executor::run(const char* in_buf_name, const uint8_t* in,
+		size_t in_elem_byte_size, const char* out_buf_name, uint8_t* out,
+		size_t out_elem_byte_size, size_t count,
+		const stream_dispatch& dispatch) {
+	bool in_place = strcmp(in_buf_name, out_buf_name) == 0;
+	if (in_place && in_elem_byte_size != out_elem_byte_size) {
+		fea::maybe_throw<std::invalid_argument>(__FUNCTION__, __LINE__,
+				"In place streaming requires input and output elements of "
+				"the same size.");
+	}
+
+	// Cuts the chunks, in order.
+	size_t next = 0;
+	auto cut_chunk = [&](tbb::flow_control& fc) {
+		if (next == count) {
+			fc.stop();
+			return chunk_range{};
+		}
+
+		size_t chunk_count = std::min(_impl->chunk_size.load(), count - next);
+		chunk_range ret{ next, chunk_count };
+		next += ret.count;
+		return ret;
+	};
+
+	// Runs a chunk on a free instance.
+	auto run_chunk = [&](chunk_range r) {
+		size_t idx = 0;
+		_impl->free_instances.pop(idx);
+		fea::on_exit e([&]() { _impl->free_instances.push(idx); });
+		task& t = _impl->instances[idx];
+
+		auto start = std::chrono::steady_clock::now();
+		t.push_buffer(in_buf_name, in + r.first * in_elem_byte_size,
+				r.count * in_elem_byte_size);
+		if (!in_place) {
+			t.reserve_buffer(out_buf_name, r.count * out_elem_byte_size);
+		}
+
+		dispatch(t, r.first, r.count);
+		t.pull_buffer(out_buf_name, out + r.first * out_elem_byte_size);
+
+		std::chrono::duration<double> dt
+				= std::chrono::steady_clock::now() - start;
+		adapt_chunk_size(*_impl, r.count, dt.count());
+	};
+
+	/*
+	 There are as many tokens as instances, so a free instance is always
+	 available. Chunks run concurrently, the transfers of one overlap the
+	 compute of the others.
+	*/
+	tbb::parallel_pipeline(_impl->instances.size(),
+			tbb::make_filter<void, chunk_range>(
+					tbb::filter_mode::serial_in_order, cut_chunk)
+					& tbb::make_filter<chunk_range, void>(
+							tbb::filter_mode::parallel, run_chunk));
+}
+} // namespace vkc
+} // namespace fea
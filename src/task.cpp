@@ -1,18 +1,31 @@
 ﻿#include "vkc/task.hpp"
+#include "private_include/capture.hpp"
+#include "private_include/glsl_compiler.hpp"
+#include "private_include/host_import.hpp"
 #include "private_include/reflection.hpp"
+#include "private_include/spirv_optimizer.hpp"
+#include "private_include/stats.hpp"
+#include "private_include/submit.hpp"
+#include "private_include/task_impl.hpp"
+#include "private_include/tracer.hpp"
 #include "private_include/transfer_buffer.hpp"
+#include "private_include/transfer_image.hpp"
 #include "vkc/vkc.hpp"
 
 #include <algorithm>
 #include <array>
+#include <chrono>
 #include <cmath>
 #include <cstdio>
 #include <fea/maps/unsigned_map.hpp>
 #include <fea/utils/file.hpp>
 #include <fea/utils/scope.hpp>
 #include <filesystem>
+#include <future>
+#include <memory>
 #include <mutex>
 #include <string>
+#include <tbb/parallel_for.h>
 #include <tbb/spin_mutex.h>
 #include <unordered_map>
 #include <vector>
@@ -20,116 +33,93 @@
 
 namespace fea {
 namespace vkc {
+// Helper functions.
 namespace {
-// A push constant (aka uniform).
-struct push_constant_info {
-	set_id_v set;
-	binding_id_v binding;
-	size_t offset = 0;
-	size_t byte_size = 0;
-	std::vector<uint8_t> constant;
-};
-} // namespace
+void add_pool_size(vk::DescriptorType type,
+		std::vector<vk::DescriptorPoolSize>& pool_sizes) {
+	auto it = std::find_if(pool_sizes.begin(), pool_sizes.end(),
+			[&](const vk::DescriptorPoolSize& s) { return s.type == type; });
 
-namespace detail {
-struct task_impl {
-	task_impl() = default;
-	task_impl(vkc* v)
-			: vkc_inst(v) {
-	}
-
-	const vkc& instance() const {
-		return *vkc_inst;
-	}
-	vkc& instance() {
-		return *vkc_inst;
+	if (it == pool_sizes.end()) {
+		pool_sizes.push_back(vk::DescriptorPoolSize{ type, 1 });
+		return;
 	}
+	++it->descriptorCount;
+}
 
-	vkc* vkc_inst = nullptr;
-
-	/*
-	Descriptors represent resources in shaders. They allow us to use
-	things like uniform buffers, storage buffers and images in GLSL. A
-	single descriptor represents a single resource, and several
-	descriptors are organized into descriptor sets, which are basically
-	just collections of descriptors.
-	*/
-	std::vector<vk::UniqueDescriptorSetLayout> descriptor_set_layouts;
-	vk::UniqueDescriptorPool descriptor_pool;
-	std::vector<vk::DescriptorSet> descriptor_sets;
-
-	/*
-	The pipeline specifies the pipeline that all graphics and compute commands
-	pass though in Vulkan. We will be creating a simple compute pipeline in this
-	application.
-	*/
-	vk::UniqueShaderModule compute_shader_module;
-	vk::UniquePipelineLayout pipeline_layout;
-	vk::UniquePipeline pipeline;
-
-	/*
-	The command buffer is used to record commands, that will be submitted to a
-	queue. To allocate such command buffers, we use a command pool.
-	*/
-	vk::UniqueCommandPool command_pool;
-
-	// The push_constants in the shader (aka uniforms).
-	std::vector<vk::PushConstantRange> push_constants_ranges;
-
-	// Our buffers.
-	fea::unsigned_map<binding_id_t, transfer_buffer> transfer_buffers;
-
-	// string -> id
-	std::unordered_map<std::string, buffer_ids> buffer_name_to_id;
-	std::unordered_map<std::string, push_constant_info>
-			push_constants_name_to_info;
-
-	// The set working group sizes.
-	std::array<uint32_t, 3> workgroupsizes = { 1u, 1u, 1u };
-
-	// The main submit command (aka, execute the shader cmd).
-	vk::CommandBuffer pipeline_submit_cmd;
-};
-} // namespace detail
-
-
-// Helper functions.
-namespace {
-void gather_buffer_descriptorsets(vkc& vkc_inst, detail::task_impl& impl,
+void gather_descriptorsets(vkc& vkc_inst, detail::task_pipeline& pipeline,
 		const spirv_cross::Compiler& comp) {
 
-	std::vector<buffer_binding_info> buffer_bindings
-			= reflect_buffer_bindings(comp);
+	pipeline.buffer_bindings = reflect_buffer_bindings(comp);
+	pipeline.image_bindings = reflect_image_bindings(comp);
+	std::vector<sampler_binding_info> sampler_bindings
+			= reflect_sampler_bindings(comp);
 
 	// Gathered info to call create once.
 	std::vector<vk::DescriptorSetLayoutBinding> layout_bindings;
-	layout_bindings.reserve(buffer_bindings.size());
+	layout_bindings.reserve(pipeline.buffer_bindings.size()
+			+ pipeline.image_bindings.size() + sampler_bindings.size());
 
-	for (const buffer_binding_info& b : buffer_bindings) {
-		// Add empty buffer, ready for future filling.
-		buffer_ids ids{ b.ids.set_id, b.ids.binding_id };
-		impl.transfer_buffers.insert({
-				b.ids.binding_id.id,
-				transfer_buffer{ ids },
-		});
-		impl.buffer_name_to_id[b.name] = ids;
+	for (const buffer_binding_info& b : pipeline.buffer_bindings) {
+		pipeline.buffer_name_to_id[b.name]
+				= buffer_ids{ b.ids.set_id, b.ids.binding_id };
 
 		/*
 		 Here we specify a binding of type VK_DESCRIPTOR_TYPE_STORAGE_BUFFER to
 		 the binding point. This binds to layout(std140, binding = N) buffer
-		 buf in the compute shader.
+		 buf in the compute shader. Texel buffers use their texel buffer
+		 type instead.
 		*/
 		vk::DescriptorSetLayoutBinding descriptor_set_layout_binding{
 			b.ids.binding_id.id,
-			vk::DescriptorType::eStorageBuffer,
+			b.type,
 			1, // used for arrays of buffers
 			vk::ShaderStageFlagBits::eCompute,
 		};
 		layout_bindings.push_back(descriptor_set_layout_binding);
+		add_pool_size(b.type, pipeline.pool_sizes);
+	}
+
+	for (const image_binding_info& b : pipeline.image_bindings) {
+		pipeline.image_name_to_id[b.name]
+				= buffer_ids{ b.ids.set_id, b.ids.binding_id };
+
+		vk::DescriptorSetLayoutBinding descriptor_set_layout_binding{
+			b.ids.binding_id.id,
+			b.type,
+			1,
+			vk::ShaderStageFlagBits::eCompute,
+		};
+		layout_bindings.push_back(descriptor_set_layout_binding);
+		add_pool_size(b.type, pipeline.pool_sizes);
+	}
+
+	/*
+	 Separate samplers are owned by the pipeline and baked in the layout as
+	 immutable samplers, instances never write them. The bindings point into
+	 sampler_handles, which doesn't reallocate.
+	*/
+	std::vector<vk::Sampler> sampler_handles;
+	sampler_handles.reserve(sampler_bindings.size());
+	for (const sampler_binding_info& b : sampler_bindings) {
+		pipeline.samplers.push_back(detail::make_sampler(vkc_inst));
+		sampler_handles.push_back(pipeline.samplers.back().get());
+
+		vk::DescriptorSetLayoutBinding descriptor_set_layout_binding{
+			b.ids.binding_id.id,
+			vk::DescriptorType::eSampler,
+			1,
+			vk::ShaderStageFlagBits::eCompute,
+			&sampler_handles.back(),
+		};
+		layout_bindings.push_back(descriptor_set_layout_binding);
+		add_pool_size(vk::DescriptorType::eSampler, pipeline.pool_sizes);
 	}
+	pipeline.descriptor_count = uint32_t(layout_bindings.size());
 
 	/*
-	 We create partiallybound binding flags for all compute storage buffers.
+	 We create partiallybound binding flags for all compute storage buffers
+	 and images.
 	 These mean we do not have to bind all descriptor sets,
 	 if for example only some buffers are not used while evaling the
 	 shader.
@@ -155,53 +145,13 @@ void gather_buffer_descriptorsets(vkc& vkc_inst, detail::task_impl& impl,
 	descriptor_set_layout_create_info.pNext = &ds_binding_flag_create_info;
 
 	// Create the descriptor set layout.
-	impl.descriptor_set_layouts.push_back(
+	pipeline.descriptor_set_layouts.push_back(
 			vkc_inst.device().createDescriptorSetLayoutUnique(
 					descriptor_set_layout_create_info));
-
-
-	/*
-	 So we will allocate a descriptor set here.
-	 But we need to first create a descriptor pool to do that.
-	*/
-	std::vector<vk::DescriptorPoolSize> pool_sizes;
-
-	vk::DescriptorPoolSize descriptor_pool_size{
-		vk::DescriptorType::eStorageBuffer,
-		uint32_t(layout_bindings.size()),
-	};
-	pool_sizes.push_back(descriptor_pool_size);
-
-	vk::DescriptorPoolCreateInfo descriptor_pool_create_info{
-		{},
-		uint32_t(layout_bindings.size()),
-		pool_sizes,
-	};
-
-	// create descriptor pool.
-	impl.descriptor_pool = vkc_inst.device().createDescriptorPoolUnique(
-			descriptor_pool_create_info);
-
-	/*
-	 With the pool allocated, we can now allocate the descriptor set.
-	*/
-	std::vector<vk::DescriptorSetLayout> layouts;
-	for (const vk::UniqueDescriptorSetLayout& l : impl.descriptor_set_layouts) {
-		layouts.push_back(l.get());
-	}
-
-	vk::DescriptorSetAllocateInfo descriptor_set_allocate_info{
-		impl.descriptor_pool.get(), // pool to allocate from.
-		layouts,
-	};
-
-	// allocate descriptor set.
-	impl.descriptor_sets = vkc_inst.device().allocateDescriptorSets(
-			descriptor_set_allocate_info);
 }
 
 void gather_uniform_descriptorsets(
-		detail::task_impl& impl, const spirv_cross::Compiler& comp) {
+		detail::task_pipeline& pipeline, const spirv_cross::Compiler& comp) {
 	std::vector<uniform_binding_info> uniform_bindings
 			= reflect_uniform_bindings(comp);
 
@@ -209,77 +159,88 @@ void gather_uniform_descriptorsets(
 	//		layout_bindings;
 
 	for (const uniform_binding_info& b : uniform_bindings) {
-		impl.push_constants_name_to_info[b.name] = {
+		pipeline.push_constants_name_to_info[b.name] = {
 			b.ids.set_id,
 			b.ids.binding_id,
 			b.offset,
 			b.size,
-			{},
+			pipeline.push_constants_ranges.size(),
 		};
 
+		if (b.has_group_base) {
+			pipeline.has_group_base = true;
+			pipeline.group_base_offset = b.group_base_offset;
+		}
+
 		vk::PushConstantRange push_constant_range{
 			vk::ShaderStageFlagBits::eCompute,
 			uint32_t(b.offset),
 			uint32_t(b.size),
 		};
-		impl.push_constants_ranges.push_back(push_constant_range);
+		pipeline.push_constants_ranges.push_back(push_constant_range);
 	}
 }
-} // namespace
-
-task::~task() = default;
-task::task(task&&) noexcept = default;
-task& task::operator=(task&&) noexcept = default;
-// task::task(const task&) = default;
-// task& task::operator=(const task&) = default;
-
-task::task(vkc& vkc_inst, const wchar_t* shader_path)
-		: pimpl_ptr(&vkc_inst) {
-	// load shader
-	// the code in comp.spv was created by running the command:
-	// glslangValidator.exe -V shader.comp
-	std::filesystem::path shader_filepath = shader_path;
-	if (!std::filesystem::exists(shader_filepath)) {
-		fprintf(stderr, "File not found : '%s'\n",
-				shader_filepath.string().c_str());
-		fea::maybe_throw<std::invalid_argument>(
-				__FUNCTION__, __LINE__, "Invalid shader path, file not found.");
-	}
-
-	if (shader_filepath.extension() != ".spv") {
-		fprintf(stderr, "Provided file isn't compiled shader (.spv) : '%s'\n",
-				shader_filepath.string().c_str());
-		fea::maybe_throw<std::invalid_argument>(__FUNCTION__, __LINE__,
-				"Provided shader not '.spv'. Task requires precompiled "
-				"shaders.");
-	}
 
-	std::vector<uint8_t> shader_data;
-	if (!fea::open_binary_file(shader_filepath, shader_data)) {
-		fprintf(stderr, "Couldn't open shader file : '%s'\n",
-				shader_filepath.string().c_str());
-		fea::maybe_throw<std::runtime_error>(
-				__FUNCTION__, __LINE__, "Couldn't open shader file.");
-	}
+// Everything needed to create a compute pipeline.
+// The create info points into this struct, don't copy or move it once
+// prepared.
+struct pipeline_create_data {
+	std::shared_ptr<detail::task_pipeline> pipeline;
+	std::vector<vk::SpecializationMapEntry> spec_entries;
+	std::vector<uint32_t> spec_values;
+	vk::SpecializationInfo spec_info;
+	vk::ComputePipelineCreateInfo create_info;
+};
 
-	// spirv compiler wants data as uint32_t, so pad with zeroes.
-	size_t padded_size = size_t(std::ceil(shader_data.size() / 4.0) * 4.0);
-	for (size_t i = shader_data.size(); i < padded_size; ++i) {
-		shader_data.push_back(0);
-	}
+// Reflects the shader and creates everything the pipeline needs, except the
+// pipeline itself. Thread-safe, may be called concurrently.
+void prepare_pipeline(vkc& vkc_inst, fea::span<const uint32_t> spirv,
+		const task_options& opts, pipeline_create_data& data) {
+	// Reflection, optimization and shader module creation.
+	detail::scoped_trace trace(vkc_inst, "prepare_pipeline");
+	data.pipeline = std::make_shared<detail::task_pipeline>();
+	detail::task_pipeline& pipeline = *data.pipeline;
+	pipeline.vkc_inst = &vkc_inst;
 
 	/*
 	Use spriv_cross reflection to figure out what descriptor sets, bindings
 	and buffers we need.
 	*/
-	spirv_cross::Compiler comp{
-		reinterpret_cast<const uint32_t*>(shader_data.data()), padded_size / 4
+	spirv_cross::Compiler comp{ spirv.data(), spirv.size() };
+
+	gather_descriptorsets(vkc_inst, pipeline, comp);
+	gather_uniform_descriptorsets(pipeline, comp);
+
+	pipeline.workgroupsizes
+			= reflect_workinggroup_sizes(comp, opts.spec_constants);
+
+	vk::PhysicalDeviceLimits limits
+			= vkc_inst.physical_device().getProperties().limits;
+	pipeline.max_group_counts = {
+		limits.maxComputeWorkGroupCount[0],
+		limits.maxComputeWorkGroupCount[1],
+		limits.maxComputeWorkGroupCount[2],
 	};
+	pipeline.max_storage_buffer_range = limits.maxStorageBufferRange;
 
-	gather_buffer_descriptorsets(vkc_inst, *_impl, comp);
-	gather_uniform_descriptorsets(*_impl, comp);
+	pipeline.spirv.assign(spirv.data(), spirv.data() + spirv.size());
+	pipeline.opts = opts;
 
-	_impl->workgroupsizes = reflect_workinggroup_sizes(comp);
+	/*
+	Optionally, optimize the shader. Reflection uses the original shader,
+	since optimization may strip unused resources and names.
+	*/
+	std::vector<uint32_t> optimized_spirv;
+	if (opts.optimize) {
+		optimized_spirv
+				= detail::optimize_spirv(vkc_inst, spirv, opts.spec_constants);
+	}
+
+	fea::span<const uint32_t> module_spirv = spirv;
+	if (!optimized_spirv.empty()) {
+		module_spirv = fea::span<const uint32_t>{ optimized_spirv.data(),
+			optimized_spirv.size() };
+	}
 
 	/*
 	We create a compute pipeline here.
@@ -291,12 +252,13 @@ task::task(vkc& vkc_inst, const wchar_t* shader_path)
 	*/
 	vk::ShaderModuleCreateInfo shader_module_create_info{
 		{},
-		padded_size,
-		reinterpret_cast<const uint32_t*>(shader_data.data()),
+		module_spirv.size() * sizeof(uint32_t),
+		module_spirv.data(),
 	};
 
-	_impl->compute_shader_module = vkc_inst.device().createShaderModuleUnique(
-			shader_module_create_info);
+	pipeline.compute_shader_module
+			= vkc_inst.device().createShaderModuleUnique(
+					shader_module_create_info);
 
 	/*
 	 Now let us actually create the compute pipeline.
@@ -304,11 +266,32 @@ task::task(vkc& vkc_inst, const wchar_t* shader_path)
 	 It only consists of a single stage with a compute shader.
 	 So first we specify the compute shader stage, and it's entry point(main).
 	*/
+	/*
+	 Specialization constants are set here. When the shader was optimized,
+	 they are already frozen and these entries are ignored.
+	*/
+	for (const spec_constant& c : opts.spec_constants) {
+		data.spec_entries.push_back(vk::SpecializationMapEntry{
+				c.id,
+				uint32_t(data.spec_values.size() * sizeof(uint32_t)),
+				sizeof(uint32_t),
+		});
+		data.spec_values.push_back(c.value);
+	}
+
+	data.spec_info = vk::SpecializationInfo{
+		uint32_t(data.spec_entries.size()),
+		data.spec_entries.data(),
+		data.spec_values.size() * sizeof(uint32_t),
+		data.spec_values.data(),
+	};
+
 	vk::PipelineShaderStageCreateInfo shader_stage_create_info{
 		{},
 		vk::ShaderStageFlagBits::eCompute,
-		_impl->compute_shader_module.get(),
+		pipeline.compute_shader_module.get(),
 		"main",
+		data.spec_entries.empty() ? nullptr : &data.spec_info,
 	};
 
 	/*
@@ -316,38 +299,161 @@ task::task(vkc& vkc_inst, const wchar_t* shader_path)
 	 So we just specify the descriptor set layout we created earlier.
 	*/
 	std::vector<vk::DescriptorSetLayout> layouts;
-	for (const auto& l : _impl->descriptor_set_layouts) {
+	for (const auto& l : pipeline.descriptor_set_layouts) {
 		layouts.push_back(l.get());
 	}
 
 	vk::PipelineLayoutCreateInfo pipeline_layout_create_info{
 		{},
 		layouts,
-		_impl->push_constants_ranges,
+		pipeline.push_constants_ranges,
 	};
 
-	_impl->pipeline_layout = vkc_inst.device().createPipelineLayoutUnique(
+	pipeline.pipeline_layout = vkc_inst.device().createPipelineLayoutUnique(
 			pipeline_layout_create_info);
 
-	vk::ComputePipelineCreateInfo pipeline_create_info{
+	data.create_info = vk::ComputePipelineCreateInfo{
 		{},
 		shader_stage_create_info,
-		_impl->pipeline_layout.get(),
+		pipeline.pipeline_layout.get(),
 	};
+}
+
+// Reflects the shader and creates the pipeline.
+// The result is immutable and shared by all instances of the task.
+std::shared_ptr<detail::task_pipeline> build_pipeline(vkc& vkc_inst,
+		fea::span<const uint32_t> spirv, const task_options& opts) {
+	pipeline_create_data data;
+	prepare_pipeline(vkc_inst, spirv, opts, data);
 
 	/*
 	 Now, we finally create the compute pipeline.
 	*/
+	detail::scoped_trace trace(vkc_inst, "create_pipeline");
 	vk::ResultValue<vk::UniquePipeline> res
 			= vkc_inst.device().createComputePipelineUnique(
-					{}, pipeline_create_info);
+					{}, data.create_info);
+	detail::count_stat(vkc_inst, detail::stat::pipeline_creations);
 
 	if (res.result != vk::Result::eSuccess) {
 		fprintf(stderr, "CreateComputePipeline failed with result : '%d'\n",
 				res.result);
 	}
 
-	_impl->pipeline = std::move(res.value);
+	data.pipeline->pipeline = std::move(res.value);
+	return std::move(data.pipeline);
+}
+
+// Reads a precompiled shader, padded to uint32_t.
+std::vector<uint32_t> load_spirv_file(
+		const std::filesystem::path& shader_filepath) {
+	// load shader
+	// the code in comp.spv was created by running the command:
+	// glslangValidator.exe -V shader.comp
+	if (!std::filesystem::exists(shader_filepath)) {
+		fprintf(stderr, "File not found : '%s'\n",
+				shader_filepath.string().c_str());
+		fea::maybe_throw<std::invalid_argument>(
+				__FUNCTION__, __LINE__, "Invalid shader path, file not found.");
+	}
+
+	if (shader_filepath.extension() != ".spv") {
+		fprintf(stderr, "Provided file isn't compiled shader (.spv) : '%s'\n",
+				shader_filepath.string().c_str());
+		fea::maybe_throw<std::invalid_argument>(__FUNCTION__, __LINE__,
+				"Provided shader not '.spv'. Task requires precompiled "
+				"shaders.");
+	}
+
+	std::vector<uint8_t> shader_data;
+	if (!fea::open_binary_file(shader_filepath, shader_data)) {
+		fprintf(stderr, "Couldn't open shader file : '%s'\n",
+				shader_filepath.string().c_str());
+		fea::maybe_throw<std::runtime_error>(
+				__FUNCTION__, __LINE__, "Couldn't open shader file.");
+	}
+
+	// spirv compiler wants data as uint32_t, so pad with zeroes.
+	std::vector<uint32_t> ret((shader_data.size() + 3) / 4, 0u);
+	std::copy(shader_data.begin(), shader_data.end(),
+			reinterpret_cast<uint8_t*>(ret.data()));
+	return ret;
+}
+
+// Moves the instance's gpu buffers to staging memory.
+// Called by vkc while the instance is idle, see vkc::residency_budget.
+void spill_buffers(detail::task_impl& impl) {
+	for (auto& kv : impl.transfer_buffers) {
+		kv.second.spill(
+				impl.instance(), impl.command_pool.get(), impl.fence.get());
+	}
+}
+
+// The device memory spill_buffers frees.
+size_t spillable_byte_size(const detail::task_impl& impl) {
+	size_t ret = 0;
+	for (const auto& kv : impl.transfer_buffers) {
+		ret += kv.second.gpu_buf().allocated_byte_size();
+	}
+	return ret;
+}
+
+// Creates the per-instance resources : descriptors, buffers, images,
+// commands and fence. This is all a task instance costs.
+void build_instance(detail::task_impl& impl) {
+	assert(impl.pipeline);
+	vkc& vkc_inst = impl.instance();
+	detail::scoped_trace trace(vkc_inst, "build_instance");
+	const detail::task_pipeline& pipeline = *impl.pipeline;
+
+	// Add empty buffers and images, ready for future filling.
+	for (const buffer_binding_info& b : pipeline.buffer_bindings) {
+		impl.transfer_buffers.insert({
+				b.ids.binding_id.id,
+				transfer_buffer{ b.ids, b.type, b.fmt },
+		});
+	}
+
+	for (const image_binding_info& b : pipeline.image_bindings) {
+		impl.transfer_images.insert({
+				b.ids.binding_id.id,
+				transfer_image{ b.ids, b.type, b.image_type, b.fmt },
+		});
+	}
+
+	impl.push_constants.resize(pipeline.push_constants_ranges.size());
+
+	/*
+	 So we will allocate a descriptor set here.
+	 But we need to first create a descriptor pool to do that.
+	*/
+	vk::DescriptorPoolCreateInfo descriptor_pool_create_info{
+		{},
+		pipeline.descriptor_count,
+		pipeline.pool_sizes,
+	};
+
+	// create descriptor pool.
+	impl.descriptor_pool = vkc_inst.device().createDescriptorPoolUnique(
+			descriptor_pool_create_info);
+
+	/*
+	 With the pool allocated, we can now allocate the descriptor set.
+	*/
+	std::vector<vk::DescriptorSetLayout> layouts;
+	for (const vk::UniqueDescriptorSetLayout& l :
+			pipeline.descriptor_set_layouts) {
+		layouts.push_back(l.get());
+	}
+
+	vk::DescriptorSetAllocateInfo descriptor_set_allocate_info{
+		impl.descriptor_pool.get(), // pool to allocate from.
+		layouts,
+	};
+
+	// allocate descriptor set.
+	impl.descriptor_sets = vkc_inst.device().allocateDescriptorSets(
+			descriptor_set_allocate_info);
 
 
 	/*
@@ -365,7 +471,7 @@ task::task(vkc& vkc_inst, const wchar_t* shader_path)
 		vkc_inst.queue_family(),
 	};
 
-	_impl->command_pool = vkc_inst.device().createCommandPoolUnique(
+	impl.command_pool = vkc_inst.device().createCommandPoolUnique(
 			command_pool_create_info);
 
 
@@ -373,7 +479,7 @@ task::task(vkc& vkc_inst, const wchar_t* shader_path)
 	Now allocate a command buffer from the command pool.
 	*/
 	vk::CommandBufferAllocateInfo command_buffer_allocate_info{
-		_impl->command_pool.get(), // specify the command pool to allocate from.
+		impl.command_pool.get(), // specify the command pool to allocate from.
 		// if the command buffer is primary, it can be directly submitted to
 		// queues. A secondary buffer has to be called from some primary command
 		// buffer, and cannot be directly submitted to a queue. To keep things
@@ -388,17 +494,93 @@ task::task(vkc& vkc_inst, const wchar_t* shader_path)
 
 	// We are only creating 1 new command buffer.
 	assert(new_buf.size() == 1);
-	_impl->pipeline_submit_cmd = std::move(new_buf.back());
+	impl.pipeline_submit_cmd = std::move(new_buf.back());
+
+	/*
+	 Fences are used to wait on the gpu from the cpu. Each instance has its
+	 own, so instances on different threads don't wait on each other.
+	*/
+	impl.fence = vkc_inst.device().createFenceUnique(vk::FenceCreateInfo{});
+
+	// vkc spills idle instances when it needs room.
+	impl.residency.init(
+			vkc_inst, [&impl]() { spill_buffers(impl); },
+			[&impl]() { return spillable_byte_size(impl); });
 }
 
-void task::submit() {
-	submit(1, 1, 1);
+// Binds the pipeline and descriptor set, and records the enqueued push
+// constants.
+void record_bind(detail::task_impl& impl, vk::CommandBuffer cmd_buf) {
+	const detail::task_pipeline& pipeline = *impl.pipeline;
+
+	/*
+	We need to bind a pipeline, AND a descriptor set before we dispatch.
+	The validation layer will NOT give warnings if you forget these, so be
+	very careful not to forget them.
+	*/
+	cmd_buf.bindPipeline(
+			vk::PipelineBindPoint::eCompute, pipeline.pipeline.get());
+	cmd_buf.bindDescriptorSets(vk::PipelineBindPoint::eCompute,
+			pipeline.pipeline_layout.get(), 0, 1, &impl.descriptor_sets.back(),
+			0, nullptr);
+
+	for (const std::pair<const std::string, detail::push_constant_info>& kv :
+			pipeline.push_constants_name_to_info) {
+		const detail::push_constant_info& info = kv.second;
+		const std::vector<uint8_t>& constant = impl.push_constants[info.idx];
+		if (constant.empty()) {
+			continue;
+		}
+
+		cmd_buf.pushConstants(pipeline.pipeline_layout.get(),
+				vk::ShaderStageFlagBits::eCompute, uint32_t(info.offset),
+				uint32_t(info.byte_size), constant.data());
+	}
 }
 
-void task::submit(size_t width, size_t height, size_t depth) {
-	{
-		assert(_impl->pipeline_submit_cmd != vk::CommandBuffer{});
+// The enqueued push constants are used by a single submit.
+void clear_push_constants(detail::task_impl& impl) {
+	for (std::vector<uint8_t>& constant : impl.push_constants) {
+		constant.clear();
+	}
+}
+
+// Measures a task phase while in scope, when profiling.
+// See task::last_timings.
+struct phase_scope {
+	phase_scope(detail::task_impl& impl, phase_timing& out)
+			: _impl(impl)
+			, _out(out) {
+		if (!_impl.profiling) {
+			return;
+		}
+		_impl.timer.reset();
+		_start = std::chrono::steady_clock::now();
+	}
+
+	~phase_scope() {
+		if (!_impl.profiling) {
+			return;
+		}
+		std::chrono::duration<double, std::milli> host_time
+				= std::chrono::steady_clock::now() - _start;
+		_out.host_ms = host_time.count();
+		_out.gpu_ms = _impl.timer.elapsed_ms();
+	}
 
+private:
+	detail::task_impl& _impl;
+	phase_timing& _out;
+	std::chrono::steady_clock::time_point _start;
+};
+
+// Records and submits a dispatch of counts groups, starting at group base.
+// Blocking.
+void submit_dispatch(detail::task_impl& impl,
+		const std::array<size_t, 3>& base,
+		const std::array<size_t, 3>& counts) {
+	assert(impl.pipeline_submit_cmd != vk::CommandBuffer{});
+	{
 		// This records the "main task" of our compute shader and stores it for
 		// later submitting.
 		vk::CommandBufferBeginInfo begin_info{
@@ -406,84 +588,312 @@ void task::submit(size_t width, size_t height, size_t depth) {
 		};
 
 		// start recording commands.
-		_impl->pipeline_submit_cmd.begin(begin_info);
-		fea::on_exit e([this]() {
+		impl.pipeline_submit_cmd.begin(begin_info);
+		detail::count_stat(impl.instance(), detail::stat::command_records);
+		fea::on_exit e([&]() {
 			// end recording commands.
-			_impl->pipeline_submit_cmd.end();
+			impl.pipeline_submit_cmd.end();
 		});
 
-		/*
-		We need to bind a pipeline, AND a descriptor set before we dispatch.
-		The validation layer will NOT give warnings if you forget these, so be
-		very careful not to forget them.
-		*/
-		_impl->pipeline_submit_cmd.bindPipeline(
-				vk::PipelineBindPoint::eCompute, _impl->pipeline.get());
-		_impl->pipeline_submit_cmd.bindDescriptorSets(
-				vk::PipelineBindPoint::eCompute, _impl->pipeline_layout.get(),
-				0, 1, &_impl->descriptor_sets.back(), 0, nullptr);
-
-		for (std::pair<const std::string, push_constant_info>& kv :
-				_impl->push_constants_name_to_info) {
-			push_constant_info& info = kv.second;
-			if (info.constant.empty()) {
-				continue;
-			}
-
-			_impl->pipeline_submit_cmd.pushConstants(
-					_impl->pipeline_layout.get(),
-					vk::ShaderStageFlagBits::eCompute, uint32_t(info.offset),
-					uint32_t(info.byte_size), info.constant.data());
-
-			info.constant.clear();
-		}
+		record_bind(impl, impl.pipeline_submit_cmd);
 
 		/*
 		 Calling vkCmdDispatch basically starts the compute pipeline, and
 		 executes the compute shader. The number of workgroups is specified in
 		 the arguments.
 		*/
-		uint32_t x
-				= uint32_t(std::ceil(width / double(_impl->workgroupsizes[0])));
-		uint32_t y = uint32_t(
-				std::ceil(height / double(_impl->workgroupsizes[1])));
-		uint32_t z
-				= uint32_t(std::ceil(depth / double(_impl->workgroupsizes[2])));
-		_impl->pipeline_submit_cmd.dispatch(x, y, z);
+		detail::record_dispatch(
+				*impl.pipeline, impl.pipeline_submit_cmd, counts, base);
 	}
-	assert(_impl->pipeline_submit_cmd != vk::CommandBuffer{});
 
 	/*
-	Now we shall finally submit the recorded command buffer to a queue.
+	Now we shall finally submit the recorded command buffer to a queue, at the
+	same time giving our fence. We then wait on the fence, other tasks may
+	use the queue concurrently.
 	*/
-	vk::SubmitInfo submit_info{
-		{},
-		nullptr,
-		nullptr,
-		1, // submit a single command buffer
-		// the command buffer to submit.
-		&_impl->pipeline_submit_cmd,
-	};
+	vk::Result res = detail::submit_and_wait(impl.instance(),
+			&impl.pipeline_submit_cmd, 1, impl.fence.get(), impl.timer_ptr());
+	if (res != vk::Result::eSuccess) {
+		fprintf(stderr, "Main task submit failed with result : '%d'\n", res);
+		return;
+	}
+}
+
+// Bound buffers can't be larger than the device range limits.
+void check_buffer_range(const detail::task_pipeline& pipeline,
+		const transfer_buffer& buf, size_t byte_size) {
+	vk::DescriptorType type = buf.gpu_buf().descriptor_type();
+	if (type == vk::DescriptorType::eStorageBuffer
+			&& byte_size > pipeline.max_storage_buffer_range) {
+		fea::maybe_throw<std::invalid_argument>(__FUNCTION__, __LINE__,
+				"Buffer is larger than the device maxStorageBufferRange. "
+				"Split the work in chunks, see stream_executor.");
+	}
+}
+
+// Records a call when capturing, see task::begin_capture.
+void capture_call(detail::task_impl& impl, capture_op op, const char* name,
+		const void* data = nullptr, size_t byte_size = 0,
+		const std::array<uint64_t, 3>& args = {}) {
+	if (!impl.capture) {
+		return;
+	}
+
+	capture_command cmd;
+	cmd.op = op;
+	if (name != nullptr) {
+		cmd.name = impl.capture->add_blob(std::string_view{ name });
+	}
+	if (data != nullptr) {
+		cmd.data = impl.capture->add_blob(data, byte_size);
+	}
+	cmd.args = args;
+	impl.capture->add(cmd);
+}
+} // namespace
+
+task::~task() = default;
+task::task(task&&) noexcept = default;
+task& task::operator=(task&&) noexcept = default;
+// task::task(const task&) = default;
+// task& task::operator=(const task&) = default;
+
+task::task(vkc& vkc_inst, const wchar_t* shader_path, const task_options& opts)
+		: pimpl_ptr(&vkc_inst) {
+	std::vector<uint32_t> spirv = load_spirv_file(shader_path);
+	_impl->pipeline = build_pipeline(vkc_inst,
+			fea::span<const uint32_t>{ spirv.data(), spirv.size() }, opts);
+	build_instance(*_impl);
+}
+
+task::task(vkc& vkc_inst, fea::span<const uint32_t> spirv,
+		const task_options& opts)
+		: pimpl_ptr(&vkc_inst) {
+	_impl->pipeline = build_pipeline(vkc_inst, spirv, opts);
+	build_instance(*_impl);
+}
+
+task::task(vkc& vkc_inst, std::string_view glsl_source,
+		const std::vector<shader_define>& defines, const task_options& opts)
+		: pimpl_ptr(&vkc_inst) {
+	std::vector<uint32_t> spirv
+			= detail::compile_glsl(vkc_inst, glsl_source, defines);
+	_impl->pipeline = build_pipeline(vkc_inst,
+			fea::span<const uint32_t>{ spirv.data(), spirv.size() }, opts);
+	build_instance(*_impl);
+}
+
+task::task(std::shared_ptr<const detail::task_pipeline> pipeline)
+		: pimpl_ptr(std::move(pipeline)) {
+	build_instance(*_impl);
+}
+
+task task::instance() const {
+	return task{ _impl->pipeline };
+}
+
+std::vector<task> load_tasks(vkc& vkc_inst,
+		const std::vector<std::filesystem::path>& shader_paths,
+		const task_options& opts) {
+	// Create infos point into these, never resize.
+	std::vector<pipeline_create_data> datas(shader_paths.size());
 
 	/*
-	We submit the command buffer on the queue, at the same time giving a
-	fence.
+	 Loading, reflecting, optimizing and creating shader modules are
+	 independent for each shader, so do it in parallel.
 	*/
+	tbb::parallel_for(size_t(0), shader_paths.size(), [&](size_t i) {
+		std::vector<uint32_t> spirv = load_spirv_file(shader_paths[i]);
+		prepare_pipeline(vkc_inst,
+				fea::span<const uint32_t>{ spirv.data(), spirv.size() }, opts,
+				datas[i]);
+	});
 
-	_impl->instance().queue().waitIdle();
-	vk::Result res = _impl->instance().queue().submit(1, &submit_info, {});
-	if (res != vk::Result::eSuccess) {
-		fprintf(stderr, "Main task submit failed with result : '%d'\n", res);
+	/*
+	 Then create all pipelines in a single call. This lets the driver
+	 compile them in parallel if it can.
+	*/
+	std::vector<vk::ComputePipelineCreateInfo> create_infos;
+	create_infos.reserve(datas.size());
+	for (const pipeline_create_data& data : datas) {
+		create_infos.push_back(data.create_info);
+	}
+
+	detail::scoped_trace trace(vkc_inst, "create_pipelines");
+	auto res = vkc_inst.device().createComputePipelinesUnique(
+			{}, create_infos);
+	detail::count_stat(vkc_inst, detail::stat::pipeline_creations,
+			create_infos.size());
+
+	if (res.result != vk::Result::eSuccess) {
+		fprintf(stderr, "CreateComputePipelines failed with result : '%d'\n",
+				res.result);
+	}
+	assert(res.value.size() == datas.size());
+
+	std::vector<task> ret;
+	ret.reserve(datas.size());
+	for (size_t i = 0; i < datas.size(); ++i) {
+		datas[i].pipeline->pipeline = std::move(res.value[i]);
+		ret.push_back(task{ std::move(datas[i].pipeline) });
+	}
+	return ret;
+}
+
+std::future<task> load_task_async(vkc& vkc_inst,
+		std::filesystem::path shader_path, task_options opts) {
+	return std::async(std::launch::async,
+			[&vkc_inst, path = std::move(shader_path),
+					opts = std::move(opts)]() {
+				return task{ vkc_inst, path.wstring().c_str(), opts };
+			});
+}
+
+std::future<task> compile_task_async(vkc& vkc_inst, std::string glsl_source,
+		std::vector<shader_define> defines, task_options opts) {
+	return std::async(std::launch::async,
+			[&vkc_inst, src = std::move(glsl_source),
+					defines = std::move(defines), opts = std::move(opts)]() {
+				return task{ vkc_inst, src, defines, opts };
+			});
+}
+
+void task::submit() {
+	submit(1, 1, 1);
+}
+
+void task::submit(size_t width, size_t height, size_t depth) {
+	detail::scoped_trace trace(_impl->instance(), "submit");
+	detail::scoped_latency latency(_impl->instance(), detail::latency::submit);
+	phase_scope phase(*_impl, _impl->timings.submit);
+	capture_call(*_impl, capture_op::submit, nullptr, nullptr, 0,
+			{ width, height, depth });
+	std::unique_lock<std::mutex> resident_lock = detail::make_resident(*_impl);
+	std::array<size_t, 3> counts
+			= detail::group_counts(*_impl->pipeline, width, height, depth);
+	detail::check_dispatch(*_impl->pipeline, counts);
+
+	if (_impl->max_groups_per_submit == 0) {
+		submit_dispatch(*_impl, {}, counts);
+	} else {
+		// Each tile is its own submission, so other work can run in between.
+		detail::for_each_tile(counts, _impl->max_groups_per_submit,
+				[&](const std::array<size_t, 3>& base,
+						const std::array<size_t, 3>& tile) {
+					submit_dispatch(*_impl, base, tile);
+				});
+	}
+	clear_push_constants(*_impl);
+}
+
+void task::max_groups_per_submit(size_t max_groups) {
+	if (max_groups != 0 && !_impl->pipeline->has_group_base) {
+		fea::maybe_throw<std::invalid_argument>(__FUNCTION__, __LINE__,
+				"Tiled submits need the shader push_constant block to declare "
+				"'uvec3 vkc_group_base'.");
+	}
+	_impl->max_groups_per_submit = max_groups;
+}
+
+void task::submit_many(const char* constant_name, const void* constants,
+		size_t constant_byte_size, const size_t* sizes, size_t count,
+		bool barriers) {
+	const detail::task_pipeline& pipeline = *_impl->pipeline;
+	const detail::push_constant_info& info
+			= pipeline.push_constants_name_to_info.at(constant_name);
+
+	if (constant_byte_size != info.byte_size) {
+		fea::maybe_throw<std::invalid_argument>(__FUNCTION__, __LINE__,
+				"Mismatch between passed in push_constant size and "
+				"shader size.");
+	}
+
+	for (size_t i = 0; i < count; ++i) {
+		const size_t* size = sizes + i * 3;
+		detail::check_dispatch(pipeline,
+				detail::group_counts(pipeline, size[0], size[1], size[2]));
+	}
+
+	if (_impl->capture) {
+		std::vector<uint64_t> capture_sizes(sizes, sizes + count * 3);
+		capture_command cmd;
+		cmd.op = capture_op::submit_many;
+		cmd.name = _impl->capture->add_blob(std::string_view{ constant_name });
+		cmd.data = _impl->capture->add_blob(
+				constants, constant_byte_size * count);
+		cmd.extra = _impl->capture->add_blob(capture_sizes.data(),
+				capture_sizes.size() * sizeof(uint64_t));
+		cmd.args = { count, barriers ? 1u : 0u, constant_byte_size };
+		_impl->capture->add(cmd);
+	}
+
+	if (count == 0) {
+		// The enqueued push constants are still consumed, like a submit.
+		clear_push_constants(*_impl);
 		return;
 	}
 
-	_impl->instance().queue().waitIdle();
+	detail::scoped_trace trace(_impl->instance(), "submit_many");
+	detail::scoped_latency latency(_impl->instance(), detail::latency::submit);
+	phase_scope phase(*_impl, _impl->timings.submit);
+	std::unique_lock<std::mutex> resident_lock = detail::make_resident(*_impl);
+	{
+		assert(_impl->pipeline_submit_cmd != vk::CommandBuffer{});
+
+		vk::CommandBufferBeginInfo begin_info{};
+		_impl->pipeline_submit_cmd.begin(begin_info);
+		detail::count_stat(
+				_impl->instance(), detail::stat::command_records);
+		fea::on_exit e([this]() { _impl->pipeline_submit_cmd.end(); });
+
+		record_bind(*_impl, _impl->pipeline_submit_cmd);
+		clear_push_constants(*_impl);
+
+		/*
+		 Each dispatch only changes the push constants. Optionally, a barrier
+		 makes the previous dispatch writes visible to the next one.
+		*/
+		vk::MemoryBarrier barrier{
+			vk::AccessFlagBits::eShaderWrite,
+			vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite,
+		};
+
+		const uint8_t* constant = reinterpret_cast<const uint8_t*>(constants);
+		for (size_t i = 0; i < count; ++i) {
+			if (i != 0 && barriers) {
+				_impl->pipeline_submit_cmd.pipelineBarrier(
+						vk::PipelineStageFlagBits::eComputeShader,
+						vk::PipelineStageFlagBits::eComputeShader, {}, 1,
+						&barrier, 0, nullptr, 0, nullptr);
+			}
+
+			_impl->pipeline_submit_cmd.pushConstants(
+					pipeline.pipeline_layout.get(),
+					vk::ShaderStageFlagBits::eCompute, uint32_t(info.offset),
+					uint32_t(info.byte_size), constant);
+			constant += constant_byte_size;
+
+			const size_t* size = sizes + i * 3;
+			std::array<size_t, 3> counts = detail::group_counts(
+					pipeline, size[0], size[1], size[2]);
+			detail::record_dispatch(
+					pipeline, _impl->pipeline_submit_cmd, counts);
+		}
+	}
+
+	vk::Result res = detail::submit_and_wait(_impl->instance(),
+			&_impl->pipeline_submit_cmd, 1, _impl->fence.get(),
+			_impl->timer_ptr());
+	if (res != vk::Result::eSuccess) {
+		fprintf(stderr, "Submit many failed with result : '%d'\n", res);
+		return;
+	}
 }
 
 void task::push_constant(
 		const char* constant_name, const void* val, size_t size) {
-	push_constant_info& info
-			= _impl->push_constants_name_to_info.at(constant_name);
+	const detail::push_constant_info& info
+			= _impl->pipeline->push_constants_name_to_info.at(constant_name);
 
 	if (size != info.byte_size) {
 		fea::maybe_throw<std::invalid_argument>(__FUNCTION__, __LINE__,
@@ -491,41 +901,93 @@ void task::push_constant(
 				"shader size.");
 	}
 
-	info.constant.resize(size);
+	capture_call(*_impl, capture_op::push_constant, constant_name, val, size);
+
+	std::vector<uint8_t>& constant = _impl->push_constants[info.idx];
+	constant.resize(size);
 	const uint8_t* in_data = reinterpret_cast<const uint8_t*>(val);
-	std::copy(in_data, in_data + size, info.constant.begin());
+	std::copy(in_data, in_data + size, constant.begin());
 }
 
 void task::reserve_buffer(const char* buf_name, size_t byte_size) {
-	buffer_ids ids = _impl->buffer_name_to_id.at(buf_name);
+	buffer_ids ids = _impl->pipeline->buffer_name_to_id.at(buf_name);
 	transfer_buffer& buf = _impl->transfer_buffers.at(ids.binding_id.id);
 	assert(buf.gpu_buf().binding_id() == ids.binding_id);
 
+	check_buffer_range(*_impl->pipeline, buf, byte_size);
+	capture_call(*_impl, capture_op::reserve_buffer, buf_name, nullptr, 0,
+			{ byte_size, 0u, 0u });
+	std::unique_lock<std::mutex> resident_lock = detail::make_resident(
+			*_impl, buf.gpu_buf().grown_capacity(byte_size));
+
 	// won't allocate if preallocated
 	buf.resize(_impl->instance(), byte_size);
 	buf.bind(_impl->instance(), _impl->descriptor_sets[ids.set_id.id]);
+}
 
-	// make_pull_cmds(_impl->instance(), _impl->command_pool.get(), buf);
+void task::reserve_buffer_capacity(const char* buf_name, size_t byte_size) {
+	buffer_ids ids = _impl->pipeline->buffer_name_to_id.at(buf_name);
+	transfer_buffer& buf = _impl->transfer_buffers.at(ids.binding_id.id);
+	assert(buf.gpu_buf().binding_id() == ids.binding_id);
+
+	capture_call(*_impl, capture_op::reserve_buffer_capacity, buf_name,
+			nullptr, 0, { byte_size, 0u, 0u });
+	size_t extra_byte_size
+			= byte_size > buf.gpu_buf().capacity() ? byte_size : 0;
+	std::unique_lock<std::mutex> resident_lock
+			= detail::make_resident(*_impl, extra_byte_size);
+
+	buf.reserve(_impl->instance(), byte_size);
+	if (buf.byte_size() != 0) {
+		// Rebinds if reallocated.
+		buf.bind(_impl->instance(), _impl->descriptor_sets[ids.set_id.id]);
+	}
 }
 
 void task::push_buffer(
 		const char* buf_name, const uint8_t* in_data, size_t byte_size) {
-	buffer_ids ids = _impl->buffer_name_to_id.at(buf_name);
+	buffer_ids ids = _impl->pipeline->buffer_name_to_id.at(buf_name);
 	transfer_buffer& buf = _impl->transfer_buffers.at(ids.binding_id.id);
 	assert(buf.gpu_buf().binding_id() == ids.binding_id);
 
+	detail::scoped_trace trace(_impl->instance(), "push_buffer");
+	detail::scoped_latency latency(_impl->instance(), detail::latency::push);
+	detail::count_stat(
+			_impl->instance(), detail::stat::bytes_pushed, byte_size);
+	phase_scope phase(*_impl, _impl->timings.push);
+	check_buffer_range(*_impl->pipeline, buf, byte_size);
+	capture_call(*_impl, capture_op::push_buffer, buf_name, in_data,
+			byte_size);
+	std::unique_lock<std::mutex> resident_lock = detail::make_resident(
+			*_impl, buf.gpu_buf().grown_capacity(byte_size));
+
 	// won't allocate if preallocated
 	buf.resize(_impl->instance(), byte_size);
 	buf.bind(_impl->instance(), _impl->descriptor_sets[ids.set_id.id]);
 
-	make_push_cmds(_impl->instance(), _impl->command_pool.get(), buf);
-	// make_pull_cmds(_impl->instance(), _impl->command_pool.get(), buf);
-	buf.push(_impl->instance(), in_data);
+	// Aligned user memory is copied straight to the gpu.
+	size_t import_byte_size = detail::importable_byte_size(
+			_impl->instance(), in_data, byte_size);
+	if (import_byte_size != 0) {
+		detail::imported_buffer imported
+				= detail::import_host_memory(_impl->instance(),
+						const_cast<uint8_t*>(in_data), import_byte_size);
+		if (imported) {
+			detail::count_stat(_impl->instance(),
+					detail::stat::bytes_imported, import_byte_size);
+			buf.push_imported(_impl->instance(), _impl->command_pool.get(),
+					in_data, imported.buf.get(), import_byte_size,
+					_impl->fence.get(), _impl->timer_ptr());
+			return;
+		}
+	}
+
+	buf.push(_impl->instance(), in_data, _impl->timer_ptr());
 }
 
 
 size_t task::get_buffer_byte_size(const char* buf_name) const {
-	buffer_ids ids = _impl->buffer_name_to_id.at(buf_name);
+	buffer_ids ids = _impl->pipeline->buffer_name_to_id.at(buf_name);
 	const transfer_buffer& buf = _impl->transfer_buffers.at(ids.binding_id.id);
 	assert(buf.gpu_buf().binding_id() == ids.binding_id);
 
@@ -533,12 +995,265 @@ size_t task::get_buffer_byte_size(const char* buf_name) const {
 }
 
 void task::pull_buffer(const char* buf_name, uint8_t* out_data) {
-	buffer_ids ids = _impl->buffer_name_to_id.at(buf_name);
+	buffer_ids ids = _impl->pipeline->buffer_name_to_id.at(buf_name);
 	transfer_buffer& buf = _impl->transfer_buffers.at(ids.binding_id.id);
 	assert(buf.gpu_buf().binding_id() == ids.binding_id);
 
-	make_pull_cmds(_impl->instance(), _impl->command_pool.get(), buf);
-	buf.pull(_impl->instance(), out_data);
+	detail::scoped_trace trace(_impl->instance(), "pull_buffer");
+	detail::scoped_latency latency(_impl->instance(), detail::latency::pull);
+	detail::count_stat(
+			_impl->instance(), detail::stat::bytes_pulled, buf.byte_size());
+	phase_scope phase(*_impl, _impl->timings.pull);
+	capture_call(*_impl, capture_op::pull_buffer, buf_name);
+	std::unique_lock<std::mutex> resident_lock = detail::make_resident(*_impl);
+
+	// Aligned user memory is copied straight from the gpu.
+	size_t import_byte_size = detail::importable_byte_size(
+			_impl->instance(), out_data, buf.byte_size());
+	if (import_byte_size != 0) {
+		detail::imported_buffer imported = detail::import_host_memory(
+				_impl->instance(), out_data, import_byte_size);
+		if (imported) {
+			detail::count_stat(_impl->instance(),
+					detail::stat::bytes_imported, import_byte_size);
+			buf.pull_imported(_impl->instance(), _impl->command_pool.get(),
+					out_data, imported.buf.get(), import_byte_size,
+					_impl->fence.get(), _impl->timer_ptr());
+			return;
+		}
+	}
+
+	buf.pull(_impl->instance(), out_data, _impl->timer_ptr());
+}
+
+void task::set_format(const char* name, format fmt) {
+	capture_call(*_impl, capture_op::set_format, name, nullptr, 0,
+			{ uint64_t(fmt), 0u, 0u });
+
+	if (auto it = _impl->pipeline->image_name_to_id.find(name);
+			it != _impl->pipeline->image_name_to_id.end()) {
+		transfer_image& img
+				= _impl->transfer_images.at(it->second.binding_id.id);
+		img.set_format(fmt);
+		return;
+	}
+
+	buffer_ids ids = _impl->pipeline->buffer_name_to_id.at(name);
+	transfer_buffer& buf = _impl->transfer_buffers.at(ids.binding_id.id);
+	if (!buf.gpu_buf().is_texel_buffer()) {
+		fea::maybe_throw<std::invalid_argument>(__FUNCTION__, __LINE__,
+				"Only images and texel buffers have a format.");
+	}
+	buf.gpu_buf().descriptor_type(buf.gpu_buf().descriptor_type(), fmt);
+}
+
+void task::reserve_image(
+		const char* img_name, size_t width, size_t height, size_t depth) {
+	buffer_ids ids = _impl->pipeline->image_name_to_id.at(img_name);
+	transfer_image& img = _impl->transfer_images.at(ids.binding_id.id);
+	assert(img.binding_id() == ids.binding_id);
+	capture_call(*_impl, capture_op::reserve_image, img_name, nullptr, 0,
+			{ width, height, depth });
+
+	// Images aren't spilled, but use the command pool and fence.
+	std::unique_lock<std::mutex> resident_lock = detail::make_resident(*_impl);
+
+	// won't allocate if same size
+	img.resize(_impl->instance(), _impl->command_pool.get(),
+			_impl->fence.get(),
+			vk::Extent3D{ uint32_t(width), uint32_t(height), uint32_t(depth) });
+	img.bind(_impl->instance(), _impl->descriptor_sets[ids.set_id.id]);
+}
+
+void task::push_image(const char* img_name, const uint8_t* in_data,
+		size_t byte_size, size_t width, size_t height, size_t depth) {
+	buffer_ids ids = _impl->pipeline->image_name_to_id.at(img_name);
+	transfer_image& img = _impl->transfer_images.at(ids.binding_id.id);
+	assert(img.binding_id() == ids.binding_id);
+
+	detail::scoped_trace trace(_impl->instance(), "push_image");
+	detail::scoped_latency latency(_impl->instance(), detail::latency::push);
+	detail::count_stat(
+			_impl->instance(), detail::stat::bytes_pushed, byte_size);
+	phase_scope phase(*_impl, _impl->timings.push);
+
+	// Images aren't spilled, but use the command pool and fence.
+	std::unique_lock<std::mutex> resident_lock = detail::make_resident(*_impl);
+
+	size_t expected_size = width * height * depth
+			* detail::texel_byte_size(img.texel_format());
+	if (byte_size != expected_size) {
+		fea::maybe_throw<std::invalid_argument>(__FUNCTION__, __LINE__,
+				"Mismatch between passed in data size and image size * "
+				"texel size.");
+	}
+	capture_call(*_impl, capture_op::push_image, img_name, in_data, byte_size,
+			{ width, height, depth });
+
+	// won't allocate if same size
+	img.resize(_impl->instance(), _impl->command_pool.get(),
+			_impl->fence.get(),
+			vk::Extent3D{ uint32_t(width), uint32_t(height), uint32_t(depth) });
+	img.bind(_impl->instance(), _impl->descriptor_sets[ids.set_id.id]);
+
+	make_push_cmds(_impl->instance(), _impl->command_pool.get(), img);
+	img.push(_impl->instance(), in_data, _impl->fence.get(),
+			_impl->timer_ptr());
+}
+
+size_t task::get_image_byte_size(const char* img_name) const {
+	buffer_ids ids = _impl->pipeline->image_name_to_id.at(img_name);
+	const transfer_image& img = _impl->transfer_images.at(ids.binding_id.id);
+	assert(img.binding_id() == ids.binding_id);
+
+	return img.byte_size();
+}
+
+void task::pull_image(const char* img_name, uint8_t* out_data) {
+	buffer_ids ids = _impl->pipeline->image_name_to_id.at(img_name);
+	transfer_image& img = _impl->transfer_images.at(ids.binding_id.id);
+	assert(img.binding_id() == ids.binding_id);
+
+	detail::scoped_trace trace(_impl->instance(), "pull_image");
+	detail::scoped_latency latency(_impl->instance(), detail::latency::pull);
+	detail::count_stat(
+			_impl->instance(), detail::stat::bytes_pulled, img.byte_size());
+	phase_scope phase(*_impl, _impl->timings.pull);
+	capture_call(*_impl, capture_op::pull_image, img_name);
+
+	// Images aren't spilled, but use the command pool and fence.
+	std::unique_lock<std::mutex> resident_lock = detail::make_resident(*_impl);
+
+	make_pull_cmds(_impl->instance(), _impl->command_pool.get(), img);
+	img.pull(_impl->instance(), out_data, _impl->fence.get(),
+			_impl->timer_ptr());
+}
+
+task_memory_stats task::memory_stats() const {
+	task_memory_stats ret;
+	for (const auto& kv : _impl->transfer_buffers) {
+		// Gpu, and staging mirror if any.
+		ret.reserved_bytes += kv.second.allocated_byte_size();
+		ret.used_bytes += kv.second.used_byte_size();
+		ret.spilled_bytes += kv.second.spilled() ? kv.second.byte_size() : 0;
+	}
+	for (const auto& kv : _impl->transfer_images) {
+		// Staging and gpu.
+		ret.reserved_bytes += kv.second.allocated_byte_size();
+		ret.used_bytes += kv.second.byte_size() * 2;
+	}
+	return ret;
+}
+
+void task::trim() {
+	std::unique_lock<std::mutex> resident_lock = detail::make_resident(*_impl);
+	for (auto& kv : _impl->transfer_buffers) {
+		transfer_buffer& buf = kv.second;
+		if (!buf.shrink_to_fit(_impl->instance(), _impl->command_pool.get(),
+					_impl->fence.get())) {
+			continue;
+		}
+
+		// The descriptor references the old buffer.
+		buf.bind(_impl->instance(),
+				_impl->descriptor_sets[buf.gpu_buf().set_id().id]);
+	}
+
+	for (auto& kv : _impl->transfer_images) {
+		kv.second.shrink_to_fit(_impl->instance());
+	}
+}
+
+void task::profiling(bool enable) {
+	_impl->profiling = enable;
+}
+
+bool task::profiling() const {
+	return _impl->profiling;
+}
+
+const task_timings& task::last_timings() const {
+	return _impl->timings;
+}
+
+bool task::begin_capture(const std::filesystem::path& filepath) {
+	end_capture();
+
+	const detail::task_pipeline& pipeline = *_impl->pipeline;
+	auto writer = std::make_unique<detail::capture_writer>();
+	if (!writer->open(filepath, pipeline.spirv, pipeline.opts)) {
+		return false;
+	}
+	_impl->capture = std::move(writer);
+	return true;
+}
+
+bool task::end_capture() {
+	if (!_impl->capture) {
+		return false;
+	}
+
+	bool ret = _impl->capture->close();
+	_impl->capture.reset();
+	return ret;
+}
+
+bool task::capturing() const {
+	return bool(_impl->capture);
+}
+
+task_reflection task::reflection() const {
+	const detail::task_pipeline& pipeline = *_impl->pipeline;
+
+	task_reflection ret;
+	ret.work_group_size = pipeline.workgroupsizes;
+
+	for (const buffer_binding_info& b : pipeline.buffer_bindings) {
+		resource_info info;
+		info.name = b.name;
+		info.set = uint32_t(b.ids.set_id.id);
+		info.binding = uint32_t(b.ids.binding_id.id);
+		info.fmt = b.fmt;
+		info.texel = b.type != vk::DescriptorType::eStorageBuffer;
+		ret.buffers.push_back(std::move(info));
+	}
+
+	for (const image_binding_info& b : pipeline.image_bindings) {
+		resource_info info;
+		info.name = b.name;
+		info.set = uint32_t(b.ids.set_id.id);
+		info.binding = uint32_t(b.ids.binding_id.id);
+		info.fmt = b.fmt;
+		switch (b.image_type) {
+		case vk::ImageType::e1D: {
+			info.dimensions = 1;
+		} break;
+		case vk::ImageType::e2D: {
+			info.dimensions = 2;
+		} break;
+		default: {
+			info.dimensions = 3;
+		} break;
+		}
+		ret.images.push_back(std::move(info));
+	}
+
+	// In declaration order.
+	std::vector<std::pair<size_t, push_constant_block>> constants;
+	for (const auto& kv : pipeline.push_constants_name_to_info) {
+		constants.push_back({
+				kv.second.offset,
+				push_constant_block{ kv.first, kv.second.byte_size },
+		});
+	}
+	std::sort(constants.begin(), constants.end(),
+			[](const auto& lhs, const auto& rhs) {
+				return lhs.first < rhs.first;
+			});
+	for (auto& c : constants) {
+		ret.push_constants.push_back(std::move(c.second));
+	}
+	return ret;
 }
 
 } // namespace vkc
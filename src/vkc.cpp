@@ -1,7 +1,16 @@
 ﻿#include "vkc/vkc.hpp"
-
+#include "private_include/residency.hpp"
+#include "private_include/staging_ring.hpp"
+#include "private_include/stats.hpp"
+#include "private_include/tracer.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <fea/utils/throw.hpp>
 #include <filesystem>
+#include <mutex>
+#include <string>
 #include <vector>
 #include <vulkan/vulkan.hpp>
 
@@ -43,6 +52,7 @@ struct vkc_impl {
 	Vulkan. Often, it is simply a graphics card that supports Vulkan.
 	*/
 	vk::PhysicalDevice physical_device;
+	std::string device_name;
 
 	/*
 	Then we have the logical device VkDevice, which basically allows
@@ -60,6 +70,12 @@ struct vkc_impl {
 	*/
 	vk::Queue queue; // a queue supporting compute operations.
 
+	/*
+	Queue operations must be externally synchronized. Tasks on different
+	threads share the queue, so submits are serialized with this mutex.
+	*/
+	std::mutex queue_mutex;
+
 	/*
 	Groups of queues that have the same capabilities(for instance, they all
 	supports graphics and computer operations), are grouped into queue families.
@@ -69,6 +85,75 @@ struct vkc_impl {
 	queue in its family.
 	*/
 	uint32_t queue_family_idx;
+
+	// Where runtime compiled spirv is stored.
+	std::filesystem::path shader_cache_dir;
+
+	/*
+	VK_EXT_external_memory_host lets us import user allocations as buffer
+	memory, so the gpu can copy straight from and into them. Optional.
+	*/
+	std::vector<const char*> enabled_device_extensions;
+	bool external_host_memory = false;
+	size_t external_host_memory_alignment = 0;
+	PFN_vkGetMemoryHostPointerPropertiesEXT get_host_pointer_properties
+			= nullptr;
+
+	/*
+	VK_EXT_memory_budget reports how much memory the driver lets us use,
+	and how much we use, per heap. Optional.
+	*/
+	bool memory_budget = false;
+	vk::PhysicalDeviceMemoryProperties memory_properties;
+
+	/*
+	Memory allocated by tasks, per heap. Tasks allocate on any thread.
+	*/
+	mutable std::array<std::atomic<size_t>, VK_MAX_MEMORY_HEAPS>
+			heap_allocated_bytes{};
+	mutable std::array<std::atomic<size_t>, VK_MAX_MEMORY_HEAPS>
+			heap_allocation_count{};
+
+	/*
+	Task instances register themselves as residents. When the residency
+	budget is set, the least recently used are spilled to make room.
+	*/
+	std::atomic<size_t> residency_budget{ 0 };
+	std::atomic<uint64_t> residency_clock{ 0 };
+	std::mutex residency_mutex;
+	std::vector<resident*> residents;
+
+	// Device memory of picked victims, which is being spilled outside the
+	// residency mutex.
+	size_t pending_spill_bytes = 0;
+
+	/*
+	See vkc::stats, only updated with FEA_VKC_STATS.
+	*/
+	mutable stats_data stats;
+
+	/*
+	See vkc::tracing.
+	*/
+	mutable tracer trace;
+
+	/*
+	Host visible memory shared by all buffer transfers, see
+	vkc::staging_ring_byte_size. Declared after the device, it is destroyed
+	first.
+	*/
+	mutable staging_ring staging;
+
+	size_t device_local_allocated_bytes() const {
+		size_t ret = 0;
+		for (uint32_t i = 0; i < memory_properties.memoryHeapCount; ++i) {
+			if (memory_properties.memoryHeaps[i].flags
+					& vk::MemoryHeapFlagBits::eDeviceLocal) {
+				ret += heap_allocated_bytes[i].load();
+			}
+		}
+		return ret;
+	}
 };
 } // namespace detail
 
@@ -258,7 +343,8 @@ vkc::vkc() {
 
 	vk::PhysicalDeviceProperties gpu_properties
 			= _impl->physical_device.getProperties();
-	printf("Selected GPU : '%s'\n", gpu_properties.deviceName.data());
+	_impl->device_name = gpu_properties.deviceName.data();
+	printf("Selected GPU : '%s'\n", _impl->device_name.c_str());
 
 	// for (const vk::PhysicalDevice& device :
 	//		_instance.enumeratePhysicalDevices()) {
@@ -300,6 +386,44 @@ vkc::vkc() {
 		&queue_priority, // one queue, so low priority
 	};
 
+	/*
+	Enable the optional device extensions we support.
+	*/
+	{
+		std::vector<vk::ExtensionProperties> extension_properties
+				= _impl->physical_device.enumerateDeviceExtensionProperties();
+
+		auto has_extension = [&](const char* name) {
+			return std::any_of(extension_properties.begin(),
+					extension_properties.end(),
+					[&](const vk::ExtensionProperties& prop) {
+						return strcmp(name, prop.extensionName) == 0;
+					});
+		};
+
+		if (has_extension(VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME)) {
+			_impl->enabled_device_extensions.push_back(
+					VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME);
+			_impl->external_host_memory = true;
+
+			using host_props_t
+					= vk::PhysicalDeviceExternalMemoryHostPropertiesEXT;
+			vk::StructureChain<vk::PhysicalDeviceProperties2, host_props_t>
+					props = _impl->physical_device.getProperties2<
+							vk::PhysicalDeviceProperties2, host_props_t>();
+			_impl->external_host_memory_alignment = size_t(
+					props.get<host_props_t>().minImportedHostPointerAlignment);
+		}
+
+		if (has_extension(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME)) {
+			_impl->enabled_device_extensions.push_back(
+					VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+			_impl->memory_budget = true;
+		}
+	}
+
+	_impl->memory_properties = _impl->physical_device.getMemoryProperties();
+
 	// Specify any desired device features here. We do not need any for this
 	// application, though.
 	vk::PhysicalDeviceFeatures device_features{};
@@ -322,8 +446,8 @@ vkc::vkc() {
 		0,
 		nullptr,
 		// Extensions
-		0,
-		nullptr,
+		uint32_t(_impl->enabled_device_extensions.size()),
+		_impl->enabled_device_extensions.data(),
 		// Features
 		&device_features,
 	};
@@ -351,6 +475,24 @@ vkc::vkc() {
 
 	// Get a handle to the only member of the queue family.
 	_impl->queue = _impl->device->getQueue(_impl->queue_family_idx, 0);
+
+	if (_impl->external_host_memory) {
+		_impl->get_host_pointer_properties
+				= reinterpret_cast<PFN_vkGetMemoryHostPointerPropertiesEXT>(
+						_impl->device->getProcAddr(
+								"vkGetMemoryHostPointerPropertiesEXT"));
+
+		if (_impl->get_host_pointer_properties == nullptr) {
+			_impl->external_host_memory = false;
+		}
+	}
+
+	// Default shader cache, in temp directory.
+	std::error_code ec;
+	std::filesystem::path temp_dir = std::filesystem::temp_directory_path(ec);
+	if (!ec) {
+		_impl->shader_cache_dir = temp_dir / "fea_vkc_cache";
+	}
 }
 
 vkc::~vkc() {
@@ -373,6 +515,17 @@ vkc::~vkc() {
 	}
 }
 
+const std::string& vkc::device_name() const {
+	return _impl->device_name;
+}
+
+void vkc::shader_cache_dir(const std::filesystem::path& dir) {
+	_impl->shader_cache_dir = dir;
+}
+const std::filesystem::path& vkc::shader_cache_dir() const {
+	return _impl->shader_cache_dir;
+}
+
 const vk::Instance& vkc::instance() const {
 	return _impl->instance.get();
 }
@@ -401,9 +554,282 @@ vk::Queue& vkc::queue() {
 	return _impl->queue;
 }
 
+vk::Result vkc::submit(
+		const vk::SubmitInfo& submit_info, const vk::Fence& fence) {
+	detail::count_stat(*this, detail::stat::queue_submits);
+	std::lock_guard<std::mutex> lock(_impl->queue_mutex);
+	return _impl->queue.submit(1, &submit_info, fence);
+}
+
 uint32_t vkc::queue_family() const {
 	return _impl->queue_family_idx;
 }
 
+bool vkc::external_host_memory() const {
+	return _impl->external_host_memory;
+}
+
+size_t vkc::external_host_memory_alignment() const {
+	return _impl->external_host_memory_alignment;
+}
+
+uint32_t vkc::host_pointer_memory_type_bits(const void* ptr) const {
+	if (!_impl->external_host_memory) {
+		return 0;
+	}
+
+	VkMemoryHostPointerPropertiesEXT props{
+		VK_STRUCTURE_TYPE_MEMORY_HOST_POINTER_PROPERTIES_EXT,
+	};
+	VkResult res = _impl->get_host_pointer_properties(_impl->device.get(),
+			VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT, ptr,
+			&props);
+
+	if (res != VK_SUCCESS) {
+		return 0;
+	}
+	return props.memoryTypeBits;
+}
+
+device_memory_stats vkc::memory_stats() const {
+	const vk::PhysicalDeviceMemoryProperties& mem_props
+			= _impl->memory_properties;
+
+	device_memory_stats ret;
+	ret.has_budget = _impl->memory_budget;
+	ret.staging_ring_bytes = _impl->staging.allocated_byte_size();
+	vk::PhysicalDeviceProperties gpu_properties
+			= _impl->physical_device.getProperties();
+	ret.max_allocation_count
+			= size_t(gpu_properties.limits.maxMemoryAllocationCount);
+	ret.heaps.resize(mem_props.memoryHeapCount);
+
+	using budget_props_t = vk::PhysicalDeviceMemoryBudgetPropertiesEXT;
+	budget_props_t budget_props{};
+	if (_impl->memory_budget) {
+		vk::StructureChain<vk::PhysicalDeviceMemoryProperties2, budget_props_t>
+				props = _impl->physical_device.getMemoryProperties2<
+						vk::PhysicalDeviceMemoryProperties2, budget_props_t>();
+		budget_props = props.get<budget_props_t>();
+	}
+
+	for (uint32_t i = 0; i < mem_props.memoryHeapCount; ++i) {
+		heap_stats& heap = ret.heaps[i];
+		heap.size = size_t(mem_props.memoryHeaps[i].size);
+		heap.device_local = bool(mem_props.memoryHeaps[i].flags
+				& vk::MemoryHeapFlagBits::eDeviceLocal);
+		heap.allocated_bytes = _impl->heap_allocated_bytes[i].load();
+		heap.allocation_count = _impl->heap_allocation_count[i].load();
+		ret.allocation_count += heap.allocation_count;
+
+		if (_impl->memory_budget) {
+			heap.budget = size_t(budget_props.heapBudget[i]);
+			heap.usage = size_t(budget_props.heapUsage[i]);
+		} else {
+			heap.budget = heap.size;
+			heap.usage = heap.allocated_bytes;
+		}
+	}
+	return ret;
+}
+
+void vkc::track_allocation(uint32_t memory_type_idx, size_t byte_size) const {
+	assert(memory_type_idx < _impl->memory_properties.memoryTypeCount);
+	uint32_t heap_idx
+			= _impl->memory_properties.memoryTypes[memory_type_idx].heapIndex;
+	_impl->heap_allocated_bytes[heap_idx] += byte_size;
+	++_impl->heap_allocation_count[heap_idx];
+	detail::count_stat(*this, detail::stat::memory_allocations);
+}
+
+void vkc::track_free(uint32_t memory_type_idx, size_t byte_size) const {
+	assert(memory_type_idx < _impl->memory_properties.memoryTypeCount);
+	uint32_t heap_idx
+			= _impl->memory_properties.memoryTypes[memory_type_idx].heapIndex;
+	assert(_impl->heap_allocated_bytes[heap_idx] >= byte_size);
+	assert(_impl->heap_allocation_count[heap_idx] != 0);
+	_impl->heap_allocated_bytes[heap_idx] -= byte_size;
+	--_impl->heap_allocation_count[heap_idx];
+}
+
+vkc_stats vkc::stats() const {
+	vkc_stats ret;
+	ret.enabled = _impl->stats.enabled;
+
+	auto counter = [this](detail::stat s) {
+		return _impl->stats.counters[size_t(s)].load();
+	};
+	ret.queue_submits = counter(detail::stat::queue_submits);
+	ret.fence_waits = counter(detail::stat::fence_waits);
+	ret.bytes_pushed = counter(detail::stat::bytes_pushed);
+	ret.bytes_pulled = counter(detail::stat::bytes_pulled);
+	ret.bytes_imported = counter(detail::stat::bytes_imported);
+	ret.command_records = counter(detail::stat::command_records);
+	ret.descriptor_updates = counter(detail::stat::descriptor_updates);
+	ret.memory_allocations = counter(detail::stat::memory_allocations);
+	ret.pipeline_creations = counter(detail::stat::pipeline_creations);
+
+	auto histogram = [this](detail::latency l) {
+		return _impl->stats.latencies[size_t(l)].load();
+	};
+	ret.submit_latency = histogram(detail::latency::submit);
+	ret.push_latency = histogram(detail::latency::push);
+	ret.pull_latency = histogram(detail::latency::pull);
+	return ret;
+}
+
+void vkc::reset_stats() {
+	for (std::atomic<uint64_t>& c : _impl->stats.counters) {
+		c = 0;
+	}
+	for (detail::atomic_histogram& h : _impl->stats.latencies) {
+		h.reset();
+	}
+}
+
+void vkc::collect_stats(bool enable) {
+	_impl->stats.enabled = enable;
+}
+
+bool vkc::collect_stats() const {
+	return _impl->stats.enabled;
+}
+
+detail::stats_data& vkc::stats_data() const {
+	return _impl->stats;
+}
+
+void vkc::tracing(bool enable) {
+	if (enable) {
+		_impl->trace.period_ns = double(
+				_impl->physical_device.getProperties().limits.timestampPeriod);
+	}
+	_impl->trace.enabled = enable;
+}
+
+bool vkc::tracing() const {
+	return _impl->trace.enabled;
+}
+
+bool vkc::write_trace(const std::filesystem::path& filepath) {
+	return _impl->trace.write(filepath);
+}
+
+detail::tracer& vkc::tracer() const {
+	return _impl->trace;
+}
+
+void vkc::residency_budget(size_t budget_bytes) {
+	_impl->residency_budget = budget_bytes;
+}
+
+size_t vkc::residency_budget() const {
+	return _impl->residency_budget;
+}
+
+void vkc::staging_ring_byte_size(size_t byte_size) {
+	_impl->staging.byte_size(*this, byte_size);
+}
+
+size_t vkc::staging_ring_byte_size() const {
+	return _impl->staging.byte_size();
+}
+
+detail::staging_ring& vkc::staging_ring() const {
+	return _impl->staging;
+}
+
+void vkc::register_resident(detail::resident* r) {
+	std::lock_guard<std::mutex> lock(_impl->residency_mutex);
+	_impl->residents.push_back(r);
+}
+
+void vkc::unregister_resident(detail::resident* r) {
+	std::lock_guard<std::mutex> lock(_impl->residency_mutex);
+	auto it = std::find(_impl->residents.begin(), _impl->residents.end(), r);
+	assert(it != _impl->residents.end());
+	_impl->residents.erase(it);
+}
+
+void vkc::make_room(detail::resident* r, size_t byte_size,
+		const std::vector<detail::resident*>& held) {
+	r->last_use = ++_impl->residency_clock;
+
+	size_t budget = _impl->residency_budget;
+	if (budget == 0) {
+		return;
+	}
+
+	/*
+	 Victims are picked and locked under the residency mutex, then spilled
+	 outside of it. Spills are blocking gpu copies, other threads keep
+	 making room meanwhile. Locked victims can't be used or picked again
+	 until spilled.
+	*/
+	std::vector<detail::resident*> victims;
+	std::vector<std::unique_lock<std::mutex>> victim_locks;
+	size_t picked_bytes = 0;
+	{
+		std::lock_guard<std::mutex> lock(_impl->residency_mutex);
+		size_t allocated = _impl->device_local_allocated_bytes();
+		size_t freed = _impl->pending_spill_bytes;
+		auto fits = [&]() {
+			return allocated - std::min(allocated, freed + picked_bytes)
+					   + byte_size
+				<= budget;
+		};
+		if (fits()) {
+			return;
+		}
+
+		std::vector<detail::resident*> lru = _impl->residents;
+		std::sort(lru.begin(), lru.end(),
+				[](const detail::resident* lhs, const detail::resident* rhs) {
+					return lhs->last_use < rhs->last_use;
+				});
+
+		for (detail::resident* victim : lru) {
+			// Locked by the caller, locking again is undefined.
+			if (victim == r
+					|| std::find(held.begin(), held.end(), victim)
+							   != held.end()) {
+				continue;
+			}
+
+			// In use on another thread, skip it.
+			std::unique_lock<std::mutex> victim_lock(
+					victim->in_use, std::try_to_lock);
+			if (!victim_lock.owns_lock()) {
+				continue;
+			}
+
+			size_t victim_bytes = victim->spillable_byte_size();
+			if (victim_bytes == 0) {
+				continue;
+			}
+
+			victims.push_back(victim);
+			victim_locks.push_back(std::move(victim_lock));
+			picked_bytes += victim_bytes;
+			if (fits()) {
+				break;
+			}
+		}
+		_impl->pending_spill_bytes += picked_bytes;
+	}
+
+	for (detail::resident* victim : victims) {
+		victim->spill();
+	}
+	victim_locks.clear();
+
+	{
+		std::lock_guard<std::mutex> lock(_impl->residency_mutex);
+		_impl->pending_spill_bytes -= picked_bytes;
+	}
+
+	// If there wasn't enough room, the allocation may still succeed.
+}
+
 } // namespace vkc
 } // namespace fea
@@ -0,0 +1,88 @@
+#include <algorithm>
+#include <gtest/gtest.h>
+#include <numeric>
+#include <vkc/flow.hpp>
+#include <vkc/vulkan_compute.hpp>
+#include <vkc_shaders/task_tests.comp.hpp>
+
+namespace {
+namespace vkc = fea::vkc;
+
+struct p_constants {
+	uint32_t test_num = 0;
+	float mul = 0.f;
+};
+
+struct chunk {
+	size_t idx = 0;
+	std::vector<float> data;
+};
+
+TEST(flow, task_node) {
+	constexpr size_t num_chunks = 32;
+	constexpr size_t chunk_size = 1000;
+
+	vkc::vkc gpu;
+	vkc::task t{ gpu, vkc_shaders::task_tests_comp };
+
+	tbb::flow::graph g;
+
+	// Cpu stage, generates the chunks.
+	size_t next_chunk = 0;
+	tbb::flow::input_node<chunk> decode{ g,
+		[&](tbb::flow_control& fc) {
+			if (next_chunk == num_chunks) {
+				fc.stop();
+				return chunk{};
+			}
+
+			chunk ret;
+			ret.idx = next_chunk++;
+			ret.data.resize(chunk_size);
+			std::iota(ret.data.begin(), ret.data.end(), float(ret.idx));
+			return ret;
+		} };
+
+	// Gpu stage, multiplies the chunks.
+	vkc::task_node<chunk, chunk> compute{ g, t, 2,
+		[](vkc::task& instance, const chunk& in) {
+			p_constants constants;
+			constants.test_num = 1;
+			constants.mul = 2.f;
+
+			chunk ret;
+			ret.idx = in.idx;
+			instance.push_constant("p_constants", constants);
+			instance.push_buffer("buf1", in.data);
+			instance.submit();
+			instance.pull_buffer("buf1", &ret.data);
+			return ret;
+		} };
+	EXPECT_EQ(compute.max_in_flight(), 2u);
+
+	// Cpu stage, gathers the results.
+	std::vector<chunk> results;
+	tbb::flow::function_node<chunk> encode{ g, tbb::flow::serial,
+		[&](const chunk& c) { results.push_back(c); } };
+
+	tbb::flow::make_edge(decode, compute.node());
+	tbb::flow::make_edge(compute.node(), encode);
+	decode.activate();
+	g.wait_for_all();
+
+	ASSERT_EQ(results.size(), num_chunks);
+	std::sort(results.begin(), results.end(),
+			[](const chunk& lhs, const chunk& rhs) {
+				return lhs.idx < rhs.idx;
+			});
+
+	for (size_t i = 0; i < num_chunks; ++i) {
+		const chunk& c = results[i];
+		EXPECT_EQ(c.idx, i);
+		ASSERT_EQ(c.data.size(), chunk_size);
+		for (size_t j = 0; j < chunk_size; ++j) {
+			EXPECT_EQ(c.data[j], (float(i) + float(j)) * 2.f);
+		}
+	}
+}
+} // namespace
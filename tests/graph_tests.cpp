@@ -0,0 +1,183 @@
+#include <algorithm>
+#include <gtest/gtest.h>
+#include <numeric>
+#include <vkc/vulkan_compute.hpp>
+#include <vkc_shaders/task_tests.comp.hpp>
+
+namespace {
+namespace vkc = fea::vkc;
+
+struct p_constants {
+	uint32_t test_num = 0;
+	float mul = 0.f;
+};
+
+TEST(graph, replay) {
+	std::vector<float> sent_data(100);
+	std::iota(sent_data.begin(), sent_data.end(), 0.f);
+	std::vector<float> recieved_data;
+
+	p_constants constants;
+	constants.test_num = 1;
+	constants.mul = 2.f;
+
+	vkc::vkc gpu;
+	vkc::task t{ gpu, vkc_shaders::task_tests_comp };
+
+	// Size and bind the buffer.
+	t.push_buffer("buf1", sent_data);
+
+	// Push, multiply in place, pull.
+	vkc::graph g{ gpu };
+	g.push(t, "buf1");
+	t.push_constant("p_constants", constants);
+	size_t d = g.dispatch(t, 1);
+	g.pull(t, "buf1");
+
+	for (size_t i = 0; i < 4; ++i) {
+		constants.mul = float(i + 1);
+		g.write(t, "buf1", sent_data);
+		g.push_constant(d, "p_constants", constants);
+		g.submit();
+		g.read(t, "buf1", &recieved_data);
+
+		EXPECT_EQ(sent_data.size(), recieved_data.size());
+		for (size_t j = 0; j < recieved_data.size(); ++j) {
+			EXPECT_EQ(sent_data[j] * constants.mul, recieved_data[j]);
+		}
+	}
+
+	// Replay without writing, multiplies the previous result again.
+	g.submit();
+	g.read(t, "buf1", &recieved_data);
+	for (size_t j = 0; j < recieved_data.size(); ++j) {
+		EXPECT_EQ(sent_data[j] * 16.f, recieved_data[j]);
+	}
+}
+
+TEST(graph, multiple_tasks) {
+	std::vector<float> sent_data(100);
+	std::iota(sent_data.begin(), sent_data.end(), 0.f);
+	std::vector<float> recieved_data;
+
+	vkc::vkc gpu;
+	vkc::task t1{ gpu, vkc_shaders::task_tests_comp };
+	vkc::task t2 = t1.instance();
+
+	t1.push_buffer("buf1", sent_data);
+	t2.push_buffer("buf1", sent_data);
+	t2.push_buffer("buf2", sent_data);
+	t2.reserve_buffer<float>("out_buf", sent_data.size());
+
+	// t1 multiplies by 3, t2 adds its buffers.
+	vkc::graph g{ gpu };
+	g.push(t1, "buf1");
+	t1.push_constant("p_constants", p_constants{ 1, 3.f });
+	g.dispatch(t1, 1);
+	g.pull(t1, "buf1");
+	g.push(t2, "buf1");
+	g.push(t2, "buf2");
+	t2.push_constant("p_constants", p_constants{ 2, 0.f });
+	g.dispatch(t2, 1);
+	g.pull(t2, "out_buf");
+
+	g.write(t1, "buf1", sent_data);
+	g.write(t2, "buf1", sent_data);
+	g.write(t2, "buf2", sent_data);
+	g.submit();
+
+	g.read(t1, "buf1", &recieved_data);
+	for (size_t j = 0; j < recieved_data.size(); ++j) {
+		EXPECT_EQ(sent_data[j] * 3.f, recieved_data[j]);
+	}
+
+	g.read(t2, "out_buf", &recieved_data);
+	EXPECT_EQ(sent_data.size(), recieved_data.size());
+	for (size_t j = 0; j < recieved_data.size(); ++j) {
+		EXPECT_EQ(sent_data[j] * 2.f, recieved_data[j]);
+	}
+}
+
+TEST(graph, task_pushes) {
+	std::vector<float> sent_data(100);
+	std::iota(sent_data.begin(), sent_data.end(), 0.f);
+	std::vector<float> recieved_data;
+
+	vkc::vkc gpu;
+	vkc::task t{ gpu, vkc_shaders::task_tests_comp };
+	t.push_buffer("buf1", sent_data);
+
+	vkc::graph g{ gpu };
+	g.push(t, "buf1");
+	t.push_constant("p_constants", p_constants{ 1, 2.f });
+	g.dispatch(t, 1);
+	g.pull(t, "buf1");
+
+	// Before any submit, the staging memory holds the pushed data.
+	g.read(t, "buf1", &recieved_data);
+	EXPECT_EQ(sent_data, recieved_data);
+
+	// Never written through the graph, the task push is uploaded.
+	g.submit();
+	g.read(t, "buf1", &recieved_data);
+	ASSERT_EQ(sent_data.size(), recieved_data.size());
+	for (size_t j = 0; j < recieved_data.size(); ++j) {
+		EXPECT_EQ(sent_data[j] * 2.f, recieved_data[j]);
+	}
+
+	// Task pushes replace older graph writes.
+	std::vector<float> zeros(sent_data.size(), 0.f);
+	g.write(t, "buf1", zeros);
+	std::reverse(sent_data.begin(), sent_data.end());
+	t.push_buffer("buf1", sent_data);
+
+	g.submit();
+	g.read(t, "buf1", &recieved_data);
+	ASSERT_EQ(sent_data.size(), recieved_data.size());
+	for (size_t j = 0; j < recieved_data.size(); ++j) {
+		EXPECT_EQ(sent_data[j] * 2.f, recieved_data[j]);
+	}
+}
+
+TEST(graph, patching) {
+	std::vector<float> sent_data(100);
+	std::iota(sent_data.begin(), sent_data.end(), 0.f);
+	std::vector<float> recieved_data;
+
+	vkc::vkc gpu;
+	vkc::task t{ gpu, vkc_shaders::task_tests_comp };
+	t.push_buffer("buf1", sent_data);
+
+	vkc::graph g{ gpu };
+	g.push(t, "buf1");
+	t.push_constant("p_constants", p_constants{ 1, 2.f });
+	size_t d = g.dispatch(t, 1);
+	g.pull(t, "buf1");
+	g.submit();
+
+	// Changed push_constants only record their dispatch again.
+	gpu.collect_stats(true);
+	uint64_t command_records = gpu.stats().command_records;
+	g.write(t, "buf1", sent_data);
+	g.push_constant(d, "p_constants", p_constants{ 1, 3.f });
+	g.submit();
+	EXPECT_EQ(gpu.stats().command_records, command_records + 1);
+
+	g.read(t, "buf1", &recieved_data);
+	ASSERT_EQ(sent_data.size(), recieved_data.size());
+	for (size_t j = 0; j < recieved_data.size(); ++j) {
+		EXPECT_EQ(sent_data[j] * 3.f, recieved_data[j]);
+	}
+
+	// Shrinking keeps the buffers, but the graph is recorded again with the
+	// new size.
+	sent_data.resize(50);
+	t.push_buffer("buf1", sent_data);
+	g.submit();
+	g.read(t, "buf1", &recieved_data);
+	ASSERT_EQ(sent_data.size(), recieved_data.size());
+	for (size_t j = 0; j < recieved_data.size(); ++j) {
+		EXPECT_EQ(sent_data[j] * 3.f, recieved_data[j]);
+	}
+}
+} // namespace
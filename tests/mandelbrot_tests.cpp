@@ -120,4 +120,44 @@ TEST(vulkan_compute, basics) {
 		//}
 	}
 }
+
+TEST(vulkan_compute, storage_image) {
+	std::filesystem::path exe_path = fea::executable_dir(argv0);
+	std::wstring buf_shader_path
+			= exe_path / L"data/shaders/mandelbrot.comp.spv";
+	std::wstring img_shader_path
+			= exe_path / L"data/shaders/mandelbrot_image.comp.spv";
+
+	size_block size;
+	vkc::vkc gpu;
+
+	// Reference, float pixels in a storage buffer.
+	std::vector<pixel> buf_data;
+	{
+		vkc::task t{ gpu, buf_shader_path.c_str() };
+		t.push_constant("p_constants", size);
+		t.reserve_buffer<pixel>("buf", size.width * size_t(size.height));
+		t.submit(size.width, size.height, 1);
+		t.pull_buffer("buf", &buf_data);
+	}
+
+	// 8bit pixels written directly by the shader.
+	std::vector<uint8_t> img_data;
+	{
+		vkc::task t{ gpu, img_shader_path.c_str() };
+		t.push_constant("p_constants", size);
+		t.reserve_image("img", size.width, size.height);
+		t.submit(size.width, size.height, 1);
+		t.pull_image("img", &img_data);
+	}
+
+	ASSERT_EQ(img_data.size(), buf_data.size() * 4);
+	for (size_t i = 0; i < buf_data.size(); ++i) {
+		// Unorm conversion rounds, allow off by one.
+		EXPECT_NEAR(float(img_data[i * 4]), buf_data[i].r * 255.f, 1.f);
+		EXPECT_NEAR(float(img_data[i * 4 + 1]), buf_data[i].g * 255.f, 1.f);
+		EXPECT_NEAR(float(img_data[i * 4 + 2]), buf_data[i].b * 255.f, 1.f);
+		EXPECT_NEAR(float(img_data[i * 4 + 3]), buf_data[i].a * 255.f, 1.f);
+	}
+}
 } // namespace
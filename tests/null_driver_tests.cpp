@@ -0,0 +1,110 @@
+#include <chrono>
+#include <cstdio>
+#include <fea/utils/platform.hpp>
+#include <gtest/gtest.h>
+#include <vector>
+#include <vkc/vulkan_compute.hpp>
+#include <vkc_shaders/task_tests.comp.hpp>
+
+/*
+Host overhead tests.
+These only run on the null vulkan driver (tools/null_icd), where commands
+return immediately. What is measured is the library itself : name lookups,
+command recording, descriptor updates, allocations and staging copies.
+
+Build the null_driver_tests target, or run the tests with
+VK_ICD_FILENAMES=<bin>/vkc_null_icd.json.
+*/
+
+namespace {
+namespace vkc = fea::vkc;
+
+struct p_constants {
+	uint32_t test_num = 0;
+	float mul = 0.f;
+};
+
+constexpr size_t num_iterations = 1000;
+
+bool on_null_driver(const vkc::vkc& gpu) {
+	return gpu.device_name() == "vkc null driver";
+}
+
+// Mean duration of func, in microseconds.
+template <class Func>
+double mean_us(Func&& func) {
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < num_iterations; ++i) {
+		func();
+	}
+	std::chrono::duration<double, std::micro> elapsed
+			= std::chrono::steady_clock::now() - start;
+	return elapsed.count() / double(num_iterations);
+}
+
+TEST(null_driver, submit) {
+	vkc::vkc gpu;
+	if (!on_null_driver(gpu)) {
+		GTEST_SKIP() << "Requires the null vulkan driver.";
+	}
+	gpu.collect_stats(true);
+
+	vkc::task t{ gpu, vkc_shaders::task_tests_comp };
+	std::vector<float> data(16 * 1024, 1.f);
+	t.push_buffer("buf1", data);
+	t.push_constant("p_constants", p_constants{});
+	t.submit();
+
+	vkc::vkc_stats before = gpu.stats();
+	double us = mean_us([&]() {
+		t.push_constant("p_constants", p_constants{});
+		t.submit();
+	});
+	vkc::vkc_stats after = gpu.stats();
+	printf("submit : %.2f us\n", us);
+
+	// Steady state submits only record and submit.
+	EXPECT_EQ(after.queue_submits - before.queue_submits, num_iterations);
+	EXPECT_EQ(
+			after.command_records - before.command_records, num_iterations);
+	EXPECT_EQ(after.memory_allocations, before.memory_allocations);
+	EXPECT_EQ(after.descriptor_updates, before.descriptor_updates);
+	EXPECT_EQ(after.pipeline_creations, before.pipeline_creations);
+
+#if defined(FEA_RELEASE)
+	// Very generous, catches pathological regressions only.
+	EXPECT_LT(us, 1000.0);
+#endif
+}
+
+TEST(null_driver, push_pull) {
+	vkc::vkc gpu;
+	if (!on_null_driver(gpu)) {
+		GTEST_SKIP() << "Requires the null vulkan driver.";
+	}
+	gpu.collect_stats(true);
+
+	vkc::task t{ gpu, vkc_shaders::task_tests_comp };
+	std::vector<float> data(16 * 1024, 1.f);
+	std::vector<float> out;
+	t.push_buffer("buf1", data);
+	t.pull_buffer("buf1", &out);
+
+	vkc::vkc_stats before = gpu.stats();
+	double push_us = mean_us([&]() { t.push_buffer("buf1", data); });
+	double pull_us = mean_us([&]() { t.pull_buffer("buf1", &out); });
+	vkc::vkc_stats after = gpu.stats();
+	printf("push_buffer : %.2f us\npull_buffer : %.2f us\n", push_us,
+			pull_us);
+
+	// Same size transfers reuse their buffers and descriptors.
+	EXPECT_EQ(after.queue_submits - before.queue_submits, 2 * num_iterations);
+	EXPECT_EQ(after.memory_allocations, before.memory_allocations);
+	EXPECT_EQ(after.descriptor_updates, before.descriptor_updates);
+
+#if defined(FEA_RELEASE)
+	EXPECT_LT(push_us, 1000.0);
+	EXPECT_LT(pull_us, 1000.0);
+#endif
+}
+} // namespace
@@ -0,0 +1,57 @@
+#include <gtest/gtest.h>
+#include <mutex>
+#include <numeric>
+#include <vkc/vulkan_compute.hpp>
+#include <vkc_shaders/task_tests.comp.hpp>
+
+namespace {
+namespace vkc = fea::vkc;
+
+struct p_constants {
+	uint32_t test_num = 0;
+	float mul = 0.f;
+};
+
+TEST(stream, in_place) {
+	std::vector<float> sent_data(100'000);
+	std::iota(sent_data.begin(), sent_data.end(), 0.f);
+	std::vector<float> recieved_data;
+
+	vkc::vkc gpu;
+	vkc::task t{ gpu, vkc_shaders::task_tests_comp };
+
+	vkc::stream_options opts;
+	opts.initial_chunk_size = 1000;
+	opts.min_chunk_size = 100;
+	opts.max_chunk_size = 32'000;
+	vkc::stream_executor s{ t, opts };
+	EXPECT_EQ(s.chunk_size(), 1000u);
+
+	p_constants constants;
+	constants.test_num = 1;
+	constants.mul = 2.f;
+
+	std::mutex streamed_mutex;
+	size_t streamed = 0;
+	s.run("buf1", sent_data, "buf1", &recieved_data,
+			[&](vkc::task& instance, size_t first, size_t count) {
+				EXPECT_LT(first, sent_data.size());
+				EXPECT_LE(first + count, sent_data.size());
+				instance.push_constant("p_constants", constants);
+				instance.submit();
+
+				// Dispatches are called concurrently.
+				std::lock_guard<std::mutex> lock(streamed_mutex);
+				streamed += count;
+			});
+
+	EXPECT_EQ(streamed, sent_data.size());
+	EXPECT_GE(s.chunk_size(), opts.min_chunk_size);
+	EXPECT_LE(s.chunk_size(), opts.max_chunk_size);
+
+	ASSERT_EQ(sent_data.size(), recieved_data.size());
+	for (size_t i = 0; i < recieved_data.size(); ++i) {
+		EXPECT_EQ(sent_data[i] * constants.mul, recieved_data[i]);
+	}
+}
+} // namespace
@@ -1,15 +1,26 @@
 #include <fea/utils/platform.hpp>
 #if defined(FEA_RELEASE) && defined(FEA_VKC_BENCHMARKS)
 
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fea/benchmark/benchmark.hpp>
 #include <fea/utils/file.hpp>
+#include <fstream>
 #include <gtest/gtest.h>
 #include <numeric>
+#include <stdexcept>
+#include <string>
 #include <tbb/parallel_for.h>
+#include <vector>
 #include <vkc/vulkan_compute.hpp>
+#include <vkc_shaders/task_tests.comp.hpp>
 
 extern const char* argv0;
 
 namespace {
+namespace vkc = fea::vkc;
+
 struct p_constants {
 	uint32_t test_num = 0;
 	float mul = 0.f;
@@ -17,19 +28,258 @@ struct p_constants {
 	// float f3 = 0.f;
 };
 
+// Test 0 of task_tests.comp does nothing.
+constexpr p_constants empty_kernel{ 0, 0.f };
+
+// The largest buffer of the bandwidth sweep.
+// Override with the FEA_VKC_BENCH_MAX_BYTES environment variable.
+size_t max_sweep_byte_size() {
+	size_t ret = size_t(1) << 30;
+	if (const char* env = std::getenv("FEA_VKC_BENCH_MAX_BYTES")) {
+		ret = size_t(std::strtoull(env, nullptr, 10));
+	}
+	return ret;
+}
+
+std::string byte_size_str(size_t byte_size) {
+	if (byte_size >= (size_t(1) << 30)) {
+		return std::to_string(byte_size >> 30) + " GB";
+	}
+	if (byte_size >= (size_t(1) << 20)) {
+		return std::to_string(byte_size >> 20) + " MB";
+	}
+	return std::to_string(byte_size >> 10) + " KB";
+}
+
+struct bench_result {
+	std::string group;
+	std::string name;
+	size_t iterations = 0;
+
+	// Mean of one iteration.
+	double seconds = 0.0;
+
+	// Bytes transferred per iteration, 0 if not a bandwidth benchmark.
+	size_t byte_size = 0;
+};
+
+// Runs benchmarks through fea::bench, and keeps the results for the json
+// report.
+struct bench_recorder {
+	void title(const char* group) {
+		if (_started) {
+			_suite.print();
+			_suite = fea::bench::suite{};
+		}
+		_started = true;
+		_group = group;
+		_suite.title(group);
+	}
+
+	// Runs func iterations times, and records the mean.
+	template <class Func>
+	void run(const std::string& name, size_t iterations, size_t byte_size,
+			Func&& func) {
+		bench_result res{ _group, name, iterations, 0.0, byte_size };
+		_suite.benchmark(name.c_str(), [&]() {
+			auto start = std::chrono::steady_clock::now();
+			for (size_t i = 0; i < iterations; ++i) {
+				func();
+			}
+			std::chrono::duration<double> elapsed
+					= std::chrono::steady_clock::now() - start;
+			res.seconds = elapsed.count() / double(iterations);
+		});
+		_results.push_back(res);
+	}
+
+	void skip(const std::string& name, const char* reason) {
+		printf("%s : skipped, %s\n", name.c_str(), reason);
+	}
+
+	// Prints the last suite and writes all results.
+	void finish(const std::filesystem::path& json_path) {
+		if (_started) {
+			_suite.print();
+		}
+
+		std::ofstream ofs{ json_path };
+		ASSERT_TRUE(ofs.is_open());
+
+		ofs << "{\n\t\"suite\": \"fea_vkc\",\n\t\"benchmarks\": [";
+		for (size_t i = 0; i < _results.size(); ++i) {
+			const bench_result& r = _results[i];
+			ofs << (i == 0 ? "\n" : ",\n");
+			ofs << "\t\t{ \"group\": \"" << r.group << "\", \"name\": \""
+				<< r.name << "\", \"iterations\": " << r.iterations
+				<< ", \"seconds\": " << r.seconds
+				<< ", \"bytes\": " << r.byte_size;
+			if (r.byte_size != 0 && r.seconds > 0.0) {
+				ofs << ", \"bytes_per_second\": "
+					<< double(r.byte_size) / r.seconds;
+			}
+			ofs << " }";
+		}
+		ofs << "\n\t]\n}\n";
+		printf("\nBenchmark results written to '%s'\n",
+				json_path.string().c_str());
+	}
+
+private:
+	fea::bench::suite _suite;
+	std::string _group;
+	bool _started = false;
+	std::vector<bench_result> _results;
+};
+
 TEST(task, benchmarks) {
-	// std::filesystem::path exe_path = fea::executable_dir(argv0);
-	// std::filesystem::path shader_path
-	//		= exe_path / L"data/shaders/task_tests.comp.spv";
+	std::filesystem::path exe_path = fea::executable_dir(argv0);
+	bench_recorder rec;
+
+	// Task construction.
+	{
+		rec.title("Task construction");
+
+		// A new vkc and its first task.
+		rec.run("cold (vkc + task)", 5, 0, [&]() {
+			vkc::vkc gpu;
+			vkc::task t{ gpu, vkc_shaders::task_tests_comp };
+		});
+
+		vkc::vkc gpu;
+		vkc::task proto{ gpu, vkc_shaders::task_tests_comp };
+		rec.run("warm (task)", 50, 0, [&]() {
+			vkc::task t{ gpu, vkc_shaders::task_tests_comp };
+		});
+
+		// Shares the pipeline.
+		rec.run("instance", 200, 0, [&]() { vkc::task t = proto.instance(); });
+	}
+
+	// Dispatch latency.
+	{
+		rec.title("Empty kernel dispatch");
+
+		vkc::vkc gpu;
+		vkc::task t{ gpu, vkc_shaders::task_tests_comp };
+		std::vector<float> data(1024);
+		t.push_buffer("buf1", data);
+
+		rec.run("submit", 1000, 0, [&]() {
+			t.push_constant("p_constants", empty_kernel);
+			t.submit();
+		});
+
+		// One submit of 100 dispatches.
+		std::vector<vkc::dispatch_info<p_constants>> dispatches(100);
+		for (vkc::dispatch_info<p_constants>& d : dispatches) {
+			d.constants = empty_kernel;
+		}
+		rec.run("submit_many x100", 100, 0,
+				[&]() { t.submit_many("p_constants", dispatches); });
+	}
+
+	// Transfer bandwidth.
+	{
+		rec.title("Push and pull bandwidth");
+
+		vkc::vkc gpu;
+		vkc::task t{ gpu, vkc_shaders::task_tests_comp };
+
+		size_t max_byte_size = max_sweep_byte_size();
+		for (size_t byte_size = 4 * 1024; byte_size <= max_byte_size;
+				byte_size *= 4) {
+			std::vector<float> data(byte_size / sizeof(float), 1.f);
+			std::vector<float> out;
+			std::string size_str = byte_size_str(byte_size);
+
+			// Fewer passes for large sizes.
+			size_t iterations = std::max(
+					size_t(1), size_t(64 * 1024 * 1024) / byte_size);
+			iterations = std::min(iterations, size_t(100));
+
+			try {
+				// Allocates, not measured.
+				t.push_buffer("buf1", data);
+			} catch (const std::exception& e) {
+				rec.skip("push " + size_str, e.what());
+				break;
+			}
+
+			rec.run("push " + size_str, iterations, byte_size,
+					[&]() { t.push_buffer("buf1", data); });
+			rec.run("pull " + size_str, iterations, byte_size,
+					[&]() { t.pull_buffer("buf1", &out); });
+
+			// Frees the largest sizes before the next one.
+			t.trim();
+		}
+	}
+
+	// Resize and rebind.
+	{
+		rec.title("Resize and rebind");
+
+		vkc::vkc gpu;
+		vkc::task t{ gpu, vkc_shaders::task_tests_comp };
+		std::vector<float> big(1024 * 1024, 1.f);
+		std::vector<float> small(512 * 1024, 1.f);
+		t.push_buffer("buf1", big);
+
+		// The capacity is kept, only descriptors and commands change.
+		bool use_big = false;
+		rec.run("rebind, same capacity", 100, 0, [&]() {
+			t.reserve_buffer<float>(
+					"buf1", use_big ? big.size() : small.size());
+			use_big = !use_big;
+		});
+
+		// Trim releases the capacity, so every resize allocates.
+		rec.run("trim + reallocate", 100, 0, [&]() {
+			t.reserve_buffer<float>("buf1", small.size());
+			t.trim();
+			t.reserve_buffer<float>("buf1", big.size());
+		});
+	}
+
+	// Multi-threaded throughput.
+	{
+		rec.title("Task throughput (push, submit, pull)");
+
+		vkc::vkc gpu;
+		vkc::task proto{ gpu, vkc_shaders::task_tests_comp };
+		p_constants constants{ 1, 2.f };
+		std::vector<float> data(64 * 1024, 1.f);
+
+		constexpr size_t num_jobs = 256;
+		std::vector<vkc::task> instances;
+		for (size_t i = 0; i < num_jobs; ++i) {
+			instances.push_back(proto.instance());
+		}
 
-	// std::vector<float> sent_data(100);
-	// std::iota(sent_data.begin(), sent_data.end(), 0.f);
-	// std::vector<float> recieved_data;
+		// Pushed and pulled.
+		size_t job_byte_size = data.size() * sizeof(float) * 2;
+		auto job = [&](vkc::task& t) {
+			std::vector<float> out;
+			t.push_buffer("buf1", data);
+			t.push_constant("p_constants", constants);
+			t.submit();
+			t.pull_buffer("buf1", &out);
+		};
 
-	// p_constants constants;
+		rec.run("256 jobs, 1 thread", 1, num_jobs * job_byte_size, [&]() {
+			for (vkc::task& t : instances) {
+				job(t);
+			}
+		});
+		rec.run("256 jobs, tbb::parallel_for", 1, num_jobs * job_byte_size,
+				[&]() {
+					tbb::parallel_for(size_t(0), num_jobs,
+							[&](size_t i) { job(instances[i]); });
+				});
+	}
 
-	// vkc::vkc gpu;
-	// vkc::task t{ gpu, shader_path.c_str() };
+	rec.finish(exe_path / "vkc_benchmarks.json");
 }
 } // namespace
 #endif
@@ -1,8 +1,18 @@
+#include <algorithm>
+#include <array>
+#include <cstring>
 #include <fea/utils/file.hpp>
+#include <fstream>
 #include <gtest/gtest.h>
 #include <numeric>
+#include <string>
 #include <tbb/parallel_for.h>
 #include <vkc/vulkan_compute.hpp>
+#include <vkc_shaders/group_base.comp.hpp>
+#include <vkc_shaders/sampled_images.comp.hpp>
+#include <vkc_shaders/separate_sampler.comp.hpp>
+#include <vkc_shaders/task_tests.comp.hpp>
+#include <vkc_shaders/texel_buffers.comp.hpp>
 
 extern const char* argv0;
 
@@ -16,6 +26,13 @@ struct p_constants {
 	// float f3 = 0.f;
 };
 
+// vkc_group_base is set by vkc, leave it 0.
+struct group_constants {
+	uint32_t vkc_group_base[3] = {};
+	uint32_t width = 101;
+	uint32_t height = 37;
+};
+
 TEST(task, basics) {
 	std::filesystem::path exe_path = fea::executable_dir(argv0);
 	std::filesystem::path shader_path
@@ -119,43 +136,1068 @@ TEST(task, basics) {
 	}
 }
 
-//// TODO
-// TEST(task, task_level_threading) {
-//	constexpr size_t num_tasks = 1'000;
-//	std::filesystem::path exe_path = fea::executable_dir(argv0);
-//	std::filesystem::path shader_path
-//			= exe_path / L"data/shaders/task_tests.comp.spv";
-//
-//	std::vector<float> sent_data(100);
-//	std::iota(sent_data.begin(), sent_data.end(), 0.f);
-//
-//	vkc::vkc gpu;
-//
-//	// Use grainsize 1 to force many threads.
-//	tbb::parallel_for(tbb::blocked_range<size_t>{ 0, num_tasks, 1 },
-//			[&](const tbb::blocked_range<size_t>& range) {
-//				for (size_t i = range.begin(); i < range.end(); ++i) {
-//					vkc::task t{ gpu, shader_path.c_str() };
-//					std::vector<float> recieved_data;
-//
-//					p_constants constants;
-//					constants.test_num = 2;
-//
-//					t.push_constant("p_constants", constants);
-//					t.push_buffer("buf1", sent_data);
-//					t.push_buffer("buf2", sent_data);
-//					t.reserve_buffer<float>("out_buf", sent_data.size());
-//					t.submit();
-//					t.pull_buffer("out_buf", &recieved_data);
-//
-//					EXPECT_EQ(sent_data.size(), recieved_data.size());
-//
-//					for (size_t j = 0; j < recieved_data.size(); ++j) {
-//						float expected = sent_data[j] + sent_data[j];
-//						EXPECT_EQ(expected, recieved_data[j]);
-//					}
-//				}
-//			});
-//}
+TEST(task, embedded_shader) {
+	std::vector<float> sent_data(100);
+	std::iota(sent_data.begin(), sent_data.end(), 0.f);
+	std::vector<float> recieved_data;
+
+	p_constants constants;
+	constants.test_num = 1;
+	constants.mul = 2.f;
+
+	vkc::vkc gpu;
+	vkc::task t{ gpu, vkc_shaders::task_tests_comp };
+
+	t.push_constant("p_constants", constants);
+	t.push_buffer("buf1", sent_data);
+	t.submit();
+	t.pull_buffer("buf1", &recieved_data);
+
+	EXPECT_EQ(sent_data.size(), recieved_data.size());
+	for (size_t i = 0; i < recieved_data.size(); ++i) {
+		EXPECT_EQ(sent_data[i] * constants.mul, recieved_data[i]);
+	}
+}
+
+TEST(task, glsl_source) {
+	constexpr const char* shader_src = R"(
+#version 450
+layout(local_size_x = 1, local_size_y = 1, local_size_z = 1) in;
+
+layout(std430, binding = 0) buffer buf {
+	float buf_data[];
+};
+
+void main() {
+	uint i = gl_GlobalInvocationID.x;
+	buf_data[i] = buf_data[i] * MUL;
+}
+)";
+
+	std::filesystem::path exe_path = fea::executable_dir(argv0);
+	std::filesystem::path cache_dir = exe_path / L"shader_cache_tests";
+	std::filesystem::remove_all(cache_dir);
+
+	std::vector<float> sent_data(100);
+	std::iota(sent_data.begin(), sent_data.end(), 0.f);
+	std::vector<float> recieved_data;
+
+	vkc::vkc gpu;
+	gpu.shader_cache_dir(cache_dir);
+
+	for (float mul : { 2.f, 3.f, 2.f }) {
+		vkc::task t{ gpu, shader_src, { { "MUL", std::to_string(mul) } } };
+		t.push_buffer("buf", sent_data);
+		t.submit(sent_data.size(), 1, 1);
+		t.pull_buffer("buf", &recieved_data);
+
+		EXPECT_EQ(sent_data.size(), recieved_data.size());
+		for (size_t i = 0; i < recieved_data.size(); ++i) {
+			EXPECT_EQ(sent_data[i] * mul, recieved_data[i]);
+		}
+	}
+
+	// One cached shader per variant.
+	size_t num_cached = std::distance(
+			std::filesystem::directory_iterator{ cache_dir },
+			std::filesystem::directory_iterator{});
+	EXPECT_EQ(num_cached, 2u);
+	std::filesystem::remove_all(cache_dir);
+}
+
+TEST(task, optimize_and_spec_constants) {
+	constexpr const char* shader_src = R"(
+#version 450
+layout(local_size_x_id = 0) in;
+layout(constant_id = 1) const float mul = 1.0;
+layout(constant_id = 2) const uint iterations = 1;
+
+layout(std430, binding = 0) buffer buf {
+	float buf_data[];
+};
+
+void main() {
+	uint i = gl_GlobalInvocationID.x;
+	if (i >= buf_data.length()) {
+		return;
+	}
+
+	float v = buf_data[i];
+	for (uint j = 0; j < iterations; ++j) {
+		v *= mul;
+	}
+	buf_data[i] = v;
+}
+)";
+
+	std::filesystem::path exe_path = fea::executable_dir(argv0);
+	std::filesystem::path cache_dir = exe_path / L"optimize_cache_tests";
+	std::filesystem::remove_all(cache_dir);
+
+	std::vector<float> sent_data(100);
+	std::iota(sent_data.begin(), sent_data.end(), 0.f);
+	std::vector<float> recieved_data;
+
+	vkc::vkc gpu;
+	gpu.shader_cache_dir(cache_dir);
+
+	for (bool optimize : { false, true }) {
+		vkc::task_options opts;
+		opts.optimize = optimize;
+		opts.spec_constants = {
+			{ 0u, 16u },
+			{ 1u, 2.f },
+			{ 2u, 3u },
+		};
+
+		vkc::task t{ gpu, shader_src, {}, opts };
+		t.push_buffer("buf", sent_data);
+		t.submit(sent_data.size(), 1, 1);
+		t.pull_buffer("buf", &recieved_data);
+
+		EXPECT_EQ(sent_data.size(), recieved_data.size());
+		for (size_t i = 0; i < recieved_data.size(); ++i) {
+			EXPECT_EQ(sent_data[i] * 8.f, recieved_data[i]);
+		}
+	}
+
+	// The compiled shader, and its optimized version.
+	std::vector<std::filesystem::path> files;
+	for (const std::filesystem::directory_entry& e :
+			std::filesystem::directory_iterator{ cache_dir }) {
+		files.push_back(e.path());
+	}
+	ASSERT_EQ(files.size(), 2u);
+	std::vector<uint8_t> first;
+	std::vector<uint8_t> second;
+	ASSERT_TRUE(fea::open_binary_file(files[0], first));
+	ASSERT_TRUE(fea::open_binary_file(files[1], second));
+	EXPECT_FALSE(first.empty());
+	EXPECT_FALSE(second.empty());
+	EXPECT_NE(first, second);
+	std::filesystem::remove_all(cache_dir);
+}
+
+TEST(task, fused_elementwise) {
+	std::vector<float> sent_data(1000);
+	std::iota(sent_data.begin(), sent_data.end(), 0.f);
+	std::vector<float> recieved_data;
+
+	// Same as task_tests.comp test 1 followed by test 2.
+	vkc::fused_elementwise chain;
+	chain.inputs = { "buf2" };
+	chain.constants = { "mul" };
+	chain.stages = { "x * p_constants.mul", "x + buf2_data[i]" };
+
+	struct {
+		float mul = 2.f;
+	} constants;
+
+	vkc::vkc gpu;
+	vkc::task t = vkc::make_fused_task(gpu, chain);
+
+	t.push_constant("p_constants", constants);
+	t.push_buffer("in_buf", sent_data);
+	t.push_buffer("buf2", sent_data);
+	t.reserve_buffer<float>("out_buf", sent_data.size());
+	t.submit(sent_data.size(), 1, 1);
+	t.pull_buffer("out_buf", &recieved_data);
+
+	EXPECT_EQ(sent_data.size(), recieved_data.size());
+	for (size_t i = 0; i < recieved_data.size(); ++i) {
+		float expected = sent_data[i] * constants.mul + sent_data[i];
+		EXPECT_EQ(expected, recieved_data[i]);
+	}
+}
+
+TEST(task, load_tasks) {
+	std::filesystem::path exe_path = fea::executable_dir(argv0);
+	std::vector<std::filesystem::path> shader_paths{
+		exe_path / L"data/shaders/task_tests.comp.spv",
+		exe_path / L"data/shaders/mandelbrot.comp.spv",
+		exe_path / L"data/shaders/task_tests.comp.spv",
+	};
+
+	std::vector<float> sent_data(100);
+	std::iota(sent_data.begin(), sent_data.end(), 0.f);
+	std::vector<float> recieved_data;
+
+	p_constants constants;
+	constants.test_num = 1;
+	constants.mul = 2.f;
+
+	vkc::vkc gpu;
+	std::vector<vkc::task> tasks = vkc::load_tasks(gpu, shader_paths);
+	EXPECT_EQ(shader_paths.size(), tasks.size());
+
+	for (size_t i : { size_t(0), size_t(2) }) {
+		vkc::task& t = tasks[i];
+		t.push_constant("p_constants", constants);
+		t.push_buffer("buf1", sent_data);
+		t.submit();
+		t.pull_buffer("buf1", &recieved_data);
+
+		EXPECT_EQ(sent_data.size(), recieved_data.size());
+		for (size_t j = 0; j < recieved_data.size(); ++j) {
+			EXPECT_EQ(sent_data[j] * constants.mul, recieved_data[j]);
+		}
+	}
+
+	// Background loading.
+	std::future<vkc::task> fut = vkc::load_task_async(gpu, shader_paths[0]);
+	vkc::task t = fut.get();
+	t.push_constant("p_constants", constants);
+	t.push_buffer("buf1", sent_data);
+	t.submit();
+	t.pull_buffer("buf1", &recieved_data);
+
+	EXPECT_EQ(sent_data.size(), recieved_data.size());
+	for (size_t j = 0; j < recieved_data.size(); ++j) {
+		EXPECT_EQ(sent_data[j] * constants.mul, recieved_data[j]);
+	}
+}
+
+TEST(task, tiled_submit) {
+	vkc::vkc gpu;
+	vkc::task t{ gpu, vkc_shaders::group_base_comp };
+
+	group_constants constants;
+	std::vector<uint32_t> expected(size_t(constants.width) * constants.height);
+	std::iota(expected.begin(), expected.end(), 0u);
+
+	// Odd tile sizes, so the last row and column of tiles are partial.
+	for (size_t max_groups : { size_t(0), size_t(1), size_t(7), size_t(100) }) {
+		std::vector<uint32_t> ids(expected.size(), ~0u);
+		t.push_buffer("ids", ids);
+
+		// Push constants apply to every tile.
+		t.max_groups_per_submit(max_groups);
+		t.push_constant("p_constants", constants);
+		t.submit(constants.width, constants.height, 1);
+		t.pull_buffer("ids", &ids);
+		EXPECT_EQ(expected, ids);
+
+		// Empty dispatches do nothing.
+		t.push_constant("p_constants", constants);
+		t.submit(0, constants.height, 1);
+		t.submit(constants.width, 0, 1);
+		t.pull_buffer("ids", &ids);
+		EXPECT_EQ(expected, ids);
+	}
+}
+
+TEST(task, submit_many) {
+	std::vector<float> sent_data(100);
+	std::iota(sent_data.begin(), sent_data.end(), 0.f);
+	std::vector<float> recieved_data;
+
+	vkc::vkc gpu;
+	vkc::task t{ gpu, vkc_shaders::task_tests_comp };
+
+	// Test 1 multiplies buf1 in place, so every dispatch must see the
+	// previous one.
+	std::vector<vkc::dispatch_info<p_constants>> dispatches;
+	float expected_mul = 1.f;
+	for (float mul : { 2.f, 3.f, 0.5f, 4.f }) {
+		vkc::dispatch_info<p_constants> d;
+		d.constants.test_num = 1;
+		d.constants.mul = mul;
+		dispatches.push_back(d);
+		expected_mul *= mul;
+	}
+
+	t.push_buffer("buf1", sent_data);
+	t.submit_many("p_constants", dispatches);
+	t.pull_buffer("buf1", &recieved_data);
+
+	EXPECT_EQ(sent_data.size(), recieved_data.size());
+	for (size_t i = 0; i < recieved_data.size(); ++i) {
+		EXPECT_EQ(sent_data[i] * expected_mul, recieved_data[i]);
+	}
+
+	// Empty does nothing.
+	t.submit_many(
+			"p_constants", std::vector<vkc::dispatch_info<p_constants>>{});
+	t.pull_buffer("buf1", &recieved_data);
+	for (size_t i = 0; i < recieved_data.size(); ++i) {
+		EXPECT_EQ(sent_data[i] * expected_mul, recieved_data[i]);
+	}
+}
+
+// Pushes sampled images of extent width x height, sums them in the shader
+// and checks the result. The sampled_img format changes.
+void check_sampled_images(vkc::task& t, vkc::format sampled_fmt, size_t width,
+		size_t height) {
+	size_t count = width * height * 4;
+	std::vector<float> expected(count);
+
+	t.set_format("sampled_img", sampled_fmt);
+	if (sampled_fmt == vkc::format::rgba32_sfloat) {
+		std::vector<float> sampled(count);
+		std::iota(sampled.begin(), sampled.end(), 0.f);
+		t.push_image("sampled_img", sampled, width, height);
+		expected = sampled;
+	} else {
+		ASSERT_EQ(sampled_fmt, vkc::format::rgba8_unorm);
+		std::vector<uint8_t> sampled(count);
+		for (size_t i = 0; i < count; ++i) {
+			sampled[i] = uint8_t(255 - i % 256);
+			expected[i] = float(sampled[i]) / 255.f;
+		}
+		t.push_image("sampled_img", sampled, width, height);
+	}
+
+	std::vector<uint8_t> combined(count);
+	for (size_t i = 0; i < count; ++i) {
+		combined[i] = uint8_t(i % 256);
+		expected[i] += float(combined[i]) / 255.f;
+	}
+	t.push_image("combined_img", combined, width, height);
+	t.reserve_image("out_img", width, height);
+	t.submit(width, height, 1);
+
+	std::vector<float> out;
+	t.pull_image("out_img", &out);
+	ASSERT_EQ(expected.size(), out.size());
+	for (size_t i = 0; i < count; ++i) {
+		EXPECT_NEAR(expected[i], out[i], 1e-3f);
+	}
+}
+
+TEST(task, sampled_images) {
+	vkc::vkc gpu;
+	vkc::task t{ gpu, vkc_shaders::sampled_images_comp };
+
+	// Sampled images have no format in the shader.
+	vkc::task_reflection refl = t.reflection();
+	for (const vkc::resource_info& r : refl.images) {
+		if (r.name != "out_img") {
+			EXPECT_EQ(r.fmt, vkc::format::undefined);
+		}
+	}
+
+	t.set_format("combined_img", vkc::format::rgba8_unorm);
+	check_sampled_images(t, vkc::format::rgba32_sfloat, 13, 7);
+}
+
+TEST(task, image_format_and_size_changes) {
+	vkc::vkc gpu;
+	vkc::task t{ gpu, vkc_shaders::sampled_images_comp };
+	t.set_format("combined_img", vkc::format::rgba8_unorm);
+
+	// Changing the format recreates the image, the copy commands of the
+	// same extent must be recorded again.
+	check_sampled_images(t, vkc::format::rgba32_sfloat, 13, 7);
+	check_sampled_images(t, vkc::format::rgba8_unorm, 13, 7);
+
+	// Resizing, then back to a previous extent.
+	check_sampled_images(t, vkc::format::rgba8_unorm, 31, 3);
+	check_sampled_images(t, vkc::format::rgba8_unorm, 13, 7);
+	check_sampled_images(t, vkc::format::rgba32_sfloat, 31, 3);
+
+	// Trimmed staging memory.
+	t.trim();
+	check_sampled_images(t, vkc::format::rgba32_sfloat, 13, 7);
+}
+
+TEST(task, separate_sampler) {
+	vkc::vkc gpu;
+	vkc::task t{ gpu, vkc_shaders::separate_sampler_comp };
+
+	// One row, sampled between each pair of texels.
+	size_t width = 17;
+	std::vector<uint8_t> texels(width * 4);
+	for (size_t i = 0; i < texels.size(); ++i) {
+		texels[i] = uint8_t((i * 37) % 256);
+	}
+
+	t.set_format("img", vkc::format::rgba8_unorm);
+	t.push_image("img", texels, width, 1);
+	t.reserve_buffer<float>("out_buf", (width - 1) * 4);
+	t.submit(width - 1, 1, 1);
+
+	std::vector<float> out;
+	t.pull_buffer("out_buf", &out);
+	ASSERT_EQ(out.size(), (width - 1) * 4);
+
+	// Linear filtering averages the neighbours.
+	for (size_t i = 0; i < out.size(); ++i) {
+		float expected = (float(texels[i]) + float(texels[i + 4])) / 510.f;
+		EXPECT_NEAR(expected, out[i], 1e-2f);
+	}
+}
+
+TEST(task, texel_buffers) {
+	vkc::vkc gpu;
+	vkc::task t{ gpu, vkc_shaders::texel_buffers_comp };
+
+	vkc::task_reflection refl = t.reflection();
+	for (const vkc::resource_info& r : refl.buffers) {
+		EXPECT_TRUE(r.texel);
+	}
+
+	// Uniform texel buffers have no format in the shader.
+	std::vector<float> sent_data(1000);
+	std::iota(sent_data.begin(), sent_data.end(), 0.f);
+	std::vector<float> recieved_data;
+
+	t.set_format("texel_in", vkc::format::r32_sfloat);
+	t.push_buffer("texel_in", sent_data);
+	t.reserve_buffer<float>("texel_out", sent_data.size());
+	t.submit(sent_data.size(), 1, 1);
+	t.pull_buffer("texel_out", &recieved_data);
+
+	ASSERT_EQ(sent_data.size(), recieved_data.size());
+	for (size_t i = 0; i < sent_data.size(); ++i) {
+		EXPECT_EQ(sent_data[i] * 2.f, recieved_data[i]);
+	}
+
+	// A new format, the buffer view is created again.
+	std::vector<uint8_t> texels(sent_data.size());
+	for (size_t i = 0; i < texels.size(); ++i) {
+		texels[i] = uint8_t(i % 256);
+	}
+	size_t texel_count = texels.size() / 4;
+
+	t.set_format("texel_in", vkc::format::rgba8_unorm);
+	t.push_buffer("texel_in", texels);
+	t.reserve_buffer<float>("texel_out", texel_count);
+	t.submit(texel_count, 1, 1);
+	t.pull_buffer("texel_out", &recieved_data);
+
+	// The red channel is stored.
+	ASSERT_EQ(texel_count, recieved_data.size());
+	for (size_t i = 0; i < texel_count; ++i) {
+		EXPECT_NEAR(float(texels[i * 4]) / 255.f * 2.f, recieved_data[i],
+				1e-5f);
+	}
+}
+
+TEST(task, host_memory) {
+	vkc::vkc gpu;
+	gpu.collect_stats(true);
+	vkc::task t{ gpu, vkc_shaders::task_tests_comp };
+
+	p_constants constants;
+	constants.test_num = 1;
+	constants.mul = 2.f;
+	t.push_constant("p_constants", constants);
+
+	// Large enough to be imported, with an unaligned tail.
+	vkc::host_vector<float> sent_data(1024 * 1024 + 3);
+	std::iota(sent_data.begin(), sent_data.end(), 0.f);
+	vkc::host_vector<float> recieved_data;
+
+	EXPECT_EQ(reinterpret_cast<uintptr_t>(sent_data.data())
+					% vkc::host_memory_alignment,
+			0u);
+
+	t.push_buffer("buf1", sent_data);
+	t.submit();
+	t.pull_buffer("buf1", &recieved_data);
+
+	EXPECT_EQ(reinterpret_cast<uintptr_t>(recieved_data.data())
+					% vkc::host_memory_alignment,
+			0u);
+	EXPECT_EQ(sent_data.size(), recieved_data.size());
+	for (size_t i = 0; i < recieved_data.size(); ++i) {
+		EXPECT_EQ(sent_data[i] * constants.mul, recieved_data[i]);
+	}
+
+	// Both transfers imported everything but the tail.
+	size_t imported_byte_size = 0;
+	if (gpu.external_host_memory()) {
+		size_t byte_size = sent_data.size() * sizeof(float);
+		imported_byte_size
+				= byte_size - byte_size % gpu.external_host_memory_alignment();
+	}
+	EXPECT_EQ(gpu.stats().bytes_imported, 2 * imported_byte_size);
+}
+
+TEST(task, large_transfers) {
+	vkc::vkc gpu;
+	vkc::task t{ gpu, vkc_shaders::task_tests_comp };
+
+	// Large enough to be copied in parallel, with a partial last chunk.
+	std::vector<float> sent_data(3 * 1024 * 1024 + 5);
+	std::iota(sent_data.begin(), sent_data.end(), 0.f);
+	std::vector<float> recieved_data;
+
+	t.push_buffer("buf1", sent_data);
+	t.pull_buffer("buf1", &recieved_data);
+	EXPECT_EQ(sent_data, recieved_data);
+
+	// Streamed through a small staging ring, in many chunks.
+	gpu.staging_ring_byte_size(1024 * 1024);
+	EXPECT_EQ(gpu.staging_ring_byte_size(), 1024u * 1024u);
+	EXPECT_EQ(gpu.memory_stats().staging_ring_bytes, 0u);
+
+	std::reverse(sent_data.begin(), sent_data.end());
+	t.push_buffer("buf1", sent_data);
+	t.pull_buffer("buf1", &recieved_data);
+	EXPECT_EQ(sent_data, recieved_data);
+	EXPECT_GE(gpu.memory_stats().staging_ring_bytes, 1024u * 1024u);
+	EXPECT_LT(gpu.memory_stats().staging_ring_bytes,
+			sent_data.size() * sizeof(float));
+}
+
+TEST(task, memory_stats) {
+	vkc::vkc gpu;
+	vkc::device_memory_stats gpu_stats = gpu.memory_stats();
+	EXPECT_FALSE(gpu_stats.heaps.empty());
+	EXPECT_EQ(gpu_stats.allocation_count, 0u);
+
+	p_constants constants;
+	constants.test_num = 1;
+	constants.mul = 2.f;
+
+	{
+		vkc::task t{ gpu, vkc_shaders::task_tests_comp };
+		EXPECT_EQ(t.memory_stats().reserved_bytes, 0u);
+		EXPECT_EQ(t.memory_stats().used_bytes, 0u);
+
+		std::vector<float> big_data(10'000, 1.f);
+		t.push_buffer("buf1", big_data);
+
+		// Staging memory is the vkc staging ring.
+		vkc::task_memory_stats big_stats = t.memory_stats();
+		EXPECT_EQ(big_stats.used_bytes, big_data.size() * sizeof(float));
+		EXPECT_GE(big_stats.reserved_bytes, big_stats.used_bytes);
+
+		gpu_stats = gpu.memory_stats();
+		EXPECT_GE(gpu_stats.allocation_count, 2u);
+		EXPECT_GE(gpu_stats.staging_ring_bytes, gpu.staging_ring_byte_size());
+		size_t allocated_bytes = 0;
+		for (const vkc::heap_stats& heap : gpu_stats.heaps) {
+			allocated_bytes += heap.allocated_bytes;
+			EXPECT_LE(heap.allocated_bytes, heap.size);
+		}
+		EXPECT_EQ(allocated_bytes,
+				big_stats.reserved_bytes + gpu_stats.staging_ring_bytes);
+
+		// Shrinking keeps the memory.
+		std::vector<float> sent_data(100);
+		std::iota(sent_data.begin(), sent_data.end(), 0.f);
+		t.push_buffer("buf1", sent_data);
+
+		vkc::task_memory_stats small_stats = t.memory_stats();
+		EXPECT_EQ(small_stats.used_bytes, sent_data.size() * sizeof(float));
+		EXPECT_EQ(small_stats.reserved_bytes, big_stats.reserved_bytes);
+
+		// Trimming releases it and keeps the contents.
+		t.trim();
+		vkc::task_memory_stats trimmed_stats = t.memory_stats();
+		EXPECT_EQ(trimmed_stats.used_bytes, small_stats.used_bytes);
+		EXPECT_LT(trimmed_stats.reserved_bytes, small_stats.reserved_bytes);
+
+		std::vector<float> recieved_data;
+		t.pull_buffer("buf1", &recieved_data);
+		EXPECT_EQ(sent_data, recieved_data);
+
+		// Rebound after trim.
+		t.push_constant("p_constants", constants);
+		t.submit();
+		t.pull_buffer("buf1", &recieved_data);
+		EXPECT_EQ(sent_data.size(), recieved_data.size());
+		for (size_t i = 0; i < recieved_data.size(); ++i) {
+			EXPECT_EQ(sent_data[i] * constants.mul, recieved_data[i]);
+		}
+	}
+
+	// Everything is released with the task, but the staging ring.
+	gpu_stats = gpu.memory_stats();
+	EXPECT_EQ(gpu_stats.allocation_count, 1u);
+	size_t allocated_bytes = 0;
+	for (const vkc::heap_stats& heap : gpu_stats.heaps) {
+		allocated_bytes += heap.allocated_bytes;
+	}
+	EXPECT_EQ(allocated_bytes, gpu_stats.staging_ring_bytes);
+}
+
+TEST(task, buffer_growth) {
+	vkc::vkc gpu;
+	vkc::task t{ gpu, vkc_shaders::task_tests_comp };
+
+	// Far above the driver's allocation granularity.
+	std::vector<float> sent_data(1024 * 1024);
+	std::iota(sent_data.begin(), sent_data.end(), 0.f);
+	std::vector<float> recieved_data;
+
+	// Growing past the capacity grows geometrically.
+	t.push_buffer("buf1", sent_data);
+	size_t byte_size = sent_data.size() * sizeof(float);
+
+	sent_data.resize(sent_data.size() + 1);
+	t.push_buffer("buf1", sent_data);
+	size_t grown_bytes = t.memory_stats().reserved_bytes;
+	EXPECT_GE(grown_bytes, byte_size + byte_size / 2);
+
+	// Small growth fits.
+	sent_data.resize(sent_data.size() + 100'000);
+	t.push_buffer("buf1", sent_data);
+	EXPECT_EQ(t.memory_stats().reserved_bytes, grown_bytes);
+	t.pull_buffer("buf1", &recieved_data);
+	EXPECT_EQ(sent_data, recieved_data);
+
+	// Reserving doesn't change the size.
+	size_t big_size = 4 * 1024 * 1024;
+	t.reserve_buffer_capacity<float>("buf1", big_size);
+	EXPECT_GE(t.memory_stats().reserved_bytes, big_size * sizeof(float));
+	EXPECT_EQ(t.get_buffer_byte_size("buf1"),
+			sent_data.size() * sizeof(float));
+
+	// Pushes up to the capacity don't allocate.
+	size_t reserved_bytes = t.memory_stats().reserved_bytes;
+	sent_data.resize(big_size);
+	std::iota(sent_data.begin(), sent_data.end(), 0.f);
+	t.push_buffer("buf1", sent_data);
+	EXPECT_EQ(t.memory_stats().reserved_bytes, reserved_bytes);
+	t.pull_buffer("buf1", &recieved_data);
+	EXPECT_EQ(sent_data, recieved_data);
+}
+
+TEST(task, residency) {
+	vkc::vkc gpu;
+
+	p_constants constants;
+	constants.test_num = 1;
+	constants.mul = 2.f;
+
+	std::vector<float> sent_data(1024 * 1024);
+	std::iota(sent_data.begin(), sent_data.end(), 0.f);
+	std::vector<float> recieved_data;
+	size_t byte_size = sent_data.size() * sizeof(float);
+
+	// Spilled buffers move to host memory, the budget applies to device
+	// memory. Integrated gpus only have device memory, where spilled
+	// buffers still count.
+	vkc::device_memory_stats gpu_stats = gpu.memory_stats();
+	bool has_host_heaps = std::any_of(gpu_stats.heaps.begin(),
+			gpu_stats.heaps.end(),
+			[](const vkc::heap_stats& h) { return !h.device_local; });
+
+	auto device_local_bytes = [&]() {
+		size_t ret = 0;
+		for (const vkc::heap_stats& heap : gpu.memory_stats().heaps) {
+			ret += heap.device_local ? heap.allocated_bytes : 0;
+		}
+		return ret;
+	};
+
+	// Room for a single task's buffer.
+	gpu.residency_budget(byte_size + byte_size / 2);
+	EXPECT_EQ(gpu.residency_budget(), byte_size + byte_size / 2);
+
+	vkc::task t1{ gpu, vkc_shaders::task_tests_comp };
+	vkc::task t2 = t1.instance();
+
+	t1.push_buffer("buf1", sent_data);
+	size_t t1_reserved = t1.memory_stats().reserved_bytes;
+	EXPECT_EQ(t1.memory_stats().spilled_bytes, 0u);
+
+	// t1 is spilled to make room.
+	t2.push_buffer("buf1", sent_data);
+	EXPECT_EQ(t1.memory_stats().spilled_bytes, byte_size);
+	EXPECT_EQ(t2.memory_stats().spilled_bytes, 0u);
+	if (has_host_heaps) {
+		EXPECT_LE(device_local_bytes(), gpu.residency_budget());
+	}
+	size_t t2_reserved = t2.memory_stats().reserved_bytes;
+
+	// t1 is restored and t2 spilled.
+	t1.push_constant("p_constants", constants);
+	t1.submit();
+	EXPECT_EQ(t1.memory_stats().spilled_bytes, 0u);
+	EXPECT_EQ(t2.memory_stats().spilled_bytes, byte_size);
+	EXPECT_EQ(t1.memory_stats().reserved_bytes, t1_reserved);
+	if (has_host_heaps) {
+		EXPECT_LE(device_local_bytes(), gpu.residency_budget());
+	}
+
+	t1.pull_buffer("buf1", &recieved_data);
+	EXPECT_EQ(sent_data.size(), recieved_data.size());
+	for (size_t i = 0; i < recieved_data.size(); ++i) {
+		EXPECT_EQ(sent_data[i] * constants.mul, recieved_data[i]);
+	}
+
+	// t2 kept its contents.
+	t2.pull_buffer("buf1", &recieved_data);
+	EXPECT_EQ(t2.memory_stats().spilled_bytes, 0u);
+	EXPECT_EQ(t1.memory_stats().spilled_bytes, byte_size);
+	EXPECT_EQ(sent_data, recieved_data);
+
+	// Disabled.
+	gpu.residency_budget(0);
+	t1.pull_buffer("buf1", &recieved_data);
+	t2.pull_buffer("buf1", &recieved_data);
+	EXPECT_EQ(t1.memory_stats().spilled_bytes, 0u);
+	EXPECT_EQ(t2.memory_stats().spilled_bytes, 0u);
+	EXPECT_EQ(t1.memory_stats().reserved_bytes, t1_reserved);
+	EXPECT_EQ(t2.memory_stats().reserved_bytes, t2_reserved);
+}
+
+TEST(task, profiling) {
+	vkc::vkc gpu;
+	vkc::task t{ gpu, vkc_shaders::task_tests_comp };
+
+	p_constants constants;
+	constants.test_num = 1;
+	constants.mul = 2.f;
+
+	std::vector<float> sent_data(1024 * 1024);
+	std::iota(sent_data.begin(), sent_data.end(), 0.f);
+	std::vector<float> recieved_data;
+
+	// Nothing is measured by default.
+	EXPECT_FALSE(t.profiling());
+	t.push_buffer("buf1", sent_data);
+	EXPECT_EQ(t.last_timings().push.host_ms, 0.0);
+	EXPECT_EQ(t.last_timings().push.gpu_ms, 0.0);
+
+	t.profiling(true);
+	EXPECT_TRUE(t.profiling());
+
+	t.push_buffer("buf1", sent_data);
+	t.push_constant("p_constants", constants);
+	t.submit();
+	t.pull_buffer("buf1", &recieved_data);
+
+	EXPECT_EQ(sent_data.size(), recieved_data.size());
+	for (size_t i = 0; i < recieved_data.size(); ++i) {
+		EXPECT_EQ(sent_data[i] * constants.mul, recieved_data[i]);
+	}
+
+	// Gpu time is part of the host time.
+	const vkc::task_timings& timings = t.last_timings();
+	for (const vkc::phase_timing& phase :
+			{ timings.push, timings.submit, timings.pull }) {
+		EXPECT_GT(phase.host_ms, 0.0);
+		EXPECT_GE(phase.gpu_ms, 0.0);
+		EXPECT_LE(phase.gpu_ms, phase.host_ms);
+	}
+
+	// Timings aren't updated once disabled.
+	t.profiling(false);
+	vkc::task_timings before = t.last_timings();
+	t.submit();
+	EXPECT_EQ(before.submit.host_ms, t.last_timings().submit.host_ms);
+	EXPECT_EQ(before.submit.gpu_ms, t.last_timings().submit.gpu_ms);
+}
+
+TEST(task, reflection) {
+	vkc::vkc gpu;
+	vkc::task t{ gpu, vkc_shaders::task_tests_comp };
+
+	vkc::task_reflection refl = t.reflection();
+	EXPECT_EQ(refl.work_group_size, (std::array<uint32_t, 3>{ 1u, 1u, 1u }));
+	EXPECT_TRUE(refl.images.empty());
+
+	ASSERT_EQ(refl.buffers.size(), 3u);
+	std::vector<std::string> names;
+	for (const vkc::resource_info& b : refl.buffers) {
+		EXPECT_FALSE(b.texel);
+		EXPECT_EQ(b.set, 0u);
+		names.push_back(b.name);
+	}
+	std::sort(names.begin(), names.end());
+	EXPECT_EQ(names, (std::vector<std::string>{ "buf1", "buf2", "out_buf" }));
+
+	ASSERT_EQ(refl.push_constants.size(), 1u);
+	EXPECT_EQ(refl.push_constants[0].name, "p_constants");
+	EXPECT_EQ(refl.push_constants[0].byte_size, sizeof(p_constants));
+
+	// Untyped push_constant, as tools do.
+	p_constants constants{ 1, 2.f };
+	std::vector<float> sent_data(1024, 2.f);
+	std::vector<float> recieved_data;
+	t.push_buffer("buf1", sent_data);
+	t.push_constant("p_constants", &constants, sizeof(constants));
+	t.submit();
+	t.pull_buffer("buf1", &recieved_data);
+	EXPECT_EQ(recieved_data, std::vector<float>(1024, 4.f));
+}
+
+TEST(task, capture) {
+	std::filesystem::path exe_path = fea::executable_dir(argv0);
+	std::filesystem::path capture_path = exe_path / "task_capture.vkccap";
+
+	vkc::vkc gpu;
+	vkc::task t{ gpu, vkc_shaders::task_tests_comp };
+	EXPECT_FALSE(t.capturing());
+	EXPECT_FALSE(t.end_capture());
+
+	p_constants constants{ 1, 2.f };
+	std::vector<float> sent_data(1024 * 1024, 1.f);
+	std::vector<float> recieved_data;
+
+	ASSERT_TRUE(t.begin_capture(capture_path));
+	EXPECT_TRUE(t.capturing());
+	t.reserve_buffer_capacity<float>("buf1", sent_data.size());
+	t.push_buffer("buf1", sent_data);
+	t.push_buffer("buf1", sent_data);
+	t.push_constant("p_constants", constants);
+	t.submit();
+	t.pull_buffer("buf1", &recieved_data);
+
+	// Empty, but consumes the enqueued push constants.
+	t.push_constant("p_constants", constants);
+	t.submit_many(
+			"p_constants", std::vector<vkc::dispatch_info<p_constants>>{});
+	EXPECT_TRUE(t.end_capture());
+	EXPECT_FALSE(t.capturing());
+
+	// Capturing doesn't change results.
+	EXPECT_EQ(recieved_data, std::vector<float>(sent_data.size(), 2.f));
+
+	std::vector<uint8_t> file;
+	ASSERT_TRUE(fea::open_binary_file(capture_path, file));
+	ASSERT_GE(file.size(), sizeof(vkc::capture_header));
+
+	vkc::capture_header header;
+	std::memcpy(&header, file.data(), sizeof(header));
+	EXPECT_EQ(header.magic, vkc::capture_magic);
+	EXPECT_EQ(header.version, vkc::capture_version);
+	EXPECT_EQ(header.commands_offset % vkc::capture_alignment, 0u);
+	ASSERT_EQ(header.command_count, 8u);
+
+	std::vector<vkc::capture_command> cmds(header.command_count);
+	std::memcpy(cmds.data(), file.data() + header.commands_offset,
+			cmds.size() * sizeof(vkc::capture_command));
+	EXPECT_EQ(cmds[0].op, vkc::capture_op::reserve_buffer_capacity);
+	EXPECT_EQ(cmds[1].op, vkc::capture_op::push_buffer);
+	EXPECT_EQ(cmds[2].op, vkc::capture_op::push_buffer);
+	EXPECT_EQ(cmds[3].op, vkc::capture_op::push_constant);
+	EXPECT_EQ(cmds[4].op, vkc::capture_op::submit);
+	EXPECT_EQ(cmds[5].op, vkc::capture_op::pull_buffer);
+	EXPECT_EQ(cmds[6].op, vkc::capture_op::push_constant);
+	EXPECT_EQ(cmds[7].op, vkc::capture_op::submit_many);
+	EXPECT_EQ(cmds[7].args,
+			(std::array<uint64_t, 3>{ 0u, 1u, sizeof(p_constants) }));
+	EXPECT_EQ(cmds[0].args[0], sent_data.size() * sizeof(float));
+	EXPECT_EQ(cmds[4].args, (std::array<uint64_t, 3>{ 1u, 1u, 1u }));
+
+	// The buffer and its name are stored once.
+	EXPECT_EQ(cmds[1].data, cmds[2].data);
+	EXPECT_EQ(cmds[0].name, cmds[5].name);
+	EXPECT_LT(file.size(), 2 * sent_data.size() * sizeof(float));
+
+	std::vector<vkc::capture_blob> blobs(header.blob_count);
+	std::memcpy(blobs.data(), file.data() + header.blobs_offset,
+			blobs.size() * sizeof(vkc::capture_blob));
+	const vkc::capture_blob& data_blob = blobs[cmds[1].data];
+	EXPECT_EQ(data_blob.offset % vkc::capture_alignment, 0u);
+	ASSERT_EQ(data_blob.byte_size, sent_data.size() * sizeof(float));
+	EXPECT_EQ(std::memcmp(file.data() + data_blob.offset, sent_data.data(),
+					  size_t(data_blob.byte_size)),
+			0);
+
+	std::filesystem::remove(capture_path);
+}
+
+TEST(task, stats) {
+	vkc::vkc gpu;
+	gpu.collect_stats(true);
+	EXPECT_TRUE(gpu.collect_stats());
+	vkc::vkc_stats stats = gpu.stats();
+	EXPECT_TRUE(stats.enabled);
+	EXPECT_EQ(stats.queue_submits, 0u);
+	EXPECT_EQ(stats.submit_latency.count, 0u);
+
+	p_constants constants;
+	constants.test_num = 1;
+	constants.mul = 2.f;
+
+	std::vector<float> sent_data(100);
+	std::iota(sent_data.begin(), sent_data.end(), 0.f);
+	std::vector<float> recieved_data;
+
+	vkc::task t{ gpu, vkc_shaders::task_tests_comp };
+	t.push_buffer("buf1", sent_data);
+	t.push_constant("p_constants", constants);
+	t.submit();
+	t.pull_buffer("buf1", &recieved_data);
+
+	stats = gpu.stats();
+	size_t byte_size = sent_data.size() * sizeof(float);
+	EXPECT_GE(stats.queue_submits, 3u);
+	EXPECT_EQ(stats.fence_waits, stats.queue_submits);
+	EXPECT_EQ(stats.bytes_pushed, byte_size);
+	EXPECT_EQ(stats.bytes_pulled, byte_size);
+	EXPECT_GE(stats.command_records, 3u);
+	EXPECT_GE(stats.descriptor_updates, 1u);
+	EXPECT_GE(stats.memory_allocations, 2u);
+	EXPECT_EQ(stats.pipeline_creations, 1u);
+
+	for (const vkc::latency_histogram& h :
+			{ stats.submit_latency, stats.push_latency, stats.pull_latency }) {
+		EXPECT_EQ(h.count, 1u);
+		uint64_t bucket_total = 0;
+		for (uint64_t b : h.buckets) {
+			bucket_total += b;
+		}
+		EXPECT_EQ(bucket_total, h.count);
+		EXPECT_LE(h.max_us, h.total_us);
+	}
+
+	// Transfers record a copy per staging ring chunk.
+	uint64_t command_records = stats.command_records;
+	t.pull_buffer("buf1", &recieved_data);
+	stats = gpu.stats();
+	EXPECT_EQ(stats.command_records, command_records + 1);
+	EXPECT_EQ(stats.bytes_pulled, byte_size * 2);
+	EXPECT_EQ(stats.pull_latency.count, 2u);
+
+	gpu.reset_stats();
+	stats = gpu.stats();
+	EXPECT_EQ(stats.queue_submits, 0u);
+	EXPECT_EQ(stats.bytes_pulled, 0u);
+	EXPECT_EQ(stats.pull_latency.count, 0u);
+
+	// Nothing is collected when disabled.
+	gpu.collect_stats(false);
+	t.pull_buffer("buf1", &recieved_data);
+	stats = gpu.stats();
+	EXPECT_FALSE(stats.enabled);
+	EXPECT_EQ(stats.queue_submits, 0u);
+	EXPECT_EQ(stats.bytes_pulled, 0u);
+	EXPECT_EQ(stats.pull_latency.count, 0u);
+}
+
+TEST(task, tracing) {
+	std::filesystem::path exe_path = fea::executable_dir(argv0);
+	std::filesystem::path trace_path = exe_path / "vkc_trace.json";
+
+	vkc::vkc gpu;
+	EXPECT_FALSE(gpu.tracing());
+	gpu.tracing(true);
+	EXPECT_TRUE(gpu.tracing());
+
+	p_constants constants;
+	constants.test_num = 1;
+	constants.mul = 2.f;
+
+	std::vector<float> sent_data(100);
+	std::iota(sent_data.begin(), sent_data.end(), 0.f);
+
+	// Tasks on other threads share the queue.
+	tbb::parallel_for(0, 4, [&](int) {
+		vkc::task t{ gpu, vkc_shaders::task_tests_comp };
+		std::vector<float> data;
+		t.push_buffer("buf1", sent_data);
+		t.push_constant("p_constants", constants);
+		t.submit();
+		t.pull_buffer("buf1", &data);
+		EXPECT_EQ(sent_data.size(), data.size());
+	});
+
+	ASSERT_TRUE(gpu.write_trace(trace_path));
+	gpu.tracing(false);
+
+	std::string trace;
+	{
+		std::ifstream ifs{ trace_path };
+		ASSERT_TRUE(ifs.is_open());
+		trace.assign(std::istreambuf_iterator<char>(ifs),
+				std::istreambuf_iterator<char>());
+	}
+
+	EXPECT_EQ(trace.front(), '{');
+	EXPECT_NE(trace.find("\"traceEvents\""), std::string::npos);
+	EXPECT_NE(trace.find("\"gpu queue\""), std::string::npos);
+	for (const char* span : { "build_instance", "push_buffer", "submit",
+				 "pull_buffer", "queue_submit", "fence_wait" }) {
+		std::string name = std::string{ "\"name\":\"" } + span + "\"";
+		EXPECT_NE(trace.find(name), std::string::npos) << span;
+	}
+
+	// Events are cleared once written.
+	ASSERT_TRUE(gpu.write_trace(trace_path));
+	std::ifstream ifs{ trace_path };
+	std::string empty_trace{ std::istreambuf_iterator<char>(ifs),
+		std::istreambuf_iterator<char>() };
+	EXPECT_EQ(empty_trace.find("push_buffer"), std::string::npos);
+}
+
+TEST(task, instances) {
+	std::vector<float> sent_data(100);
+	std::iota(sent_data.begin(), sent_data.end(), 0.f);
+	std::vector<float> recieved_data;
+
+	p_constants constants;
+	constants.test_num = 1;
+	constants.mul = 2.f;
+
+	vkc::vkc gpu;
+	vkc::task t{ gpu, vkc_shaders::task_tests_comp };
+	t.push_buffer("buf1", sent_data);
+
+	// Instances share the pipeline, but not the buffers.
+	vkc::task inst = t.instance();
+	inst.push_constant("p_constants", constants);
+	inst.push_buffer("buf1", sent_data);
+	inst.submit();
+	inst.pull_buffer("buf1", &recieved_data);
+
+	EXPECT_EQ(sent_data.size(), recieved_data.size());
+	for (size_t i = 0; i < recieved_data.size(); ++i) {
+		EXPECT_EQ(sent_data[i] * constants.mul, recieved_data[i]);
+	}
+
+	// The original task's buffer is untouched.
+	t.pull_buffer("buf1", &recieved_data);
+	EXPECT_EQ(sent_data.size(), recieved_data.size());
+	for (size_t i = 0; i < recieved_data.size(); ++i) {
+		EXPECT_EQ(sent_data[i], recieved_data[i]);
+	}
+
+	// Instances outlive their original.
+	{
+		vkc::task orig{ gpu, vkc_shaders::task_tests_comp };
+		inst = orig.instance();
+	}
+	inst.push_constant("p_constants", constants);
+	inst.push_buffer("buf1", sent_data);
+	inst.submit();
+	inst.pull_buffer("buf1", &recieved_data);
+	for (size_t i = 0; i < recieved_data.size(); ++i) {
+		EXPECT_EQ(sent_data[i] * constants.mul, recieved_data[i]);
+	}
+}
+
+TEST(task, task_level_threading) {
+	constexpr size_t num_tasks = 1'000;
+
+	std::vector<float> sent_data(100);
+	std::iota(sent_data.begin(), sent_data.end(), 0.f);
+
+	vkc::vkc gpu;
+	vkc::task t{ gpu, vkc_shaders::task_tests_comp };
+
+	// Use grainsize 1 to force many threads.
+	tbb::parallel_for(tbb::blocked_range<size_t>{ 0, num_tasks, 1 },
+			[&](const tbb::blocked_range<size_t>& range) {
+				vkc::task inst = t.instance();
+				for (size_t i = range.begin(); i < range.end(); ++i) {
+					std::vector<float> recieved_data;
+
+					p_constants constants;
+					constants.test_num = 2;
+
+					inst.push_constant("p_constants", constants);
+					inst.push_buffer("buf1", sent_data);
+					inst.push_buffer("buf2", sent_data);
+					inst.reserve_buffer<float>("out_buf", sent_data.size());
+					inst.submit();
+					inst.pull_buffer("out_buf", &recieved_data);
+
+					EXPECT_EQ(sent_data.size(), recieved_data.size());
+
+					for (size_t j = 0; j < recieved_data.size(); ++j) {
+						float expected = sent_data[j] + sent_data[j];
+						EXPECT_EQ(expected, recieved_data[j]);
+					}
+				}
+			});
+}
 
 } // namespace
@@ -0,0 +1,1015 @@
+﻿#define VK_NO_PROTOTYPES
+#include <vulkan/vk_icd.h>
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <unordered_set>
+
+/*
+vkc null driver
+A vulkan driver (ICD) which does nothing. Every command returns immediately
+and fences are always signaled. Memory is plain host memory, so mapping
+works.
+
+Running vkc on it measures the pure host-side cost of the library (name
+lookups, command recording, descriptor updates, allocations and staging
+copies), without a gpu or a cpu-emulated one. Pulled data is garbage.
+
+Select it with the loader, using its manifest :
+VK_ICD_FILENAMES=<bin>/vkc_null_icd.json
+*/
+
+#if defined(_WIN32)
+#define NULL_ICD_EXPORT extern "C" __declspec(dllexport)
+#else
+#define NULL_ICD_EXPORT extern "C" __attribute__((visibility("default")))
+#endif
+
+namespace {
+constexpr const char device_name[] = "vkc null driver";
+constexpr uint32_t icd_interface_version = 5;
+
+constexpr VkDeviceSize resource_alignment = 256;
+constexpr VkDeviceSize device_heap_byte_size = VkDeviceSize(8) << 30;
+constexpr VkDeviceSize host_heap_byte_size = VkDeviceSize(16) << 30;
+
+/*
+Dispatchable handles must start with the loader's data.
+*/
+struct dispatchable {
+	dispatchable() {
+		set_loader_magic_value(this);
+	}
+
+	VK_LOADER_DATA loader_data;
+};
+
+struct null_physical_device : dispatchable {
+	// Bytes allocated per heap, reported by VK_EXT_memory_budget.
+	std::array<std::atomic<VkDeviceSize>, 2> heap_usage{};
+};
+
+struct null_instance : dispatchable {
+	null_physical_device physical_device;
+};
+
+struct null_queue : dispatchable {};
+struct null_command_buffer : dispatchable {};
+
+struct null_device : dispatchable {
+	null_physical_device* physical_device = nullptr;
+	null_queue queue;
+};
+
+struct null_memory {
+	uint8_t* data = nullptr;
+	VkDeviceSize byte_size = 0;
+	uint32_t heap = 0;
+};
+
+// Buffers and images only need their size, for memory requirements.
+struct null_resource {
+	VkDeviceSize byte_size = 0;
+};
+
+// Command buffers are freed with their pool.
+struct null_command_pool {
+	std::mutex mutex;
+	std::unordered_set<null_command_buffer*> cmd_bufs;
+};
+
+// Descriptor sets are freed with their pool.
+struct null_descriptor_pool {
+	std::mutex mutex;
+	std::unordered_set<uint64_t*> sets;
+};
+
+// Every other non-dispatchable handle is a unique dummy allocation.
+template <class T>
+T make_handle() {
+	return reinterpret_cast<T>(new uint64_t{});
+}
+
+template <class T>
+void destroy_handle(T handle) {
+	delete reinterpret_cast<uint64_t*>(handle);
+}
+
+template <class T, class Handle>
+T* get(Handle handle) {
+	return reinterpret_cast<T*>(handle);
+}
+
+// Writes a vulkan array, as queried with the count then data idiom.
+template <class T, size_t N>
+VkResult write_array(
+		const std::array<T, N>& arr, uint32_t* count, T* out) {
+	if (out == nullptr) {
+		*count = uint32_t(N);
+		return VK_SUCCESS;
+	}
+	uint32_t written = std::min(*count, uint32_t(N));
+	std::copy(arr.begin(), arr.begin() + written, out);
+	*count = written;
+	return written < N ? VK_INCOMPLETE : VK_SUCCESS;
+}
+
+VkExtensionProperties make_extension(const char* name, uint32_t version) {
+	VkExtensionProperties ret{};
+	std::strncpy(ret.extensionName, name, VK_MAX_EXTENSION_NAME_SIZE - 1);
+	ret.specVersion = version;
+	return ret;
+}
+
+// Finds a struct in a pNext chain.
+template <class T>
+T* find_in_chain(void* chain, VkStructureType type) {
+	VkBaseOutStructure* s = reinterpret_cast<VkBaseOutStructure*>(chain);
+	while (s != nullptr) {
+		if (s->sType == type) {
+			return reinterpret_cast<T*>(s);
+		}
+		s = s->pNext;
+	}
+	return nullptr;
+}
+
+/*
+Instance and physical device.
+*/
+
+VKAPI_ATTR VkResult VKAPI_CALL null_EnumerateInstanceExtensionProperties(
+		const char* /*pLayerName*/, uint32_t* pPropertyCount,
+		VkExtensionProperties* pProperties) {
+	static const std::array<VkExtensionProperties, 1> extensions{
+		make_extension(VK_EXT_DEBUG_UTILS_EXTENSION_NAME, 2),
+	};
+	return write_array(extensions, pPropertyCount, pProperties);
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL null_EnumerateInstanceVersion(
+		uint32_t* pApiVersion) {
+	*pApiVersion = VK_API_VERSION_1_2;
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL null_CreateInstance(
+		const VkInstanceCreateInfo* /*pCreateInfo*/,
+		const VkAllocationCallbacks* /*pAllocator*/, VkInstance* pInstance) {
+	*pInstance = reinterpret_cast<VkInstance>(new null_instance{});
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL null_DestroyInstance(
+		VkInstance instance, const VkAllocationCallbacks* /*pAllocator*/) {
+	delete get<null_instance>(instance);
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL null_EnumeratePhysicalDevices(
+		VkInstance instance, uint32_t* pPhysicalDeviceCount,
+		VkPhysicalDevice* pPhysicalDevices) {
+	std::array<VkPhysicalDevice, 1> devices{
+		reinterpret_cast<VkPhysicalDevice>(
+				&get<null_instance>(instance)->physical_device),
+	};
+	return write_array(devices, pPhysicalDeviceCount, pPhysicalDevices);
+}
+
+VKAPI_ATTR void VKAPI_CALL null_GetPhysicalDeviceProperties(
+		VkPhysicalDevice /*physicalDevice*/,
+		VkPhysicalDeviceProperties* pProperties) {
+	*pProperties = VkPhysicalDeviceProperties{};
+	pProperties->apiVersion = VK_API_VERSION_1_2;
+	pProperties->driverVersion = 1;
+	pProperties->deviceType = VK_PHYSICAL_DEVICE_TYPE_OTHER;
+	std::strncpy(pProperties->deviceName, device_name,
+			VK_MAX_PHYSICAL_DEVICE_NAME_SIZE - 1);
+
+	// Typical desktop limits.
+	VkPhysicalDeviceLimits& limits = pProperties->limits;
+	limits.maxImageDimension1D = 16384;
+	limits.maxImageDimension2D = 16384;
+	limits.maxImageDimension3D = 2048;
+	limits.maxImageArrayLayers = 2048;
+	limits.maxTexelBufferElements = 128 * 1024 * 1024;
+	limits.maxUniformBufferRange = 65536;
+	limits.maxStorageBufferRange = UINT32_MAX;
+	limits.maxPushConstantsSize = 256;
+	limits.maxMemoryAllocationCount = 4096;
+	limits.maxSamplerAllocationCount = 4000;
+	limits.bufferImageGranularity = 1024;
+	limits.maxBoundDescriptorSets = 32;
+	limits.maxPerStageDescriptorSamplers = 1024 * 1024;
+	limits.maxPerStageDescriptorUniformBuffers = 1024 * 1024;
+	limits.maxPerStageDescriptorStorageBuffers = 1024 * 1024;
+	limits.maxPerStageDescriptorSampledImages = 1024 * 1024;
+	limits.maxPerStageDescriptorStorageImages = 1024 * 1024;
+	limits.maxPerStageResources = 1024 * 1024;
+	limits.maxDescriptorSetSamplers = 1024 * 1024;
+	limits.maxDescriptorSetUniformBuffers = 1024 * 1024;
+	limits.maxDescriptorSetStorageBuffers = 1024 * 1024;
+	limits.maxDescriptorSetSampledImages = 1024 * 1024;
+	limits.maxDescriptorSetStorageImages = 1024 * 1024;
+	limits.maxComputeSharedMemorySize = 49152;
+	limits.maxComputeWorkGroupCount[0] = 2147483647;
+	limits.maxComputeWorkGroupCount[1] = 65535;
+	limits.maxComputeWorkGroupCount[2] = 65535;
+	limits.maxComputeWorkGroupInvocations = 1024;
+	limits.maxComputeWorkGroupSize[0] = 1024;
+	limits.maxComputeWorkGroupSize[1] = 1024;
+	limits.maxComputeWorkGroupSize[2] = 64;
+	limits.minMemoryMapAlignment = 64;
+	limits.minTexelBufferOffsetAlignment = 16;
+	limits.minUniformBufferOffsetAlignment = 64;
+	limits.minStorageBufferOffsetAlignment = 16;
+	limits.timestampComputeAndGraphics = VK_TRUE;
+	limits.timestampPeriod = 1.f;
+	limits.optimalBufferCopyOffsetAlignment = 1;
+	limits.optimalBufferCopyRowPitchAlignment = 1;
+	limits.nonCoherentAtomSize = 64;
+}
+
+VKAPI_ATTR void VKAPI_CALL null_GetPhysicalDeviceProperties2(
+		VkPhysicalDevice physicalDevice,
+		VkPhysicalDeviceProperties2* pProperties) {
+	null_GetPhysicalDeviceProperties(
+			physicalDevice, &pProperties->properties);
+}
+
+VKAPI_ATTR void VKAPI_CALL null_GetPhysicalDeviceFeatures(
+		VkPhysicalDevice /*physicalDevice*/,
+		VkPhysicalDeviceFeatures* pFeatures) {
+	*pFeatures = VkPhysicalDeviceFeatures{};
+	pFeatures->shaderInt64 = VK_TRUE;
+	pFeatures->shaderFloat64 = VK_TRUE;
+	pFeatures->shaderStorageImageWriteWithoutFormat = VK_TRUE;
+	pFeatures->shaderStorageImageReadWithoutFormat = VK_TRUE;
+}
+
+VKAPI_ATTR void VKAPI_CALL null_GetPhysicalDeviceFeatures2(
+		VkPhysicalDevice physicalDevice,
+		VkPhysicalDeviceFeatures2* pFeatures) {
+	null_GetPhysicalDeviceFeatures(physicalDevice, &pFeatures->features);
+}
+
+VKAPI_ATTR void VKAPI_CALL null_GetPhysicalDeviceQueueFamilyProperties(
+		VkPhysicalDevice /*physicalDevice*/,
+		uint32_t* pQueueFamilyPropertyCount,
+		VkQueueFamilyProperties* pQueueFamilyProperties) {
+	VkQueueFamilyProperties family{};
+	family.queueFlags = VK_QUEUE_COMPUTE_BIT | VK_QUEUE_TRANSFER_BIT;
+	family.queueCount = 1;
+	family.timestampValidBits = 64;
+	family.minImageTransferGranularity = { 1, 1, 1 };
+	write_array(std::array<VkQueueFamilyProperties, 1>{ family },
+			pQueueFamilyPropertyCount, pQueueFamilyProperties);
+}
+
+VKAPI_ATTR void VKAPI_CALL null_GetPhysicalDeviceQueueFamilyProperties2(
+		VkPhysicalDevice physicalDevice, uint32_t* pQueueFamilyPropertyCount,
+		VkQueueFamilyProperties2* pQueueFamilyProperties) {
+	if (pQueueFamilyProperties == nullptr || *pQueueFamilyPropertyCount == 0) {
+		*pQueueFamilyPropertyCount = 1;
+		return;
+	}
+	*pQueueFamilyPropertyCount = 1;
+	null_GetPhysicalDeviceQueueFamilyProperties(physicalDevice,
+			pQueueFamilyPropertyCount,
+			&pQueueFamilyProperties[0].queueFamilyProperties);
+}
+
+/*
+A discrete gpu layout. Device local memory isn't host visible, so vkc uses
+its staging buffers like it would on real hardware.
+*/
+VKAPI_ATTR void VKAPI_CALL null_GetPhysicalDeviceMemoryProperties(
+		VkPhysicalDevice /*physicalDevice*/,
+		VkPhysicalDeviceMemoryProperties* pMemoryProperties) {
+	*pMemoryProperties = VkPhysicalDeviceMemoryProperties{};
+	pMemoryProperties->memoryHeapCount = 2;
+	pMemoryProperties->memoryHeaps[0]
+			= { device_heap_byte_size, VK_MEMORY_HEAP_DEVICE_LOCAL_BIT };
+	pMemoryProperties->memoryHeaps[1] = { host_heap_byte_size, 0 };
+
+	pMemoryProperties->memoryTypeCount = 3;
+	pMemoryProperties->memoryTypes[0]
+			= { VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0 };
+	pMemoryProperties->memoryTypes[1]
+			= { VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+							| VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+				  1 };
+	pMemoryProperties->memoryTypes[2]
+			= { VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+							| VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+							| VK_MEMORY_PROPERTY_HOST_CACHED_BIT,
+				  1 };
+}
+
+VKAPI_ATTR void VKAPI_CALL null_GetPhysicalDeviceMemoryProperties2(
+		VkPhysicalDevice physicalDevice,
+		VkPhysicalDeviceMemoryProperties2* pMemoryProperties) {
+	null_GetPhysicalDeviceMemoryProperties(
+			physicalDevice, &pMemoryProperties->memoryProperties);
+
+	auto* budget = find_in_chain<VkPhysicalDeviceMemoryBudgetPropertiesEXT>(
+			pMemoryProperties->pNext,
+			VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT);
+	if (budget == nullptr) {
+		return;
+	}
+
+	null_physical_device* dev = get<null_physical_device>(physicalDevice);
+	for (uint32_t i = 0; i < VK_MAX_MEMORY_HEAPS; ++i) {
+		budget->heapBudget[i] = 0;
+		budget->heapUsage[i] = 0;
+	}
+	budget->heapBudget[0] = device_heap_byte_size;
+	budget->heapBudget[1] = host_heap_byte_size;
+	budget->heapUsage[0] = dev->heap_usage[0].load();
+	budget->heapUsage[1] = dev->heap_usage[1].load();
+}
+
+// Every format supports everything.
+VKAPI_ATTR void VKAPI_CALL null_GetPhysicalDeviceFormatProperties(
+		VkPhysicalDevice /*physicalDevice*/, VkFormat /*format*/,
+		VkFormatProperties* pFormatProperties) {
+	VkFormatFeatureFlags image_features = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT
+			| VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT
+			| VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT
+			| VK_FORMAT_FEATURE_TRANSFER_SRC_BIT
+			| VK_FORMAT_FEATURE_TRANSFER_DST_BIT;
+	pFormatProperties->linearTilingFeatures = image_features;
+	pFormatProperties->optimalTilingFeatures = image_features;
+	pFormatProperties->bufferFeatures
+			= VK_FORMAT_FEATURE_UNIFORM_TEXEL_BUFFER_BIT
+			| VK_FORMAT_FEATURE_STORAGE_TEXEL_BUFFER_BIT;
+}
+
+VKAPI_ATTR void VKAPI_CALL null_GetPhysicalDeviceFormatProperties2(
+		VkPhysicalDevice physicalDevice, VkFormat format,
+		VkFormatProperties2* pFormatProperties) {
+	null_GetPhysicalDeviceFormatProperties(
+			physicalDevice, format, &pFormatProperties->formatProperties);
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL null_GetPhysicalDeviceImageFormatProperties(
+		VkPhysicalDevice /*physicalDevice*/, VkFormat /*format*/,
+		VkImageType /*type*/, VkImageTiling /*tiling*/,
+		VkImageUsageFlags /*usage*/, VkImageCreateFlags /*flags*/,
+		VkImageFormatProperties* pImageFormatProperties) {
+	*pImageFormatProperties = VkImageFormatProperties{};
+	pImageFormatProperties->maxExtent = { 16384, 16384, 2048 };
+	pImageFormatProperties->maxMipLevels = 15;
+	pImageFormatProperties->maxArrayLayers = 2048;
+	pImageFormatProperties->sampleCounts = VK_SAMPLE_COUNT_1_BIT;
+	pImageFormatProperties->maxResourceSize = VkDeviceSize(1) << 40;
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL null_EnumerateDeviceExtensionProperties(
+		VkPhysicalDevice /*physicalDevice*/, const char* /*pLayerName*/,
+		uint32_t* pPropertyCount, VkExtensionProperties* pProperties) {
+	static const std::array<VkExtensionProperties, 1> extensions{
+		make_extension(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME, 1),
+	};
+	return write_array(extensions, pPropertyCount, pProperties);
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL null_CreateDebugUtilsMessengerEXT(
+		VkInstance /*instance*/,
+		const VkDebugUtilsMessengerCreateInfoEXT* /*pCreateInfo*/,
+		const VkAllocationCallbacks* /*pAllocator*/,
+		VkDebugUtilsMessengerEXT* pMessenger) {
+	*pMessenger = make_handle<VkDebugUtilsMessengerEXT>();
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL null_DestroyDebugUtilsMessengerEXT(
+		VkInstance /*instance*/, VkDebugUtilsMessengerEXT messenger,
+		const VkAllocationCallbacks* /*pAllocator*/) {
+	destroy_handle(messenger);
+}
+
+/*
+Device and queue.
+*/
+
+VKAPI_ATTR VkResult VKAPI_CALL null_CreateDevice(
+		VkPhysicalDevice physicalDevice,
+		const VkDeviceCreateInfo* /*pCreateInfo*/,
+		const VkAllocationCallbacks* /*pAllocator*/, VkDevice* pDevice) {
+	null_device* dev = new null_device{};
+	dev->physical_device = get<null_physical_device>(physicalDevice);
+	*pDevice = reinterpret_cast<VkDevice>(dev);
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL null_DestroyDevice(
+		VkDevice device, const VkAllocationCallbacks* /*pAllocator*/) {
+	delete get<null_device>(device);
+}
+
+VKAPI_ATTR void VKAPI_CALL null_GetDeviceQueue(VkDevice device,
+		uint32_t /*queueFamilyIndex*/, uint32_t /*queueIndex*/,
+		VkQueue* pQueue) {
+	*pQueue = reinterpret_cast<VkQueue>(&get<null_device>(device)->queue);
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL null_QueueSubmit(VkQueue /*queue*/,
+		uint32_t /*submitCount*/, const VkSubmitInfo* /*pSubmits*/,
+		VkFence /*fence*/) {
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL null_QueueWaitIdle(VkQueue /*queue*/) {
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL null_DeviceWaitIdle(VkDevice /*device*/) {
+	return VK_SUCCESS;
+}
+
+/*
+Memory, buffers and images.
+*/
+
+VKAPI_ATTR VkResult VKAPI_CALL null_AllocateMemory(VkDevice device,
+		const VkMemoryAllocateInfo* pAllocateInfo,
+		const VkAllocationCallbacks* /*pAllocator*/, VkDeviceMemory* pMemory) {
+	null_memory* mem = new null_memory{};
+	mem->byte_size = pAllocateInfo->allocationSize;
+	mem->heap = pAllocateInfo->memoryTypeIndex == 0 ? 0 : 1;
+
+	// Untouched pages aren't committed, large device allocations are cheap.
+	mem->data = static_cast<uint8_t*>(std::malloc(size_t(mem->byte_size)));
+	if (mem->data == nullptr) {
+		VkResult res = mem->heap == 0 ? VK_ERROR_OUT_OF_DEVICE_MEMORY
+									  : VK_ERROR_OUT_OF_HOST_MEMORY;
+		delete mem;
+		return res;
+	}
+
+	get<null_device>(device)->physical_device->heap_usage[mem->heap]
+			+= mem->byte_size;
+	*pMemory = reinterpret_cast<VkDeviceMemory>(mem);
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL null_FreeMemory(VkDevice device,
+		VkDeviceMemory memory, const VkAllocationCallbacks* /*pAllocator*/) {
+	null_memory* mem = get<null_memory>(memory);
+	if (mem == nullptr) {
+		return;
+	}
+	get<null_device>(device)->physical_device->heap_usage[mem->heap]
+			-= mem->byte_size;
+	std::free(mem->data);
+	delete mem;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL null_MapMemory(VkDevice /*device*/,
+		VkDeviceMemory memory, VkDeviceSize offset, VkDeviceSize /*size*/,
+		VkMemoryMapFlags /*flags*/, void** ppData) {
+	*ppData = get<null_memory>(memory)->data + offset;
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL null_UnmapMemory(
+		VkDevice /*device*/, VkDeviceMemory /*memory*/) {
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL null_FlushMappedMemoryRanges(
+		VkDevice /*device*/, uint32_t /*memoryRangeCount*/,
+		const VkMappedMemoryRange* /*pMemoryRanges*/) {
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL null_CreateBuffer(VkDevice /*device*/,
+		const VkBufferCreateInfo* pCreateInfo,
+		const VkAllocationCallbacks* /*pAllocator*/, VkBuffer* pBuffer) {
+	*pBuffer = reinterpret_cast<VkBuffer>(
+			new null_resource{ pCreateInfo->size });
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL null_DestroyBuffer(VkDevice /*device*/,
+		VkBuffer buffer, const VkAllocationCallbacks* /*pAllocator*/) {
+	delete get<null_resource>(buffer);
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL null_CreateImage(VkDevice /*device*/,
+		const VkImageCreateInfo* pCreateInfo,
+		const VkAllocationCallbacks* /*pAllocator*/, VkImage* pImage) {
+	// Large enough for any format vkc supports.
+	constexpr VkDeviceSize max_texel_byte_size = 16;
+	const VkExtent3D& extent = pCreateInfo->extent;
+	*pImage = reinterpret_cast<VkImage>(new null_resource{
+			VkDeviceSize(extent.width) * extent.height * extent.depth
+			* pCreateInfo->arrayLayers * max_texel_byte_size });
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL null_DestroyImage(VkDevice /*device*/,
+		VkImage image, const VkAllocationCallbacks* /*pAllocator*/) {
+	delete get<null_resource>(image);
+}
+
+void get_memory_requirements(
+		const null_resource* res, VkMemoryRequirements* pMemoryRequirements) {
+	VkDeviceSize byte_size = std::max(res->byte_size, VkDeviceSize(1));
+	pMemoryRequirements->size = (byte_size + resource_alignment - 1)
+			/ resource_alignment * resource_alignment;
+	pMemoryRequirements->alignment = resource_alignment;
+	pMemoryRequirements->memoryTypeBits = 0b111;
+}
+
+VKAPI_ATTR void VKAPI_CALL null_GetBufferMemoryRequirements(
+		VkDevice /*device*/, VkBuffer buffer,
+		VkMemoryRequirements* pMemoryRequirements) {
+	get_memory_requirements(get<null_resource>(buffer), pMemoryRequirements);
+}
+
+VKAPI_ATTR void VKAPI_CALL null_GetImageMemoryRequirements(
+		VkDevice /*device*/, VkImage image,
+		VkMemoryRequirements* pMemoryRequirements) {
+	get_memory_requirements(get<null_resource>(image), pMemoryRequirements);
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL null_BindBufferMemory(VkDevice /*device*/,
+		VkBuffer /*buffer*/, VkDeviceMemory /*memory*/,
+		VkDeviceSize /*memoryOffset*/) {
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL null_BindImageMemory(VkDevice /*device*/,
+		VkImage /*image*/, VkDeviceMemory /*memory*/,
+		VkDeviceSize /*memoryOffset*/) {
+	return VK_SUCCESS;
+}
+
+/*
+Synchronization and queries. The queue is always idle.
+*/
+
+VKAPI_ATTR VkResult VKAPI_CALL null_WaitForFences(VkDevice /*device*/,
+		uint32_t /*fenceCount*/, const VkFence* /*pFences*/,
+		VkBool32 /*waitAll*/, uint64_t /*timeout*/) {
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL null_ResetFences(VkDevice /*device*/,
+		uint32_t /*fenceCount*/, const VkFence* /*pFences*/) {
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL null_GetFenceStatus(
+		VkDevice /*device*/, VkFence /*fence*/) {
+	return VK_SUCCESS;
+}
+
+// Timestamps are all 0, no gpu time is spent.
+VKAPI_ATTR VkResult VKAPI_CALL null_GetQueryPoolResults(VkDevice /*device*/,
+		VkQueryPool /*queryPool*/, uint32_t /*firstQuery*/,
+		uint32_t /*queryCount*/, size_t dataSize, void* pData,
+		VkDeviceSize /*stride*/, VkQueryResultFlags /*flags*/) {
+	std::memset(pData, 0, dataSize);
+	return VK_SUCCESS;
+}
+
+/*
+Descriptors.
+*/
+
+VKAPI_ATTR VkResult VKAPI_CALL null_CreateDescriptorPool(VkDevice /*device*/,
+		const VkDescriptorPoolCreateInfo* /*pCreateInfo*/,
+		const VkAllocationCallbacks* /*pAllocator*/,
+		VkDescriptorPool* pDescriptorPool) {
+	*pDescriptorPool
+			= reinterpret_cast<VkDescriptorPool>(new null_descriptor_pool{});
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL null_ResetDescriptorPool(VkDevice /*device*/,
+		VkDescriptorPool descriptorPool, VkDescriptorPoolResetFlags /*flags*/) {
+	null_descriptor_pool* pool = get<null_descriptor_pool>(descriptorPool);
+	std::lock_guard<std::mutex> lock(pool->mutex);
+	for (uint64_t* set : pool->sets) {
+		delete set;
+	}
+	pool->sets.clear();
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL null_DestroyDescriptorPool(VkDevice device,
+		VkDescriptorPool descriptorPool,
+		const VkAllocationCallbacks* /*pAllocator*/) {
+	if (descriptorPool == VK_NULL_HANDLE) {
+		return;
+	}
+	null_ResetDescriptorPool(device, descriptorPool, 0);
+	delete get<null_descriptor_pool>(descriptorPool);
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL null_AllocateDescriptorSets(VkDevice /*device*/,
+		const VkDescriptorSetAllocateInfo* pAllocateInfo,
+		VkDescriptorSet* pDescriptorSets) {
+	null_descriptor_pool* pool
+			= get<null_descriptor_pool>(pAllocateInfo->descriptorPool);
+	std::lock_guard<std::mutex> lock(pool->mutex);
+	for (uint32_t i = 0; i < pAllocateInfo->descriptorSetCount; ++i) {
+		uint64_t* set = new uint64_t{};
+		pool->sets.insert(set);
+		pDescriptorSets[i] = reinterpret_cast<VkDescriptorSet>(set);
+	}
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL null_FreeDescriptorSets(VkDevice /*device*/,
+		VkDescriptorPool descriptorPool, uint32_t descriptorSetCount,
+		const VkDescriptorSet* pDescriptorSets) {
+	null_descriptor_pool* pool = get<null_descriptor_pool>(descriptorPool);
+	std::lock_guard<std::mutex> lock(pool->mutex);
+	for (uint32_t i = 0; i < descriptorSetCount; ++i) {
+		uint64_t* set = get<uint64_t>(pDescriptorSets[i]);
+		if (pool->sets.erase(set) != 0) {
+			delete set;
+		}
+	}
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL null_UpdateDescriptorSets(VkDevice /*device*/,
+		uint32_t /*descriptorWriteCount*/,
+		const VkWriteDescriptorSet* /*pDescriptorWrites*/,
+		uint32_t /*descriptorCopyCount*/,
+		const VkCopyDescriptorSet* /*pDescriptorCopies*/) {
+}
+
+/*
+Command pools and buffers. Recording does nothing.
+*/
+
+VKAPI_ATTR VkResult VKAPI_CALL null_CreateCommandPool(VkDevice /*device*/,
+		const VkCommandPoolCreateInfo* /*pCreateInfo*/,
+		const VkAllocationCallbacks* /*pAllocator*/,
+		VkCommandPool* pCommandPool) {
+	*pCommandPool = reinterpret_cast<VkCommandPool>(new null_command_pool{});
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL null_DestroyCommandPool(VkDevice /*device*/,
+		VkCommandPool commandPool,
+		const VkAllocationCallbacks* /*pAllocator*/) {
+	null_command_pool* pool = get<null_command_pool>(commandPool);
+	if (pool == nullptr) {
+		return;
+	}
+	for (null_command_buffer* cmd_buf : pool->cmd_bufs) {
+		delete cmd_buf;
+	}
+	delete pool;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL null_ResetCommandPool(VkDevice /*device*/,
+		VkCommandPool /*commandPool*/, VkCommandPoolResetFlags /*flags*/) {
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL null_AllocateCommandBuffers(VkDevice /*device*/,
+		const VkCommandBufferAllocateInfo* pAllocateInfo,
+		VkCommandBuffer* pCommandBuffers) {
+	null_command_pool* pool
+			= get<null_command_pool>(pAllocateInfo->commandPool);
+	std::lock_guard<std::mutex> lock(pool->mutex);
+	for (uint32_t i = 0; i < pAllocateInfo->commandBufferCount; ++i) {
+		null_command_buffer* cmd_buf = new null_command_buffer{};
+		pool->cmd_bufs.insert(cmd_buf);
+		pCommandBuffers[i] = reinterpret_cast<VkCommandBuffer>(cmd_buf);
+	}
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL null_FreeCommandBuffers(VkDevice /*device*/,
+		VkCommandPool commandPool, uint32_t commandBufferCount,
+		const VkCommandBuffer* pCommandBuffers) {
+	null_command_pool* pool = get<null_command_pool>(commandPool);
+	std::lock_guard<std::mutex> lock(pool->mutex);
+	for (uint32_t i = 0; i < commandBufferCount; ++i) {
+		null_command_buffer* cmd_buf
+				= get<null_command_buffer>(pCommandBuffers[i]);
+		if (pool->cmd_bufs.erase(cmd_buf) != 0) {
+			delete cmd_buf;
+		}
+	}
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL null_BeginCommandBuffer(
+		VkCommandBuffer /*commandBuffer*/,
+		const VkCommandBufferBeginInfo* /*pBeginInfo*/) {
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL null_EndCommandBuffer(
+		VkCommandBuffer /*commandBuffer*/) {
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL null_ResetCommandBuffer(
+		VkCommandBuffer /*commandBuffer*/,
+		VkCommandBufferResetFlags /*flags*/) {
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL null_CmdBindPipeline(
+		VkCommandBuffer /*commandBuffer*/,
+		VkPipelineBindPoint /*pipelineBindPoint*/, VkPipeline /*pipeline*/) {
+}
+
+VKAPI_ATTR void VKAPI_CALL null_CmdBindDescriptorSets(
+		VkCommandBuffer /*commandBuffer*/,
+		VkPipelineBindPoint /*pipelineBindPoint*/,
+		VkPipelineLayout /*layout*/, uint32_t /*firstSet*/,
+		uint32_t /*descriptorSetCount*/,
+		const VkDescriptorSet* /*pDescriptorSets*/,
+		uint32_t /*dynamicOffsetCount*/,
+		const uint32_t* /*pDynamicOffsets*/) {
+}
+
+VKAPI_ATTR void VKAPI_CALL null_CmdPushConstants(
+		VkCommandBuffer /*commandBuffer*/, VkPipelineLayout /*layout*/,
+		VkShaderStageFlags /*stageFlags*/, uint32_t /*offset*/,
+		uint32_t /*size*/, const void* /*pValues*/) {
+}
+
+VKAPI_ATTR void VKAPI_CALL null_CmdDispatch(VkCommandBuffer /*commandBuffer*/,
+		uint32_t /*groupCountX*/, uint32_t /*groupCountY*/,
+		uint32_t /*groupCountZ*/) {
+}
+
+VKAPI_ATTR void VKAPI_CALL null_CmdDispatchBase(
+		VkCommandBuffer /*commandBuffer*/, uint32_t /*baseGroupX*/,
+		uint32_t /*baseGroupY*/, uint32_t /*baseGroupZ*/,
+		uint32_t /*groupCountX*/, uint32_t /*groupCountY*/,
+		uint32_t /*groupCountZ*/) {
+}
+
+VKAPI_ATTR void VKAPI_CALL null_CmdCopyBuffer(
+		VkCommandBuffer /*commandBuffer*/, VkBuffer /*srcBuffer*/,
+		VkBuffer /*dstBuffer*/, uint32_t /*regionCount*/,
+		const VkBufferCopy* /*pRegions*/) {
+}
+
+VKAPI_ATTR void VKAPI_CALL null_CmdCopyBufferToImage(
+		VkCommandBuffer /*commandBuffer*/, VkBuffer /*srcBuffer*/,
+		VkImage /*dstImage*/, VkImageLayout /*dstImageLayout*/,
+		uint32_t /*regionCount*/, const VkBufferImageCopy* /*pRegions*/) {
+}
+
+VKAPI_ATTR void VKAPI_CALL null_CmdCopyImageToBuffer(
+		VkCommandBuffer /*commandBuffer*/, VkImage /*srcImage*/,
+		VkImageLayout /*srcImageLayout*/, VkBuffer /*dstBuffer*/,
+		uint32_t /*regionCount*/, const VkBufferImageCopy* /*pRegions*/) {
+}
+
+VKAPI_ATTR void VKAPI_CALL null_CmdFillBuffer(
+		VkCommandBuffer /*commandBuffer*/, VkBuffer /*dstBuffer*/,
+		VkDeviceSize /*dstOffset*/, VkDeviceSize /*size*/,
+		uint32_t /*data*/) {
+}
+
+VKAPI_ATTR void VKAPI_CALL null_CmdPipelineBarrier(
+		VkCommandBuffer /*commandBuffer*/,
+		VkPipelineStageFlags /*srcStageMask*/,
+		VkPipelineStageFlags /*dstStageMask*/,
+		VkDependencyFlags /*dependencyFlags*/,
+		uint32_t /*memoryBarrierCount*/,
+		const VkMemoryBarrier* /*pMemoryBarriers*/,
+		uint32_t /*bufferMemoryBarrierCount*/,
+		const VkBufferMemoryBarrier* /*pBufferMemoryBarriers*/,
+		uint32_t /*imageMemoryBarrierCount*/,
+		const VkImageMemoryBarrier* /*pImageMemoryBarriers*/) {
+}
+
+VKAPI_ATTR void VKAPI_CALL null_CmdResetQueryPool(
+		VkCommandBuffer /*commandBuffer*/, VkQueryPool /*queryPool*/,
+		uint32_t /*firstQuery*/, uint32_t /*queryCount*/) {
+}
+
+VKAPI_ATTR void VKAPI_CALL null_CmdWriteTimestamp(
+		VkCommandBuffer /*commandBuffer*/,
+		VkPipelineStageFlagBits /*pipelineStage*/, VkQueryPool /*queryPool*/,
+		uint32_t /*query*/) {
+}
+
+/*
+Objects which only need a handle.
+*/
+
+#define NULL_ICD_HANDLE_OBJECT(name, create_info_t)                          \
+	VKAPI_ATTR VkResult VKAPI_CALL null_Create##name(VkDevice /*device*/,    \
+			const create_info_t* /*pCreateInfo*/,                            \
+			const VkAllocationCallbacks* /*pAllocator*/, Vk##name* pOut) {   \
+		*pOut = make_handle<Vk##name>();                                     \
+		return VK_SUCCESS;                                                   \
+	}                                                                        \
+	VKAPI_ATTR void VKAPI_CALL null_Destroy##name(VkDevice /*device*/,       \
+			Vk##name handle, const VkAllocationCallbacks* /*pAllocator*/) {  \
+		destroy_handle(handle);                                              \
+	}
+
+NULL_ICD_HANDLE_OBJECT(Fence, VkFenceCreateInfo)
+NULL_ICD_HANDLE_OBJECT(Semaphore, VkSemaphoreCreateInfo)
+NULL_ICD_HANDLE_OBJECT(QueryPool, VkQueryPoolCreateInfo)
+NULL_ICD_HANDLE_OBJECT(BufferView, VkBufferViewCreateInfo)
+NULL_ICD_HANDLE_OBJECT(ImageView, VkImageViewCreateInfo)
+NULL_ICD_HANDLE_OBJECT(Sampler, VkSamplerCreateInfo)
+NULL_ICD_HANDLE_OBJECT(ShaderModule, VkShaderModuleCreateInfo)
+NULL_ICD_HANDLE_OBJECT(PipelineLayout, VkPipelineLayoutCreateInfo)
+NULL_ICD_HANDLE_OBJECT(PipelineCache, VkPipelineCacheCreateInfo)
+NULL_ICD_HANDLE_OBJECT(DescriptorSetLayout, VkDescriptorSetLayoutCreateInfo)
+#undef NULL_ICD_HANDLE_OBJECT
+
+VKAPI_ATTR VkResult VKAPI_CALL null_CreateComputePipelines(VkDevice /*device*/,
+		VkPipelineCache /*pipelineCache*/, uint32_t createInfoCount,
+		const VkComputePipelineCreateInfo* /*pCreateInfos*/,
+		const VkAllocationCallbacks* /*pAllocator*/, VkPipeline* pPipelines) {
+	for (uint32_t i = 0; i < createInfoCount; ++i) {
+		pPipelines[i] = make_handle<VkPipeline>();
+	}
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL null_DestroyPipeline(VkDevice /*device*/,
+		VkPipeline pipeline, const VkAllocationCallbacks* /*pAllocator*/) {
+	destroy_handle(pipeline);
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL null_GetPipelineCacheData(VkDevice /*device*/,
+		VkPipelineCache /*pipelineCache*/, size_t* pDataSize,
+		void* /*pData*/) {
+	*pDataSize = 0;
+	return VK_SUCCESS;
+}
+
+/*
+Entry points.
+*/
+
+struct entry_point {
+	const char* name;
+	PFN_vkVoidFunction func;
+};
+
+#define NULL_ICD_ENTRY(name)                                                 \
+	entry_point {                                                            \
+		"vk" #name, reinterpret_cast<PFN_vkVoidFunction>(&null_##name)       \
+	}
+#define NULL_ICD_ALIAS(alias, name)                                          \
+	entry_point {                                                            \
+		"vk" #alias, reinterpret_cast<PFN_vkVoidFunction>(&null_##name)      \
+	}
+
+VKAPI_ATTR PFN_vkVoidFunction VKAPI_CALL null_GetDeviceProcAddr(
+		VkDevice device, const char* pName);
+
+const std::array entry_points{
+	NULL_ICD_ENTRY(EnumerateInstanceExtensionProperties),
+	NULL_ICD_ENTRY(EnumerateInstanceVersion),
+	NULL_ICD_ENTRY(CreateInstance),
+	NULL_ICD_ENTRY(DestroyInstance),
+	NULL_ICD_ENTRY(EnumeratePhysicalDevices),
+	NULL_ICD_ENTRY(GetPhysicalDeviceProperties),
+	NULL_ICD_ENTRY(GetPhysicalDeviceProperties2),
+	NULL_ICD_ALIAS(GetPhysicalDeviceProperties2KHR,
+			GetPhysicalDeviceProperties2),
+	NULL_ICD_ENTRY(GetPhysicalDeviceFeatures),
+	NULL_ICD_ENTRY(GetPhysicalDeviceFeatures2),
+	NULL_ICD_ALIAS(GetPhysicalDeviceFeatures2KHR, GetPhysicalDeviceFeatures2),
+	NULL_ICD_ENTRY(GetPhysicalDeviceQueueFamilyProperties),
+	NULL_ICD_ENTRY(GetPhysicalDeviceQueueFamilyProperties2),
+	NULL_ICD_ALIAS(GetPhysicalDeviceQueueFamilyProperties2KHR,
+			GetPhysicalDeviceQueueFamilyProperties2),
+	NULL_ICD_ENTRY(GetPhysicalDeviceMemoryProperties),
+	NULL_ICD_ENTRY(GetPhysicalDeviceMemoryProperties2),
+	NULL_ICD_ALIAS(GetPhysicalDeviceMemoryProperties2KHR,
+			GetPhysicalDeviceMemoryProperties2),
+	NULL_ICD_ENTRY(GetPhysicalDeviceFormatProperties),
+	NULL_ICD_ENTRY(GetPhysicalDeviceFormatProperties2),
+	NULL_ICD_ALIAS(GetPhysicalDeviceFormatProperties2KHR,
+			GetPhysicalDeviceFormatProperties2),
+	NULL_ICD_ENTRY(GetPhysicalDeviceImageFormatProperties),
+	NULL_ICD_ENTRY(EnumerateDeviceExtensionProperties),
+	NULL_ICD_ENTRY(CreateDebugUtilsMessengerEXT),
+	NULL_ICD_ENTRY(DestroyDebugUtilsMessengerEXT),
+	NULL_ICD_ENTRY(CreateDevice),
+	NULL_ICD_ENTRY(DestroyDevice),
+	NULL_ICD_ENTRY(GetDeviceProcAddr),
+	NULL_ICD_ENTRY(GetDeviceQueue),
+	NULL_ICD_ENTRY(QueueSubmit),
+	NULL_ICD_ENTRY(QueueWaitIdle),
+	NULL_ICD_ENTRY(DeviceWaitIdle),
+	NULL_ICD_ENTRY(AllocateMemory),
+	NULL_ICD_ENTRY(FreeMemory),
+	NULL_ICD_ENTRY(MapMemory),
+	NULL_ICD_ENTRY(UnmapMemory),
+	NULL_ICD_ENTRY(FlushMappedMemoryRanges),
+	NULL_ICD_ALIAS(InvalidateMappedMemoryRanges, FlushMappedMemoryRanges),
+	NULL_ICD_ENTRY(CreateBuffer),
+	NULL_ICD_ENTRY(DestroyBuffer),
+	NULL_ICD_ENTRY(CreateImage),
+	NULL_ICD_ENTRY(DestroyImage),
+	NULL_ICD_ENTRY(GetBufferMemoryRequirements),
+	NULL_ICD_ENTRY(GetImageMemoryRequirements),
+	NULL_ICD_ENTRY(BindBufferMemory),
+	NULL_ICD_ENTRY(BindImageMemory),
+	NULL_ICD_ENTRY(CreateFence),
+	NULL_ICD_ENTRY(DestroyFence),
+	NULL_ICD_ENTRY(WaitForFences),
+	NULL_ICD_ENTRY(ResetFences),
+	NULL_ICD_ENTRY(GetFenceStatus),
+	NULL_ICD_ENTRY(CreateSemaphore),
+	NULL_ICD_ENTRY(DestroySemaphore),
+	NULL_ICD_ENTRY(CreateQueryPool),
+	NULL_ICD_ENTRY(DestroyQueryPool),
+	NULL_ICD_ENTRY(GetQueryPoolResults),
+	NULL_ICD_ENTRY(CreateBufferView),
+	NULL_ICD_ENTRY(DestroyBufferView),
+	NULL_ICD_ENTRY(CreateImageView),
+	NULL_ICD_ENTRY(DestroyImageView),
+	NULL_ICD_ENTRY(CreateSampler),
+	NULL_ICD_ENTRY(DestroySampler),
+	NULL_ICD_ENTRY(CreateShaderModule),
+	NULL_ICD_ENTRY(DestroyShaderModule),
+	NULL_ICD_ENTRY(CreatePipelineLayout),
+	NULL_ICD_ENTRY(DestroyPipelineLayout),
+	NULL_ICD_ENTRY(CreatePipelineCache),
+	NULL_ICD_ENTRY(DestroyPipelineCache),
+	NULL_ICD_ENTRY(GetPipelineCacheData),
+	NULL_ICD_ENTRY(CreateComputePipelines),
+	NULL_ICD_ENTRY(DestroyPipeline),
+	NULL_ICD_ENTRY(CreateDescriptorSetLayout),
+	NULL_ICD_ENTRY(DestroyDescriptorSetLayout),
+	NULL_ICD_ENTRY(CreateDescriptorPool),
+	NULL_ICD_ENTRY(DestroyDescriptorPool),
+	NULL_ICD_ENTRY(ResetDescriptorPool),
+	NULL_ICD_ENTRY(AllocateDescriptorSets),
+	NULL_ICD_ENTRY(FreeDescriptorSets),
+	NULL_ICD_ENTRY(UpdateDescriptorSets),
+	NULL_ICD_ENTRY(CreateCommandPool),
+	NULL_ICD_ENTRY(DestroyCommandPool),
+	NULL_ICD_ENTRY(ResetCommandPool),
+	NULL_ICD_ENTRY(AllocateCommandBuffers),
+	NULL_ICD_ENTRY(FreeCommandBuffers),
+	NULL_ICD_ENTRY(BeginCommandBuffer),
+	NULL_ICD_ENTRY(EndCommandBuffer),
+	NULL_ICD_ENTRY(ResetCommandBuffer),
+	NULL_ICD_ENTRY(CmdBindPipeline),
+	NULL_ICD_ENTRY(CmdBindDescriptorSets),
+	NULL_ICD_ENTRY(CmdPushConstants),
+	NULL_ICD_ENTRY(CmdDispatch),
+	NULL_ICD_ENTRY(CmdDispatchBase),
+	NULL_ICD_ALIAS(CmdDispatchBaseKHR, CmdDispatchBase),
+	NULL_ICD_ENTRY(CmdCopyBuffer),
+	NULL_ICD_ENTRY(CmdCopyBufferToImage),
+	NULL_ICD_ENTRY(CmdCopyImageToBuffer),
+	NULL_ICD_ENTRY(CmdFillBuffer),
+	NULL_ICD_ENTRY(CmdPipelineBarrier),
+	NULL_ICD_ENTRY(CmdResetQueryPool),
+	NULL_ICD_ENTRY(CmdWriteTimestamp),
+};
+#undef NULL_ICD_ENTRY
+#undef NULL_ICD_ALIAS
+
+// Unsupported functions return nullptr, the loader handles that.
+PFN_vkVoidFunction find_entry_point(const char* name) {
+	for (const entry_point& e : entry_points) {
+		if (std::strcmp(e.name, name) == 0) {
+			return e.func;
+		}
+	}
+	return nullptr;
+}
+
+VKAPI_ATTR PFN_vkVoidFunction VKAPI_CALL null_GetDeviceProcAddr(
+		VkDevice /*device*/, const char* pName) {
+	return find_entry_point(pName);
+}
+} // namespace
+
+NULL_ICD_EXPORT VKAPI_ATTR VkResult VKAPI_CALL
+vk_icdNegotiateLoaderICDInterfaceVersion(uint32_t* pSupportedVersion) {
+	*pSupportedVersion = std::min(*pSupportedVersion, icd_interface_version);
+	return VK_SUCCESS;
+}
+
+NULL_ICD_EXPORT VKAPI_ATTR PFN_vkVoidFunction VKAPI_CALL
+vk_icdGetInstanceProcAddr(VkInstance /*instance*/, const char* pName) {
+	return find_entry_point(pName);
+}
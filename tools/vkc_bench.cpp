@@ -0,0 +1,318 @@
+﻿#include <vkc/vulkan_compute.hpp>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+vkc_bench
+Benchmarks any precompiled compute shader, without writing a test for it.
+
+Buffers are reflected from the shader and filled with synthetic data, the
+push_constants are zeroed unless provided. The shader is then dispatched
+repeatedly and the host and gpu latencies are reported.
+*/
+
+namespace {
+namespace vkc = fea::vkc;
+
+void print_usage() {
+	printf("Usage : vkc_bench <shader.spv> [options]\n"
+		   "\n"
+		   "Options :\n"
+		   "  --size <bytes>              Size of every buffer, "
+		   "16777216 by default.\n"
+		   "  --buffer <name>=<bytes>     Size of one buffer.\n"
+		   "  --image <name>=<w>x<h>x<d>  Size of one image, in texels. "
+		   "512x512x1 by default.\n"
+		   "  --constant <name>=<u32>,..  Push constant block words, "
+		   "zeroed by default.\n"
+		   "  --grid <x> <y> <z>          Dispatch size, in invocations. "
+		   "One per 4 bytes of\n"
+		   "                              buffer by default, up to 65535 "
+		   "work groups.\n"
+		   "  --iterations <n>            Measured dispatches, 100 by "
+		   "default.\n"
+		   "  --warmup <n>                Unmeasured dispatches, 5 by "
+		   "default.\n");
+}
+
+struct options {
+	std::filesystem::path shader_path;
+	size_t default_byte_size = 16 * 1024 * 1024;
+	std::unordered_map<std::string, size_t> buffer_byte_sizes;
+	std::unordered_map<std::string, std::array<size_t, 3>> image_sizes;
+	std::unordered_map<std::string, std::vector<uint32_t>> constants;
+	std::array<size_t, 3> grid = { 0, 1, 1 };
+	size_t iterations = 100;
+	size_t warmup = 5;
+};
+
+// Splits "name=value".
+bool split_assignment(const char* arg, std::string& name, std::string& val) {
+	const char* eq = std::strchr(arg, '=');
+	if (eq == nullptr) {
+		return false;
+	}
+	name.assign(arg, eq);
+	val.assign(eq + 1);
+	return !name.empty() && !val.empty();
+}
+
+// Returns false on bad arguments.
+bool parse_options(int argc, char** argv, options& opts) {
+	if (argc < 2) {
+		return false;
+	}
+	opts.shader_path = argv[1];
+
+	for (int i = 2; i < argc; ++i) {
+		std::string arg = argv[i];
+		auto has_values = [&](int count) { return i + count < argc; };
+
+		if (arg == "--size" && has_values(1)) {
+			opts.default_byte_size = std::strtoull(argv[++i], nullptr, 10);
+		} else if (arg == "--buffer" && has_values(1)) {
+			std::string name, val;
+			if (!split_assignment(argv[++i], name, val)) {
+				return false;
+			}
+			opts.buffer_byte_sizes[name]
+					= std::strtoull(val.c_str(), nullptr, 10);
+		} else if (arg == "--image" && has_values(1)) {
+			std::string name, val;
+			if (!split_assignment(argv[++i], name, val)) {
+				return false;
+			}
+			std::array<size_t, 3> size = { 1, 1, 1 };
+			const char* str = val.c_str();
+			for (size_t& s : size) {
+				char* end = nullptr;
+				s = std::strtoull(str, &end, 10);
+				if (*end != 'x') {
+					break;
+				}
+				str = end + 1;
+			}
+			opts.image_sizes[name] = size;
+		} else if (arg == "--constant" && has_values(1)) {
+			std::string name, val;
+			if (!split_assignment(argv[++i], name, val)) {
+				return false;
+			}
+			std::vector<uint32_t>& words = opts.constants[name];
+			const char* str = val.c_str();
+			while (*str != '\0') {
+				char* end = nullptr;
+				words.push_back(uint32_t(std::strtoul(str, &end, 0)));
+				str = *end == ',' ? end + 1 : end;
+				if (end == str && *end != '\0') {
+					return false;
+				}
+			}
+		} else if (arg == "--grid" && has_values(3)) {
+			for (size_t& g : opts.grid) {
+				g = std::strtoull(argv[++i], nullptr, 10);
+			}
+		} else if (arg == "--iterations" && has_values(1)) {
+			opts.iterations = std::strtoull(argv[++i], nullptr, 10);
+		} else if (arg == "--warmup" && has_values(1)) {
+			opts.warmup = std::strtoull(argv[++i], nullptr, 10);
+		} else {
+			fprintf(stderr, "Unknown or incomplete option '%s'\n", argv[i]);
+			return false;
+		}
+	}
+	return opts.iterations != 0;
+}
+
+// Nearest rank percentile, of sorted values.
+double percentile(const std::vector<double>& sorted, double p) {
+	size_t idx = size_t(p * double(sorted.size() - 1) + 0.5);
+	return sorted[std::min(idx, sorted.size() - 1)];
+}
+
+void print_latencies(const char* title, std::vector<double> ms) {
+	std::sort(ms.begin(), ms.end());
+	printf("%-14s p50 %9.3f ms  p90 %9.3f ms  p99 %9.3f ms  max %9.3f ms\n",
+			title, percentile(ms, 0.5), percentile(ms, 0.9),
+			percentile(ms, 0.99), ms.back());
+}
+
+double gb_per_s(size_t byte_size, double ms) {
+	if (ms <= 0.0) {
+		return 0.0;
+	}
+	return double(byte_size) / (ms / 1000.0) / 1e9;
+}
+
+// The maxComputeWorkGroupCount every vulkan device supports.
+constexpr size_t min_max_group_count = 65535;
+
+// Runs the benchmark, returns the exit code.
+// Throws if the dispatch exceeds the device limits, see --grid.
+int bench(options& opts) {
+	vkc::vkc gpu;
+
+	auto construct_start = std::chrono::steady_clock::now();
+	vkc::task t{ gpu, opts.shader_path.wstring().c_str() };
+	std::chrono::duration<double, std::milli> construct_time
+			= std::chrono::steady_clock::now() - construct_start;
+
+	t.profiling(true);
+	vkc::task_reflection refl = t.reflection();
+
+	printf("Shader '%s'\n", opts.shader_path.string().c_str());
+	printf("Work group size %u x %u x %u, task construction %.3f ms\n\n",
+			refl.work_group_size[0], refl.work_group_size[1],
+			refl.work_group_size[2], construct_time.count());
+
+	// Buffers, filled with small floats so shaders don't see nans.
+	size_t buffer_traffic = 0;
+	size_t largest_buffer = 0;
+	std::vector<uint8_t> data;
+	for (const vkc::resource_info& b : refl.buffers) {
+		auto it = opts.buffer_byte_sizes.find(b.name);
+		size_t byte_size = it != opts.buffer_byte_sizes.end()
+				? it->second
+				: opts.default_byte_size;
+		byte_size -= byte_size % sizeof(float);
+
+		if (b.texel && b.fmt == vkc::format::undefined) {
+			t.set_format(b.name.c_str(), vkc::format::r32_sfloat);
+		}
+
+		data.resize(byte_size);
+		float* floats = reinterpret_cast<float*>(data.data());
+		for (size_t i = 0; i < byte_size / sizeof(float); ++i) {
+			floats[i] = float(i % 1024) / 1024.f;
+		}
+
+		t.push_buffer(b.name.c_str(), data);
+		vkc::phase_timing push = t.last_timings().push;
+
+		std::vector<uint8_t> out;
+		t.pull_buffer(b.name.c_str(), &out);
+		vkc::phase_timing pull = t.last_timings().pull;
+
+		printf("Buffer %-20s %12zu bytes  push %7.2f GB/s  pull %7.2f "
+			   "GB/s\n",
+				b.name.c_str(), byte_size, gb_per_s(byte_size, push.host_ms),
+				gb_per_s(byte_size, pull.host_ms));
+
+		buffer_traffic += byte_size;
+		largest_buffer = std::max(largest_buffer, byte_size);
+	}
+
+	for (const vkc::resource_info& img : refl.images) {
+		std::array<size_t, 3> size = { 512, img.dimensions > 1 ? 512u : 1u,
+			img.dimensions > 2 ? 512u : 1u };
+		auto it = opts.image_sizes.find(img.name);
+		if (it != opts.image_sizes.end()) {
+			size = it->second;
+		}
+
+		if (img.fmt == vkc::format::undefined) {
+			t.set_format(img.name.c_str(), vkc::format::rgba8_unorm);
+		}
+		t.reserve_image(img.name.c_str(), size[0], size[1], size[2]);
+		printf("Image  %-20s %zu x %zu x %zu texels\n", img.name.c_str(),
+				size[0], size[1], size[2]);
+	}
+
+	// Push constants, zeroed unless provided.
+	std::vector<std::vector<uint8_t>> constants;
+	for (const vkc::push_constant_block& c : refl.push_constants) {
+		std::vector<uint8_t> bytes(c.byte_size, 0);
+		auto it = opts.constants.find(c.name);
+		if (it != opts.constants.end()) {
+			size_t copy_size = std::min(
+					bytes.size(), it->second.size() * sizeof(uint32_t));
+			std::memcpy(bytes.data(), it->second.data(), copy_size);
+		}
+		constants.push_back(std::move(bytes));
+		printf("Push constant %-13s %zu bytes\n", c.name.c_str(),
+				c.byte_size);
+	}
+
+	if (opts.grid[0] == 0) {
+		// Within the group count limit of every device.
+		opts.grid[0] = std::clamp(largest_buffer / sizeof(float), size_t(1),
+				min_max_group_count * refl.work_group_size[0]);
+	}
+	printf("\nDispatching %zu x %zu x %zu invocations, %zu times\n\n",
+			opts.grid[0], opts.grid[1], opts.grid[2], opts.iterations);
+
+	auto dispatch = [&]() {
+		for (size_t i = 0; i < constants.size(); ++i) {
+			t.push_constant(refl.push_constants[i].name.c_str(),
+					constants[i].data(), constants[i].size());
+		}
+		t.submit(opts.grid[0], opts.grid[1], opts.grid[2]);
+	};
+
+	for (size_t i = 0; i < opts.warmup; ++i) {
+		dispatch();
+	}
+
+	std::vector<double> host_ms;
+	std::vector<double> gpu_ms;
+	std::vector<double> overhead_ms;
+	host_ms.reserve(opts.iterations);
+	gpu_ms.reserve(opts.iterations);
+	overhead_ms.reserve(opts.iterations);
+	for (size_t i = 0; i < opts.iterations; ++i) {
+		dispatch();
+		vkc::phase_timing submit = t.last_timings().submit;
+		host_ms.push_back(submit.host_ms);
+		gpu_ms.push_back(submit.gpu_ms);
+		overhead_ms.push_back(std::max(0.0, submit.host_ms - submit.gpu_ms));
+	}
+
+	print_latencies("Host latency", host_ms);
+	print_latencies("Gpu time", gpu_ms);
+	print_latencies("Host overhead", overhead_ms);
+
+	// Assumes every buffer is read or written once per dispatch.
+	std::sort(gpu_ms.begin(), gpu_ms.end());
+	printf("\nDeclared buffer traffic %zu bytes, %.2f GB/s at p50 gpu "
+		   "time\n",
+			buffer_traffic, gb_per_s(buffer_traffic, percentile(gpu_ms, 0.5)));
+
+	return EXIT_SUCCESS;
+}
+} // namespace
+
+int main(int argc, char** argv) {
+	options opts;
+	if (!parse_options(argc, argv, opts)) {
+		print_usage();
+		return EXIT_FAILURE;
+	}
+
+	if (!std::filesystem::exists(opts.shader_path)) {
+		fprintf(stderr, "Shader '%s' not found.\n",
+				opts.shader_path.string().c_str());
+		return EXIT_FAILURE;
+	}
+
+	try {
+		return bench(opts);
+	} catch (const std::exception& e) {
+		// Typically a dispatch larger than the device limits.
+		fprintf(stderr,
+				"Benchmark failed : %s\nTry a smaller dispatch with "
+				"--grid.\n",
+				e.what());
+		return EXIT_FAILURE;
+	}
+}
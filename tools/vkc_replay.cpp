@@ -0,0 +1,418 @@
+﻿#include <vkc/vulkan_compute.hpp>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/*
+vkc_replay
+Replays a task capture (see task::begin_capture) and times it.
+
+The capture is memory mapped, pushed data is used in place. The whole
+session is replayed on the same task, so steady state performance is
+measured after the warmup.
+*/
+
+namespace {
+namespace vkc = fea::vkc;
+
+void print_usage() {
+	printf("Usage : vkc_replay <capture> [options]\n"
+		   "\n"
+		   "Options :\n"
+		   "  --iterations <n>  Measured replays of the session, 10 by "
+		   "default.\n"
+		   "  --warmup <n>      Unmeasured replays, 1 by default.\n");
+}
+
+// A read-only memory mapped file.
+struct mapped_file {
+	mapped_file() = default;
+	mapped_file(const mapped_file&) = delete;
+	mapped_file& operator=(const mapped_file&) = delete;
+
+	~mapped_file() {
+#if defined(_WIN32)
+		if (_data != nullptr) {
+			UnmapViewOfFile(_data);
+		}
+		if (_mapping != nullptr) {
+			CloseHandle(_mapping);
+		}
+		if (_file != INVALID_HANDLE_VALUE) {
+			CloseHandle(_file);
+		}
+#else
+		if (_data != nullptr) {
+			munmap(const_cast<uint8_t*>(_data), _byte_size);
+		}
+#endif
+	}
+
+	bool open(const std::filesystem::path& filepath) {
+		std::error_code ec;
+		_byte_size = size_t(std::filesystem::file_size(filepath, ec));
+		if (ec || _byte_size == 0) {
+			return false;
+		}
+
+#if defined(_WIN32)
+		_file = CreateFileW(filepath.wstring().c_str(), GENERIC_READ,
+				FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+				nullptr);
+		if (_file == INVALID_HANDLE_VALUE) {
+			return false;
+		}
+		_mapping = CreateFileMappingW(
+				_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (_mapping == nullptr) {
+			return false;
+		}
+		_data = static_cast<const uint8_t*>(
+				MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+#else
+		int fd = ::open(filepath.c_str(), O_RDONLY);
+		if (fd < 0) {
+			return false;
+		}
+		void* ptr = mmap(nullptr, _byte_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		_data = ptr == MAP_FAILED ? nullptr : static_cast<const uint8_t*>(ptr);
+#endif
+		return _data != nullptr;
+	}
+
+	const uint8_t* data() const {
+		return _data;
+	}
+	size_t size() const {
+		return _byte_size;
+	}
+
+private:
+	const uint8_t* _data = nullptr;
+	size_t _byte_size = 0;
+#if defined(_WIN32)
+	HANDLE _file = INVALID_HANDLE_VALUE;
+	HANDLE _mapping = nullptr;
+#endif
+};
+
+// A validated view of a mapped capture.
+struct capture_view {
+	// Returns false if the capture is invalid or truncated.
+	bool init(const mapped_file& file) {
+		if (file.size() < sizeof(vkc::capture_header)) {
+			return false;
+		}
+		std::memcpy(&header, file.data(), sizeof(header));
+		if (header.magic != vkc::capture_magic
+				|| header.version != vkc::capture_version) {
+			return false;
+		}
+
+		uint64_t commands_end = header.commands_offset
+				+ uint64_t(header.command_count) * sizeof(vkc::capture_command);
+		uint64_t blobs_end = header.blobs_offset
+				+ uint64_t(header.blob_count) * sizeof(vkc::capture_blob);
+		if (commands_end > file.size() || blobs_end > file.size()) {
+			return false;
+		}
+
+		base = file.data();
+		commands = reinterpret_cast<const vkc::capture_command*>(
+				base + header.commands_offset);
+		blobs = reinterpret_cast<const vkc::capture_blob*>(
+				base + header.blobs_offset);
+
+		for (uint32_t i = 0; i < header.blob_count; ++i) {
+			if (blobs[i].offset + blobs[i].byte_size > file.size()) {
+				return false;
+			}
+		}
+		for (uint32_t i = 0; i < header.command_count; ++i) {
+			const vkc::capture_command& cmd = commands[i];
+			if (cmd.op >= vkc::capture_op::count || !valid(cmd.name)
+					|| !valid(cmd.data) || !valid(cmd.extra)) {
+				return false;
+			}
+		}
+		return header.spirv < header.blob_count && valid(header.spec_constants);
+	}
+
+	bool valid(uint32_t blob) const {
+		return blob == vkc::capture_no_blob || blob < header.blob_count;
+	}
+
+	const uint8_t* data(uint32_t blob) const {
+		return base + blobs[blob].offset;
+	}
+	size_t byte_size(uint32_t blob) const {
+		return blob == vkc::capture_no_blob ? 0 : size_t(blobs[blob].byte_size);
+	}
+
+	vkc::capture_header header;
+	const uint8_t* base = nullptr;
+	const vkc::capture_command* commands = nullptr;
+	const vkc::capture_blob* blobs = nullptr;
+};
+
+constexpr std::array<const char*, size_t(vkc::capture_op::count)> op_names{
+	"push_constant",
+	"reserve_buffer",
+	"push_buffer",
+	"pull_buffer",
+	"set_format",
+	"reserve_image",
+	"push_image",
+	"pull_image",
+	"submit",
+	"submit_many",
+	"reserve_buffer_capacity",
+};
+
+bool is_transfer(vkc::capture_op op) {
+	return op == vkc::capture_op::push_buffer
+			|| op == vkc::capture_op::pull_buffer
+			|| op == vkc::capture_op::push_image
+			|| op == vkc::capture_op::pull_image;
+}
+
+struct op_stats {
+	size_t count = 0;
+	size_t byte_size = 0;
+	double host_ms = 0.0;
+	double gpu_ms = 0.0;
+};
+
+// Nearest rank percentile, of sorted values.
+double percentile(const std::vector<double>& sorted, double p) {
+	size_t idx = size_t(p * double(sorted.size() - 1) + 0.5);
+	return sorted[std::min(idx, sorted.size() - 1)];
+}
+
+double gb_per_s(size_t byte_size, double ms) {
+	if (ms <= 0.0) {
+		return 0.0;
+	}
+	return double(byte_size) / (ms / 1000.0) / 1e9;
+}
+} // namespace
+
+int main(int argc, char** argv) {
+	if (argc < 2) {
+		print_usage();
+		return EXIT_FAILURE;
+	}
+
+	std::filesystem::path capture_path = argv[1];
+	size_t iterations = 10;
+	size_t warmup = 1;
+	for (int i = 2; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--iterations" && i + 1 < argc) {
+			iterations = std::strtoull(argv[++i], nullptr, 10);
+		} else if (arg == "--warmup" && i + 1 < argc) {
+			warmup = std::strtoull(argv[++i], nullptr, 10);
+		} else {
+			fprintf(stderr, "Unknown or incomplete option '%s'\n", argv[i]);
+			print_usage();
+			return EXIT_FAILURE;
+		}
+	}
+	if (iterations == 0) {
+		print_usage();
+		return EXIT_FAILURE;
+	}
+
+	mapped_file file;
+	if (!file.open(capture_path)) {
+		fprintf(stderr, "Couldn't open capture '%s'.\n",
+				capture_path.string().c_str());
+		return EXIT_FAILURE;
+	}
+
+	capture_view cap;
+	if (!cap.init(file)) {
+		fprintf(stderr, "Invalid or unsupported capture '%s'.\n",
+				capture_path.string().c_str());
+		return EXIT_FAILURE;
+	}
+
+	// Decode everything up front, so replays only call the task.
+	vkc::task_options opts;
+	opts.optimize = cap.header.optimize != 0;
+	if (cap.header.spec_constants != vkc::capture_no_blob) {
+		size_t count = cap.byte_size(cap.header.spec_constants)
+				/ (2 * sizeof(uint32_t));
+		const uint8_t* spec = cap.data(cap.header.spec_constants);
+		for (size_t i = 0; i < count; ++i) {
+			std::array<uint32_t, 2> c;
+			std::memcpy(c.data(), spec + i * sizeof(c), sizeof(c));
+			opts.spec_constants.push_back(vkc::spec_constant{ c[0], c[1] });
+		}
+	}
+
+	std::vector<std::string> names(cap.header.command_count);
+	std::vector<std::vector<size_t>> dispatch_sizes(cap.header.command_count);
+	for (uint32_t i = 0; i < cap.header.command_count; ++i) {
+		const vkc::capture_command& cmd = cap.commands[i];
+		if (cmd.name != vkc::capture_no_blob) {
+			names[i].assign(reinterpret_cast<const char*>(cap.data(cmd.name)),
+					cap.byte_size(cmd.name));
+		}
+		if (cmd.op == vkc::capture_op::submit_many) {
+			std::vector<uint64_t> sizes(
+					cap.byte_size(cmd.extra) / sizeof(uint64_t));
+			std::memcpy(sizes.data(), cap.data(cmd.extra),
+					sizes.size() * sizeof(uint64_t));
+			dispatch_sizes[i].assign(sizes.begin(), sizes.end());
+		}
+	}
+
+	vkc::vkc gpu;
+	const uint32_t* spirv
+			= reinterpret_cast<const uint32_t*>(cap.data(cap.header.spirv));
+	vkc::task t{ gpu,
+		fea::span<const uint32_t>{
+				spirv, cap.byte_size(cap.header.spirv) / sizeof(uint32_t) },
+		opts };
+	t.profiling(true);
+
+	std::vector<uint8_t> scratch;
+	std::array<op_stats, size_t(vkc::capture_op::count)> stats{};
+	bool measure = false;
+
+	auto replay = [&]() {
+		for (uint32_t i = 0; i < cap.header.command_count; ++i) {
+			const vkc::capture_command& cmd = cap.commands[i];
+			const char* name = names[i].c_str();
+			const uint8_t* data = cmd.data == vkc::capture_no_blob
+					? nullptr
+					: cap.data(cmd.data);
+			size_t byte_size = cap.byte_size(cmd.data);
+			const std::array<uint64_t, 3>& args = cmd.args;
+
+			auto start = std::chrono::steady_clock::now();
+			double gpu_ms = 0.0;
+			switch (cmd.op) {
+			case vkc::capture_op::push_constant: {
+				t.push_constant(name, data, byte_size);
+			} break;
+			case vkc::capture_op::reserve_buffer: {
+				t.reserve_buffer(name, size_t(args[0]));
+			} break;
+			case vkc::capture_op::reserve_buffer_capacity: {
+				t.reserve_buffer_capacity(name, size_t(args[0]));
+			} break;
+			case vkc::capture_op::push_buffer: {
+				t.push_buffer(name, data, byte_size);
+				gpu_ms = t.last_timings().push.gpu_ms;
+			} break;
+			case vkc::capture_op::pull_buffer: {
+				byte_size = t.get_buffer_byte_size(name);
+				scratch.resize(std::max(scratch.size(), byte_size));
+				t.pull_buffer(name, scratch.data());
+				gpu_ms = t.last_timings().pull.gpu_ms;
+			} break;
+			case vkc::capture_op::set_format: {
+				t.set_format(name, vkc::format(args[0]));
+			} break;
+			case vkc::capture_op::reserve_image: {
+				t.reserve_image(name, size_t(args[0]), size_t(args[1]),
+						size_t(args[2]));
+			} break;
+			case vkc::capture_op::push_image: {
+				t.push_image(name, data, byte_size, size_t(args[0]),
+						size_t(args[1]), size_t(args[2]));
+				gpu_ms = t.last_timings().push.gpu_ms;
+			} break;
+			case vkc::capture_op::pull_image: {
+				byte_size = t.get_image_byte_size(name);
+				scratch.resize(std::max(scratch.size(), byte_size));
+				t.pull_image(name, scratch.data());
+				gpu_ms = t.last_timings().pull.gpu_ms;
+			} break;
+			case vkc::capture_op::submit: {
+				t.submit(size_t(args[0]), size_t(args[1]), size_t(args[2]));
+				gpu_ms = t.last_timings().submit.gpu_ms;
+			} break;
+			case vkc::capture_op::submit_many: {
+				// Empty calls still consume the enqueued push constants.
+				size_t count = size_t(args[0]);
+				size_t constant_byte_size
+						= count == 0 ? size_t(args[2]) : byte_size / count;
+				t.submit_many(name, data, constant_byte_size,
+						dispatch_sizes[i].data(), count, args[1] != 0);
+				gpu_ms = t.last_timings().submit.gpu_ms;
+			} break;
+			default: {
+			} break;
+			}
+			std::chrono::duration<double, std::milli> elapsed
+					= std::chrono::steady_clock::now() - start;
+
+			if (measure) {
+				op_stats& s = stats[size_t(cmd.op)];
+				++s.count;
+				s.byte_size += is_transfer(cmd.op) ? byte_size : 0;
+				s.host_ms += elapsed.count();
+				s.gpu_ms += gpu_ms;
+			}
+		}
+	};
+
+	for (size_t i = 0; i < warmup; ++i) {
+		replay();
+	}
+
+	measure = true;
+	std::vector<double> session_ms;
+	for (size_t i = 0; i < iterations; ++i) {
+		auto start = std::chrono::steady_clock::now();
+		replay();
+		std::chrono::duration<double, std::milli> elapsed
+				= std::chrono::steady_clock::now() - start;
+		session_ms.push_back(elapsed.count());
+	}
+	std::sort(session_ms.begin(), session_ms.end());
+
+	printf("Capture '%s' : %u commands, %u unique blobs, %zu bytes\n\n",
+			capture_path.string().c_str(), cap.header.command_count,
+			cap.header.blob_count, file.size());
+	printf("Session  p50 %9.3f ms  p90 %9.3f ms  max %9.3f ms\n\n",
+			percentile(session_ms, 0.5), percentile(session_ms, 0.9),
+			session_ms.back());
+
+	printf("%-23s %8s %12s %12s %12s %10s\n", "Call", "Count", "Host ms",
+			"Gpu ms", "Mean us", "GB/s");
+	for (size_t i = 0; i < stats.size(); ++i) {
+		const op_stats& s = stats[i];
+		if (s.count == 0) {
+			continue;
+		}
+		printf("%-23s %8zu %12.3f %12.3f %12.2f %10.2f\n", op_names[i],
+				s.count, s.host_ms, s.gpu_ms,
+				s.host_ms * 1000.0 / double(s.count),
+				gb_per_s(s.byte_size, s.host_ms));
+	}
+
+	return EXIT_SUCCESS;
+}